@@ -0,0 +1,684 @@
+#include "common.h"
+#include "histogram.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+#include <pthread.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <arpa/inet.h>
+
+#define MAX_EVENTS 256
+
+typedef enum
+{
+    OP_SENSLOC,
+    OP_SENSSTATUS,
+    OP_LOCLIST,
+    OP_DISCSEN,
+    OP_CONNSEN, // Reconexão após REQ_DISCSEN (não entra no mix)
+    OP_COUNT,
+} Op;
+
+static const char *op_names[OP_COUNT] = {"REQ_SENSLOC", "REQ_SENSSTATUS", "REQ_LOCLIST", "REQ_DISCSEN", "REQ_CONNSEN"};
+
+typedef struct Options
+{
+    int threads;
+    int sensors;
+    int duration;        // Segundos de medição
+    int id_base;         // ID do primeiro sensor
+    int mix[OP_CONNSEN]; // Peso de cada operação
+    int legacy;          // Não oferece o formato compacto
+} Options_t;
+
+/**
+ * Um sensor simulado: conectado aos dois servidores, com no máximo uma
+ * requisição em andamento por vez.
+ */
+typedef struct Sensor
+{
+    int id;
+    int sl;      // Socket do servidor de localização
+    int ss;      // Socket do servidor de status
+    int ss_addr; // Índice do endereço do SS em Worker_t.addrs
+    int alive;
+    Op waiting;  // Operação em andamento (válida se `busy`)
+    int busy;
+    uint64_t sent_at;
+} Sensor_t;
+
+typedef struct Worker
+{
+    int index;
+    const Options_t *opts;
+    struct sockaddr_storage *addrs; // Os dois servidores
+    pthread_barrier_t *ready;
+    Sensor_t *sensors;
+    int nsensors;
+    int epfd;
+    unsigned int seed;
+    volatile int *stop;
+    Histogram_t hist[OP_COUNT];
+    uint64_t errors[OP_COUNT];
+    uint64_t failed_connects;
+    pthread_t thread;
+} Worker_t;
+
+/**
+ * @brief Exibe a forma correta de usar o programa e o encerra.
+ * @param argc O número de argumentos da linha de comando.
+ * @param argv O array de strings dos argumentos.
+ */
+void usage(int argc, char **argv)
+{
+    printf("usage: %s [options] <server IP> <server port> <server port>\n", argv[0]);
+    printf("example: %s --sensors 2000 --threads 4 127.0.0.1 51511 51512\n", argv[0]);
+    printf("options:\n");
+    printf("  --threads <n>    threads geradoras de carga (padrão 4)\n");
+    printf("  --sensors <n>    sensores simulados, cada um conectado aos dois servidores (padrão 1000)\n");
+    printf("  --duration <s>   duração da medição em segundos (padrão 10)\n");
+    printf("  --id-base <n>    ID do primeiro sensor (padrão 100000)\n");
+    printf("  --mix <mix>      pesos das operações (padrão sensloc:50,sensstatus:30,loclist:15,discsen:5)\n");
+    printf("  --legacy         usa o formato de fio original em vez do compacto\n");
+    printf("os servidores devem aceitar os sensores (ex: server --max-sensors <n>)\n");
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Interpreta o mix de operações, no formato "nome:peso,nome:peso".
+ * @param str A string do mix.
+ * @param mix Destino dos pesos (indexado por Op).
+ * @return int 0 em caso de sucesso, -1 se o mix for inválido.
+ */
+int parse_mix(const char *str, int *mix)
+{
+    static const char *names[OP_CONNSEN] = {"sensloc", "sensstatus", "loclist", "discsen"};
+    char buf[BUFSZ];
+    int total = 0;
+
+    memset(mix, 0, OP_CONNSEN * sizeof(int));
+    snprintf(buf, sizeof(buf), "%s", str);
+
+    for (char *tok = strtok(buf, ","); tok != NULL; tok = strtok(NULL, ","))
+    {
+        char *colon = strchr(tok, ':');
+        if (colon == NULL)
+        {
+            return -1;
+        }
+        *colon = '\0';
+
+        int op = 0;
+        while (op < OP_CONNSEN && strcmp(tok, names[op]) != 0)
+        {
+            op++;
+        }
+        if (op == OP_CONNSEN || atoi(colon + 1) < 0)
+        {
+            return -1;
+        }
+
+        mix[op] = atoi(colon + 1);
+        total += mix[op];
+    }
+
+    return total > 0 ? 0 : -1;
+}
+
+/**
+ * @brief Lê as opções de linha de comando.
+ * @param argc O número de argumentos da linha de comando.
+ * @param argv O array de strings dos argumentos.
+ * @param opts A estrutura a ser preenchida (já com os valores padrão).
+ */
+void parse_options(int argc, char **argv, Options_t *opts)
+{
+    static struct option long_opts[] = {
+        {"threads", required_argument, NULL, 't'},
+        {"sensors", required_argument, NULL, 'n'},
+        {"duration", required_argument, NULL, 'd'},
+        {"id-base", required_argument, NULL, 'i'},
+        {"mix", required_argument, NULL, 'm'},
+        {"legacy", no_argument, NULL, 'l'},
+        {NULL, 0, NULL, 0},
+    };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "", long_opts, NULL)) != -1)
+    {
+        switch (c)
+        {
+        case 't':
+            opts->threads = atoi(optarg);
+            break;
+        case 'n':
+            opts->sensors = atoi(optarg);
+            break;
+        case 'd':
+            opts->duration = atoi(optarg);
+            break;
+        case 'i':
+            opts->id_base = atoi(optarg);
+            break;
+        case 'm':
+            if (parse_mix(optarg, opts->mix) != 0)
+            {
+                usage(argc, argv);
+            }
+            break;
+        case 'l':
+            opts->legacy = 1;
+            break;
+        default:
+            usage(argc, argv);
+        }
+    }
+
+    if (opts->threads < 1 || opts->sensors < 1 || opts->duration < 1)
+    {
+        usage(argc, argv);
+    }
+}
+
+/**
+ * @brief Retorna o tempo monotônico atual em nanossegundos.
+ * @return uint64_t O tempo atual.
+ */
+uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Conecta um sensor a um servidor e realiza o handshake REQ_CONNSEN.
+ * * O handshake é feito em modo bloqueante; em seguida o socket passa a ser
+ * não bloqueante para ser multiplexado pelo epoll da thread.
+ * * @param addr O endereço do servidor.
+ * @param id O ID do sensor.
+ * @param legacy Se diferente de zero, não oferece o formato compacto.
+ * @param is_sl Destino: 1 se o servidor respondeu como SL, 0 se como SS.
+ * @return int O socket conectado, ou -1 em caso de falha.
+ */
+int sensor_connect(struct sockaddr_storage *addr, int id, int legacy, int *is_sl)
+{
+    int s = socket(addr->ss_family, SOCK_STREAM, 0);
+    if (s == -1)
+    {
+        return -1;
+    }
+
+    if (connect(s, (struct sockaddr *)addr, sizeof(struct sockaddr_in)) != 0)
+    {
+        close(s);
+        return -1;
+    }
+
+    Msg_t msg = {0};
+    msg.type = REQ_CONNSEN;
+    msg.payload = id;
+    if (!legacy)
+    {
+        wire_offer(&msg);
+    }
+
+    if (send_msg(s, &msg) == -1 || recv_msg(s, &msg) <= 0 || msg.type != RES_CONNSEN)
+    {
+        conn_close(s);
+        return -1;
+    }
+
+    if (!legacy && wire_offered(&msg))
+    {
+        conn_set_wire(s, WIRE_COMPACT);
+    }
+
+    *is_sl = strncmp(msg.desc, "SL", 2) == 0;
+    conn_set_nonblocking(s);
+    return s;
+}
+
+/**
+ * @brief Registra um socket de sensor no epoll da thread.
+ * * O índice do sensor e o servidor (SL ou SS) são guardados no evento.
+ * * @param w A thread.
+ * @param index O índice do sensor na thread.
+ * @param fd O socket.
+ * @param is_ss 1 se o socket é do SS.
+ */
+void sensor_watch(Worker_t *w, int index, int fd, int is_ss)
+{
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.u64 = ((uint64_t)index << 1) | (uint64_t)is_ss;
+    if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, fd, &ev) != 0)
+    {
+        logexit("epoll_ctl");
+    }
+}
+
+/**
+ * @brief Conecta o sensor ao SL e ao SS.
+ * * Os dois endereços são tentados na ordem dada; o papel de cada servidor é
+ * descoberto pela resposta ao REQ_CONNSEN, como no cliente.
+ * * @param w A thread.
+ * @param index O índice do sensor na thread.
+ * @return int 0 em caso de sucesso, -1 em caso de falha.
+ */
+int sensor_open(Worker_t *w, int index)
+{
+    Sensor_t *sensor = &w->sensors[index];
+    int socks[2], is_sl[2];
+
+    for (int i = 0; i < 2; i++)
+    {
+        socks[i] = sensor_connect(&w->addrs[i], sensor->id, w->opts->legacy, &is_sl[i]);
+        if (socks[i] == -1)
+        {
+            if (i == 1)
+            {
+                conn_close(socks[0]);
+            }
+            return -1;
+        }
+    }
+
+    sensor->ss_addr = is_sl[0] ? 1 : 0;
+    sensor->sl = socks[1 - sensor->ss_addr];
+    sensor->ss = socks[sensor->ss_addr];
+    sensor->alive = 1;
+    sensor->busy = 0;
+    sensor_watch(w, index, sensor->sl, 0);
+    sensor_watch(w, index, sensor->ss, 1);
+    return 0;
+}
+
+/**
+ * @brief Sorteia a próxima operação de acordo com os pesos do mix.
+ * @param w A thread.
+ * @return Op A operação sorteada.
+ */
+Op pick_op(Worker_t *w)
+{
+    int total = 0;
+    for (int op = 0; op < OP_CONNSEN; op++)
+    {
+        total += w->opts->mix[op];
+    }
+
+    int r = rand_r(&w->seed) % total;
+    for (int op = 0; op < OP_CONNSEN; op++)
+    {
+        if (r < w->opts->mix[op])
+        {
+            return (Op)op;
+        }
+        r -= w->opts->mix[op];
+    }
+
+    return OP_SENSLOC;
+}
+
+/**
+ * @brief Envia a próxima requisição de um sensor.
+ * * REQ_SENSLOC e REQ_LOCLIST vão para o SL; REQ_SENSSTATUS e REQ_DISCSEN
+ * vão para o SS (após o REQ_DISCSEN o sensor se reconecta ao SS).
+ * * @param w A thread.
+ * @param sensor O sensor.
+ */
+void sensor_issue(Worker_t *w, Sensor_t *sensor)
+{
+    Op op = pick_op(w);
+    Msg_t msg = {0};
+    int fd = sensor->sl;
+
+    switch (op)
+    {
+    case OP_SENSLOC:
+        msg.type = REQ_SENSLOC;
+        msg.payload = sensor->id;
+        break;
+    case OP_SENSSTATUS:
+        msg.type = REQ_SENSSTATUS;
+        msg.payload = sensor->id;
+        fd = sensor->ss;
+        break;
+    case OP_LOCLIST:
+        msg.type = REQ_LOCLIST;
+        msg.payload = rand_r(&w->seed) % 10 + 1;
+        break;
+    default:
+        msg.type = REQ_DISCSEN;
+        msg.payload = sensor->id;
+        fd = sensor->ss;
+        break;
+    }
+
+    sensor->waiting = op;
+    sensor->busy = 1;
+    sensor->sent_at = now_ns();
+    if (send_msg(fd, &msg) == -1)
+    {
+        w->errors[op]++;
+        sensor->alive = 0;
+    }
+}
+
+/**
+ * @brief Trata uma resposta completa recebida por um sensor.
+ * @param w A thread.
+ * @param index O índice do sensor na thread.
+ * @param msg A resposta.
+ */
+void sensor_reply(Worker_t *w, int index, Msg_t *msg)
+{
+    Sensor_t *sensor = &w->sensors[index];
+    if (!sensor->busy)
+    {
+        return;
+    }
+
+    // Páginas intermediárias de RES_LOCLIST não completam a requisição
+    if (msg->type == RES_LOCLIST && msg->more)
+    {
+        return;
+    }
+
+    uint64_t now = now_ns();
+    hist_record(&w->hist[sensor->waiting], now - sensor->sent_at);
+    if (msg->type == ERROR_MSG && !(sensor->waiting == OP_LOCLIST && msg->payload == 11))
+    {
+        w->errors[sensor->waiting]++;
+    }
+    sensor->busy = 0;
+
+    if (sensor->waiting == OP_DISCSEN)
+    {
+        conn_close(sensor->ss);
+
+        int is_sl;
+        uint64_t start = now_ns();
+        sensor->ss = sensor_connect(&w->addrs[sensor->ss_addr], sensor->id, w->opts->legacy, &is_sl);
+        if (sensor->ss == -1)
+        {
+            w->errors[OP_CONNSEN]++;
+            sensor->alive = 0;
+            return;
+        }
+        hist_record(&w->hist[OP_CONNSEN], now_ns() - start);
+        sensor_watch(w, index, sensor->ss, 1);
+    }
+
+    if (!*w->stop)
+    {
+        sensor_issue(w, sensor);
+    }
+}
+
+/**
+ * @brief Lê e trata todas as mensagens disponíveis em um socket de sensor.
+ * @param w A thread.
+ * @param index O índice do sensor na thread.
+ * @param fd O socket.
+ */
+void sensor_activity(Worker_t *w, int index, int fd)
+{
+    ConnFill fill;
+    do
+    {
+        fill = conn_fill(fd);
+
+        Msg_t msg;
+        int len;
+        while ((len = conn_next_msg(fd, &msg)) > 0)
+        {
+            sensor_reply(w, index, &msg);
+            if (!w->sensors[index].alive)
+            {
+                return;
+            }
+        }
+
+        if (len < 0 || fill == CONN_CLOSED)
+        {
+            Sensor_t *sensor = &w->sensors[index];
+            if (sensor->busy)
+            {
+                w->errors[sensor->waiting]++;
+            }
+            sensor->alive = 0;
+            return;
+        }
+    } while (fill == CONN_FULL);
+}
+
+/**
+ * @brief Thread geradora de carga.
+ * * Conecta seus sensores, espera todas as threads ficarem prontas e então
+ * mantém uma requisição em andamento por sensor até o fim da medição.
+ * * @param arg A thread (Worker_t *).
+ * @return void* Sempre NULL.
+ */
+void *worker_main(void *arg)
+{
+    Worker_t *w = arg;
+    struct epoll_event events[MAX_EVENTS];
+
+    w->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (w->epfd == -1)
+    {
+        logexit("epoll_create1");
+    }
+
+    for (int i = 0; i < w->nsensors; i++)
+    {
+        w->sensors[i].id = w->opts->id_base + w->index + i * w->opts->threads;
+        if (sensor_open(w, i) != 0)
+        {
+            w->failed_connects++;
+        }
+    }
+
+    pthread_barrier_wait(w->ready);
+
+    for (int i = 0; i < w->nsensors; i++)
+    {
+        if (w->sensors[i].alive)
+        {
+            sensor_issue(w, &w->sensors[i]);
+        }
+    }
+
+    while (!*w->stop)
+    {
+        int ready = epoll_wait(w->epfd, events, MAX_EVENTS, 100);
+        if (ready == -1 && errno != EINTR)
+        {
+            logexit("epoll_wait");
+        }
+
+        for (int i = 0; i < ready; i++)
+        {
+            int index = (int)(events[i].data.u64 >> 1);
+            Sensor_t *sensor = &w->sensors[index];
+            int fd = (events[i].data.u64 & 1) ? sensor->ss : sensor->sl;
+
+            if (!sensor->alive)
+            {
+                continue;
+            }
+            if (events[i].events & EPOLLOUT)
+            {
+                conn_flush(fd);
+            }
+            if (events[i].events & ~EPOLLOUT)
+            {
+                sensor_activity(w, index, fd);
+            }
+        }
+    }
+
+    pthread_barrier_wait(w->ready);
+
+    for (int i = 0; i < w->nsensors; i++)
+    {
+        if (w->sensors[i].sl > 0)
+        {
+            conn_close(w->sensors[i].sl);
+        }
+        if (w->sensors[i].ss > 0)
+        {
+            conn_close(w->sensors[i].ss);
+        }
+    }
+    close(w->epfd);
+
+    return NULL;
+}
+
+/**
+ * @brief Imprime o resumo da medição: vazão, percentis e distribuição por operação.
+ * @param workers As threads.
+ * @param opts As opções.
+ * @param elapsed A duração real da medição em segundos.
+ */
+void report(Worker_t *workers, const Options_t *opts, double elapsed)
+{
+    static Histogram_t total[OP_COUNT];
+    uint64_t errors[OP_COUNT] = {0};
+    uint64_t failed = 0, requests = 0;
+
+    for (int t = 0; t < opts->threads; t++)
+    {
+        for (int op = 0; op < OP_COUNT; op++)
+        {
+            hist_merge(&total[op], &workers[t].hist[op]);
+            errors[op] += workers[t].errors[op];
+        }
+        failed += workers[t].failed_connects;
+    }
+
+    for (int op = 0; op < OP_CONNSEN; op++)
+    {
+        requests += total[op].total;
+    }
+
+    printf("sensors: %d (%llu failed to connect), threads: %d, wire: %s\n", opts->sensors,
+           (unsigned long long)failed, opts->threads, opts->legacy ? "legacy" : "compact");
+    printf("requests: %llu in %.2fs (%.0f req/s)\n\n", (unsigned long long)requests, elapsed,
+           (double)requests / elapsed);
+
+    printf("%-16s %10s %8s %10s %10s %10s %10s %10s\n", "operation", "count", "errors", "req/s",
+           "p50(us)", "p99(us)", "p999(us)", "max(us)");
+    for (int op = 0; op < OP_COUNT; op++)
+    {
+        printf("%-16s %10llu %8llu %10.0f %10.1f %10.1f %10.1f %10.1f\n", op_names[op],
+               (unsigned long long)total[op].total, (unsigned long long)errors[op],
+               (double)total[op].total / elapsed, hist_percentile(&total[op], 50) / 1000.0,
+               hist_percentile(&total[op], 99) / 1000.0, hist_percentile(&total[op], 99.9) / 1000.0,
+               total[op].max / 1000.0);
+    }
+
+    for (int op = 0; op < OP_COUNT; op++)
+    {
+        if (total[op].total > 0)
+        {
+            printf("\n%s latency (us):\n", op_names[op]);
+            hist_print(stdout, &total[op], 1000.0);
+        }
+    }
+}
+
+/**
+ * @brief Função principal do gerador de carga.
+ * * Abre `--sensors` sensores simulados distribuídos entre `--threads`
+ * threads, mede as respostas durante `--duration` segundos e imprime a
+ * vazão e os histogramas de latência de cada operação.
+ */
+int main(int argc, char **argv)
+{
+    Options_t opts = {4, 1000, 10, 100000, {50, 30, 15, 5}, 0};
+    parse_options(argc, argv, &opts);
+
+    if (argc - optind < 3)
+    {
+        usage(argc, argv);
+    }
+    char **args = argv + optind - 1;
+
+    // Cada sensor usa dois sockets; eleva o limite antes da primeira conexão
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0)
+    {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    struct sockaddr_storage addrs[2];
+    if (0 != client_sockaddr_init(args[1], args[2], args[3], &addrs[0], &addrs[1]))
+    {
+        usage(argc, argv);
+    }
+
+    Worker_t *workers = calloc(opts.threads, sizeof(Worker_t));
+    Sensor_t *sensors = calloc(opts.sensors, sizeof(Sensor_t));
+    if (workers == NULL || sensors == NULL)
+    {
+        logexit("calloc");
+    }
+
+    volatile int stop = 0;
+    pthread_barrier_t ready;
+    pthread_barrier_init(&ready, NULL, opts.threads + 1);
+
+    int offset = 0;
+    for (int t = 0; t < opts.threads; t++)
+    {
+        Worker_t *w = &workers[t];
+        w->index = t;
+        w->opts = &opts;
+        w->addrs = addrs;
+        w->ready = &ready;
+        w->stop = &stop;
+        w->seed = (unsigned int)time(NULL) ^ (unsigned int)(t * 2654435761u);
+        w->nsensors = opts.sensors / opts.threads + (t < opts.sensors % opts.threads);
+        w->sensors = sensors + offset;
+        offset += w->nsensors;
+
+        if (pthread_create(&w->thread, NULL, worker_main, w) != 0)
+        {
+            logexit("pthread_create");
+        }
+    }
+
+    printf("Connecting %d sensors...\n", opts.sensors);
+    pthread_barrier_wait(&ready);
+
+    printf("Running for %ds...\n", opts.duration);
+    uint64_t start = now_ns();
+    sleep(opts.duration);
+    stop = 1;
+    pthread_barrier_wait(&ready);
+    double elapsed = (now_ns() - start) / 1e9;
+
+    for (int t = 0; t < opts.threads; t++)
+    {
+        pthread_join(workers[t].thread, NULL);
+    }
+
+    report(workers, &opts, elapsed);
+
+    free(workers);
+    free(sensors);
+    return 0;
+}
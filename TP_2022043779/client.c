@@ -1,18 +1,85 @@
 #include "common.h"
+#include "hashring.h"
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 #include <ctype.h>
+#include <getopt.h>
+#include <stdint.h>
 
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/select.h>
 #include <arpa/inet.h>
 
-#define DEFAULT_ID 200
-#define ID_FILENAME "client_ids.txt"
+#define WINDOW_DEFAULT 64
+#define HEARTBEAT_DEFAULT 1000
+
+typedef struct Options
+{
+    int pipeline;       // Envia os comandos sem aguardar as respostas
+    const char *script; // Arquivo de comandos (NULL = entrada padrão)
+    int window;         // Máximo de requisições em andamento no modo em paralelo
+    int heartbeat;      // Inatividade após a qual um HEARTBEAT é enviado, em ms (0 = nunca)
+} Options_t;
+
+/**
+ * SLs aos quais as consultas de localização são enviadas. Com um cluster, há
+ * uma conexão por nó do anel: a do SL dono do ID deste sensor, em que ele
+ * está registrado, e conexões só de consulta (ID_QUERY) com os demais. Sem
+ * cluster, há apenas o SL de registro.
+ */
+typedef struct Cluster
+{
+    int count;                     // Nós do anel (1 = sem cluster)
+    int socks[HASHRING_MAX_NODES]; // Um socket por nó, na ordem do anel
+    int home;                      // Nó em que o sensor está registrado
+    HashRing_t ring;
+} Cluster_t;
+
+/**
+ * Requisição enviada no modo em paralelo e ainda sem resposta completa,
+ * indexada por `seq & (cap - 1)`.
+ */
+typedef struct Inflight
+{
+    uint32_t seq; // 0 = posição livre
+    int type;     // Tipo da requisição
+    int arg;      // Sensor ou localização consultada
+    int *ids;     // IDs de um lote (ou NULL)
+    int count;    // Número de IDs do lote
+    char *list;   // Páginas de RES_LOCLIST já recebidas
+    int *values;  // Valores de um lote já recebidos, na ordem de `ids`
+    int parts;    // Respostas ainda esperadas (uma por SL, se a requisição foi espalhada)
+} Inflight_t;
+
+/**
+ * Estado do modo em paralelo. Os comandos são lidos e enviados enquanto há
+ * espaço na janela; as respostas são associadas às requisições pelo seq.
+ */
+typedef struct Pipeline
+{
+    int ss_socket;
+    Cluster_t *cluster;
+    int client_id;
+    Inflight_t *slots;
+    uint32_t cap;      // Potência de 2 >= janela
+    uint32_t next_seq;
+    int outstanding;
+    int window;
+    int input_fd;
+    char line[BUFSZ];  // Linha de comando parcial
+    size_t line_len;
+    int input_done;    // Fim da entrada ou comando 'kill'
+    int kill;
+    int batch_type;    // Lote ainda não totalmente enviado (0 = nenhum)
+    int *batch_ids;
+    int batch_count;
+    int batch_done;
+    int heartbeat;
+} Pipeline_t;
 
 /**
  * @brief Exibe a forma correta de usar o programa e o encerra.
@@ -21,53 +88,475 @@
  */
 void usage(int argc, char **argv)
 {
-    printf("usage: %s <server IP> <server port> <server port>\n", argv[0]);
+    printf("usage: %s [options] <server IP> <server port> <server port>\n", argv[0]);
     printf("example: %s 127.0.0.1 51511 51512\n", argv[0]);
+    printf("         %s unix:/tmp/tp 51511 51512 (servidores com --unix /tmp/tp)\n", argv[0]);
+    printf("options:\n");
+    printf("  --pipeline        envia os comandos sem aguardar as respostas\n");
+    printf("  --script <file>   lê os comandos de um arquivo\n");
+    printf("  --window <n>      requisições em andamento no modo --pipeline (padrão %d)\n", WINDOW_DEFAULT);
+    printf("  --heartbeat <ms>  sinal de vida aos servidores quando ocioso (padrão %d, 0 = nunca)\n", HEARTBEAT_DEFAULT);
     exit(EXIT_FAILURE);
 }
 
 /**
- * @brief Obtém um ID de cliente único a partir de um arquivo de persistência.
+ * @brief Lê as opções de linha de comando do cliente.
+ * * Ao final, `optind` aponta para o primeiro argumento posicional.
+ * * @param argc O número de argumentos da linha de comando.
+ * @param argv O array de strings dos argumentos.
+ * @param opts A estrutura a ser preenchida (já com os valores padrão).
+ */
+void parse_options(int argc, char **argv, Options_t *opts)
+{
+    static struct option long_opts[] = {
+        {"pipeline", no_argument, NULL, 'p'},
+        {"script", required_argument, NULL, 'f'},
+        {"window", required_argument, NULL, 'n'},
+        {"heartbeat", required_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "", long_opts, NULL)) != -1)
+    {
+        switch (c)
+        {
+        case 'p':
+            opts->pipeline = 1;
+            break;
+        case 'f':
+            opts->script = optarg;
+            break;
+        case 'n':
+            opts->window = atoi(optarg);
+            if (opts->window < 1)
+            {
+                usage(argc, argv);
+            }
+            break;
+        case 'h':
+            opts->heartbeat = atoi(optarg);
+            if (opts->heartbeat < 0)
+            {
+                usage(argc, argv);
+            }
+            break;
+        default:
+            usage(argc, argv);
+        }
+    }
+}
+
+/**
+ * @brief Registra este cliente (sensor) em um servidor.
+ *
+ * Envia o REQ_CONNSEN oferecendo o formato compacto e espera o RES_CONNSEN,
+ * cujo payload é o ID com que o sensor foi registrado. Com `client_id` igual a
+ * ID_ASSIGN, o próprio servidor escolhe um ID único.
+ *
+ * @param s O socket conectado ao servidor.
+ * @param client_id O ID deste cliente ou ID_ASSIGN.
+ * @param resp Destino da resposta (a descrição identifica o servidor como "SL" ou "SS").
+ */
+void register_sensor(int s, int client_id, Msg_t *resp)
+{
+    Msg_t msg = {0};
+    msg.type = REQ_CONNSEN;
+    msg.payload = client_id;
+    wire_offer(&msg);
+    send_msg(s, &msg);
+
+    memset(resp, 0, sizeof(Msg_t));
+    recv_msg(s, resp);
+
+    // Trata possíveis erros na conexão
+    if (resp->type == ERROR_MSG)
+    {
+        close(s);
+        logexit(resp->desc);
+    }
+
+    if (resp->type != RES_CONNSEN)
+    {
+        close(s);
+        logexit("Unexpected message type");
+    }
+
+    // Passa a usar o formato compacto se o servidor o aceitou
+    if (wire_offered(resp))
+    {
+        conn_set_wire(s, WIRE_COMPACT);
+    }
+}
+
+/**
+ * @brief Pede ao SS a tabela de roteamento do cluster de SLs (`REQ_ROUTES`).
+ *
+ * Servidores sem suporte a cluster respondem com um erro, tratado como uma
+ * tabela vazia.
+ *
+ * @param ss_socket O socket do Servidor de Status.
+ * @param ports Destino das portas de clientes dos SLs, na ordem do anel.
+ * @return int O número de SLs (0 se a tabela não está disponível).
+ */
+int fetch_routes(int ss_socket, int *ports)
+{
+    Msg_t msg = {0};
+    msg.type = REQ_ROUTES;
+    if (send_msg(ss_socket, &msg) == -1 || recv_msg(ss_socket, &msg) <= 0 || msg.type != RES_ROUTES)
+    {
+        return 0;
+    }
+
+    return batch_parse(&msg, ports, HASHRING_MAX_NODES);
+}
+
+/**
+ * @brief Conecta-se a uma porta de clientes no mesmo endereço de outro servidor.
+ * * Com um endereço "unix:", a porta escolhe o socket AF_UNIX do servidor.
+ * * @param base O endereço de referência.
+ * @param port A porta.
+ * @return int O socket conectado.
+ */
+int connect_port(const struct sockaddr_storage *base, int port)
+{
+    struct sockaddr_storage storage = *base;
+    if (sockaddr_set_port(&storage, port) != 0)
+    {
+        logexit("connect");
+    }
+
+    int s = conn_socket(&storage);
+    if (s == -1)
+    {
+        logexit("socket");
+    }
+    if (connect(s, (struct sockaddr *)&storage, sockaddr_len(&storage)) != 0)
+    {
+        logexit("connect");
+    }
+    return s;
+}
+
+/**
+ * @brief Escolhe o SL de registro de um sensor cujo ID foi atribuído pelo SS.
+ *
+ * Em um cluster, o sensor deve ser registrado no SL dono do seu ID. Se ele não
+ * for o SL informado na linha de comando, a conexão com esse SL é trocada pela
+ * conexão com o dono.
+ *
+ * @param sl_socket O socket conectado ao SL informado na linha de comando.
+ * @param sl_storage O endereço desse SL.
+ * @param ports A tabela de roteamento.
+ * @param count O número de SLs na tabela.
+ * @param client_id O ID do sensor.
+ * @return int O socket do SL de registro.
+ */
+int cluster_home(int sl_socket, const struct sockaddr_storage *sl_storage, const int *ports, int count, int client_id)
+{
+    HashRing_t ring;
+    if (count < 2 || hashring_init(&ring, ports, count) != 0)
+    {
+        return sl_socket;
+    }
+
+    int port = ports[hashring_owner(&ring, client_id)];
+    if (port == sockaddr_port(sl_storage))
+    {
+        return sl_socket;
+    }
+
+    close(sl_socket);
+    return connect_port(sl_storage, port);
+}
+
+/**
+ * @brief Abre as conexões só de consulta com os SLs do cluster.
  *
- * Esta função lê um número de um arquivo (`client_ids.txt`), que representa o ID a ser usado.
- * Em seguida, incrementa esse número e o salva de volta no arquivo para garantir que
- * a próxima instância do cliente receba um ID diferente. Se o arquivo não existir,
- * ele é criado com um valor padrão.
+ * Sem cluster, ou se o SL de registro não estiver na tabela, as consultas
+ * continuam indo todas para ele.
  *
- * @return int O ID único para esta instância do cliente.
+ * @param cluster O cluster a inicializar.
+ * @param sl_socket O socket do SL de registro.
+ * @param sl_storage O endereço usado na conexão com esse SL.
+ * @param sl_port A porta de clientes desse SL.
+ * @param ports A tabela de roteamento.
+ * @param count O número de SLs na tabela.
  */
-int get_client_id()
+void cluster_open(Cluster_t *cluster, int sl_socket, const struct sockaddr_storage *sl_storage, int sl_port,
+                  const int *ports, int count)
 {
-    int client_id = DEFAULT_ID;
-    FILE *fp = fopen(ID_FILENAME, "r+");
+    cluster->count = 1;
+    cluster->home = 0;
+    cluster->socks[0] = sl_socket;
 
-    if (fp == NULL)
+    int home;
+    if (count < 2 || hashring_init(&cluster->ring, ports, count) != 0 ||
+        (home = hashring_find(&cluster->ring, sl_port)) < 0)
     {
-        fp = fopen(ID_FILENAME, "w+");
-        if (fp == NULL)
+        return;
+    }
+
+    cluster->count = count;
+    cluster->home = home;
+    for (int node = 0; node < count; node++)
+    {
+        if (node == home)
         {
-            logexit("fopen");
+            cluster->socks[node] = sl_socket;
+            continue;
         }
+
+        Msg_t resp;
+        cluster->socks[node] = connect_port(sl_storage, ports[node]);
+        register_sensor(cluster->socks[node], ID_QUERY, &resp);
     }
+    printf("Cluster of %d SLs\n", count);
+}
 
-    char buf[BUFSZ];
-    if (fgets(buf, BUFSZ, fp) != NULL)
+/**
+ * @brief Fecha as conexões só de consulta (a do SL de registro é fechada à parte).
+ * @param cluster O cluster.
+ */
+void cluster_close(Cluster_t *cluster)
+{
+    for (int node = 0; node < cluster->count; node++)
+    {
+        if (node != cluster->home)
+        {
+            close(cluster->socks[node]);
+        }
+    }
+}
+
+/**
+ * @brief Encontra o nó do anel dono de um sensor.
+ * @param cluster O cluster.
+ * @param id O ID do sensor.
+ * @return int A posição do nó em `socks`.
+ */
+int cluster_owner(const Cluster_t *cluster, int id)
+{
+    return cluster->count > 1 ? hashring_owner(&cluster->ring, id) : 0;
+}
+
+/**
+ * @brief Seleciona, em ordem, os sensores de uma lista que pertencem a um nó.
+ * @param cluster O cluster.
+ * @param ids Os IDs dos sensores.
+ * @param count O número de sensores.
+ * @param node O nó.
+ * @param out Destino dos IDs selecionados (capacidade `count`).
+ * @return int O número de IDs selecionados.
+ */
+int cluster_select(const Cluster_t *cluster, const int *ids, int count, int node, int *out)
+{
+    int selected = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (cluster_owner(cluster, ids[i]) == node)
+        {
+            out[selected++] = ids[i];
+        }
+    }
+    return selected;
+}
+
+/**
+ * @brief Encontra o nó de um socket do cluster.
+ * @param cluster O cluster.
+ * @param sock O socket.
+ * @return int A posição do nó, ou -1 se o socket não é de um SL.
+ */
+int cluster_node(const Cluster_t *cluster, int sock)
+{
+    for (int node = 0; node < cluster->count; node++)
     {
-        client_id = atoi(buf);
+        if (cluster->socks[node] == sock)
+        {
+            return node;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Retorna a área geográfica correspondente a uma localização.
+ * @param location A localização (1 a 10).
+ * @return const char* O nome da área.
+ */
+const char *area_name(int location)
+{
+    switch (location)
+    {
+    case 1:
+    case 2:
+    case 3:
+        return "1 (Norte)";
+    case 4:
+    case 5:
+        return "2 (Sul)";
+    case 6:
+    case 7:
+        return "3 (Leste)";
+    case 8:
+    case 9:
+    case 10:
+        return "4 (Oeste)";
+    default:
+        return "Unknown";
+    }
+}
+
+/**
+ * @brief Imprime a resposta a um 'check failure' (`REQ_SENSSTATUS`).
+ * @param prefix Prefixo de cada linha (identifica a requisição no modo em paralelo).
+ * @param resp A resposta recebida.
+ */
+void print_check_failure(const char *prefix, const Msg_t *resp)
+{
+    if (resp->type == RES_SENSSTATUS)
+    {
+        printf("%sAlert received from area: %s\n", prefix, area_name(resp->payload));
+    }
+
+    if (resp->type == ERROR_MSG || resp->type == OK_MSG)
+    {
+        printf("%s%s\n", prefix, resp->desc);
+    }
+}
+
+/**
+ * @brief Imprime a resposta a um 'locate' (`REQ_SENSLOC`).
+ * @param prefix Prefixo de cada linha.
+ * @param resp A resposta recebida.
+ */
+void print_locate(const char *prefix, const Msg_t *resp)
+{
+    if (resp->type == ERROR_MSG)
+    {
+        printf("%s%s\n", prefix, resp->desc);
+    }
+
+    if (resp->type == RES_SENSLOC)
+    {
+        printf("%sCurrent sensor location: %d\n", prefix, resp->payload);
+    }
+}
+
+/**
+ * @brief Imprime o resultado de uma consulta em lote, um sensor por linha.
+ * @param prefix Prefixo de cada linha.
+ * @param type O tipo da requisição (`REQ_SENSLOC_BATCH` ou `REQ_SENSSTATUS_BATCH`).
+ * @param ids Os IDs dos sensores.
+ * @param values Os valores recebidos, na ordem de `ids`.
+ * @param count O número de sensores.
+ */
+void print_batch(const char *prefix, int type, const int *ids, const int *values, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (values[i] < 0)
+        {
+            printf("%sSensor %d: %s\n", prefix, ids[i], DESC_ERROR_10);
+        }
+        else if (type == REQ_SENSLOC_BATCH)
+        {
+            printf("%sSensor %d location: %d\n", prefix, ids[i], values[i]);
+        }
+        else if (values[i] == 0)
+        {
+            printf("%sSensor %d: %s\n", prefix, ids[i], DESC_OK_03);
+        }
+        else
+        {
+            printf("%sSensor %d: alert received from area: %s\n", prefix, ids[i], area_name(values[i]));
+        }
+    }
+}
+
+/**
+ * @brief Imprime a resposta a um 'subscribe' (`REQ_SUBSCRIBE`).
+ * @param prefix Prefixo da linha.
+ * @param resp A resposta recebida.
+ */
+void print_subscribe(const char *prefix, const Msg_t *resp)
+{
+    if (resp->type == RES_SUBSCRIBE)
+    {
+        printf("%sSubscribed to alerts (current status %d)\n", prefix, resp->payload);
+    }
+
+    if (resp->type == ERROR_MSG)
+    {
+        printf("%s%s\n", prefix, resp->desc);
+    }
+}
+
+/**
+ * @brief Imprime um alerta enviado pelo SS sem requisição (`ALERT_MSG`).
+ * @param prefix Prefixo da linha.
+ * @param resp O alerta recebido.
+ */
+void print_alert(const char *prefix, const Msg_t *resp)
+{
+    printf("%sPushed alert from area: %s\n", prefix, area_name(resp->payload));
+}
+
+/**
+ * @brief Recebe a resposta a uma requisição, tratando os alertas que chegarem antes.
+ *
+ * Após um 'subscribe', o SS pode enviar um `ALERT_MSG` a qualquer momento,
+ * inclusive enquanto o cliente aguarda a resposta de outra requisição.
+ *
+ * @param s O socket do servidor.
+ * @param msg Destino da resposta.
+ * @return int O retorno de `recv_msg`.
+ */
+int recv_response(int s, Msg_t *msg)
+{
+    int count;
+    while ((count = recv_msg(s, msg)) > 0 && msg->type == ALERT_MSG)
+    {
+        print_alert("", msg);
     }
 
-    rewind(fp);
-    fprintf(fp, "%d\n", client_id + 1);
-    fclose(fp);
+    return count;
+}
+
+/**
+ * @brief Trata os quadros já completos no buffer de recepção de um servidor.
+ *
+ * `recv_msg` lê tudo o que o kernel tem, então um alerta que chega no mesmo
+ * segmento de uma resposta (ex: RES_SUBSCRIBE seguido de ALERT_MSG) fica no
+ * buffer da conexão sem que `select()` o detecte.
+ *
+ * @param s O socket do servidor.
+ * @return int Retorna 1 se a conexão estiver ativa, 0 se um quadro malformado foi recebido.
+ */
+int handle_buffered(int s)
+{
+    Msg_t msg = {0};
+    int count;
+    while ((count = conn_next_msg(s, &msg)) > 0)
+    {
+        if (msg.type == ALERT_MSG)
+        {
+            print_alert("", &msg);
+        }
+        memset(&msg, 0, sizeof(msg));
+    }
 
-    return client_id;
+    return count == 0;
 }
 
 /**
  * @brief Trata atividade genérica vinda de um dos servidores.
  *
  * A função é chamada quando `select()` detecta dados em um dos sockets do servidor.
- * Ela tenta receber uma mensagem para verificar se a conexão ainda está ativa.
+ * Ela recebe uma mensagem para verificar se a conexão ainda está ativa e exibe
+ * os alertas enviados pelo SS após um 'subscribe', inclusive os que chegaram
+ * juntos no mesmo segmento.
  *
  * @param s O socket do servidor que apresentou atividade.
  * @return int Retorna 1 se a conexão estiver ativa, 0 se a conexão for encerrada.
@@ -82,7 +571,12 @@ int handle_server_activity(int s)
         return 0;
     }
 
-    return 1;
+    if (msg.type == ALERT_MSG)
+    {
+        print_alert("", &msg);
+    }
+
+    return handle_buffered(s);
 }
 
 /**
@@ -111,8 +605,8 @@ int handle_kill(int s, int s_2, int client_id)
     }
 
     Msg_t resp1 = {0}, resp2 = {0};
-    int recv1 = recv_msg(s, &resp1);
-    int recv2 = recv_msg(s_2, &resp2);
+    int recv1 = recv_response(s, &resp1);
+    int recv2 = recv_response(s_2, &resp2);
 
     close(s);
     close(s_2);
@@ -129,259 +623,1028 @@ int handle_kill(int s, int s_2, int client_id)
 }
 
 /**
- * @brief Processa o comando 'check failure'.
- *
- * Envia uma requisição (`REQ_SENSSTATUS`) para o Servidor de Status (SS) para verificar
- * a condição de falha do sensor. Imprime a resposta recebida, que pode ser um OK,
- * um erro, ou, em caso de falha, a área geográfica do alerta.
- *
- * @param ss_socket O socket do Servidor de Status.
- * @param client_id O ID deste cliente.
- * @return int Retorna 1 para continuar a execução, 0 em caso de erro fatal.
+ * @brief Lê uma lista de IDs de sensores, como "200 201 210-250".
+ * @param str O texto com os IDs, separados por espaços; "a-b" indica um intervalo.
+ * @param count Destino do número de IDs lidos.
+ * @return int* Os IDs (deve ser liberado pelo chamador), ou NULL se não houver nenhum.
+ */
+int *parse_id_list(const char *str, int *count)
+{
+    int *ids = NULL;
+    int cap = 0;
+    *count = 0;
+
+    for (;;)
+    {
+        int first, last, n;
+        if (sscanf(str, " %d-%d%n", &first, &last, &n) != 2)
+        {
+            if (sscanf(str, " %d%n", &first, &n) != 1)
+            {
+                break;
+            }
+            last = first;
+        }
+        str += n;
+
+        for (int id = first; id <= last; id++)
+        {
+            if (*count == cap)
+            {
+                cap = cap ? cap * 2 : 64;
+                int *grown = realloc(ids, cap * sizeof(int));
+                if (grown == NULL)
+                {
+                    logexit("realloc");
+                }
+                ids = grown;
+            }
+            ids[(*count)++] = id;
+        }
+    }
+
+    return ids;
+}
+
+/**
+ * @brief Envia uma consulta em lote e recebe as respostas, em blocos de BATCH_MAX_IDS.
+ *
+ * Cada bloco custa uma única ida e volta ao servidor, em vez de uma por sensor.
+ *
+ * @param s O socket do servidor.
+ * @param type O tipo da requisição (`REQ_SENSLOC_BATCH` ou `REQ_SENSSTATUS_BATCH`).
+ * @param ids Os IDs dos sensores.
+ * @param values Destino dos valores, na ordem de `ids`.
+ * @param count O número de sensores.
+ * @return int 0 em caso de sucesso, -1 em caso de erro.
+ */
+int batch_query(int s, int type, const int *ids, int *values, int count)
+{
+    for (int done = 0; done < count;)
+    {
+        Msg_t req = {0};
+        req.type = type;
+        int sent = batch_format(&req, ids + done, count - done);
+
+        Msg_t resp = {0};
+        if (send_msg(s, &req) == -1 || recv_response(s, &resp) <= 0 || resp.type != type + 1)
+        {
+            return -1;
+        }
+
+        if (batch_parse(&resp, values + done, sent) != sent)
+        {
+            return -1;
+        }
+        done += sent;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Processa o comando 'check failure' com uma lista de sensores.
+ *
+ * Consulta o status de todos os sensores com `REQ_SENSSTATUS_BATCH` e imprime,
+ * para cada um, se há falha e a área do alerta.
+ *
+ * @param ss_socket O socket do Servidor de Status.
+ * @param ids Os IDs dos sensores.
+ * @param count O número de sensores.
+ * @return int Retorna 1 para continuar a execução, 0 em caso de erro fatal.
+ */
+int handle_check_failure_batch(int ss_socket, const int *ids, int count)
+{
+    printf("Sending REQ_SENSSTATUS_BATCH %d\n", count);
+    int *values = malloc(count * sizeof(int));
+    if (values == NULL)
+    {
+        logexit("malloc");
+    }
+
+    if (batch_query(ss_socket, REQ_SENSSTATUS_BATCH, ids, values, count) != 0)
+    {
+        printf("Error receiving check failure response\n");
+        free(values);
+        return 0;
+    }
+
+    print_batch("", REQ_SENSSTATUS_BATCH, ids, values, count);
+    free(values);
+    return 1;
+}
+
+/**
+ * @brief Processa o comando 'check failure'.
+ *
+ * Envia uma requisição (`REQ_SENSSTATUS`) para o Servidor de Status (SS) para verificar
+ * a condição de falha do sensor. Imprime a resposta recebida, que pode ser um OK,
+ * um erro, ou, em caso de falha, a área geográfica do alerta.
+ *
+ * @param ss_socket O socket do Servidor de Status.
+ * @param client_id O ID deste cliente.
+ * @return int Retorna 1 para continuar a execução, 0 em caso de erro fatal.
+ */
+int handle_check_failure(int ss_socket, int client_id)
+{
+    printf("Sending REQ_SENSSTATUS %d\n", client_id);
+    Msg_t disc = {0};
+    disc.type = REQ_SENSSTATUS;
+    disc.payload = client_id;
+
+    if (send_msg(ss_socket, &disc) == -1)
+    {
+        printf("Error sending check failure request\n");
+        close(ss_socket);
+        return 0;
+    }
+
+    Msg_t resp = {0};
+
+    if (recv_response(ss_socket, &resp) <= 0)
+    {
+        printf("Error receiving check failure response\n");
+        return 0;
+    }
+
+    print_check_failure("", &resp);
+    return 1;
+}
+
+/**
+ * @brief Processa o comando 'subscribe'.
+ *
+ * Inscreve o sensor nos alertas por push do Servidor de Status (SS): a partir
+ * daí, cada mudança do seu status para 1 chega como um `ALERT_MSG`, com a
+ * área já resolvida pelo SL, sem que o cliente precise consultar com
+ * 'check failure'.
+ *
+ * @param ss_socket O socket do Servidor de Status.
+ * @param client_id O ID deste cliente.
+ * @return int Retorna 1 para continuar a execução, 0 em caso de erro fatal.
+ */
+int handle_subscribe(int ss_socket, int client_id)
+{
+    printf("Sending REQ_SUBSCRIBE %d\n", client_id);
+    Msg_t disc = {0};
+    disc.type = REQ_SUBSCRIBE;
+    disc.payload = client_id;
+
+    Msg_t resp = {0};
+    if (send_msg(ss_socket, &disc) == -1 || recv_response(ss_socket, &resp) <= 0)
+    {
+        printf("Error sending subscribe request\n");
+        return 0;
+    }
+
+    print_subscribe("", &resp);
+    return 1;
+}
+
+/**
+ * @brief Processa o comando 'locate'.
+ *
+ * Envia uma requisição (`REQ_SENSLOC`) para o Servidor de Localização (SL)
+ * para obter a localização do sensor com o ID especificado e imprime a resposta.
+ *
+ * @param sl_socket O socket do Servidor de Localização.
+ * @param client_id O ID do sensor a ser localizado.
+ * @return int Retorna 1 para continuar, -1 em caso de erro.
+ */
+int handle_locate_sensor(int sl_socket, int client_id)
+{
+    printf("Sending REQ_SENSLOC %d\n", client_id);
+    Msg_t disc = {0};
+    disc.type = REQ_SENSLOC;
+    disc.payload = client_id;
+
+    if (send_msg(sl_socket, &disc) == -1)
+    {
+        printf("Error sending locate sensor request\n");
+        close(sl_socket);
+        return -1;
+    }
+
+    Msg_t resp = {0};
+    int recv = recv_response(sl_socket, &resp);
+
+    if (recv <= 0)
+    {
+        printf("Error receiving locate sensor response\n");
+        return -1;
+    }
+
+    print_locate("", &resp);
+    return 1;
+}
+
+/**
+ * @brief Processa o comando 'locate' com uma lista de sensores.
+ *
+ * Consulta a localização de todos os sensores com `REQ_SENSLOC_BATCH`. Em um
+ * cluster, cada SL recebe apenas os sensores dos quais é dono, e as
+ * respostas são reunidas na ordem da lista.
+ *
+ * @param cluster Os Servidores de Localização.
+ * @param ids Os IDs dos sensores.
+ * @param count O número de sensores.
+ * @return int Retorna 1 para continuar, -1 em caso de erro.
+ */
+int handle_locate_batch(const Cluster_t *cluster, const int *ids, int count)
+{
+    printf("Sending REQ_SENSLOC_BATCH %d\n", count);
+    int *values = malloc(count * sizeof(int));
+    int *sub_ids = malloc(count * sizeof(int));
+    int *sub_values = malloc(count * sizeof(int));
+    if (values == NULL || sub_ids == NULL || sub_values == NULL)
+    {
+        logexit("malloc");
+    }
+
+    int status = 1;
+    for (int node = 0; node < cluster->count && status == 1; node++)
+    {
+        int sub_count = cluster_select(cluster, ids, count, node, sub_ids);
+        if (sub_count == 0)
+        {
+            continue;
+        }
+
+        if (batch_query(cluster->socks[node], REQ_SENSLOC_BATCH, sub_ids, sub_values, sub_count) != 0)
+        {
+            printf("Error receiving locate sensor response\n");
+            status = -1;
+            break;
+        }
+
+        for (int i = 0, next = 0; i < count; i++)
+        {
+            if (cluster_owner(cluster, ids[i]) == node)
+            {
+                values[i] = sub_values[next++];
+            }
+        }
+    }
+
+    if (status == 1)
+    {
+        print_batch("", REQ_SENSLOC_BATCH, ids, values, count);
+    }
+    free(values);
+    free(sub_ids);
+    free(sub_values);
+    return status;
+}
+
+/**
+ * @brief Processa o comando 'diagnose'.
+ *
+ * Envia uma requisição (`REQ_LOCLIST`) para o Servidor de Localização (SL) para
+ * obter uma lista de todos os sensores em uma determinada localização e imprime o resultado.
+ * Em um cluster, a requisição é enviada a todos os SLs ao mesmo tempo e as
+ * listas de cada um são reunidas; a localização só não é encontrada se
+ * nenhum deles tiver sensores nela.
+ *
+ * @param cluster Os Servidores de Localização.
+ * @param loc_id O ID da localização a ser diagnosticada.
+ * @return int Retorna 1 para continuar, -1 em caso de erro.
+ */
+int handle_diagnose_loc(const Cluster_t *cluster, int loc_id)
+{
+    printf("Sending REQ_LOCLIST %d\n", loc_id);
+    Msg_t disc = {0};
+    disc.type = REQ_LOCLIST;
+    disc.payload = loc_id;
+
+    for (int node = 0; node < cluster->count; node++)
+    {
+        if (send_msg(cluster->socks[node], &disc) == -1)
+        {
+            printf("Error sending diagnose location request\n");
+            return -1;
+        }
+    }
+
+    Msg_t resp = {0};
+    Msg_t error = {0};
+    int found = 0;
+    for (int node = 0; node < cluster->count; node++)
+    {
+        if (recv_response(cluster->socks[node], &resp) <= 0)
+        {
+            printf("%sError receiving diagnose location response\n", found ? "\n" : "");
+            return -1;
+        }
+
+        if (resp.type == ERROR_MSG)
+        {
+            error = resp;
+            continue;
+        }
+
+        if (resp.type == RES_LOCLIST)
+        {
+            // Listas longas chegam em várias páginas; a última tem `more` = 0
+            if (found++ == 0)
+            {
+                printf("Sensors at location %d: %s", loc_id, resp.desc);
+            }
+            else
+            {
+                printf(", %s", resp.desc);
+            }
+            while (resp.more)
+            {
+                if (recv_response(cluster->socks[node], &resp) <= 0 || resp.type != RES_LOCLIST)
+                {
+                    printf("\nError receiving diagnose location response\n");
+                    return -1;
+                }
+                printf(", %s", resp.desc);
+            }
+        }
+    }
+
+    if (found)
+    {
+        printf("\n");
+    }
+    else if (error.type == ERROR_MSG)
+    {
+        printf("%s\n", error.desc);
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Envia um HEARTBEAT aos servidores, para que não desconectem este sensor por inatividade.
+ *
+ * Servidores que não negociaram o formato compacto não conhecem a mensagem e
+ * não a recebem.
+ *
+ * @param ss_socket O socket do Servidor de Status.
+ * @param cluster Os Servidores de Localização.
+ */
+void send_heartbeats(int ss_socket, const Cluster_t *cluster)
+{
+    for (int i = -1; i < cluster->count; i++)
+    {
+        int sock = i < 0 ? ss_socket : cluster->socks[i];
+        if (conn_get_wire(sock) == WIRE_COMPACT)
+        {
+            Msg_t beat = {0};
+            beat.type = HEARTBEAT;
+            send_msg(sock, &beat);
+        }
+    }
+}
+
+/**
+ * @brief Converte um intervalo de heartbeat para o formato do `select()`.
+ *
+ * @param heartbeat O intervalo, em ms.
+ * @param tv Destino do intervalo.
+ * @return struct timeval* `tv`, ou NULL (sem limite) se o heartbeat está desativado.
+ */
+struct timeval *heartbeat_timeout(int heartbeat, struct timeval *tv)
+{
+    if (heartbeat <= 0)
+    {
+        return NULL;
+    }
+
+    tv->tv_sec = heartbeat / 1000;
+    tv->tv_usec = (heartbeat % 1000) * 1000;
+    return tv;
+}
+
+/**
+ * @brief Aguarda por atividade nos sockets ou na entrada de comandos.
+ *
+ * Utiliza `select()` para monitorar a entrada do usuário (stdin ou script) e os sockets
+ * dos dois servidores (SS e SL). Processa os comandos do usuário ('kill',
+ * 'check failure [IDs]', 'locate <IDs>', 'diagnose', 'subscribe') e direciona para a
+ * função de tratamento correspondente.
+ *
+ * @param read_fds Conjunto de file descriptors a serem monitorados.
+ * @param input A entrada de comandos (stdin ou o script).
+ * @param ss_socket O socket do Servidor de Status.
+ * @param cluster Os Servidores de Localização ('locate' vai ao dono do sensor e 'diagnose', a todos).
+ * @param client_id O ID deste cliente.
+ * @param heartbeat Inatividade após a qual um HEARTBEAT é enviado, em ms (0 = nunca).
+ * @return int Retorna 1 para continuar, 0 para encerrar, -1 em caso de erro.
+ */
+int wait_for_activity(fd_set *read_fds, FILE *input, int ss_socket, const Cluster_t *cluster, int client_id,
+                      int heartbeat)
+{
+    int sl_socket = cluster->socks[cluster->home];
+    int input_fd = fileno(input);
+
+    // Quadros que chegaram junto de uma resposta já foram lidos do kernel e não acordam o `select()`
+    if (!handle_buffered(ss_socket))
+    {
+        return 0;
+    }
+    for (int node = 0; node < cluster->count; node++)
+    {
+        if (!handle_buffered(cluster->socks[node]))
+        {
+            return 0;
+        }
+    }
+
+    FD_ZERO(read_fds);
+    FD_SET(input_fd, read_fds);
+    FD_SET(ss_socket, read_fds);
+
+    int max_fd = ss_socket > input_fd ? ss_socket : input_fd;
+    for (int node = 0; node < cluster->count; node++)
+    {
+        FD_SET(cluster->socks[node], read_fds);
+        if (max_fd < cluster->socks[node])
+        {
+            max_fd = cluster->socks[node];
+        }
+    }
+
+    struct timeval tv;
+    int ready = select(max_fd + 1, read_fds, NULL, NULL, heartbeat_timeout(heartbeat, &tv));
+    if (ready < 0)
+    {
+        logexit("select");
+    }
+
+    if (ready == 0)
+    {
+        send_heartbeats(ss_socket, cluster);
+        return 1;
+    }
+
+    if (FD_ISSET(input_fd, read_fds))
+    {
+        char buf[BUFSZ];
+        memset(buf, 0, BUFSZ);
+        if (fgets(buf, sizeof(buf), input) == NULL)
+        {
+            // Fim da entrada (ex: fim do script): encerra o cliente
+            return 0;
+        }
+
+        toLowerString(buf);
+        if (strncmp(buf, "kill", 4) == 0)
+        {
+            return handle_kill(ss_socket, sl_socket, client_id);
+        }
+
+        if (strncmp(buf, "subscribe", 9) == 0)
+        {
+            return handle_subscribe(ss_socket, client_id);
+        }
+
+        // Com uma lista de IDs, as consultas são feitas em lote
+        if (strncmp(buf, "check failure", 13) == 0)
+        {
+            int count;
+            int *ids = parse_id_list(buf + 13, &count);
+            int status = ids == NULL ? handle_check_failure(ss_socket, client_id)
+                                     : handle_check_failure_batch(ss_socket, ids, count);
+            free(ids);
+            return status;
+        }
+
+        if (strncmp(buf, "locate", 6) == 0)
+        {
+            int count;
+            int *ids = parse_id_list(buf + 6, &count);
+            if (ids != NULL)
+            {
+                int status = count == 1 ? handle_locate_sensor(cluster->socks[cluster_owner(cluster, ids[0])], ids[0])
+                                        : handle_locate_batch(cluster, ids, count);
+                free(ids);
+                return status;
+            }
+        }
+
+        if (strncmp(buf, "diagnose", 8) == 0)
+        {
+            int loc_id;
+            if (sscanf(buf + 8, "%d", &loc_id) == 1)
+            {
+                return handle_diagnose_loc(cluster, loc_id);
+            }
+        }
+    }
+
+    if (FD_ISSET(ss_socket, read_fds))
+    {
+        return handle_server_activity(ss_socket);
+    }
+
+    for (int node = 0; node < cluster->count; node++)
+    {
+        if (FD_ISSET(cluster->socks[node], read_fds))
+        {
+            return handle_server_activity(cluster->socks[node]);
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Verifica se uma nova requisição pode ser enviada no modo em paralelo.
+ * * Além do limite da janela, a posição do próximo seq deve estar livre: uma
+ * requisição antiga e lenta bloqueia o envio até ser respondida.
+ * * @param p O estado do modo em paralelo.
+ * @return int 1 se há espaço, 0 caso contrário.
  */
-int handle_check_failure(int ss_socket, int client_id)
+int pipeline_can_issue(Pipeline_t *p)
 {
-    printf("Sending REQ_SENSSTATUS %d\n", client_id);
-    Msg_t disc = {0};
-    disc.type = REQ_SENSSTATUS;
-    disc.payload = client_id;
+    uint32_t seq = p->next_seq == 0 ? 1 : p->next_seq;
+    return p->outstanding < p->window && p->slots[seq & (p->cap - 1)].seq == 0;
+}
 
-    if (send_msg(ss_socket, &disc) == -1)
+/**
+ * @brief Envia uma requisição com o próximo seq e a registra como em andamento.
+ * @param p O estado do modo em paralelo.
+ * @param sock O socket do servidor de destino.
+ * @param msg A requisição (recebe o seq).
+ * @param arg O sensor ou localização consultada.
+ * @return Inflight_t* O registro da requisição.
+ */
+Inflight_t *pipeline_issue(Pipeline_t *p, int sock, Msg_t *msg, int arg)
+{
+    if (p->next_seq == 0)
     {
-        printf("Error sending check failure request\n");
-        close(ss_socket);
-        return 0;
+        p->next_seq = 1;
     }
 
-    Msg_t resp = {0};
+    msg->seq = p->next_seq++;
+    Inflight_t *req = &p->slots[msg->seq & (p->cap - 1)];
+    memset(req, 0, sizeof(Inflight_t));
+    req->seq = msg->seq;
+    req->type = msg->type;
+    req->arg = arg;
+    req->parts = 1;
+    p->outstanding++;
 
-    if (recv_msg(ss_socket, &resp) <= 0)
+    if (send_msg(sock, msg) == -1)
     {
-        printf("Error receiving check failure response\n");
-        return 0;
+        printf("Error sending request\n");
+        exit(EXIT_FAILURE);
     }
 
-    if (resp.type == ERROR_MSG)
+    return req;
+}
+
+/**
+ * @brief Envia a outro SL mais uma parte de uma requisição já registrada, com o mesmo seq.
+ * * A requisição só é concluída quando todas as partes forem respondidas.
+ * * @param p O estado do modo em paralelo.
+ * @param req O registro da requisição.
+ * @param sock O socket do SL.
+ * @param msg A parte (recebe o seq).
+ */
+void pipeline_issue_part(Pipeline_t *p, Inflight_t *req, int sock, Msg_t *msg)
+{
+    msg->seq = req->seq;
+    req->parts++;
+
+    if (send_msg(sock, msg) == -1)
     {
-        printf("%s\n", resp.desc);
-        return 1;
+        printf("Error sending request\n");
+        exit(EXIT_FAILURE);
     }
+}
 
-    if (resp.type == RES_SENSSTATUS)
+/**
+ * @brief Envia o próximo bloco do lote em andamento, se houver espaço na janela.
+ * @param p O estado do modo em paralelo.
+ */
+void pipeline_issue_batch(Pipeline_t *p)
+{
+    while (p->batch_type != 0 && pipeline_can_issue(p))
     {
-        int location = resp.payload;
-        char area[BUFSZ];
+        Msg_t msg = {0};
+        msg.type = p->batch_type;
+        int sent = batch_format(&msg, p->batch_ids + p->batch_done, p->batch_count - p->batch_done);
 
-        switch (location)
+        // Cada SL recebe, com o mesmo seq, só os sensores do bloco dos quais é dono
+        Inflight_t *req = NULL;
+        for (int node = 0; p->batch_type == REQ_SENSLOC_BATCH && node < p->cluster->count; node++)
         {
-        case 1:
-        case 2:
-        case 3:
-            strcpy(area, "1 (Norte)");
-            break;
-        case 4:
-        case 5:
-            strcpy(area, "2 (Sul)");
-            break;
-        case 6:
-        case 7:
-            strcpy(area, "3 (Leste)");
-            break;
-        case 8:
-        case 9:
-        case 10:
-            strcpy(area, "4 (Oeste)");
-            break;
-        default:
-            strcpy(area, "Unknown");
-            break;
-        }
+            int ids[BATCH_MAX_IDS];
+            Msg_t part = {0};
+            part.type = REQ_SENSLOC_BATCH;
+            int count = cluster_select(p->cluster, p->batch_ids + p->batch_done, sent, node, ids);
+            if (count == 0)
+            {
+                continue;
+            }
 
-        printf("Alert received from area: %s\n", area);
-    }
+            batch_format(&part, ids, count);
+            if (req == NULL)
+            {
+                req = pipeline_issue(p, p->cluster->socks[node], &part, 0);
+            }
+            else
+            {
+                pipeline_issue_part(p, req, p->cluster->socks[node], &part);
+            }
+        }
+        if (req == NULL)
+        {
+            req = pipeline_issue(p, p->ss_socket, &msg, 0);
+        }
+        req->count = sent;
+        req->ids = malloc(sent * sizeof(int));
+        if (req->ids == NULL)
+        {
+            logexit("malloc");
+        }
+        memcpy(req->ids, p->batch_ids + p->batch_done, sent * sizeof(int));
+        printf("[%u] Sending %s %d\n", req->seq,
+               p->batch_type == REQ_SENSLOC_BATCH ? "REQ_SENSLOC_BATCH" : "REQ_SENSSTATUS_BATCH", sent);
 
-    if (resp.type == OK_MSG)
-    {
-        printf("%s\n", resp.desc);
+        p->batch_done += sent;
+        if (p->batch_done == p->batch_count)
+        {
+            free(p->batch_ids);
+            p->batch_ids = NULL;
+            p->batch_type = 0;
+        }
     }
-
-    return 1;
 }
 
 /**
- * @brief Processa o comando 'locate'.
- *
- * Envia uma requisição (`REQ_SENSLOC`) para o Servidor de Localização (SL)
- * para obter a localização do sensor com o ID especificado e imprime a resposta.
- *
- * @param sl_socket O socket do Servidor de Localização.
- * @param client_id O ID do sensor a ser localizado.
- * @return int Retorna 1 para continuar, -1 em caso de erro.
+ * @brief Interpreta e envia um comando no modo em paralelo.
+ * @param p O estado do modo em paralelo.
+ * @param buf A linha do comando.
  */
-int handle_locate_sensor(int sl_socket, int client_id)
+void pipeline_command(Pipeline_t *p, char *buf)
 {
-    printf("Sending REQ_SENSLOC %d\n", client_id);
-    Msg_t disc = {0};
-    disc.type = REQ_SENSLOC;
-    disc.payload = client_id;
+    toLowerString(buf);
+    Msg_t msg = {0};
 
-    if (send_msg(sl_socket, &disc) == -1)
+    if (strncmp(buf, "kill", 4) == 0)
     {
-        printf("Error sending locate sensor request\n");
-        close(sl_socket);
-        return -1;
+        // As requisições em andamento são concluídas antes da desconexão
+        p->input_done = 1;
+        p->kill = 1;
+        return;
     }
 
-    Msg_t resp = {0};
-    int recv = recv_msg(sl_socket, &resp);
+    if (strncmp(buf, "check failure", 13) == 0 || strncmp(buf, "locate", 6) == 0)
+    {
+        int status = buf[0] == 'c';
+        int count;
+        int *ids = parse_id_list(buf + (status ? 13 : 6), &count);
 
-    if (recv <= 0)
+        if (ids == NULL && status)
+        {
+            msg.type = REQ_SENSSTATUS;
+            msg.payload = p->client_id;
+            Inflight_t *req = pipeline_issue(p, p->ss_socket, &msg, p->client_id);
+            printf("[%u] Sending REQ_SENSSTATUS %d\n", req->seq, p->client_id);
+        }
+        else if (ids != NULL && count == 1 && !status)
+        {
+            msg.type = REQ_SENSLOC;
+            msg.payload = ids[0];
+            Inflight_t *req = pipeline_issue(p, p->cluster->socks[cluster_owner(p->cluster, ids[0])], &msg, ids[0]);
+            printf("[%u] Sending REQ_SENSLOC %d\n", req->seq, ids[0]);
+            free(ids);
+        }
+        else if (ids != NULL)
+        {
+            p->batch_type = status ? REQ_SENSSTATUS_BATCH : REQ_SENSLOC_BATCH;
+            p->batch_ids = ids;
+            p->batch_count = count;
+            p->batch_done = 0;
+            pipeline_issue_batch(p);
+        }
+        return;
+    }
+
+    if (strncmp(buf, "subscribe", 9) == 0)
     {
-        printf("Error receiving locate sensor response\n");
-        return -1;
+        msg.type = REQ_SUBSCRIBE;
+        msg.payload = p->client_id;
+        Inflight_t *req = pipeline_issue(p, p->ss_socket, &msg, p->client_id);
+        printf("[%u] Sending REQ_SUBSCRIBE %d\n", req->seq, p->client_id);
+        return;
     }
 
-    if (resp.type == ERROR_MSG)
+    int loc_id;
+    if (strncmp(buf, "diagnose", 8) == 0 && sscanf(buf + 8, "%d", &loc_id) == 1)
     {
-        printf("%s\n", resp.desc);
-        return 1;
+        // A lista é reunida a partir das respostas de todos os SLs
+        msg.type = REQ_LOCLIST;
+        msg.payload = loc_id;
+        Inflight_t *req = pipeline_issue(p, p->cluster->socks[0], &msg, loc_id);
+        for (int node = 1; node < p->cluster->count; node++)
+        {
+            pipeline_issue_part(p, req, p->cluster->socks[node], &msg);
+        }
+        printf("[%u] Sending REQ_LOCLIST %d\n", req->seq, loc_id);
     }
+}
 
-    if (resp.type == RES_SENSLOC)
+/**
+ * @brief Processa as linhas completas já lidas e ainda não enviadas.
+ * @param p O estado do modo em paralelo.
+ */
+void pipeline_drain_lines(Pipeline_t *p)
+{
+    char *start = p->line;
+    char *newline;
+    while (!p->input_done && p->batch_type == 0 && pipeline_can_issue(p) &&
+           (newline = memchr(start, '\n', p->line + p->line_len - start)) != NULL)
     {
-        printf("Current sensor location: %d\n", resp.payload);
+        *newline = '\0';
+        pipeline_command(p, start);
+        start = newline + 1;
     }
 
-    return 1;
+    p->line_len -= start - p->line;
+    memmove(p->line, start, p->line_len);
 }
 
 /**
- * @brief Processa o comando 'diagnose'.
- *
- * Envia uma requisição (`REQ_LOCLIST`) para o Servidor de Localização (SL) para
- * obter uma lista de todos os sensores em uma determinada localização e imprime o resultado.
- *
- * @param sl_socket O socket do Servidor de Localização.
- * @param loc_id O ID da localização a ser diagnosticada.
- * @return int Retorna 1 para continuar, -1 em caso de erro.
+ * @brief Lê os comandos disponíveis na entrada e os envia enquanto há espaço na janela.
+ * * A entrada é lida com `read`, sem o buffer do stdio, para que `select` reflita
+ * exatamente os dados ainda não consumidos.
+ * * @param p O estado do modo em paralelo.
  */
-int handle_diagnose_loc(int sl_socket, int loc_id)
+void pipeline_read_input(Pipeline_t *p)
 {
-    printf("Sending REQ_LOCLIST %d\n", loc_id);
-    Msg_t disc = {0};
-    disc.type = REQ_LOCLIST;
-    disc.payload = loc_id;
-
-    if (send_msg(sl_socket, &disc) == -1)
+    ssize_t count = read(p->input_fd, p->line + p->line_len, sizeof(p->line) - 1 - p->line_len);
+    if (count <= 0)
     {
-        printf("Error sending diagnose location request\n");
-        close(sl_socket);
-        return -1;
+        p->input_done = 1;
+        if (p->line_len > 0)
+        {
+            p->line[p->line_len] = '\0';
+            p->line_len = 0;
+            pipeline_command(p, p->line);
+        }
+        return;
     }
+    p->line_len += count;
+    pipeline_drain_lines(p);
 
-    Msg_t resp = {0};
-    int recv = recv_msg(sl_socket, &resp);
+    // Linhas que não cabem no buffer são descartadas
+    if (p->line_len == sizeof(p->line) - 1 && memchr(p->line, '\n', p->line_len) == NULL)
+    {
+        p->line_len = 0;
+    }
+}
 
-    if (recv == 0)
+/**
+ * @brief Associa uma resposta à sua requisição e a imprime.
+ * * Requisições espalhadas entre os SLs de um cluster são impressas quando
+ * todas as partes forem respondidas.
+ * * @param p O estado do modo em paralelo.
+ * @param resp A resposta recebida.
+ * @param node O nó do cluster que enviou a resposta (-1 = SS).
+ */
+void pipeline_response(Pipeline_t *p, Msg_t *resp, int node)
+{
+    if (resp->type == ALERT_MSG)
     {
-        printf("Error receiving diagnose location response\n");
-        return -1;
+        print_alert("[push] ", resp);
+        return;
     }
 
-    if (resp.type == ERROR_MSG)
+    Inflight_t *req = &p->slots[resp->seq & (p->cap - 1)];
+    if (resp->seq == 0 || req->seq != resp->seq)
     {
-        printf("%s\n", resp.desc);
-        return 1;
+        return;
     }
 
-    if (resp.type == RES_LOCLIST)
+    char prefix[16];
+    snprintf(prefix, sizeof(prefix), "[%u] ", req->seq);
+
+    switch (req->type)
     {
-        printf("Sensors at location %d: %s\n", loc_id, resp.desc);
+    case REQ_SENSSTATUS:
+        print_check_failure(prefix, resp);
+        break;
+    case REQ_SENSLOC:
+        print_locate(prefix, resp);
+        break;
+    case REQ_SUBSCRIBE:
+        print_subscribe(prefix, resp);
+        break;
+    case REQ_SENSLOC_BATCH:
+    case REQ_SENSSTATUS_BATCH:
+        if (resp->type == req->type + 1)
+        {
+            if (req->values == NULL && (req->values = malloc(req->count * sizeof(int))) == NULL)
+            {
+                logexit("malloc");
+            }
+
+            // Cada SL responde, em ordem, pelos sensores do bloco dos quais é dono
+            int values[BATCH_MAX_IDS];
+            int count = batch_parse(resp, values, req->count);
+            for (int i = 0, next = 0; i < req->count; i++)
+            {
+                if (req->type == REQ_SENSSTATUS_BATCH || cluster_owner(p->cluster, req->ids[i]) == node)
+                {
+                    req->values[i] = next < count ? values[next++] : -1;
+                }
+            }
+        }
+        if (--req->parts > 0)
+        {
+            return;
+        }
+        if (req->values != NULL)
+        {
+            print_batch(prefix, req->type, req->ids, req->values, req->count);
+        }
+        free(req->ids);
+        free(req->values);
+        break;
+    case REQ_LOCLIST:
+        if (resp->type == RES_LOCLIST)
+        {
+            // Listas longas chegam em várias páginas com o mesmo seq; a última tem `more` = 0
+            size_t len = req->list ? strlen(req->list) : 0;
+            char *list = realloc(req->list, len + strlen(resp->desc) + 3);
+            if (list == NULL)
+            {
+                logexit("realloc");
+            }
+            sprintf(list + len, "%s%s", len > 0 ? ", " : "", resp->desc);
+            req->list = list;
+
+            if (resp->more)
+            {
+                return;
+            }
+        }
+        if (--req->parts > 0)
+        {
+            return;
+        }
+
+        // Sem nenhuma lista, a última resposta é o erro de um SL
+        if (req->list == NULL)
+        {
+            printf("%s%s\n", prefix, resp->desc);
+            break;
+        }
+        printf("%sSensors at location %d: %s\n", prefix, req->arg, req->list);
+        free(req->list);
+        break;
     }
 
-    return 1;
+    req->seq = 0;
+    p->outstanding--;
 }
 
 /**
- * @brief Aguarda por atividade nos sockets ou na entrada padrão.
- *
- * Utiliza `select()` para monitorar a entrada do usuário (stdin) e os sockets
- * dos dois servidores (SS e SL). Processa os comandos do usuário ('kill',
- * 'check failure', 'locate', 'diagnose') e direciona para a função de
- * tratamento correspondente.
- *
- * @param read_fds Conjunto de file descriptors a serem monitorados.
- * @param ss_socket O socket do Servidor de Status.
- * @param sl_socket O socket do Servidor de Localização.
- * @param client_id O ID deste cliente.
- * @return int Retorna 1 para continuar, 0 para encerrar, -1 em caso de erro.
+ * @brief Lê e trata todas as respostas disponíveis em um socket.
+ * @param p O estado do modo em paralelo.
+ * @param sock O socket do servidor.
+ * @return int 1 se a conexão continua ativa, 0 se foi encerrada.
  */
-int wait_for_activity(fd_set *read_fds, int ss_socket, int sl_socket, int client_id)
+int pipeline_receive(Pipeline_t *p, int sock)
 {
-    FD_ZERO(read_fds);
-    FD_SET(STDIN_FILENO, read_fds);
-    FD_SET(ss_socket, read_fds);
-    FD_SET(sl_socket, read_fds);
+    ConnFill fill;
+    do
+    {
+        fill = conn_fill(sock);
+
+        Msg_t resp;
+        int len;
+        int node = cluster_node(p->cluster, sock);
+        while ((len = conn_next_msg(sock, &resp)) > 0)
+        {
+            pipeline_response(p, &resp, node);
+        }
+
+        if (len < 0 || fill == CONN_CLOSED)
+        {
+            return 0;
+        }
+    } while (fill == CONN_FULL);
+
+    return 1;
+}
 
-    int max_fd = ss_socket > sl_socket ? ss_socket : sl_socket;
-    if (max_fd < STDIN_FILENO)
+/**
+ * @brief Executa o cliente no modo em paralelo.
+ * * Os comandos são enviados um após o outro, cada um com um seq, sem aguardar
+ * as respostas, até o limite da janela. As respostas são associadas às
+ * requisições pelo seq à medida que chegam, inclusive fora de ordem (ex: um
+ * 'check failure' que depende de uma consulta do SS ao SL). Ao fim da entrada
+ * ou após um 'kill', o cliente aguarda as respostas pendentes antes de retornar.
+ * * @param p O estado do modo em paralelo (sockets, ID e janela já definidos).
+ * @return int 0 em caso de sucesso, -1 em caso de erro.
+ */
+int run_pipeline(Pipeline_t *p)
+{
+    p->cap = 1;
+    while (p->cap < (uint32_t)p->window)
+    {
+        p->cap <<= 1;
+    }
+    p->slots = calloc(p->cap, sizeof(Inflight_t));
+    if (p->slots == NULL)
     {
-        max_fd = STDIN_FILENO;
+        logexit("calloc");
     }
 
-    if (select(max_fd + 1, read_fds, NULL, NULL, NULL) < 0)
+    // A janela limita os bytes enfileirados por conexão
+    conn_set_out_policy((size_t)p->window * FRAME_MAX_SZ + OUT_LIMIT_DEFAULT, SLOW_CLOSE);
+    // O SS e os SLs, na ordem do cluster
+    int socks[1 + HASHRING_MAX_NODES];
+    int nsocks = 1 + p->cluster->count;
+    socks[0] = p->ss_socket;
+    memcpy(socks + 1, p->cluster->socks, p->cluster->count * sizeof(int));
+    for (int i = 0; i < nsocks; i++)
     {
-        logexit("select");
+        conn_set_nonblocking(socks[i]);
     }
 
-    if (FD_ISSET(STDIN_FILENO, read_fds))
+    for (;;)
     {
-        char buf[BUFSZ];
-        memset(buf, 0, BUFSZ);
-        if (fgets(buf, sizeof(buf), stdin) != NULL)
+        // Envia o que couber na janela antes de decidir se ainda há o que aguardar;
+        // as requisições do ciclo saem juntas, uma chamada por servidor
+        conn_cork();
+        pipeline_issue_batch(p);
+        pipeline_drain_lines(p);
+        conn_uncork();
+        if (p->input_done && p->batch_type == 0 && p->outstanding == 0)
         {
-            toLowerString(buf);
-            if (strncmp(buf, "kill", 4) == 0)
-            {
-                return handle_kill(ss_socket, sl_socket, client_id);
-            }
+            break;
+        }
+
+        fd_set read_fds, write_fds;
+        FD_ZERO(&read_fds);
+        FD_ZERO(&write_fds);
+        int max_fd = 0;
+        for (int i = 0; i < nsocks; i++)
+        {
+            FD_SET(socks[i], &read_fds);
+            max_fd = socks[i] > max_fd ? socks[i] : max_fd;
+        }
+
+        if (!p->input_done && p->batch_type == 0 && pipeline_can_issue(p))
+        {
+            FD_SET(p->input_fd, &read_fds);
+            max_fd = p->input_fd > max_fd ? p->input_fd : max_fd;
+        }
 
-            if (strncmp(buf, "check failure", 13) == 0)
+        for (int i = 0; i < nsocks; i++)
+        {
+            if (conn_pending_out(socks[i]) > 0)
             {
-                return handle_check_failure(ss_socket, client_id);
+                FD_SET(socks[i], &write_fds);
             }
+        }
+
+        struct timeval tv;
+        int ready = select(max_fd + 1, &read_fds, &write_fds, NULL, heartbeat_timeout(p->heartbeat, &tv));
+        if (ready < 0)
+        {
+            logexit("select");
+        }
+
+        if (ready == 0)
+        {
+            send_heartbeats(p->ss_socket, p->cluster);
+            continue;
+        }
 
-            if (strncmp(buf, "locate", 6) == 0)
+        for (int i = 0; i < nsocks; i++)
+        {
+            if (FD_ISSET(socks[i], &write_fds) && conn_flush(socks[i]) < 0)
             {
-                int id;
-                if (sscanf(buf + 6, "%d", &id) == 1)
-                {
-                    return handle_locate_sensor(sl_socket, id);
-                }
+                printf("Error sending request\n");
+                return -1;
             }
 
-            if (strncmp(buf, "diagnose", 8) == 0)
+            if (FD_ISSET(socks[i], &read_fds) && !pipeline_receive(p, socks[i]))
             {
-                int loc_id;
-                if (sscanf(buf + 8, "%d", &loc_id) == 1)
-                {
-                    return handle_diagnose_loc(sl_socket, loc_id);
-                }
+                printf("Server disconnected\n");
+                return -1;
             }
         }
-    }
 
-    if (FD_ISSET(ss_socket, read_fds))
-    {
-        return handle_server_activity(ss_socket);
-    }
-
-    if (FD_ISSET(sl_socket, read_fds))
-    {
-        return handle_server_activity(sl_socket);
+        if (FD_ISSET(p->input_fd, &read_fds))
+        {
+            pipeline_read_input(p);
+        }
+        fflush(stdout);
     }
 
-    return 1;
+    free(p->slots);
+    return 0;
 }
 
 /**
@@ -390,16 +1653,28 @@ int wait_for_activity(fd_set *read_fds, int ss_socket, int sl_socket, int client
  * O cliente se conecta a duas portas de servidor. Ele não sabe qual é o Servidor
  * de Status (SS) e qual é o de Localização (SL). Após a conexão, ele envia uma
  * mensagem de identificação para ambos e, com base na resposta, determina qual
- * socket corresponde a qual servidor. Em seguida, entra em um loop para
- * processar comandos do usuário e atividade dos servidores.
+ * socket corresponde a qual servidor. Se o SS informar um cluster de SLs, o
+ * sensor é registrado no SL dono do seu ID e o cliente se conecta também aos
+ * demais, para enviar cada consulta de localização ao SL certo. Em seguida,
+ * entra em um loop para processar comandos do usuário e atividade dos servidores.
  */
 int main(int argc, char **argv)
 {
+    Options_t opts = {.window = WINDOW_DEFAULT, .heartbeat = HEARTBEAT_DEFAULT};
+    parse_options(argc, argv, &opts);
+
     // Verifica se os argumentos da linha de comando estão corretos
-    if (argc < 3)
+    if (argc - optind < 3)
     {
         usage(argc, argv);
     }
+    argv += optind - 1;
+
+    FILE *input = stdin;
+    if (opts.script != NULL && (input = fopen(opts.script, "r")) == NULL)
+    {
+        logexit("fopen");
+    }
 
     int s, s_2;
     int ss_socket, sl_socket; // Sockets para Servidor de Status e Servidor de Localização
@@ -414,9 +1689,9 @@ int main(int argc, char **argv)
         usage(argc, argv);
     }
 
-    // Cria um socket para cada servidor
-    s = socket(storage.ss_family, SOCK_STREAM, 0);
-    s_2 = socket(storage_2.ss_family, SOCK_STREAM, 0);
+    // Cria um socket para cada servidor (SOCK_SEQPACKET com um endereço "unix:")
+    s = conn_socket(&storage);
+    s_2 = conn_socket(&storage_2);
 
     if (s == -1 || s_2 == -1)
     {
@@ -426,79 +1701,96 @@ int main(int argc, char **argv)
     // Conecta-se aos dois servidores
     struct sockaddr *addr = (struct sockaddr *)(&storage);
     struct sockaddr *addr_2 = (struct sockaddr *)(&storage_2);
-    socklen_t addrlen = sizeof(struct sockaddr_in);
 
-    if (connect(s, addr, addrlen) != 0)
+    if (connect(s, addr, sockaddr_len(&storage)) != 0)
     {
         logexit("connect");
     }
 
-    if (connect(s_2, addr_2, addrlen) != 0)
+    if (connect(s_2, addr_2, sockaddr_len(&storage_2)) != 0)
     {
         logexit("connect");
     }
 
     memset(buf, 0, BUFSZ);
 
-    // Prepara a mensagem de conexão
-    Msg_t msg1 = {0}, msg2 = {0};
-    int client_id = get_client_id(); // Obtém um ID único para o cliente
-
-    msg1.type = msg2.type = REQ_CONNSEN;
-    msg1.payload = msg2.payload = client_id;
-
-    // Envia a requisição de conexão para ambos os servidores
-    send_msg(s, &msg1);
-    send_msg(s_2, &msg2);
-
-    memset(&msg1, 0, sizeof(msg1));
-
-    // Recebe a resposta de ambos os servidores para identificá-los
-    recv_msg(s, &msg1);
-    recv_msg(s_2, &msg2);
-
-    // Trata possíveis erros na conexão
-    if (msg1.type == ERROR_MSG)
-    {
-        close(s);
-        logexit(msg1.desc);
-    }
-
-    if (msg2.type == ERROR_MSG)
-    {
-        close(s_2);
-        logexit(msg2.desc);
-    }
-
-    if (msg1.type != RES_CONNSEN || msg2.type != RES_CONNSEN)
-    {
-        close(s);
-        close(s_2);
-        logexit("Unexpected message type");
-    }
-
+    // O primeiro servidor atribui o ID do cliente, que é então registrado no segundo.
     // Identifica qual servidor é o de Status (SS) e qual é o de Localização (SL)
     // com base na descrição enviada na resposta.
+    Msg_t msg1, msg2;
+    int ports[HASHRING_MAX_NODES];
+    int nports;
+    struct sockaddr_storage *sl_storage;
+    register_sensor(s, ID_ASSIGN, &msg1);
+    int client_id = msg1.payload;
     if (strncmp(msg1.desc, "SS", 2) == 0)
     {
+        // O ID veio do SS: em um cluster, o sensor é registrado no SL dono dele
         ss_socket = s;
-        sl_socket = s_2;
+        sl_storage = &storage_2;
+        nports = fetch_routes(ss_socket, ports);
+        sl_socket = cluster_home(s_2, sl_storage, ports, nports, client_id);
+        register_sensor(sl_socket, client_id, &msg2);
     }
     else
     {
+        // Um SL de um cluster só atribui IDs que lhe pertencem
         ss_socket = s_2;
         sl_socket = s;
+        sl_storage = &storage;
+        register_sensor(s_2, client_id, &msg2);
+        nports = fetch_routes(ss_socket, ports);
     }
 
     printf("%s New ID: %d\n", msg1.desc, msg1.payload);
     printf("%s New ID: %d\n", msg2.desc, msg2.payload);
     printf("Ok(02)\n");
 
+    // A porta de clientes do SL de registro identifica o seu nó no anel
+    Cluster_t cluster;
+    struct sockaddr_storage sl_addr;
+    socklen_t sl_addrlen = sizeof(sl_addr);
+    if (getpeername(sl_socket, (struct sockaddr *)&sl_addr, &sl_addrlen) != 0)
+    {
+        logexit("getpeername");
+    }
+    cluster_open(&cluster, sl_socket, sl_storage, sockaddr_port(&sl_addr), ports, nports);
+
+    if (opts.pipeline)
+    {
+        // O seq só é transportado no formato compacto
+        if (conn_get_wire(ss_socket) == WIRE_COMPACT && conn_get_wire(sl_socket) == WIRE_COMPACT)
+        {
+            Pipeline_t pipeline = {0};
+            pipeline.ss_socket = ss_socket;
+            pipeline.cluster = &cluster;
+            pipeline.client_id = client_id;
+            pipeline.window = opts.window;
+            pipeline.heartbeat = opts.heartbeat;
+            pipeline.input_fd = fileno(input);
+
+            int ret = run_pipeline(&pipeline);
+            cluster_close(&cluster);
+            if (ret == 0 && pipeline.kill)
+            {
+                // handle_kill fecha os sockets
+                ret = handle_kill(ss_socket, sl_socket, client_id);
+            }
+            else
+            {
+                close(ss_socket);
+                close(sl_socket);
+            }
+            exit(ret == -1 ? EXIT_FAILURE : EXIT_SUCCESS);
+        }
+        printf("Pipelining requires the compact wire format, falling back to one request at a time\n");
+    }
+
     // Loop principal: continua executando enquanto 'keep' for verdadeiro
     int keep = 1;
     while (keep)
     {
-        keep = wait_for_activity(&read_fds, ss_socket, sl_socket, client_id);
+        keep = wait_for_activity(&read_fds, input, ss_socket, &cluster, client_id, opts.heartbeat);
 
         if (keep == 0) // Comando 'kill' foi bem-sucedido
         {
@@ -512,8 +1804,9 @@ int main(int argc, char **argv)
     }
 
     // Fecha os sockets antes de sair
-    close(s);
-    close(s_2);
+    cluster_close(&cluster);
+    close(ss_socket);
+    close(sl_socket);
 
     exit(EXIT_SUCCESS);
 }
\ No newline at end of file
@@ -3,10 +3,71 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
 
 #include <arpa/inet.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <poll.h>
 #include "common.h"
 
+/**
+ * @brief Layout de Msg_t no formato de fio original.
+ * * Mantido separado de Msg_t para que campos usados apenas no formato
+ * compacto (como `seq`) não alterem o que peers antigos esperam receber.
+ */
+typedef struct LegacyMsg
+{
+    int type;
+    int payload;
+    char desc[BUFSZ];
+} LegacyMsg_t;
+
+/**
+ * @brief Estado mantido por conexão, indexado pelo file descriptor.
+ */
+typedef struct Conn
+{
+    uint32_t gen;        // Incrementado a cada fechamento do fd
+    WireFormat wire;
+    int nonblocking;     // Envios passam pela fila de saída em vez de bloquear
+    int broken;          // Erro de envio ou consumidor lento: deve ser fechada
+    int dirty;           // Na lista de sockets a esvaziar em conn_uncork
+    int async;           // Operações io_uring em andamento referenciam o socket (ver conn_set_async)
+    int packet;          // Socket SOCK_SEQPACKET: leituras e escritas em registros de até CONN_PACKET_MAX
+    unsigned char *rbuf; // Buffer circular de recepção (alocado sob demanda)
+    uint32_t rhead;      // Contadores livres: o índice real é (contador & RING_MASK)
+    uint32_t rtail;
+    unsigned char *wbuf; // Fila de saída circular; cresce em potências de 2
+    uint32_t wcap;
+    uint32_t whead;
+    uint32_t wtail;
+    uint32_t wsending;   // Bytes do início da fila entregues a um envio assíncrono ainda não concluído
+    const ConnTransport_t *transport; // Substitui o socket nas leituras e escritas (NULL = o próprio socket)
+    void *transport_ctx;
+} Conn_t;
+
+#define RING_SZ 4096
+#define RING_MASK (RING_SZ - 1)
+
+static Conn_t *conns = NULL;
+static int conns_cap = 0;
+
+static size_t out_limit = OUT_LIMIT_DEFAULT;
+static SlowPolicy slow_policy = SLOW_CLOSE;
+
+// Agrupamento de envios (ver conn_cork). Cada conexão é escrita apenas pela
+// thread dona dela, então cada thread mantém sua própria lista.
+static _Thread_local int corked = 0;
+static _Thread_local int *dirty = NULL;
+static _Thread_local int dirty_count = 0;
+static _Thread_local int dirty_cap = 0;
+
 /**
  * @brief Exibe uma mensagem de erro e encerra o programa.
  * * Esta função utilitária imprime a mensagem de erro fornecida, seguida
@@ -25,7 +86,8 @@ void logexit(const char *msg)
  * * Prepara as estruturas `sockaddr_storage` para o cliente se conectar a dois
  * servidores (ou duas portas no mesmo servidor). Converte as strings de
  * endereço e porta para o formato binário de rede.
- * * @param addrstr String contendo o endereço IP do servidor.
+ * * @param addrstr String contendo o endereço IP do servidor, ou "unix:<caminho>"
+ * para os sockets AF_UNIX dos servidores (ver unix_sockaddr_init).
  * @param portstr String contendo a porta do primeiro servidor.
  * @param portstr_2 String contendo a porta do segundo servidor.
  * @param storage Ponteiro para a estrutura que armazenará o endereço do primeiro servidor.
@@ -48,6 +110,16 @@ int client_sockaddr_init(const char *addrstr, const char *portstr, const char *p
         return -1;
     }
 
+    if (strncmp(addrstr, UNIX_ADDR_PREFIX, strlen(UNIX_ADDR_PREFIX)) == 0)
+    {
+        const char *path = addrstr + strlen(UNIX_ADDR_PREFIX);
+        if (unix_sockaddr_init(path, port, storage) != 0 || unix_sockaddr_init(path, port_2, storage_2) != 0)
+        {
+            return -1;
+        }
+        return 0;
+    }
+
     port = htons(port); // host to network short
     port_2 = htons(port_2);
 
@@ -72,6 +144,105 @@ int client_sockaddr_init(const char *addrstr, const char *portstr, const char *p
     return -1;
 }
 
+/**
+ * @brief Inicializa o endereço AF_UNIX em que um servidor atende clientes locais.
+ * * O caminho recebe a porta de clientes como sufixo, de modo que o endereço
+ * de cada servidor (inclusive os SLs de um cluster, identificados pela porta)
+ * é derivado de um único caminho base.
+ * * @param path O caminho base.
+ * @param port A porta de clientes do servidor.
+ * @param storage Destino do endereço.
+ * @return int 0 em caso de sucesso, -1 se o caminho for longo demais.
+ */
+int unix_sockaddr_init(const char *path, int port, struct sockaddr_storage *storage)
+{
+    struct sockaddr_un *addr = (struct sockaddr_un *)storage;
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+
+    int len = snprintf(addr->sun_path, sizeof(addr->sun_path), "%s.%d", path, port);
+    if (*path == '\0' || len < 0 || (size_t)len >= sizeof(addr->sun_path))
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Retorna o tamanho de um endereço, conforme a sua família.
+ * @param storage O endereço.
+ * @return socklen_t O tamanho a ser passado a `bind`/`connect`.
+ */
+socklen_t sockaddr_len(const struct sockaddr_storage *storage)
+{
+    if (storage->ss_family == AF_UNIX)
+    {
+        const struct sockaddr_un *addr = (const struct sockaddr_un *)storage;
+        return offsetof(struct sockaddr_un, sun_path) + strlen(addr->sun_path) + 1;
+    }
+    return sizeof(struct sockaddr_in);
+}
+
+/**
+ * @brief Retorna a porta de clientes de um endereço.
+ * @param storage O endereço (IPv4 ou AF_UNIX com a porta como sufixo).
+ * @return int A porta, ou 0 se o endereço não tiver uma.
+ */
+int sockaddr_port(const struct sockaddr_storage *storage)
+{
+    if (storage->ss_family == AF_UNIX)
+    {
+        const char *dot = strrchr(((const struct sockaddr_un *)storage)->sun_path, '.');
+        return dot != NULL ? atoi(dot + 1) : 0;
+    }
+    return ntohs(((const struct sockaddr_in *)storage)->sin_port);
+}
+
+/**
+ * @brief Troca a porta de clientes de um endereço, mantendo o servidor.
+ * @param storage O endereço (IPv4 ou AF_UNIX com a porta como sufixo).
+ * @param port A nova porta.
+ * @return int 0 em caso de sucesso, -1 se o endereço não tiver uma porta.
+ */
+int sockaddr_set_port(struct sockaddr_storage *storage, int port)
+{
+    if (storage->ss_family == AF_UNIX)
+    {
+        struct sockaddr_un *addr = (struct sockaddr_un *)storage;
+        char *dot = strrchr(addr->sun_path, '.');
+        if (dot == NULL)
+        {
+            return -1;
+        }
+        *dot = '\0';
+
+        char path[sizeof(addr->sun_path)];
+        strcpy(path, addr->sun_path);
+        return unix_sockaddr_init(path, port, storage);
+    }
+
+    ((struct sockaddr_in *)storage)->sin_port = htons((uint16_t)port);
+    return 0;
+}
+
+/**
+ * @brief Cria um socket para se conectar a um servidor.
+ * * Com um endereço AF_UNIX, o socket é SOCK_SEQPACKET, que preserva os
+ * limites de cada envio; caso contrário, é um socket TCP.
+ * * @param storage O endereço do servidor.
+ * @return int O socket, ou -1 em caso de erro.
+ */
+int conn_socket(const struct sockaddr_storage *storage)
+{
+    int unix_socket = storage->ss_family == AF_UNIX;
+    int s = socket(storage->ss_family, unix_socket ? SOCK_SEQPACKET : SOCK_STREAM, 0);
+    if (s != -1 && unix_socket)
+    {
+        conn_set_packet(s);
+    }
+    return s;
+}
+
 /**
  * @brief Inicializa duas estruturas de endereço de socket para o servidor.
  * * Prepara as estruturas `sockaddr_storage` para o servidor: uma para a
@@ -123,43 +294,1265 @@ int server_sockaddr_init(const char *addrstr, const char *portp2pstr, const char
 }
 
 /**
- * @brief Envia uma estrutura Msg_t completa através de um socket.
- * * Função wrapper para a chamada `send` que garante que todos os bytes
- * da mensagem foram enviados e trata erros caso contrário.
- * * @param sock O file descriptor do socket para envio.
- * @param msg Ponteiro para a mensagem a ser enviada.
- * @return int O número de bytes enviados.
+ * @brief Obtém o estado da conexão associada a um socket.
+ * * A tabela é dimensionada pelo limite de file descriptors do processo na
+ * primeira chamada, de modo que a consulta é sempre um acesso direto.
+ * * @param sock O file descriptor do socket.
+ * @return Conn_t* O estado da conexão, ou NULL se o fd estiver fora dos limites.
  */
-int send_msg(int sock, Msg_t *msg)
+static Conn_t *conn_get(int sock)
+{
+    if (conns == NULL)
+    {
+        struct rlimit rl;
+        conns_cap = 1024;
+        if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY && rl.rlim_cur > 1024)
+        {
+            conns_cap = (int)rl.rlim_cur;
+        }
+
+        conns = calloc(conns_cap, sizeof(Conn_t));
+        if (conns == NULL)
+        {
+            logexit("calloc");
+        }
+    }
+
+    if (sock < 0 || sock >= conns_cap)
+    {
+        return NULL;
+    }
+
+    return &conns[sock];
+}
+
+/**
+ * @brief Define o formato de fio usado por uma conexão.
+ * @param sock O file descriptor do socket.
+ * @param wire O formato a ser usado a partir da próxima mensagem.
+ */
+void conn_set_wire(int sock, WireFormat wire)
+{
+    Conn_t *conn = conn_get(sock);
+    if (conn != NULL)
+    {
+        conn->wire = wire;
+    }
+}
+
+/**
+ * @brief Retorna o formato de fio negociado para uma conexão.
+ * @param sock O file descriptor do socket.
+ * @return WireFormat O formato em uso (WIRE_LEGACY por padrão).
+ */
+WireFormat conn_get_wire(int sock)
+{
+    Conn_t *conn = conn_get(sock);
+    return conn != NULL ? conn->wire : WIRE_LEGACY;
+}
+
+static int conn_flush_transport(int sock, Conn_t *conn);
+
+/**
+ * @brief Fecha um socket e descarta o estado de conexão associado.
+ * * Deve ser usado no lugar de `close` para sockets que trocam mensagens,
+ * evitando que um fd reaproveitado herde o formato de fio ou bytes
+ * pendentes da conexão anterior. Quadros ainda na fila de saída (ex: um
+ * ERROR enviado entre conn_cork e conn_uncork logo antes do fechamento) são
+ * enviados antes, sem bloquear.
+ * * @param sock O file descriptor do socket.
+ */
+void conn_close(int sock)
+{
+    Conn_t *conn = conn_get(sock);
+    if (conn != NULL)
+    {
+        if (!conn->broken && !conn->async && conn->wtail != conn->whead)
+        {
+            conn_flush_transport(sock, conn);
+        }
+
+        if (conn->async)
+        {
+            // Um recv multishot mantém o socket aberto mesmo após o close; o
+            // shutdown o encerra (EOF) e libera a referência do kernel
+            shutdown(sock, SHUT_RDWR);
+        }
+
+        if (conn->transport != NULL)
+        {
+            conn->transport->close(conn->transport_ctx);
+        }
+
+        uint32_t gen = conn->gen;
+        free(conn->rbuf);
+        free(conn->wbuf);
+        memset(conn, 0, sizeof(Conn_t));
+        conn->gen = gen + 1;
+    }
+    close(sock);
+}
+
+/**
+ * @brief Retorna a geração atual de um file descriptor.
+ * * Permite descobrir se uma resposta tardia ainda pertence à mesma conexão
+ * ou se o fd já foi fechado e reaproveitado por outra.
+ * * @param sock O file descriptor do socket.
+ * @return uint32_t A geração, incrementada a cada `conn_close`.
+ */
+uint32_t conn_generation(int sock)
+{
+    Conn_t *conn = conn_get(sock);
+    return conn != NULL ? conn->gen : 0;
+}
+
+/**
+ * @brief Anuncia o suporte ao formato compacto em uma mensagem de handshake.
+ * * O marcador é gravado logo após o '\0' de `desc`, de modo que peers que
+ * não o conhecem continuam lendo apenas a descrição original.
+ * * @param msg A mensagem REQ_CONNSEN/RES_CONNSEN/REQ_CONPEER/RES_CONPEER.
+ */
+void wire_offer(Msg_t *msg)
+{
+    size_t len = strnlen(msg->desc, BUFSZ);
+    if (len + 1 + sizeof(WIRE_COMPACT_TAG) <= BUFSZ)
+    {
+        memcpy(msg->desc + len + 1, WIRE_COMPACT_TAG, sizeof(WIRE_COMPACT_TAG));
+    }
+}
+
+/**
+ * @brief Verifica se o remetente de uma mensagem de handshake suporta o formato compacto.
+ * @param msg A mensagem recebida.
+ * @return int 1 se o marcador estiver presente, 0 caso contrário.
+ */
+int wire_offered(const Msg_t *msg)
+{
+    size_t len = strnlen(msg->desc, BUFSZ);
+    if (len + 1 + sizeof(WIRE_COMPACT_TAG) > BUFSZ)
+    {
+        return 0;
+    }
+
+    return memcmp(msg->desc + len + 1, WIRE_COMPACT_TAG, sizeof(WIRE_COMPACT_TAG)) == 0;
+}
+
+/**
+ * @brief Lê a lista de inteiros de uma mensagem em lote.
+ * * Os valores em `desc` são separados por vírgulas (espaços são ignorados).
+ * A leitura para no primeiro item inválido ou ao atingir `max` valores.
+ * * @param msg A mensagem.
+ * @param values Destino dos valores.
+ * @param max Capacidade de `values`.
+ * @return int O número de valores lidos.
+ */
+int batch_parse(const Msg_t *msg, int *values, int max)
 {
-    size_t count = send(sock, msg, sizeof(Msg_t), 0);
-    if (count != sizeof(Msg_t))
+    const char *p = msg->desc;
+    const char *end = msg->desc + strnlen(msg->desc, BUFSZ);
+    int count = 0;
+
+    while (p < end && count < max)
     {
-        logexit("send_msg");
+        char *next;
+        long value = strtol(p, &next, 10);
+        if (next == p)
+        {
+            break;
+        }
+        values[count++] = (int)value;
+
+        p = next + strspn(next, " ");
+        if (p < end && *p != ',')
+        {
+            break;
+        }
+        p++;
     }
 
     return count;
 }
 
 /**
- * @brief Recebe uma estrutura Msg_t a partir de um socket.
- * * Função wrapper para a chamada `recv` que preenche a estrutura `msg`
- * fornecida com os dados recebidos e trata erros de recepção.
- * * @param sock O file descriptor do socket para recebimento.
- * @param msg Ponteiro para a estrutura onde a mensagem será armazenada.
- * @return int O número de bytes recebidos.
+ * @brief Escreve uma lista de inteiros em uma mensagem em lote.
+ * * O `payload` recebe o número de valores que couberam em `desc`.
+ * * @param msg A mensagem.
+ * @param values Os valores.
+ * @param count O número de valores.
+ * @return int O número de valores escritos.
  */
-int recv_msg(int sock, Msg_t *msg)
+int batch_format(Msg_t *msg, const int *values, int count)
+{
+    size_t len = 0;
+    int written = 0;
+    memset(msg->desc, 0, BUFSZ);
+
+    for (; written < count; written++)
+    {
+        char item[16];
+        int item_len = snprintf(item, sizeof(item), "%s%d", written > 0 ? "," : "", values[written]);
+        if (len + item_len > BUFSZ - 1)
+        {
+            break;
+        }
+        memcpy(msg->desc + len, item, item_len);
+        len += item_len;
+    }
+
+    msg->payload = written;
+    return written;
+}
+
+/**
+ * @brief Escreve um inteiro como varint (codificação zigzag para negativos).
+ * @param p Destino dos bytes.
+ * @param value O valor a ser codificado.
+ * @return size_t O número de bytes escritos.
+ */
+static size_t varint_put(unsigned char *p, int value)
 {
-    size_t count = recv(sock, msg, sizeof(Msg_t), 0);
-    if (count < 0)
+    uint32_t v = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+    size_t n = 0;
+    while (v >= 0x80)
     {
-        logexit("recv_msg");
+        p[n++] = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (unsigned char)v;
+    return n;
+}
+
+/**
+ * @brief Lê um varint codificado por `varint_put`.
+ * @param p Início dos bytes.
+ * @param end Fim do buffer disponível.
+ * @param value Destino do valor decodificado.
+ * @return size_t O número de bytes consumidos, ou 0 se o varint for inválido.
+ */
+static size_t varint_get(const unsigned char *p, const unsigned char *end, int *value)
+{
+    uint32_t v = 0;
+    size_t n = 0;
+    for (int shift = 0; shift < 35 && p + n < end; shift += 7)
+    {
+        unsigned char b = p[n++];
+        v |= (uint32_t)(b & 0x7f) << shift;
+        if ((b & 0x80) == 0)
+        {
+            *value = (int)((v >> 1) ^ -(v & 1));
+            return n;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Codifica uma mensagem no formato compacto.
+ * @param msg A mensagem a ser codificada.
+ * @param frame Buffer de destino com pelo menos FRAME_MAX_SZ bytes.
+ * @return size_t O tamanho total do quadro.
+ */
+static size_t frame_encode(const Msg_t *msg, unsigned char *frame)
+{
+    size_t desc_len = strnlen(msg->desc, BUFSZ);
+    size_t n = FRAME_HDR_SZ;
+
+    frame[n++] = (unsigned char)msg->type;
+    frame[n++] = (desc_len > 0 ? FRAME_DESC : 0) | (msg->seq != 0 ? FRAME_SEQ : 0) |
+                 (msg->more ? FRAME_MORE : 0);
+    n += varint_put(frame + n, msg->payload);
+    if (msg->seq != 0)
+    {
+        n += varint_put(frame + n, (int)msg->seq);
+    }
+    if (desc_len > 0)
+    {
+        n += varint_put(frame + n, (int)desc_len);
+        memcpy(frame + n, msg->desc, desc_len);
+        n += desc_len;
+    }
+
+    uint16_t body_len = htons((uint16_t)(n - FRAME_HDR_SZ));
+    memcpy(frame, &body_len, FRAME_HDR_SZ);
+    return n;
+}
+
+/**
+ * @brief Decodifica o corpo de um quadro compacto.
+ * @param body O corpo do quadro (sem o prefixo de tamanho).
+ * @param len O tamanho do corpo.
+ * @param msg Destino da mensagem decodificada.
+ * @return int 0 em caso de sucesso, -1 se o quadro estiver malformado.
+ */
+static int frame_decode(const unsigned char *body, size_t len, Msg_t *msg)
+{
+    const unsigned char *end = body + len;
+    if (len < 3)
+    {
+        return -1;
+    }
+
+    memset(msg, 0, sizeof(Msg_t));
+    msg->type = body[0];
+    unsigned char flags = body[1];
+    const unsigned char *p = body + 2;
+    msg->more = (flags & FRAME_MORE) != 0;
+
+    size_t n = varint_get(p, end, &msg->payload);
+    if (n == 0)
+    {
+        return -1;
+    }
+    p += n;
+
+    if (flags & FRAME_SEQ)
+    {
+        int seq;
+        n = varint_get(p, end, &seq);
+        if (n == 0)
+        {
+            return -1;
+        }
+        msg->seq = (uint32_t)seq;
+        p += n;
+    }
+
+    if (flags & FRAME_DESC)
+    {
+        int desc_len;
+        n = varint_get(p, end, &desc_len);
+        // A descrição precisa deixar lugar para o '\0' (msg já foi zerada)
+        if (n == 0 || desc_len < 0 || desc_len >= BUFSZ || p + n + desc_len > end)
+        {
+            return -1;
+        }
+        memcpy(msg->desc, p + n, desc_len);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Copia bytes do buffer circular de recepção, tratando a volta do anel.
+ * @param conn A conexão.
+ * @param off Deslocamento a partir do início dos dados pendentes.
+ * @param dst Destino da cópia.
+ * @param len Quantidade de bytes a copiar.
+ */
+static void ring_peek(const Conn_t *conn, uint32_t off, void *dst, size_t len)
+{
+    uint32_t start = (conn->rhead + off) & RING_MASK;
+    size_t first = RING_SZ - start;
+    if (first > len)
+    {
+        first = len;
+    }
+
+    memcpy(dst, conn->rbuf + start, first);
+    memcpy((unsigned char *)dst + first, conn->rbuf, len - first);
+}
+
+/**
+ * @brief Aloca o buffer circular de recepção, se ainda não existir.
+ * @param conn A conexão.
+ */
+static void ring_alloc(Conn_t *conn)
+{
+    if (conn->rbuf == NULL)
+    {
+        conn->rbuf = malloc(RING_SZ);
+        if (conn->rbuf == NULL)
+        {
+            logexit("malloc");
+        }
+    }
+}
+
+/**
+ * @brief Recebe um registro de um socket SOCK_SEQPACKET para o buffer circular.
+ * * Um registro maior que o espaço passado a `recv` seria truncado, então só
+ * se lê com espaço para um registro inteiro; se ele não for contíguo no
+ * anel, o registro passa por um buffer temporário.
+ * * @param sock O file descriptor do socket.
+ * @param conn A conexão associada.
+ * @param flags Flags repassadas a `recv`.
+ * @param span O espaço contíguo livre a partir do fim dos dados.
+ * @return ssize_t O retorno de `recv`, ou -1 com errno ENOBUFS se não há
+ * espaço para um registro ou EMSGSIZE se o registro excede CONN_PACKET_MAX.
+ */
+static ssize_t ring_recv_packet(int sock, Conn_t *conn, int flags, size_t span)
+{
+    if (RING_SZ - (conn->rtail - conn->rhead) < CONN_PACKET_MAX)
+    {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    unsigned char packet[CONN_PACKET_MAX];
+    unsigned char *dst = span >= CONN_PACKET_MAX ? conn->rbuf + (conn->rtail & RING_MASK) : packet;
+    ssize_t count = recv(sock, dst, CONN_PACKET_MAX, flags | MSG_TRUNC);
+    if (count > CONN_PACKET_MAX)
+    {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    if (count > 0 && dst == packet)
+    {
+        size_t first = (size_t)count < span ? (size_t)count : span;
+        memcpy(conn->rbuf + (conn->rtail & RING_MASK), packet, first);
+        memcpy(conn->rbuf, packet + first, count - first);
+    }
+    if (count > 0)
+    {
+        conn->rtail += count;
+    }
+    return count;
+}
+
+/**
+ * @brief Recebe bytes do socket para o espaço livre do buffer circular.
+ * @param sock O file descriptor do socket.
+ * @param conn A conexão associada.
+ * @param flags Flags repassadas a `recv` (ex: MSG_DONTWAIT); o transporte
+ * da conexão, se houver, nunca bloqueia.
+ * @return ssize_t O retorno de `recv`, ou -1 com errno ENOBUFS se o anel estiver cheio.
+ */
+static ssize_t ring_recv(int sock, Conn_t *conn, int flags)
+{
+    ring_alloc(conn);
+
+    uint32_t used = conn->rtail - conn->rhead;
+    if (used == RING_SZ)
+    {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    uint32_t start = conn->rtail & RING_MASK;
+    size_t span = RING_SZ - start;
+    if (span > RING_SZ - used)
+    {
+        span = RING_SZ - used;
+    }
+
+    if (conn->packet)
+    {
+        return ring_recv_packet(sock, conn, flags, span);
+    }
+
+    ssize_t count;
+    if (conn->transport != NULL)
+    {
+        count = conn->transport->recv(conn->transport_ctx, conn->rbuf + start, span);
+    }
+    else
+    {
+        count = recv(sock, conn->rbuf + start, span, flags);
+    }
+
+    if (count > 0)
+    {
+        conn->rtail += count;
     }
 
     return count;
 }
 
+/**
+ * @brief Verifica se o socket de uma conexão com transporte foi encerrado.
+ * * Com o transporte, o socket não carrega mais dados: só o EOF ou um erro.
+ * * @param sock O file descriptor do socket.
+ * @return int 1 se o socket foi encerrado, 0 caso contrário.
+ */
+static int transport_hangup(int sock)
+{
+    char byte;
+    ssize_t count = recv(sock, &byte, 1, MSG_DONTWAIT | MSG_PEEK);
+    return count == 0 || (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR);
+}
+
+/**
+ * @brief Conclui a leitura de uma conexão com transporte.
+ * * O descritor do transporte também sinaliza espaço liberado para envio,
+ * então a fila de saída é continuada aqui; o fim da conexão é detectado no socket.
+ * * @param sock O file descriptor do socket.
+ * @param conn A conexão associada.
+ * @param fill O resultado da leitura.
+ * @return ConnFill `fill`; com o socket encerrado, CONN_FULL enquanto o anel
+ * ainda tiver dados e CONN_CLOSED depois.
+ */
+static ConnFill transport_drained(int sock, Conn_t *conn, ConnFill fill)
+{
+    if (transport_hangup(sock))
+    {
+        // O peer escreve no anel antes de encerrar o socket: o que ele deixou
+        // ali ainda é lido antes de a conexão ser dada como encerrada
+        ssize_t count = ring_recv(sock, conn, MSG_DONTWAIT);
+        return count > 0 || (count < 0 && errno == ENOBUFS) ? CONN_FULL : CONN_CLOSED;
+    }
+
+    if (conn->wtail != conn->whead && conn_flush_transport(sock, conn) != 0)
+    {
+        return CONN_CLOSED;
+    }
+    return fill;
+}
+
+/**
+ * @brief Lê, sem bloquear, todos os bytes disponíveis em um socket.
+ * * Os bytes são acumulados no buffer circular da conexão, onde os quadros
+ * são remontados por `conn_next_msg` independentemente de como o TCP os
+ * fragmentou ou agrupou.
+ * * @param sock O file descriptor do socket.
+ * @return ConnFill CONN_DRAINED se o socket foi esvaziado, CONN_FULL se o
+ * buffer encheu antes disso, ou CONN_CLOSED em caso de EOF ou erro.
+ */
+ConnFill conn_fill(int sock)
+{
+    Conn_t *conn = conn_get(sock);
+    if (conn == NULL || conn->broken)
+    {
+        return CONN_CLOSED;
+    }
+
+    for (;;)
+    {
+        ssize_t count = ring_recv(sock, conn, MSG_DONTWAIT);
+        if (count > 0)
+        {
+            continue;
+        }
+
+        if (count == 0)
+        {
+            return CONN_CLOSED;
+        }
+
+        if (errno == EINTR)
+        {
+            continue;
+        }
+
+        if (errno == ENOBUFS)
+        {
+            return conn->transport != NULL ? transport_drained(sock, conn, CONN_FULL) : CONN_FULL;
+        }
+
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            return CONN_CLOSED;
+        }
+
+        return conn->transport != NULL ? transport_drained(sock, conn, CONN_DRAINED) : CONN_DRAINED;
+    }
+}
+
+/**
+ * @brief Acrescenta ao buffer de recepção bytes já lidos do socket por outro meio.
+ * * Usada quando a leitura é feita pelo kernel de forma assíncrona (io_uring);
+ * os quadros são remontados por `conn_next_msg` como na leitura com `conn_fill`.
+ * * @param sock O file descriptor do socket.
+ * @param data Os bytes recebidos.
+ * @param len A quantidade de bytes.
+ * @return size_t Quantos bytes couberam no buffer (o restante deve ser
+ * entregue depois que as mensagens completas forem consumidas).
+ */
+size_t conn_feed(int sock, const unsigned char *data, size_t len)
+{
+    Conn_t *conn = conn_get(sock);
+    if (conn == NULL || conn->broken)
+    {
+        return 0;
+    }
+
+    ring_alloc(conn);
+
+    uint32_t room = RING_SZ - (conn->rtail - conn->rhead);
+    if (len > room)
+    {
+        len = room;
+    }
+
+    uint32_t start = conn->rtail & RING_MASK;
+    size_t first = RING_SZ - start < len ? RING_SZ - start : len;
+    memcpy(conn->rbuf + start, data, first);
+    memcpy(conn->rbuf, data + first, len - first);
+    conn->rtail += len;
+    return len;
+}
+
+/**
+ * @brief Extrai a próxima mensagem completa do buffer de recepção.
+ * @param sock O file descriptor do socket.
+ * @param msg Destino da mensagem.
+ * @return int O tamanho do quadro consumido, 0 se ainda não há um quadro
+ * completo, ou -1 se o quadro estiver malformado.
+ */
+int conn_next_msg(int sock, Msg_t *msg)
+{
+    Conn_t *conn = conn_get(sock);
+    if (conn == NULL || conn->rbuf == NULL)
+    {
+        return 0;
+    }
+
+    uint32_t used = conn->rtail - conn->rhead;
+
+    if (conn->wire == WIRE_LEGACY)
+    {
+        LegacyMsg_t legacy;
+        if (used < sizeof(legacy))
+        {
+            return 0;
+        }
+
+        ring_peek(conn, 0, &legacy, sizeof(legacy));
+        conn->rhead += sizeof(legacy);
+
+        memset(msg, 0, sizeof(Msg_t));
+        msg->type = legacy.type;
+        msg->payload = legacy.payload;
+        memcpy(msg->desc, legacy.desc, BUFSZ);
+        msg->desc[BUFSZ - 1] = '\0'; // Um peer pode enviar a descrição sem terminador
+        return sizeof(legacy);
+    }
+
+    uint16_t body_len;
+    if (used < FRAME_HDR_SZ)
+    {
+        return 0;
+    }
+
+    ring_peek(conn, 0, &body_len, FRAME_HDR_SZ);
+    body_len = ntohs(body_len);
+    if (body_len > FRAME_MAX_SZ - FRAME_HDR_SZ)
+    {
+        return -1;
+    }
+
+    if (used < FRAME_HDR_SZ + (uint32_t)body_len)
+    {
+        return 0;
+    }
+
+    unsigned char body[FRAME_MAX_SZ];
+    ring_peek(conn, FRAME_HDR_SZ, body, body_len);
+    conn->rhead += FRAME_HDR_SZ + body_len;
+
+    if (frame_decode(body, body_len, msg) != 0)
+    {
+        return -1;
+    }
+
+    return FRAME_HDR_SZ + body_len;
+}
+
+/**
+ * @brief Define o limite da fila de saída e a política para consumidores lentos.
+ * @param limit O máximo de bytes pendentes por conexão.
+ * @param policy O que fazer quando uma nova mensagem excederia o limite.
+ */
+void conn_set_out_policy(size_t limit, SlowPolicy policy)
+{
+    out_limit = limit;
+    slow_policy = policy;
+}
+
+/**
+ * @brief Coloca o socket em modo não bloqueante e passa a enfileirar seus envios.
+ * @param sock O file descriptor do socket.
+ */
+void conn_set_nonblocking(int sock)
+{
+    int flags = fcntl(sock, F_GETFL, 0);
+    if (flags == -1 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) == -1)
+    {
+        logexit("fcntl");
+    }
+
+    Conn_t *conn = conn_get(sock);
+    if (conn != NULL)
+    {
+        conn->nonblocking = 1;
+    }
+}
+
+/**
+ * @brief Passa a trocar os bytes de uma conexão por outro transporte.
+ * * O socket deixa de carregar dados, mas continua aberto: seu fechamento
+ * encerra a conexão. Os envios passam pela fila de saída, como em
+ * `conn_set_nonblocking`, e o transporte é fechado junto com o socket.
+ * Deve ser chamada com os buffers da conexão vazios.
+ * * @param sock O file descriptor do socket.
+ * @param transport As operações do transporte.
+ * @param ctx O estado do transporte, repassado às operações.
+ */
+void conn_set_transport(int sock, const ConnTransport_t *transport, void *ctx)
+{
+    Conn_t *conn = conn_get(sock);
+    if (conn == NULL)
+    {
+        transport->close(ctx);
+        return;
+    }
+
+    conn->transport = transport;
+    conn->transport_ctx = ctx;
+    conn->nonblocking = 1;
+}
+
+/**
+ * @brief Retorna o descritor que sinaliza atividade no transporte de uma conexão.
+ * @param sock O file descriptor do socket.
+ * @return int O descritor a monitorar junto com o socket, ou -1 se a conexão não tem transporte.
+ */
+int conn_transport_fd(int sock)
+{
+    Conn_t *conn = conn_get(sock);
+    if (conn == NULL || conn->transport == NULL)
+    {
+        return -1;
+    }
+    return conn->transport->fd(conn->transport_ctx);
+}
+
+/**
+ * @brief Passa a enfileirar os envios de um socket lido e escrito via io_uring.
+ * * O socket continua bloqueante para o kernel, para que as operações
+ * assíncronas aguardem dados ou espaço em vez de falharem com EAGAIN; os
+ * acessos diretos desta camada já usam MSG_DONTWAIT. Ao fechar, o socket é
+ * encerrado com `shutdown` para terminar as operações ainda armadas.
+ * * @param sock O file descriptor do socket.
+ */
+void conn_set_async(int sock)
+{
+    Conn_t *conn = conn_get(sock);
+    if (conn != NULL)
+    {
+        conn->nonblocking = 1;
+        conn->async = 1;
+    }
+}
+
+/**
+ * @brief Indica que o socket é SOCK_SEQPACKET (AF_UNIX).
+ * * Os quadros continuam no formato negociado, mas cada leitura e escrita
+ * passa a respeitar os limites de registro do socket (ver CONN_PACKET_MAX).
+ * * @param sock O file descriptor do socket.
+ */
+void conn_set_packet(int sock)
+{
+    Conn_t *conn = conn_get(sock);
+    if (conn != NULL)
+    {
+        conn->packet = 1;
+    }
+}
+
+/**
+ * @brief Marca a conexão para ser fechada.
+ * * O `shutdown` faz o epoll sinalizar o socket e a próxima leitura retornar
+ * EOF, de modo que o fechamento segue o mesmo caminho de uma desconexão.
+ * * @param sock O file descriptor do socket.
+ * @param conn A conexão associada.
+ */
+static void conn_break(int sock, Conn_t *conn)
+{
+    conn->broken = 1;
+    shutdown(sock, SHUT_RDWR);
+}
+
+/**
+ * @brief Limita um envio da fila de saída a um registro de até CONN_PACKET_MAX bytes.
+ * * Em um socket SOCK_SEQPACKET cada envio é um registro, que o destino lê
+ * inteiro (ver ring_recv_packet); os quadros podem ficar divididos entre
+ * registros, pois o destino os remonta como no TCP.
+ * * @param conn A conexão.
+ * @param iov Os (até dois) trechos da fila, ajustados.
+ */
+static void packet_limit(const Conn_t *conn, struct iovec iov[2])
+{
+    if (!conn->packet)
+    {
+        return;
+    }
+
+    if (iov[0].iov_len >= CONN_PACKET_MAX)
+    {
+        iov[0].iov_len = CONN_PACKET_MAX;
+        iov[1].iov_len = 0;
+    }
+    else if (iov[0].iov_len + iov[1].iov_len > CONN_PACKET_MAX)
+    {
+        iov[1].iov_len = CONN_PACKET_MAX - iov[0].iov_len;
+    }
+}
+
+/**
+ * @brief Envia o máximo possível da fila de saída sem bloquear.
+ * * Deve ser chamada quando o epoll indicar que o socket voltou a aceitar escrita.
+ * * @param sock O file descriptor do socket.
+ * @return int 0 se a conexão continua válida (mesmo com bytes pendentes), -1 em caso de erro.
+ */
+int conn_flush(int sock)
+{
+    Conn_t *conn = conn_get(sock);
+    if (conn == NULL || conn->broken)
+    {
+        return -1;
+    }
+
+    return conn_flush_transport(sock, conn);
+}
+
+/**
+ * @brief Envia o máximo possível da fila de saída pelo socket ou pelo transporte da conexão.
+ * @param sock O file descriptor do socket.
+ * @param conn A conexão associada.
+ * @return int 0 se a conexão continua válida, -1 em caso de erro.
+ */
+static int conn_flush_transport(int sock, Conn_t *conn)
+{
+    if (conn->wsending > 0)
+    {
+        // A fila será continuada quando o envio assíncrono terminar
+        return 0;
+    }
+
+    while (conn->wtail != conn->whead)
+    {
+        // A fila é circular: no máximo dois trechos, enviados com uma única chamada
+        uint32_t queued = conn->wtail - conn->whead;
+        uint32_t start = conn->whead & (conn->wcap - 1);
+        struct iovec iov[2];
+        iov[0].iov_base = conn->wbuf + start;
+        iov[0].iov_len = conn->wcap - start < queued ? conn->wcap - start : queued;
+        iov[1].iov_base = conn->wbuf;
+        iov[1].iov_len = queued - iov[0].iov_len;
+        packet_limit(conn, iov);
+
+        struct msghdr mh = {0};
+        mh.msg_iov = iov;
+        mh.msg_iovlen = iov[1].iov_len > 0 ? 2 : 1;
+
+        ssize_t count;
+        if (conn->transport != NULL)
+        {
+            count = conn->transport->send(conn->transport_ctx, iov, mh.msg_iovlen);
+        }
+        else
+        {
+            count = sendmsg(sock, &mh, MSG_DONTWAIT | MSG_NOSIGNAL);
+        }
+
+        if (count > 0)
+        {
+            conn->whead += count;
+            continue;
+        }
+
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            return 0;
+        }
+
+        conn_break(sock, conn);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Retorna quantos bytes aguardam envio na fila de saída.
+ * @param sock O file descriptor do socket.
+ * @return size_t O número de bytes pendentes.
+ */
+size_t conn_pending_out(int sock)
+{
+    Conn_t *conn = conn_get(sock);
+    return conn != NULL ? conn->wtail - conn->whead : 0;
+}
+
+/**
+ * @brief Entrega o conteúdo da fila de saída a um envio assíncrono.
+ * * Os bytes continuam na fila (e contam para o limite) até `conn_output_done`;
+ * enquanto isso, nenhum outro envio da conexão é iniciado, o que preserva a
+ * ordem. Os trechos apontam para a fila e só valem até a próxima operação
+ * na conexão: devem ser copiados antes de a submissão ser feita.
+ * * @param sock O file descriptor do socket.
+ * @param iov Destino dos (até dois) trechos da fila circular.
+ * @return size_t Os bytes entregues (no máximo um registro, em um socket
+ * SOCK_SEQPACKET), ou 0 se não há nada a enviar ou já há um envio em andamento.
+ */
+size_t conn_output_begin(int sock, struct iovec iov[2])
+{
+    Conn_t *conn = conn_get(sock);
+    if (conn == NULL || conn->broken || conn->wsending > 0 || conn->wtail == conn->whead)
+    {
+        return 0;
+    }
+
+    uint32_t queued = conn->wtail - conn->whead;
+    uint32_t start = conn->whead & (conn->wcap - 1);
+    iov[0].iov_base = conn->wbuf + start;
+    iov[0].iov_len = conn->wcap - start < queued ? conn->wcap - start : queued;
+    iov[1].iov_base = conn->wbuf;
+    iov[1].iov_len = queued - iov[0].iov_len;
+    packet_limit(conn, iov);
+
+    conn->wsending = iov[0].iov_len + iov[1].iov_len;
+    return conn->wsending;
+}
+
+/**
+ * @brief Registra o resultado de um envio iniciado por `conn_output_begin`.
+ * @param sock O file descriptor do socket.
+ * @param res O resultado do envio: bytes enviados ou -errno.
+ * @return size_t Os bytes que ainda aguardam envio na fila (0 se a conexão foi marcada para fechar).
+ */
+size_t conn_output_done(int sock, int res)
+{
+    Conn_t *conn = conn_get(sock);
+    if (conn == NULL || conn->wsending == 0)
+    {
+        return 0;
+    }
+
+    conn->wsending = 0;
+    if (res > 0)
+    {
+        conn->whead += res;
+    }
+    else if (res != -EAGAIN && res != -EINTR)
+    {
+        conn_break(sock, conn);
+        return 0;
+    }
+
+    return conn->broken ? 0 : conn->wtail - conn->whead;
+}
+
+/**
+ * @brief Acrescenta bytes ao fim da fila de saída, aumentando-a se preciso.
+ * @param conn A conexão.
+ * @param data Os bytes a enfileirar.
+ * @param len A quantidade de bytes.
+ */
+static void wqueue_push(Conn_t *conn, const unsigned char *data, size_t len)
+{
+    uint32_t queued = conn->wtail - conn->whead;
+    if (queued + len > conn->wcap)
+    {
+        uint32_t cap = conn->wcap ? conn->wcap : RING_SZ;
+        while (cap < queued + len)
+        {
+            cap *= 2;
+        }
+
+        unsigned char *buf = malloc(cap);
+        if (buf == NULL)
+        {
+            logexit("malloc");
+        }
+
+        if (queued > 0)
+        {
+            uint32_t start = conn->whead & (conn->wcap - 1);
+            uint32_t first = conn->wcap - start < queued ? conn->wcap - start : queued;
+            memcpy(buf, conn->wbuf + start, first);
+            memcpy(buf + first, conn->wbuf, queued - first);
+        }
+
+        free(conn->wbuf);
+        conn->wbuf = buf;
+        conn->wcap = cap;
+        conn->whead = 0;
+        conn->wtail = queued;
+    }
+
+    uint32_t start = conn->wtail & (conn->wcap - 1);
+    size_t first = conn->wcap - start < len ? conn->wcap - start : len;
+    memcpy(conn->wbuf + start, data, first);
+    memcpy(conn->wbuf, data + first, len - first);
+    conn->wtail += len;
+}
+
+/**
+ * @brief Marca uma conexão para ser esvaziada em conn_uncork.
+ * @param sock O file descriptor do socket.
+ * @param conn A conexão.
+ */
+static void dirty_add(int sock, Conn_t *conn)
+{
+    if (conn->dirty)
+    {
+        return;
+    }
+
+    if (dirty_count == dirty_cap)
+    {
+        int cap = dirty_cap ? dirty_cap * 2 : 64;
+        int *list = realloc(dirty, cap * sizeof(int));
+        if (list == NULL)
+        {
+            logexit("realloc");
+        }
+        dirty = list;
+        dirty_cap = cap;
+    }
+
+    dirty[dirty_count++] = sock;
+    conn->dirty = 1;
+}
+
+/**
+ * @brief Passa a apenas enfileirar os envios em conexões não bloqueantes desta thread.
+ * * Deve envolver um ciclo de tratamento de eventos: todas as respostas
+ * geradas para uma mesma conexão no ciclo são enviadas juntas por
+ * `conn_uncork`, com uma única chamada de sistema.
+ */
+void conn_cork(void)
+{
+    corked = 1;
+}
+
+/**
+ * @brief Entrega cada conexão que recebeu quadros desde conn_cork a uma função de envio.
+ * * Conexões fechadas no meio do ciclo são ignoradas (`conn_close` limpa a marca).
+ * * @param flush A função que envia a fila de saída de um socket (NULL = `conn_flush`).
+ * @param arg Argumento repassado a `flush`.
+ */
+void conn_uncork_with(void (*flush)(int sock, void *arg), void *arg)
+{
+    corked = 0;
+
+    for (int i = 0; i < dirty_count; i++)
+    {
+        Conn_t *conn = conn_get(dirty[i]);
+        if (conn != NULL && conn->dirty)
+        {
+            conn->dirty = 0;
+            if (flush != NULL)
+            {
+                flush(dirty[i], arg);
+            }
+            else
+            {
+                conn_flush(dirty[i]);
+            }
+        }
+    }
+    dirty_count = 0;
+}
+
+/**
+ * @brief Envia as filas de saída das conexões que receberam quadros desde conn_cork.
+ */
+void conn_uncork(void)
+{
+    conn_uncork_with(NULL, NULL);
+}
+
+/**
+ * @brief Envia um quadro por uma conexão não bloqueante.
+ * * Com a fila vazia o quadro é enviado diretamente; o que o kernel não
+ * aceitar fica na fila, que é esvaziada por `conn_flush` quando o socket
+ * voltar a aceitar escrita. Entre conn_cork e conn_uncork, o quadro é apenas
+ * enfileirado. Se a fila passaria do limite configurado, a
+ * política de consumidor lento decide entre descartar o quadro ou fechar
+ * a conexão, de modo que um cliente travado nunca bloqueia o servidor.
+ * * @return int O tamanho do quadro, ou -1 se ele foi descartado.
+ */
+static int conn_queue(int sock, Conn_t *conn, const unsigned char *frame, size_t len)
+{
+    if (conn->broken)
+    {
+        return -1;
+    }
+
+    size_t sent = 0;
+    if (conn->wtail == conn->whead && !corked)
+    {
+        ssize_t count;
+        if (conn->transport != NULL)
+        {
+            struct iovec iov = {(void *)frame, len};
+            count = conn->transport->send(conn->transport_ctx, &iov, 1);
+        }
+        else
+        {
+            count = send(sock, frame, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+        }
+
+        if (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        {
+            conn_break(sock, conn);
+            return -1;
+        }
+        sent = count > 0 ? count : 0;
+    }
+
+    if (sent == len)
+    {
+        return len;
+    }
+
+    if (conn->wtail - conn->whead + (len - sent) > out_limit)
+    {
+        if (slow_policy == SLOW_CLOSE || sent > 0)
+        {
+            // Um quadro parcialmente enviado não pode ser descartado sem corromper o fluxo
+            conn_break(sock, conn);
+        }
+        return -1;
+    }
+
+    wqueue_push(conn, frame + sent, len - sent);
+    if (corked)
+    {
+        dirty_add(sock, conn);
+    }
+    return len;
+}
+
+/**
+ * @brief Envia uma mensagem através de um socket.
+ * * Usa o formato de fio negociado para a conexão: a estrutura Msg_t
+ * completa no formato original ou um quadro compacto com prefixo de tamanho.
+ * Em conexões não bloqueantes a mensagem passa pela fila de saída; nas
+ * demais (ex: o cliente), o envio bloqueia até que o quadro seja todo escrito.
+ * * @param sock O file descriptor do socket para envio.
+ * @param msg Ponteiro para a mensagem a ser enviada.
+ * @return int O número de bytes do quadro, ou -1 em caso de falha.
+ */
+int send_msg(int sock, Msg_t *msg)
+{
+    union
+    {
+        LegacyMsg_t legacy;
+        unsigned char compact[FRAME_MAX_SZ];
+    } frame;
+    size_t len;
+
+    Conn_t *conn = conn_get(sock);
+    if (conn == NULL)
+    {
+        return -1;
+    }
+
+    if (conn->wire == WIRE_COMPACT)
+    {
+        len = frame_encode(msg, frame.compact);
+    }
+    else
+    {
+        memset(&frame.legacy, 0, sizeof(frame.legacy));
+        frame.legacy.type = msg->type;
+        frame.legacy.payload = msg->payload;
+        memcpy(frame.legacy.desc, msg->desc, BUFSZ);
+        len = sizeof(frame.legacy);
+    }
+
+    if (conn->nonblocking)
+    {
+        return conn_queue(sock, conn, frame.compact, len);
+    }
+
+    size_t sent = 0;
+    while (sent < len)
+    {
+        ssize_t count = send(sock, frame.compact + sent, len - sent, MSG_NOSIGNAL);
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (count <= 0)
+        {
+            return -1;
+        }
+        sent += count;
+    }
+
+    return len;
+}
+
+/**
+ * @brief Recebe uma mensagem a partir de um socket, bloqueando até que ela esteja completa.
+ * * Mensagens já remontadas no buffer da conexão são entregues sem nenhuma
+ * chamada de sistema; caso contrário, lê do socket até completar um quadro
+ * no formato de fio negociado para a conexão.
+ * * @param sock O file descriptor do socket para recebimento.
+ * @param msg Ponteiro para a estrutura onde a mensagem será armazenada.
+ * @return int O número de bytes da mensagem, 0 se a conexão foi encerrada ou
+ * -1 em caso de erro (incluindo quadros malformados).
+ */
+int recv_msg(int sock, Msg_t *msg)
+{
+    Conn_t *conn = conn_get(sock);
+    if (conn == NULL)
+    {
+        return -1;
+    }
+
+    for (;;)
+    {
+        int len = conn_next_msg(sock, msg);
+        if (len != 0)
+        {
+            return len;
+        }
+
+        ssize_t count = ring_recv(sock, conn, 0);
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        // Sockets não bloqueantes (lado servidor) aguardam os dados com poll. Um
+        // pedido ainda na fila de saída (ex: entre conn_cork e conn_uncork)
+        // precisa ser enviado antes, ou a resposta nunca chegaria.
+        if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            conn_flush(sock);
+            if (conn->transport != NULL)
+            {
+                // O descritor do transporte sinaliza dados e espaço; o socket, só o fim
+                struct pollfd pfd[2] = {{.fd = conn->transport->fd(conn->transport_ctx), .events = POLLIN},
+                                        {.fd = sock, .events = POLLIN}};
+                poll(pfd, 2, -1);
+                if (transport_hangup(sock) && ring_recv(sock, conn, MSG_DONTWAIT) <= 0)
+                {
+                    // Só é o fim depois de esvaziar o que o peer deixou no anel
+                    return 0;
+                }
+                continue;
+            }
+
+            struct pollfd pfd = {.fd = sock, .events = POLLIN};
+            if (conn->wtail != conn->whead)
+            {
+                pfd.events |= POLLOUT;
+            }
+            poll(&pfd, 1, -1);
+            continue;
+        }
+
+        if (count <= 0)
+        {
+            return (int)count;
+        }
+    }
+}
+
 /**
  * @brief Converte todos os caracteres de uma string para minúsculas.
  * * Altera a string original, convertendo cada caractere para sua
@@ -2,6 +2,8 @@
 
 #include <stdlib.h>
 #include <arpa/inet.h>
+#include <sys/types.h>
+#include <sys/uio.h>
 
 #define BUFSZ 501
 
@@ -17,17 +19,57 @@ typedef enum {
     TERMINATE_P2P_CONNECTION,
 } ServerCommand;
 
+typedef enum
+{
+    WIRE_LEGACY,  // Msg_t inteira no socket (formato original)
+    WIRE_COMPACT, // Quadro com prefixo de tamanho e campos varint
+} WireFormat;
+
+typedef enum
+{
+    CONN_DRAINED, // Socket esvaziado (EAGAIN)
+    CONN_FULL,    // Buffer de recepção cheio; ainda pode haver dados no socket
+    CONN_CLOSED,  // EOF ou erro
+} ConnFill;
+
+typedef enum
+{
+    SLOW_CLOSE, // Fecha a conexão cuja fila de saída excede o limite
+    SLOW_DROP,  // Descarta as mensagens que excederiam o limite
+} SlowPolicy;
+
+/**
+ * Transporte alternativo dos bytes de uma conexão (ver conn_set_transport),
+ * com a semântica das chamadas de socket que substitui: leituras e escritas
+ * nunca bloqueiam e retornam -1 com errno EAGAIN quando não há dados ou
+ * espaço. O socket original continua aberto e indica o fim da conexão.
+ */
+typedef struct ConnTransport
+{
+    ssize_t (*recv)(void *ctx, void *buf, size_t len);
+    ssize_t (*send)(void *ctx, const struct iovec *iov, int iovcnt);
+    int (*fd)(void *ctx); // Fica legível quando há bytes a receber ou espaço para enviar
+    void (*close)(void *ctx);
+} ConnTransport_t;
+
 typedef struct Msg
 {
     int type;
     int payload;
     char desc[BUFSZ];
+    uint32_t seq; // ID de correlação (0 = nenhum); só trafega no formato compacto
+    uint8_t more; // 1 se a resposta continua no próximo quadro; só no formato compacto
 } Msg_t;
 
 typedef struct Client{
     int id;
     int socket_id;
     int data; // Location or status 
+    int subscribed; // SS: o sensor recebe alertas por push (REQ_SUBSCRIBE)
+    int worker;     // SS: worker dono da conexão inscrita
+    uint32_t gen;   // SS: geração da conexão inscrita (ver conn_generation)
+    int loc;        // SS: localização informada pelo SL (0 = desconhecida)
+    uint32_t record; // Posição no arquivo de estado (ver store.h)
 } Client_t;
 
 #define MAX_PEERS 2
@@ -40,6 +82,18 @@ typedef struct Client{
 #define RES_CONNSEN      24
 #define REQ_DISCSEN      25
 
+// Um REQ_CONNSEN com payload ID_ASSIGN pede ao servidor um ID novo, devolvido
+// no payload do RES_CONNSEN. Cada papel atribui IDs em uma faixa própria, então
+// o ID obtido de um servidor pode ser registrado no outro sem colisão.
+#define ID_ASSIGN        0
+#define ID_BASE_LOC      (1 << 24)
+#define ID_BASE_STATUS   (1 << 30)
+
+// Um REQ_CONNSEN com payload ID_QUERY abre uma conexão só de consulta, sem
+// registrar um sensor: usada pelos clientes para consultar os SLs do cluster
+// que não são donos do seu ID
+#define ID_QUERY         (-1)
+
 #define REQ_CHECKALERT   36
 #define RES_CHECKALERT   37
 #define REQ_SENSLOC      38
@@ -49,16 +103,84 @@ typedef struct Client{
 #define REQ_LOCLIST      42
 #define RES_LOCLIST      43
 
+// Consultas em lote: `desc` leva a lista de IDs separados por vírgula e a
+// resposta, a lista de valores na mesma ordem (-1 = sensor não encontrado)
+#define REQ_SENSLOC_BATCH     44
+#define RES_SENSLOC_BATCH     45
+#define REQ_SENSSTATUS_BATCH  46
+#define RES_SENSSTATUS_BATCH  47
+#define REQ_CHECKALERT_BATCH  48
+#define RES_CHECKALERT_BATCH  49
+
+// Máximo de IDs por lote: cada valor da resposta ocupa até 3 bytes ("10,")
+#define BATCH_MAX_IDS ((BUFSZ - 1) / 3)
+
+// Alertas por push: após um REQ_SUBSCRIBE (respondido com o status atual), o
+// SS envia um ALERT_MSG (seq 0, payload = localização) sempre que o status do
+// sensor passa a 1
+#define REQ_SUBSCRIBE    50
+#define RES_SUBSCRIBE    51
+#define ALERT_MSG        52
+
+// SL -> SS: localização de um sensor ao se registrar ou ser removido do SL
+// (`desc` = "id,loc"; loc -1 = removido), guardada pelo SS para responder a
+// sensores em falha sem consultar o SL. Só trafega no formato compacto.
+#define SENSLOC_NOTIFY   53
+
+// Sinal de vida enviado periodicamente no link entre os servidores e pelos
+// clientes ociosos; não tem resposta. Só trafega no formato compacto.
+#define HEARTBEAT        54
+
+// Tabela de roteamento do cluster de SLs: `desc` = portas de clientes dos SLs
+// ("p1,p2,..."; payload = quantidade), que são as chaves do anel de hashing
+// consistente (ver hashring.h). Pedida ao SS pelos clientes (REQ_ROUTES) e
+// enviada pelo SS a cada SL (RES_ROUTES) ao formar o cluster, para que o SL
+// só atribua IDs que lhe pertencem. Sem cluster, a tabela tem um único SL.
+#define REQ_ROUTES       55
+#define RES_ROUTES       56
+
+// Conexão adicional do pool entre o SS e um SL (opção --peer-conns do SS):
+// payload = ID atribuído ao SS pelo SL no REQ_CONPEER, `desc` = índice do
+// link (1 em diante). Os links carregam as consultas REQ_CHECKALERT dos
+// workers do SS; o link 0 é a conexão original. Só no formato compacto.
+#define REQ_PEERLINK     57
+#define RES_PEERLINK     58
+
 #define ERROR_MSG        255
 #define OK_MSG           0
 #define PEER_LIMIT_ERROR 1
 #define CLIENT_LIMIT_ERROR 9
+#define SENSOR_IN_USE_ERROR 12
 
 #define DESC_ERROR_01 "Peer limit exceeded"
 #define DESC_ERROR_02 "Peer not found"
 #define DESC_ERROR_09 "Sensor limit exceeded"
 #define DESC_ERROR_10 "Sensor not found"
 #define DESC_ERROR_11 "Location not found"
+#define DESC_ERROR_12 "Sensor ID already in use"
+
+// Marcador de capacidade anexado após o '\0' de `desc` nos handshakes
+// REQ_CONNSEN/REQ_CONPEER. Peers antigos o ignoram, pois só leem até o '\0'.
+#define WIRE_COMPACT_TAG "WIRE/1"
+
+// Formato compacto: [tamanho u16][tipo u8][flags u8][payload varint][seq?][desc?]
+#define FRAME_HDR_SZ 2
+#define FRAME_MAX_SZ (FRAME_HDR_SZ + 2 + 5 + 5 + 2 + BUFSZ)
+#define FRAME_DESC 0x01
+#define FRAME_SEQ 0x02
+#define FRAME_MORE 0x04
+
+// Maior registro trocado em um socket AF_UNIX SOCK_SEQPACKET (ver conn_set_packet):
+// cabe um quadro em qualquer formato, e o buffer de recepção sempre tem espaço
+// para um registro inteiro depois de entregar os quadros completos
+#define CONN_PACKET_MAX 2048
+
+// Prefixo do endereço dos servidores no socket AF_UNIX (ex: "unix:/tmp/tp");
+// cada servidor escuta em "<caminho>.<porta de clientes>"
+#define UNIX_ADDR_PREFIX "unix:"
+
+// Limite padrão de bytes pendentes na fila de saída de cada conexão
+#define OUT_LIMIT_DEFAULT (64 * 1024)
 
 #define DESC_OK_01 "Successful disconnect"
 #define DESC_OK_02 "Successful create"
@@ -72,8 +194,66 @@ int client_sockaddr_init(const char *addrstr, const char *portstr, const char *p
 int server_sockaddr_init(const char *addrstr, const char *portp2pstr, const char *portstr,
                          struct sockaddr_storage *p2p_storage, struct sockaddr_storage *clients_storage);
 
+int unix_sockaddr_init(const char *path, int port, struct sockaddr_storage *storage);
+
+socklen_t sockaddr_len(const struct sockaddr_storage *storage);
+
+int sockaddr_port(const struct sockaddr_storage *storage);
+
+int sockaddr_set_port(struct sockaddr_storage *storage, int port);
+
+int conn_socket(const struct sockaddr_storage *storage);
+
+void wire_offer(Msg_t *msg);
+
+int wire_offered(const Msg_t *msg);
+
+int batch_parse(const Msg_t *msg, int *values, int max);
+
+int batch_format(Msg_t *msg, const int *values, int count);
+
+void conn_set_wire(int sock, WireFormat wire);
+
+WireFormat conn_get_wire(int sock);
+
+void conn_close(int sock);
+
+uint32_t conn_generation(int sock);
+
+void conn_set_nonblocking(int sock);
+
+void conn_set_transport(int sock, const ConnTransport_t *transport, void *ctx);
+
+int conn_transport_fd(int sock);
+
+void conn_set_async(int sock);
+
+void conn_set_packet(int sock);
+
+void conn_set_out_policy(size_t limit, SlowPolicy policy);
+
+int conn_flush(int sock);
+
+size_t conn_pending_out(int sock);
+
+size_t conn_output_begin(int sock, struct iovec iov[2]);
+
+size_t conn_output_done(int sock, int res);
+
+void conn_cork(void);
+
+void conn_uncork(void);
+
+void conn_uncork_with(void (*flush)(int sock, void *arg), void *arg);
+
 int send_msg(int sock, Msg_t *msg);
 
 int recv_msg(int sock, Msg_t *msg);
 
+ConnFill conn_fill(int sock);
+
+int conn_next_msg(int sock, Msg_t *msg);
+
+size_t conn_feed(int sock, const unsigned char *data, size_t len);
+
 void toLowerString(char *str);
\ No newline at end of file
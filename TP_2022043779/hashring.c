@@ -0,0 +1,112 @@
+#include <stdlib.h>
+
+#include "hashring.h"
+
+/**
+ * @brief Espalha os bits de um inteiro de 32 bits (finalizador do MurmurHash3).
+ * @param x O valor.
+ * @return uint32_t O hash.
+ */
+static uint32_t hash32(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x85ebca6bu;
+    x ^= x >> 13;
+    x *= 0xc2b2ae35u;
+    x ^= x >> 16;
+    return x;
+}
+
+/**
+ * @brief Ordena os pontos do anel pelo hash (desempate pelo nó).
+ * @param a O primeiro ponto.
+ * @param b O segundo ponto.
+ * @return int Negativo, zero ou positivo, como em `qsort`.
+ */
+static int point_compare(const void *a, const void *b)
+{
+    const HashRingPoint_t *pa = a;
+    const HashRingPoint_t *pb = b;
+    if (pa->hash != pb->hash)
+    {
+        return pa->hash < pb->hash ? -1 : 1;
+    }
+    return pa->node - pb->node;
+}
+
+/**
+ * @brief Constrói o anel para uma lista de nós.
+ * @param ring O anel.
+ * @param keys As chaves dos nós (a posição de cada uma é o índice do nó).
+ * @param count O número de nós (1 a HASHRING_MAX_NODES).
+ * @return int 0 em caso de sucesso, -1 se `count` estiver fora dos limites.
+ */
+int hashring_init(HashRing_t *ring, const int *keys, int count)
+{
+    if (count < 1 || count > HASHRING_MAX_NODES)
+    {
+        return -1;
+    }
+
+    ring->nodes = count;
+    ring->npoints = 0;
+    for (int node = 0; node < count; node++)
+    {
+        ring->keys[node] = keys[node];
+        for (uint32_t v = 0; v < HASHRING_VNODES; v++)
+        {
+            HashRingPoint_t *point = &ring->points[ring->npoints++];
+            point->hash = hash32(hash32((uint32_t)keys[node]) ^ (v * 0x9e3779b9u));
+            point->node = node;
+        }
+    }
+
+    qsort(ring->points, ring->npoints, sizeof(HashRingPoint_t), point_compare);
+    return 0;
+}
+
+/**
+ * @brief Encontra o nó dono de um sensor.
+ * @param ring O anel.
+ * @param id O ID do sensor.
+ * @return int O índice do nó.
+ */
+int hashring_owner(const HashRing_t *ring, int id)
+{
+    uint32_t h = hash32((uint32_t)id);
+
+    // Primeiro ponto com hash >= h; depois do último, o anel volta ao início
+    int lo = 0, hi = ring->npoints;
+    while (lo < hi)
+    {
+        int mid = lo + (hi - lo) / 2;
+        if (ring->points[mid].hash < h)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    return ring->points[lo == ring->npoints ? 0 : lo].node;
+}
+
+/**
+ * @brief Encontra o índice de um nó pela sua chave.
+ * @param ring O anel.
+ * @param key A chave do nó.
+ * @return int O índice do nó, ou -1 se ele não estiver no anel.
+ */
+int hashring_find(const HashRing_t *ring, int key)
+{
+    for (int node = 0; node < ring->nodes; node++)
+    {
+        if (ring->keys[node] == key)
+        {
+            return node;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdint.h>
+
+#define HASHRING_MAX_NODES 16
+#define HASHRING_VNODES 64 // Pontos de cada nó no anel
+
+/**
+ * Anel de hashing consistente que distribui os IDs dos sensores entre os SLs
+ * de um cluster. Cada nó é identificado por uma chave estável (a porta de
+ * clientes do SL) e ocupa HASHRING_VNODES pontos do anel; um sensor pertence
+ * ao nó do primeiro ponto igual ou posterior ao hash do seu ID. Ao adicionar
+ * um nó, só os sensores que passam a cair nos pontos dele mudam de dono.
+ *
+ * O SS e os clientes constroem o anel a partir da mesma lista de chaves e,
+ * portanto, concordam sobre o dono de cada sensor. Imutável depois de
+ * `hashring_init`: pode ser lido por várias threads.
+ */
+typedef struct HashRingPoint
+{
+    uint32_t hash;
+    int node; // Posição do nó em `keys`
+} HashRingPoint_t;
+
+typedef struct HashRing
+{
+    int nodes;
+    int keys[HASHRING_MAX_NODES];
+    int npoints;
+    HashRingPoint_t points[HASHRING_MAX_NODES * HASHRING_VNODES]; // Ordenados pelo hash
+} HashRing_t;
+
+int hashring_init(HashRing_t *ring, const int *keys, int count);
+
+int hashring_owner(const HashRing_t *ring, int id);
+
+int hashring_find(const HashRing_t *ring, int key);
@@ -0,0 +1,152 @@
+#include <string.h>
+
+#include "histogram.h"
+
+/**
+ * @brief Calcula a faixa do histograma correspondente a um valor.
+ * * Valores menores que HIST_SUB_COUNT têm uma faixa cada; acima disso, a
+ * faixa é dada pela potência de 2 do valor e pelos HIST_SUB_BITS bits
+ * seguintes ao bit mais significativo.
+ * * @param value O valor.
+ * @return int O índice da faixa.
+ */
+int hist_bucket(uint64_t value)
+{
+    if (value < HIST_SUB_COUNT)
+    {
+        return (int)value;
+    }
+
+    int msb = 63 - __builtin_clzll(value);
+    int shift = msb - HIST_SUB_BITS;
+    return (shift + 1) * HIST_SUB_COUNT + (int)((value >> shift) - HIST_SUB_COUNT);
+}
+
+/**
+ * @brief Retorna o maior valor que cai em uma faixa.
+ * @param bucket O índice da faixa.
+ * @return uint64_t O limite superior (inclusivo) da faixa.
+ */
+uint64_t hist_bucket_upper(int bucket)
+{
+    if (bucket < HIST_SUB_COUNT)
+    {
+        return (uint64_t)bucket;
+    }
+
+    int shift = bucket / HIST_SUB_COUNT - 1;
+    uint64_t sub = (uint64_t)(bucket % HIST_SUB_COUNT + HIST_SUB_COUNT);
+    return ((sub + 1) << shift) - 1;
+}
+
+/**
+ * @brief Registra um valor no histograma.
+ * @param h O histograma.
+ * @param value O valor (ex: latência em nanossegundos).
+ */
+void hist_record(Histogram_t *h, uint64_t value)
+{
+    h->counts[hist_bucket(value)]++;
+    h->total++;
+    h->sum += value;
+    if (value > h->max)
+    {
+        h->max = value;
+    }
+}
+
+/**
+ * @brief Acumula um histograma em outro.
+ * @param dst O histograma de destino.
+ * @param src O histograma a ser somado.
+ */
+void hist_merge(Histogram_t *dst, const Histogram_t *src)
+{
+    for (int i = 0; i < HIST_BUCKETS; i++)
+    {
+        dst->counts[i] += src->counts[i];
+    }
+    dst->total += src->total;
+    dst->sum += src->sum;
+    if (src->max > dst->max)
+    {
+        dst->max = src->max;
+    }
+}
+
+/**
+ * @brief Estima um percentil do histograma.
+ * @param h O histograma.
+ * @param p O percentil desejado, entre 0 e 100.
+ * @return uint64_t O limite superior da faixa que contém o percentil (0 se vazio).
+ */
+uint64_t hist_percentile(const Histogram_t *h, double p)
+{
+    if (h->total == 0)
+    {
+        return 0;
+    }
+
+    uint64_t rank = (uint64_t)(p / 100.0 * (double)h->total + 0.5);
+    if (rank == 0)
+    {
+        rank = 1;
+    }
+
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++)
+    {
+        seen += h->counts[i];
+        if (seen >= rank)
+        {
+            uint64_t upper = hist_bucket_upper(i);
+            return upper < h->max ? upper : h->max;
+        }
+    }
+
+    return h->max;
+}
+
+/**
+ * @brief Imprime a distribuição agrupada por potências de 2, com barras.
+ * @param out O arquivo de saída.
+ * @param h O histograma.
+ * @param unit Divisor aplicado aos limites impressos (ex: 1000 para ns -> us).
+ */
+void hist_print(FILE *out, const Histogram_t *h, double unit)
+{
+    uint64_t groups[64 - HIST_SUB_BITS + 1];
+    uint64_t peak = 0;
+    int first = -1, last = -1;
+
+    memset(groups, 0, sizeof(groups));
+    for (int i = 0; i < HIST_BUCKETS; i++)
+    {
+        groups[i / HIST_SUB_COUNT] += h->counts[i];
+    }
+
+    for (int g = 0; g < 64 - HIST_SUB_BITS + 1; g++)
+    {
+        if (groups[g] == 0)
+        {
+            continue;
+        }
+        if (first < 0)
+        {
+            first = g;
+        }
+        last = g;
+        if (groups[g] > peak)
+        {
+            peak = groups[g];
+        }
+    }
+
+    for (int g = first; g >= 0 && g <= last; g++)
+    {
+        uint64_t upper = hist_bucket_upper((g + 1) * HIST_SUB_COUNT - 1);
+        int width = (int)(groups[g] * 40 / peak);
+        fprintf(out, "  <= %12.1f | %-40.*s %llu\n", (double)upper / unit, width,
+                "########################################", (unsigned long long)groups[g]);
+    }
+}
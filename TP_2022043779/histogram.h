@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Histograma log-linear (no estilo HDR): cada potência de 2 é dividida em
+// 2^HIST_SUB_BITS faixas iguais, o que dá erro relativo máximo de ~3%.
+#define HIST_SUB_BITS 5
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB_COUNT)
+
+typedef struct Histogram
+{
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;
+    uint64_t sum;
+    uint64_t max;
+} Histogram_t;
+
+int hist_bucket(uint64_t value);
+
+uint64_t hist_bucket_upper(int bucket);
+
+void hist_record(Histogram_t *h, uint64_t value);
+
+void hist_merge(Histogram_t *dst, const Histogram_t *src);
+
+uint64_t hist_percentile(const Histogram_t *h, double p);
+
+void hist_print(FILE *out, const Histogram_t *h, double unit);
@@ -0,0 +1,389 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "common.h"
+#include "log.h"
+
+// Capacidade do anel de cada thread (potência de 2)
+#define LOG_RING_SIZE 1024
+
+// Intervalo de espera do escritor quando todos os anéis estão vazios
+#define LOG_IDLE_NS 1000000
+
+/**
+ * Mensagem ainda não formatada. Guarda apenas o formato (que deve ser uma
+ * string literal) e os argumentos; a formatação é feita pela thread
+ * escritora. Argumentos %s são copiados para `text` e referenciados pelo
+ * deslocamento em `args`.
+ */
+typedef struct LogRecord
+{
+    uint64_t ts;
+    const char *fmt;
+    int args[LOG_MAX_ARGS];
+    uint16_t text_len;
+    char text[LOG_TEXT_MAX];
+} LogRecord_t;
+
+/**
+ * Anel de uma thread produtora, com um único produtor (a thread dona) e um
+ * único consumidor (o escritor). Quando o anel está cheio, a mensagem é
+ * descartada: o produtor nunca espera pelo escritor.
+ */
+typedef struct LogRing
+{
+    _Atomic uint32_t tail __attribute__((aligned(64))); // Escrito pelo produtor
+    _Atomic uint32_t head __attribute__((aligned(64))); // Escrito pelo consumidor
+    _Atomic uint32_t dropped;
+    _Atomic int owned;             // 1 enquanto alguma thread usa o anel
+    struct LogRing *next;          // Lista de todos os anéis (nunca removidos)
+    LogRecord_t records[LOG_RING_SIZE];
+} LogRing_t;
+
+_Atomic int log_level = LOG_INFO;
+
+static _Atomic(LogRing_t *) rings;
+static _Thread_local LogRing_t *my_ring;
+
+// Serializa os consumidores (o escritor e `log_flush`); produtores não a usam
+static pthread_mutex_t drain_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *level_names[] = {"error", "warn", "info", "debug"};
+
+/**
+ * @brief Retorna o tempo monotônico atual em nanossegundos.
+ * @return uint64_t O tempo atual.
+ */
+static uint64_t log_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Retorna o anel da thread atual, reaproveitando o de uma thread
+ * encerrada ou criando um novo no primeiro uso.
+ * @return LogRing_t* O anel da thread.
+ */
+static LogRing_t *log_ring(void)
+{
+    if (my_ring != NULL)
+    {
+        return my_ring;
+    }
+
+    for (LogRing_t *ring = atomic_load(&rings); ring != NULL; ring = ring->next)
+    {
+        int expected = 0;
+        if (atomic_compare_exchange_strong(&ring->owned, &expected, 1))
+        {
+            my_ring = ring;
+            return ring;
+        }
+    }
+
+    LogRing_t *ring = calloc(1, sizeof(LogRing_t));
+    if (ring == NULL)
+    {
+        logexit("calloc");
+    }
+    atomic_init(&ring->owned, 1);
+
+    LogRing_t *first = atomic_load(&rings);
+    do
+    {
+        ring->next = first;
+    } while (!atomic_compare_exchange_weak(&rings, &first, ring));
+
+    my_ring = ring;
+    return ring;
+}
+
+/**
+ * @brief Enfileira uma mensagem no anel da thread atual, sem formatá-la.
+ * * Aceita as conversões de inteiros (%d, %u, %x, %c...) e %s, com no máximo
+ * LOG_MAX_ARGS argumentos. Prefira as macros `log_info` etc., que testam o
+ * nível antes da chamada.
+ * * @param level O nível da mensagem.
+ * @param fmt O formato (string literal, sem '\n' final).
+ */
+void log_write(LogLevel level, const char *fmt, ...)
+{
+    LogRing_t *ring = log_ring();
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    if (tail - atomic_load_explicit(&ring->head, memory_order_acquire) == LOG_RING_SIZE)
+    {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    LogRecord_t *rec = &ring->records[tail & (LOG_RING_SIZE - 1)];
+    rec->ts = log_now();
+    rec->fmt = fmt;
+    rec->text_len = 0;
+
+    va_list ap;
+    va_start(ap, fmt);
+    int nargs = 0;
+    for (const char *p = fmt; *p != '\0' && nargs < LOG_MAX_ARGS; p++)
+    {
+        if (*p != '%')
+        {
+            continue;
+        }
+
+        p += strspn(p + 1, "-+ #0123456789.hlz") + 1;
+        if (*p == '%')
+        {
+            continue;
+        }
+        if (*p == '\0')
+        {
+            break;
+        }
+
+        if (*p == 's')
+        {
+            const char *str = va_arg(ap, const char *);
+            if (rec->text_len >= LOG_TEXT_MAX - 1)
+            {
+                // Sem espaço: o último byte (sempre livre ou um terminador) vira uma string vazia
+                rec->text[LOG_TEXT_MAX - 1] = '\0';
+                rec->args[nargs++] = LOG_TEXT_MAX - 1;
+                continue;
+            }
+
+            size_t room = LOG_TEXT_MAX - rec->text_len - 1;
+            size_t len = strnlen(str, room);
+            memcpy(rec->text + rec->text_len, str, len);
+            rec->text[rec->text_len + len] = '\0';
+            rec->args[nargs++] = rec->text_len;
+            rec->text_len += len + 1;
+        }
+        else
+        {
+            rec->args[nargs++] = va_arg(ap, int);
+        }
+    }
+    va_end(ap);
+
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+/**
+ * @brief Formata uma mensagem e a escreve na saída padrão.
+ * @param rec A mensagem.
+ */
+static void log_emit(const LogRecord_t *rec)
+{
+    const char *p = rec->fmt;
+    int nargs = 0;
+
+    while (*p != '\0')
+    {
+        const char *pct = strchr(p, '%');
+        if (pct == NULL)
+        {
+            fputs(p, stdout);
+            break;
+        }
+        fwrite(p, 1, pct - p, stdout);
+
+        const char *conv = pct + 1 + strspn(pct + 1, "-+ #0123456789.hlz");
+        if (*conv == '\0')
+        {
+            break;
+        }
+        p = conv + 1;
+
+        if (*conv == '%')
+        {
+            fputc('%', stdout);
+            continue;
+        }
+        if (nargs == LOG_MAX_ARGS)
+        {
+            continue;
+        }
+
+        char spec[16];
+        size_t spec_len = conv - pct + 1;
+        if (spec_len >= sizeof(spec))
+        {
+            continue;
+        }
+        memcpy(spec, pct, spec_len);
+        spec[spec_len] = '\0';
+
+        if (*conv == 's')
+        {
+            printf(spec, rec->text + rec->args[nargs++]);
+        }
+        else
+        {
+            printf(spec, rec->args[nargs++]);
+        }
+    }
+
+    fputc('\n', stdout);
+}
+
+/**
+ * @brief Escreve todas as mensagens enfileiradas, em ordem de criação.
+ * * A cada passo é escrita a mensagem mais antiga entre as primeiras de cada
+ * anel, de modo que a saída intercala as threads na ordem em que os eventos
+ * ocorreram. A saída padrão é descarregada uma única vez ao final do lote.
+ * * @return int O número de mensagens escritas.
+ */
+static int log_drain(void)
+{
+    int written = 0;
+    pthread_mutex_lock(&drain_lock);
+
+    for (;;)
+    {
+        LogRing_t *oldest = NULL;
+        const LogRecord_t *oldest_rec = NULL;
+
+        for (LogRing_t *ring = atomic_load(&rings); ring != NULL; ring = ring->next)
+        {
+            uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+            if (head == atomic_load_explicit(&ring->tail, memory_order_acquire))
+            {
+                continue;
+            }
+
+            const LogRecord_t *rec = &ring->records[head & (LOG_RING_SIZE - 1)];
+            if (oldest_rec == NULL || rec->ts < oldest_rec->ts)
+            {
+                oldest = ring;
+                oldest_rec = rec;
+            }
+        }
+
+        if (oldest == NULL)
+        {
+            break;
+        }
+
+        log_emit(oldest_rec);
+        atomic_fetch_add_explicit(&oldest->head, 1, memory_order_release);
+        written++;
+    }
+
+    for (LogRing_t *ring = atomic_load(&rings); ring != NULL; ring = ring->next)
+    {
+        uint32_t dropped = atomic_exchange_explicit(&ring->dropped, 0, memory_order_relaxed);
+        if (dropped > 0)
+        {
+            printf("(%u log messages dropped)\n", dropped);
+            written++;
+        }
+    }
+
+    if (written > 0)
+    {
+        fflush(stdout);
+    }
+
+    pthread_mutex_unlock(&drain_lock);
+    return written;
+}
+
+/**
+ * @brief Laço da thread escritora.
+ * @param arg Não utilizado.
+ * @return void* Nunca retorna.
+ */
+static void *log_main(void *arg)
+{
+    (void)arg;
+    struct timespec idle = {0, LOG_IDLE_NS};
+
+    for (;;)
+    {
+        if (log_drain() == 0)
+        {
+            nanosleep(&idle, NULL);
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Inicia a thread escritora e define o nível inicial.
+ * * As mensagens pendentes são escritas também quando o processo termina
+ * com `exit`.
+ * * @param level O nível inicial.
+ */
+void log_init(LogLevel level)
+{
+    log_set_level(level);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, log_main, NULL) != 0)
+    {
+        logexit("pthread_create");
+    }
+    pthread_detach(thread);
+
+    atexit(log_flush);
+}
+
+/**
+ * @brief Altera o nível de log. Pode ser chamada a qualquer momento.
+ * @param level O novo nível.
+ */
+void log_set_level(LogLevel level)
+{
+    atomic_store_explicit(&log_level, level, memory_order_relaxed);
+}
+
+/**
+ * @brief Converte o nome de um nível ("error", "warn", "info", "debug").
+ * @param name O nome.
+ * @param level Destino do nível.
+ * @return int 0 em caso de sucesso, -1 se o nome for inválido.
+ */
+int log_parse_level(const char *name, LogLevel *level)
+{
+    for (int i = LOG_ERROR; i <= LOG_DEBUG; i++)
+    {
+        if (strcmp(name, level_names[i]) == 0)
+        {
+            *level = i;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Libera o anel da thread atual para ser reaproveitado.
+ * * Deve ser chamada antes do fim de threads que registraram mensagens; as
+ * mensagens ainda não escritas são preservadas.
+ */
+void log_thread_exit(void)
+{
+    if (my_ring != NULL)
+    {
+        atomic_store(&my_ring->owned, 0);
+        my_ring = NULL;
+    }
+}
+
+/**
+ * @brief Escreve imediatamente todas as mensagens pendentes.
+ */
+void log_flush(void)
+{
+    log_drain();
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdatomic.h>
+
+typedef enum
+{
+    LOG_ERROR,
+    LOG_WARN,
+    LOG_INFO,
+    LOG_DEBUG,
+} LogLevel;
+
+// Máximo de argumentos por mensagem e de bytes copiados dos argumentos %s
+#define LOG_MAX_ARGS 4
+#define LOG_TEXT_MAX 512
+
+extern _Atomic int log_level;
+
+/**
+ * Registra uma mensagem se o nível estiver habilitado. O nível é testado
+ * antes da chamada, então mensagens desabilitadas não custam nada além de
+ * uma leitura atômica.
+ */
+#define log_error(...) log_at(LOG_ERROR, __VA_ARGS__)
+#define log_warn(...) log_at(LOG_WARN, __VA_ARGS__)
+#define log_info(...) log_at(LOG_INFO, __VA_ARGS__)
+#define log_debug(...) log_at(LOG_DEBUG, __VA_ARGS__)
+
+#define log_at(level, ...)                                                       \
+    do                                                                           \
+    {                                                                            \
+        if ((int)(level) <= atomic_load_explicit(&log_level, memory_order_relaxed)) \
+        {                                                                        \
+            log_write(level, __VA_ARGS__);                                       \
+        }                                                                        \
+    } while (0)
+
+void log_init(LogLevel level);
+
+void log_set_level(LogLevel level);
+
+int log_parse_level(const char *name, LogLevel *level);
+
+void log_write(LogLevel level, const char *fmt, ...);
+
+void log_thread_exit(void);
+
+void log_flush(void);
@@ -0,0 +1,373 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "common.h"
+#include "metrics.h"
+
+// Limites dos buckets exportados: potências de 2 em nanossegundos, de ~1us a ~17s
+#define EXPORT_MIN_SHIFT 10
+#define EXPORT_MAX_SHIFT 34
+
+typedef struct MetricsServer
+{
+    int sock;
+    Metrics_t *metrics;
+    int nthreads;
+} MetricsServer_t;
+
+/**
+ * @brief Retorna o nome de um tipo de mensagem, usado como rótulo.
+ * @param type O tipo da mensagem.
+ * @return const char* O nome, ou NULL para tipos desconhecidos.
+ */
+static const char *msg_type_name(int type)
+{
+    switch (type)
+    {
+    case OK_MSG: return "OK";
+    case REQ_CONPEER: return "REQ_CONPEER";
+    case RES_CONPEER: return "RES_CONPEER";
+    case REQ_DISCPEER: return "REQ_DISCPEER";
+    case REQ_CONNSEN: return "REQ_CONNSEN";
+    case RES_CONNSEN: return "RES_CONNSEN";
+    case REQ_DISCSEN: return "REQ_DISCSEN";
+    case REQ_CHECKALERT: return "REQ_CHECKALERT";
+    case RES_CHECKALERT: return "RES_CHECKALERT";
+    case REQ_SENSLOC: return "REQ_SENSLOC";
+    case RES_SENSLOC: return "RES_SENSLOC";
+    case REQ_SENSSTATUS: return "REQ_SENSSTATUS";
+    case RES_SENSSTATUS: return "RES_SENSSTATUS";
+    case REQ_LOCLIST: return "REQ_LOCLIST";
+    case RES_LOCLIST: return "RES_LOCLIST";
+    case REQ_SENSLOC_BATCH: return "REQ_SENSLOC_BATCH";
+    case RES_SENSLOC_BATCH: return "RES_SENSLOC_BATCH";
+    case REQ_SENSSTATUS_BATCH: return "REQ_SENSSTATUS_BATCH";
+    case RES_SENSSTATUS_BATCH: return "RES_SENSSTATUS_BATCH";
+    case REQ_CHECKALERT_BATCH: return "REQ_CHECKALERT_BATCH";
+    case RES_CHECKALERT_BATCH: return "RES_CHECKALERT_BATCH";
+    case REQ_SUBSCRIBE: return "REQ_SUBSCRIBE";
+    case RES_SUBSCRIBE: return "RES_SUBSCRIBE";
+    case ALERT_MSG: return "ALERT";
+    case SENSLOC_NOTIFY: return "SENSLOC_NOTIFY";
+    case HEARTBEAT: return "HEARTBEAT";
+    case REQ_ROUTES: return "REQ_ROUTES";
+    case RES_ROUTES: return "RES_ROUTES";
+    case REQ_PEERLINK: return "REQ_PEERLINK";
+    case RES_PEERLINK: return "RES_PEERLINK";
+    case ERROR_MSG: return "ERROR";
+    default: return NULL;
+    }
+}
+
+/**
+ * @brief Aloca as métricas de `nthreads` threads.
+ * @param nthreads O número de threads.
+ * @return Metrics_t* Um array com as métricas de cada thread.
+ */
+Metrics_t *metrics_create(int nthreads)
+{
+    Metrics_t *metrics = calloc(nthreads, sizeof(Metrics_t));
+    if (metrics == NULL)
+    {
+        logexit("calloc");
+    }
+
+    return metrics;
+}
+
+/**
+ * @brief Retorna o tempo monotônico atual em nanossegundos.
+ * @return uint64_t O tempo atual.
+ */
+uint64_t metrics_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Contabiliza uma mensagem tratada e o tempo gasto pelo seu tratador.
+ * * Deve ser chamada apenas pela thread dona de `m`.
+ * * @param m As métricas da thread (NULL se as métricas estiverem desativadas).
+ * @param source A origem da mensagem.
+ * @param type O tipo da mensagem.
+ * @param elapsed_ns O tempo de tratamento em nanossegundos.
+ */
+void metrics_count(Metrics_t *m, MetricSource source, int type, uint64_t elapsed_ns)
+{
+    if (m == NULL)
+    {
+        return;
+    }
+
+    type &= 0xff;
+    m->messages[source][type]++;
+
+    Histogram_t *h = atomic_load_explicit(&m->handlers[source][type], memory_order_relaxed);
+    if (h == NULL)
+    {
+        h = calloc(1, sizeof(Histogram_t));
+        if (h == NULL)
+        {
+            logexit("calloc");
+        }
+        atomic_store_explicit(&m->handlers[source][type], h, memory_order_release);
+    }
+    hist_record(h, elapsed_ns);
+}
+
+/**
+ * @brief Registra o tempo de ida e volta de uma consulta REQ_CHECKALERT.
+ * @param m As métricas da thread dona do peer (NULL se desativadas).
+ * @param elapsed_ns O tempo entre o envio e a resposta, em nanossegundos.
+ */
+void metrics_peer_rtt(Metrics_t *m, uint64_t elapsed_ns)
+{
+    if (m != NULL)
+    {
+        hist_record(&m->peer_rtt, elapsed_ns);
+    }
+}
+
+/**
+ * @brief Escreve um histograma no formato de texto do Prometheus.
+ * * Os buckets exportados são fixos (potências de 2 de ~1us a ~17s), para que
+ * a série seja a mesma em todas as coletas.
+ * * @param out O destino.
+ * @param name O nome da métrica.
+ * @param labels Os rótulos, no formato `a="x",b="y"` (ou string vazia).
+ * @param h O histograma (em nanossegundos).
+ */
+static void write_histogram(FILE *out, const char *name, const char *labels, const Histogram_t *h)
+{
+    uint64_t cumulative = 0;
+    int bucket = 0;
+    const char *sep = labels[0] != '\0' ? "," : "";
+
+    for (int shift = EXPORT_MIN_SHIFT; shift <= EXPORT_MAX_SHIFT; shift++)
+    {
+        uint64_t limit = (1ull << shift) - 1;
+        while (bucket < HIST_BUCKETS && hist_bucket_upper(bucket) <= limit)
+        {
+            cumulative += h->counts[bucket++];
+        }
+        fprintf(out, "%s_bucket{%s%sle=\"%.9g\"} %llu\n", name, labels, sep, (double)(1ull << shift) / 1e9,
+                (unsigned long long)cumulative);
+    }
+
+    fprintf(out, "%s_bucket{%s%sle=\"+Inf\"} %llu\n", name, labels, sep, (unsigned long long)h->total);
+    fprintf(out, "%s_sum{%s} %.9f\n", name, labels, (double)h->sum / 1e9);
+    fprintf(out, "%s_count{%s} %llu\n", name, labels, (unsigned long long)h->total);
+}
+
+/**
+ * @brief Gera o texto de todas as métricas, somando as de todas as threads.
+ * @param out O destino.
+ * @param srv O endpoint.
+ */
+static void metrics_render(FILE *out, MetricsServer_t *srv)
+{
+    static const char *sources[METRIC_SOURCES] = {"client", "peer"};
+    Histogram_t *merged = malloc(sizeof(Histogram_t));
+    if (merged == NULL)
+    {
+        return;
+    }
+
+    fprintf(out, "# HELP tp_messages_total Mensagens tratadas, por origem e tipo.\n");
+    fprintf(out, "# TYPE tp_messages_total counter\n");
+    for (int s = 0; s < METRIC_SOURCES; s++)
+    {
+        for (int type = 0; type < 256; type++)
+        {
+            uint64_t total = 0;
+            for (int t = 0; t < srv->nthreads; t++)
+            {
+                total += srv->metrics[t].messages[s][type];
+            }
+            if (total > 0 && msg_type_name(type) != NULL)
+            {
+                fprintf(out, "tp_messages_total{source=\"%s\",type=\"%s\"} %llu\n", sources[s],
+                        msg_type_name(type), (unsigned long long)total);
+            }
+        }
+    }
+
+    fprintf(out, "# HELP tp_handler_seconds Tempo gasto no tratamento de cada mensagem.\n");
+    fprintf(out, "# TYPE tp_handler_seconds histogram\n");
+    for (int s = 0; s < METRIC_SOURCES; s++)
+    {
+        for (int type = 0; type < 256; type++)
+        {
+            int found = 0;
+            memset(merged, 0, sizeof(Histogram_t));
+            for (int t = 0; t < srv->nthreads; t++)
+            {
+                Histogram_t *h = atomic_load_explicit(&srv->metrics[t].handlers[s][type], memory_order_acquire);
+                if (h != NULL)
+                {
+                    hist_merge(merged, h);
+                    found = 1;
+                }
+            }
+
+            if (found && msg_type_name(type) != NULL)
+            {
+                char labels[64];
+                snprintf(labels, sizeof(labels), "source=\"%s\",type=\"%s\"", sources[s], msg_type_name(type));
+                write_histogram(out, "tp_handler_seconds", labels, merged);
+            }
+        }
+    }
+
+    fprintf(out, "# HELP tp_peer_rtt_seconds Tempo de ida e volta das consultas REQ_CHECKALERT ao peer.\n");
+    fprintf(out, "# TYPE tp_peer_rtt_seconds histogram\n");
+    memset(merged, 0, sizeof(Histogram_t));
+    for (int t = 0; t < srv->nthreads; t++)
+    {
+        hist_merge(merged, &srv->metrics[t].peer_rtt);
+    }
+    write_histogram(out, "tp_peer_rtt_seconds", "", merged);
+
+    free(merged);
+}
+
+/**
+ * @brief Atende uma coleta: lê a requisição HTTP e responde com as métricas.
+ * * Qualquer caminho é aceito; a requisição é lida apenas para não fechar a
+ * conexão com dados pendentes.
+ * * @param srv O endpoint.
+ * @param csock O socket do coletor.
+ */
+static void metrics_handle(MetricsServer_t *srv, int csock)
+{
+    char req[1024];
+    struct timeval tv = {1, 0};
+    setsockopt(csock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    if (recv(csock, req, sizeof(req), 0) <= 0)
+    {
+        return;
+    }
+
+    char *body = NULL;
+    size_t body_len = 0;
+    FILE *out = open_memstream(&body, &body_len);
+    if (out == NULL)
+    {
+        return;
+    }
+    metrics_render(out, srv);
+    fclose(out);
+
+    char header[128];
+    int header_len = snprintf(header, sizeof(header),
+                              "HTTP/1.0 200 OK\r\n"
+                              "Content-Type: text/plain; version=0.0.4\r\n"
+                              "Content-Length: %zu\r\n\r\n",
+                              body_len);
+
+    if (send(csock, header, header_len, MSG_NOSIGNAL) == header_len)
+    {
+        size_t sent = 0;
+        while (sent < body_len)
+        {
+            ssize_t count = send(csock, body + sent, body_len - sent, MSG_NOSIGNAL);
+            if (count <= 0)
+            {
+                break;
+            }
+            sent += count;
+        }
+    }
+
+    free(body);
+}
+
+/**
+ * @brief Laço da thread do endpoint de métricas.
+ * @param arg O endpoint (MetricsServer_t *).
+ * @return void* Nunca retorna.
+ */
+static void *metrics_main(void *arg)
+{
+    MetricsServer_t *srv = arg;
+
+    for (;;)
+    {
+        int csock = accept(srv->sock, NULL, NULL);
+        if (csock == -1)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+            logexit("accept metrics");
+        }
+
+        metrics_handle(srv, csock);
+        close(csock);
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Inicia o endpoint HTTP de métricas em 127.0.0.1:`port`.
+ * * O endpoint roda em uma thread própria, de modo que as coletas não
+ * competem com o loop de eventos do servidor.
+ * * @param metrics As métricas de todas as threads.
+ * @param nthreads O número de threads em `metrics`.
+ * @param port A porta local.
+ */
+void metrics_serve(Metrics_t *metrics, int nthreads, int port)
+{
+    MetricsServer_t *srv = malloc(sizeof(MetricsServer_t));
+    if (srv == NULL)
+    {
+        logexit("malloc");
+    }
+    srv->metrics = metrics;
+    srv->nthreads = nthreads;
+
+    srv->sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (srv->sock == -1)
+    {
+        logexit("socket");
+    }
+
+    int enable = 1;
+    if (0 != setsockopt(srv->sock, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(int)))
+    {
+        logexit("setsockopt");
+    }
+
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (0 != bind(srv->sock, (struct sockaddr *)&addr, sizeof(addr)))
+    {
+        logexit("bind metrics");
+    }
+    if (0 != listen(srv->sock, 10))
+    {
+        logexit("listen");
+    }
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, metrics_main, srv) != 0)
+    {
+        logexit("pthread_create");
+    }
+    pthread_detach(thread);
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include "histogram.h"
+
+typedef enum
+{
+    METRIC_CLIENT, // Mensagens recebidas de sensores
+    METRIC_PEER,   // Mensagens recebidas do peer
+    METRIC_SOURCES,
+} MetricSource;
+
+/**
+ * Métricas de uma thread. Cada thread escreve apenas nas suas próprias
+ * métricas, sem travas nem operações atômicas; o endpoint lê todas elas e
+ * soma os valores no momento da coleta. Como os contadores são palavras
+ * alinhadas que só crescem, uma coleta concorrente vê no máximo valores
+ * ligeiramente atrasados.
+ */
+typedef struct Metrics
+{
+    uint64_t messages[METRIC_SOURCES][256];                // Por tipo de mensagem
+    _Atomic(Histogram_t *) handlers[METRIC_SOURCES][256]; // Alocados no primeiro uso
+    Histogram_t peer_rtt;                                  // REQ_CHECKALERT -> resposta
+} Metrics_t;
+
+Metrics_t *metrics_create(int nthreads);
+
+uint64_t metrics_now(void);
+
+void metrics_count(Metrics_t *m, MetricSource source, int type, uint64_t elapsed_ns);
+
+void metrics_peer_rtt(Metrics_t *m, uint64_t elapsed_ns);
+
+void metrics_serve(Metrics_t *metrics, int nthreads, int port);
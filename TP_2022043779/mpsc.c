@@ -0,0 +1,76 @@
+#include <stddef.h>
+
+#include "mpsc.h"
+
+/**
+ * @brief Inicializa uma fila vazia.
+ * @param q A fila.
+ */
+void mpsc_init(Mpsc_t *q)
+{
+    atomic_store_explicit(&q->stub.next, NULL, memory_order_relaxed);
+    atomic_store_explicit(&q->head, &q->stub, memory_order_relaxed);
+    q->tail = &q->stub;
+}
+
+/**
+ * @brief Insere um nó no final da fila. Pode ser chamada por qualquer thread.
+ * * A inserção é uma única troca atômica seguida do encadeamento do nó
+ * anterior; não há laço de repetição, então produtores nunca esperam uns
+ * pelos outros.
+ * * @param q A fila.
+ * @param node O nó a ser inserido.
+ */
+void mpsc_push(Mpsc_t *q, MpscNode_t *node)
+{
+    atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+    MpscNode_t *prev = atomic_exchange_explicit(&q->head, node, memory_order_acq_rel);
+    atomic_store_explicit(&prev->next, node, memory_order_release);
+}
+
+/**
+ * @brief Remove o nó mais antigo da fila. Apenas a thread consumidora pode chamá-la.
+ * * Se um produtor estiver no meio de uma inserção, a função retorna NULL
+ * mesmo que a fila não esteja vazia; o produtor sinaliza o consumidor após
+ * concluir a inserção, então o nó é encontrado na próxima chamada.
+ * * @param q A fila.
+ * @return MpscNode_t* O nó removido, ou NULL se não houver nenhum disponível.
+ */
+MpscNode_t *mpsc_pop(Mpsc_t *q)
+{
+    MpscNode_t *tail = q->tail;
+    MpscNode_t *next = atomic_load_explicit(&tail->next, memory_order_acquire);
+
+    if (tail == &q->stub)
+    {
+        if (next == NULL)
+        {
+            return NULL;
+        }
+        q->tail = next;
+        tail = next;
+        next = atomic_load_explicit(&next->next, memory_order_acquire);
+    }
+
+    if (next != NULL)
+    {
+        q->tail = next;
+        return tail;
+    }
+
+    if (tail != atomic_load_explicit(&q->head, memory_order_acquire))
+    {
+        return NULL;
+    }
+
+    // `tail` é o último nó: reinsere o stub para poder removê-lo
+    mpsc_push(q, &q->stub);
+    next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    if (next != NULL)
+    {
+        q->tail = next;
+        return tail;
+    }
+
+    return NULL;
+}
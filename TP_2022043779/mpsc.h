@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdatomic.h>
+
+/**
+ * Fila intrusiva sem travas com vários produtores e um único consumidor
+ * (algoritmo de Vyukov). Qualquer thread pode inserir com `mpsc_push`; apenas
+ * a thread dona da fila pode remover com `mpsc_pop`. Os nós são embutidos
+ * como primeiro campo das estruturas enfileiradas.
+ */
+typedef struct MpscNode
+{
+    _Atomic(struct MpscNode *) next;
+} MpscNode_t;
+
+typedef struct Mpsc
+{
+    _Atomic(MpscNode_t *) head; // Último nó inserido (lado dos produtores)
+    MpscNode_t *tail;           // Próximo nó a remover (lado do consumidor)
+    MpscNode_t stub;
+} Mpsc_t;
+
+void mpsc_init(Mpsc_t *q);
+
+void mpsc_push(Mpsc_t *q, MpscNode_t *node);
+
+MpscNode_t *mpsc_pop(Mpsc_t *q);
@@ -0,0 +1,566 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "registry.h"
+
+#define REGISTRY_INITIAL_CAP 16
+
+/**
+ * @brief Calcula a posição inicial de um ID na tabela hash.
+ * * Usa hashing multiplicativo (Fibonacci), que espalha bem IDs sequenciais.
+ * * @param id O ID do sensor.
+ * @param cap A capacidade da tabela (potência de 2).
+ * @return uint32_t A posição inicial da sondagem.
+ */
+static uint32_t registry_hash(int id, uint32_t cap)
+{
+    uint32_t h = (uint32_t)id * 2654435761u;
+    return (h ^ (h >> 16)) & (cap - 1);
+}
+
+/**
+ * @brief Insere uma posição do pool na tabela hash, sem verificar duplicatas.
+ * @param index A tabela hash.
+ * @param cap A capacidade da tabela.
+ * @param id O ID do sensor.
+ * @param slot A posição do sensor no pool.
+ */
+static void index_insert(uint32_t *index, uint32_t cap, int id, uint32_t slot)
+{
+    uint32_t i = registry_hash(id, cap);
+    while (index[i] != 0)
+    {
+        i = (i + 1) & (cap - 1);
+    }
+    index[i] = slot + 1;
+}
+
+/**
+ * @brief Aumenta a tabela hash para `cap` posições e reinsere todos os sensores.
+ * @param reg O registro.
+ * @param cap A nova capacidade (potência de 2).
+ */
+static void index_resize(Registry_t *reg, uint32_t cap)
+{
+    uint32_t *index = calloc(cap, sizeof(uint32_t));
+    if (index == NULL)
+    {
+        logexit("calloc");
+    }
+
+    for (uint32_t i = 0; i < reg->index_cap; i++)
+    {
+        if (reg->index[i] != 0)
+        {
+            uint32_t slot = reg->index[i] - 1;
+            index_insert(index, cap, reg->slots[slot].id, slot);
+        }
+    }
+
+    free(reg->index);
+    reg->index = index;
+    reg->index_cap = cap;
+}
+
+/**
+ * @brief Dobra a tabela hash.
+ * @param reg O registro.
+ */
+static void index_grow(Registry_t *reg)
+{
+    index_resize(reg, reg->index_cap ? reg->index_cap * 2 : REGISTRY_INITIAL_CAP * 2);
+}
+
+/**
+ * @brief Aumenta o pool de sensores para `cap` posições.
+ * @param reg O registro.
+ * @param cap A nova capacidade.
+ */
+static void slots_resize(Registry_t *reg, uint32_t cap)
+{
+    Client_t *slots = realloc(reg->slots, cap * sizeof(Client_t));
+    uint8_t *live = realloc(reg->live, cap * sizeof(uint8_t));
+    uint32_t *free_list = realloc(reg->free_list, cap * sizeof(uint32_t));
+    uint32_t *group_next = realloc(reg->group_next, cap * sizeof(uint32_t));
+    uint32_t *group_prev = realloc(reg->group_prev, cap * sizeof(uint32_t));
+    if (slots == NULL || live == NULL || free_list == NULL || group_next == NULL || group_prev == NULL)
+    {
+        logexit("realloc");
+    }
+
+    reg->slots = slots;
+    reg->live = live;
+    reg->free_list = free_list;
+    reg->group_next = group_next;
+    reg->group_prev = group_prev;
+    reg->slots_cap = cap;
+}
+
+/**
+ * @brief Localiza a posição da tabela hash que aponta para um ID.
+ * @param reg O registro.
+ * @param id O ID do sensor.
+ * @return int64_t A posição na tabela hash, ou -1 se o ID não estiver registrado.
+ */
+static int64_t index_lookup(const Registry_t *reg, int id)
+{
+    if (reg->index_cap == 0)
+    {
+        return -1;
+    }
+
+    uint32_t i = registry_hash(id, reg->index_cap);
+    while (reg->index[i] != 0)
+    {
+        if (reg->slots[reg->index[i] - 1].id == id)
+        {
+            return i;
+        }
+        i = (i + 1) & (reg->index_cap - 1);
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Remove uma entrada da tabela hash por deslocamento para trás.
+ * * Em vez de deixar marcadores de remoção, as entradas seguintes da mesma
+ * sequência de sondagem são movidas para preencher o buraco, mantendo as
+ * buscas curtas mesmo após muitas remoções.
+ * * @param reg O registro.
+ * @param hole A posição da tabela hash a ser liberada.
+ */
+static void index_erase(Registry_t *reg, uint32_t hole)
+{
+    uint32_t mask = reg->index_cap - 1;
+    uint32_t i = hole;
+
+    for (;;)
+    {
+        i = (i + 1) & mask;
+        if (reg->index[i] == 0)
+        {
+            break;
+        }
+
+        uint32_t home = registry_hash(reg->slots[reg->index[i] - 1].id, reg->index_cap);
+        // A entrada pode ocupar o buraco se sua posição inicial não está em (hole, i]
+        if (((i - home) & mask) >= ((i - hole) & mask))
+        {
+            reg->index[hole] = reg->index[i];
+            hole = i;
+        }
+    }
+
+    reg->index[hole] = 0;
+}
+
+/**
+ * @brief Associa um fd a uma posição do pool, aumentando a tabela direta se preciso.
+ * @param reg O registro.
+ * @param sock O file descriptor.
+ * @param slot A posição, ou -1 para desassociar.
+ */
+static void by_fd_set(Registry_t *reg, int sock, int32_t slot)
+{
+    if (sock < 0)
+    {
+        return;
+    }
+
+    if (sock >= reg->by_fd_cap)
+    {
+        if (slot < 0)
+        {
+            return;
+        }
+
+        int cap = reg->by_fd_cap ? reg->by_fd_cap : 64;
+        while (cap <= sock)
+        {
+            cap *= 2;
+        }
+
+        int32_t *by_fd = realloc(reg->by_fd, cap * sizeof(int32_t));
+        if (by_fd == NULL)
+        {
+            logexit("realloc");
+        }
+
+        for (int i = reg->by_fd_cap; i < cap; i++)
+        {
+            by_fd[i] = -1;
+        }
+
+        reg->by_fd = by_fd;
+        reg->by_fd_cap = cap;
+    }
+
+    reg->by_fd[sock] = slot;
+}
+
+/**
+ * @brief Insere uma posição no final da lista do seu valor de `data`.
+ * * Inserir no final preserva a ordem de conexão dos sensores. Valores
+ * negativos de `data` não são indexados.
+ * * @param reg O registro.
+ * @param slot A posição do sensor no pool.
+ */
+static void group_link(Registry_t *reg, uint32_t slot)
+{
+    int data = reg->slots[slot].data;
+    reg->group_next[slot] = 0;
+    reg->group_prev[slot] = 0;
+    if (data < 0)
+    {
+        return;
+    }
+
+    if (data >= reg->group_cap)
+    {
+        int cap = reg->group_cap ? reg->group_cap : REGISTRY_INITIAL_CAP;
+        while (cap <= data)
+        {
+            cap *= 2;
+        }
+
+        uint32_t *head = realloc(reg->group_head, cap * sizeof(uint32_t));
+        uint32_t *tail = realloc(reg->group_tail, cap * sizeof(uint32_t));
+        uint32_t *size = realloc(reg->group_size, cap * sizeof(uint32_t));
+        if (head == NULL || tail == NULL || size == NULL)
+        {
+            logexit("realloc");
+        }
+
+        memset(head + reg->group_cap, 0, (cap - reg->group_cap) * sizeof(uint32_t));
+        memset(tail + reg->group_cap, 0, (cap - reg->group_cap) * sizeof(uint32_t));
+        memset(size + reg->group_cap, 0, (cap - reg->group_cap) * sizeof(uint32_t));
+        reg->group_head = head;
+        reg->group_tail = tail;
+        reg->group_size = size;
+        reg->group_cap = cap;
+    }
+
+    uint32_t tail = reg->group_tail[data];
+    reg->group_prev[slot] = tail;
+    if (tail != 0)
+    {
+        reg->group_next[tail - 1] = slot + 1;
+    }
+    else
+    {
+        reg->group_head[data] = slot + 1;
+    }
+    reg->group_tail[data] = slot + 1;
+    reg->group_size[data]++;
+}
+
+/**
+ * @brief Retira uma posição da lista do seu valor de `data`.
+ * @param reg O registro.
+ * @param slot A posição do sensor no pool.
+ */
+static void group_unlink(Registry_t *reg, uint32_t slot)
+{
+    int data = reg->slots[slot].data;
+    if (data < 0)
+    {
+        return;
+    }
+
+    uint32_t next = reg->group_next[slot];
+    uint32_t prev = reg->group_prev[slot];
+    if (prev != 0)
+    {
+        reg->group_next[prev - 1] = next;
+    }
+    else
+    {
+        reg->group_head[data] = next;
+    }
+    if (next != 0)
+    {
+        reg->group_prev[next - 1] = prev;
+    }
+    else
+    {
+        reg->group_tail[data] = prev;
+    }
+    reg->group_size[data]--;
+}
+
+/**
+ * @brief Inicializa um registro vazio.
+ * @param reg O registro.
+ * @param max_clients O número máximo de sensores simultâneos.
+ */
+void registry_init(Registry_t *reg, uint32_t max_clients)
+{
+    memset(reg, 0, sizeof(Registry_t));
+    reg->max_clients = max_clients;
+}
+
+/**
+ * @brief Libera toda a memória do registro.
+ * @param reg O registro.
+ */
+void registry_free(Registry_t *reg)
+{
+    free(reg->slots);
+    free(reg->live);
+    free(reg->free_list);
+    free(reg->index);
+    free(reg->by_fd);
+    free(reg->group_next);
+    free(reg->group_prev);
+    free(reg->group_head);
+    free(reg->group_tail);
+    free(reg->group_size);
+    memset(reg, 0, sizeof(Registry_t));
+}
+
+/**
+ * @brief Reserva espaço para `count` sensores.
+ * * Evita as realocações e a reinserção na tabela hash a cada duplicação
+ * quando o número de sensores é conhecido de antemão (ex: na recuperação do
+ * estado persistente).
+ * * @param reg O registro.
+ * @param count O número de sensores esperado.
+ */
+void registry_reserve(Registry_t *reg, uint32_t count)
+{
+    if (count > reg->slots_cap)
+    {
+        slots_resize(reg, count);
+    }
+
+    uint32_t cap = reg->index_cap ? reg->index_cap : REGISTRY_INITIAL_CAP * 2;
+    while (cap < count * 2)
+    {
+        cap *= 2;
+    }
+    if (cap > reg->index_cap)
+    {
+        index_resize(reg, cap);
+    }
+}
+
+/**
+ * @brief Busca um sensor pelo ID.
+ * @param reg O registro.
+ * @param id O ID do sensor.
+ * @return Client_t* O sensor, ou NULL se não estiver registrado.
+ */
+Client_t *registry_find(Registry_t *reg, int id)
+{
+    int64_t i = index_lookup(reg, id);
+    return i < 0 ? NULL : &reg->slots[reg->index[i] - 1];
+}
+
+/**
+ * @brief Busca o sensor associado a um socket.
+ * @param reg O registro.
+ * @param sock O file descriptor do socket.
+ * @return Client_t* O sensor, ou NULL se o socket não pertence a nenhum sensor.
+ */
+Client_t *registry_find_by_socket(Registry_t *reg, int sock)
+{
+    if (sock < 0 || sock >= reg->by_fd_cap || reg->by_fd[sock] < 0)
+    {
+        return NULL;
+    }
+
+    return &reg->slots[reg->by_fd[sock]];
+}
+
+/**
+ * @brief Registra um novo sensor.
+ * * O ponteiro retornado é válido até a próxima inserção ou remoção.
+ * * @param reg O registro.
+ * @param id O ID do sensor (não pode estar registrado).
+ * @param sock O socket do sensor.
+ * @param data A localização ou o status do sensor.
+ * @return Client_t* O sensor registrado, ou NULL se o limite foi atingido.
+ */
+Client_t *registry_add(Registry_t *reg, int id, int sock, int data)
+{
+    if (reg->count >= reg->max_clients)
+    {
+        return NULL;
+    }
+
+    uint32_t slot;
+    if (reg->free_count > 0)
+    {
+        slot = reg->free_list[--reg->free_count];
+    }
+    else
+    {
+        if (reg->high_water == reg->slots_cap)
+        {
+            slots_resize(reg, reg->slots_cap ? reg->slots_cap * 2 : REGISTRY_INITIAL_CAP);
+        }
+        slot = reg->high_water++;
+    }
+
+    // Mantém a carga da tabela hash abaixo de 50%
+    if ((reg->count + 1) * 2 > reg->index_cap)
+    {
+        index_grow(reg);
+    }
+
+    reg->slots[slot].id = id;
+    reg->slots[slot].socket_id = sock;
+    reg->slots[slot].data = data;
+    reg->slots[slot].subscribed = 0;
+    reg->slots[slot].loc = 0;
+    reg->live[slot] = 1;
+    reg->count++;
+
+    index_insert(reg->index, reg->index_cap, id, slot);
+    by_fd_set(reg, sock, slot);
+    group_link(reg, slot);
+
+    return &reg->slots[slot];
+}
+
+/**
+ * @brief Associa um sensor já registrado a um novo socket (reconexão).
+ * @param reg O registro.
+ * @param client O sensor.
+ * @param sock O novo socket.
+ */
+void registry_attach(Registry_t *reg, Client_t *client, int sock)
+{
+    if (registry_find_by_socket(reg, client->socket_id) == client)
+    {
+        by_fd_set(reg, client->socket_id, -1);
+    }
+
+    client->socket_id = sock;
+    by_fd_set(reg, sock, client - reg->slots);
+}
+
+/**
+ * @brief Remove um sensor do registro.
+ * * A posição do sensor volta para a lista de livres sem deslocar nenhum
+ * outro sensor.
+ * * @param reg O registro.
+ * @param client O sensor (obtido de `registry_find*`).
+ */
+void registry_remove(Registry_t *reg, Client_t *client)
+{
+    uint32_t slot = client - reg->slots;
+
+    int64_t i = index_lookup(reg, client->id);
+    if (i >= 0)
+    {
+        index_erase(reg, (uint32_t)i);
+    }
+
+    if (registry_find_by_socket(reg, client->socket_id) == client)
+    {
+        by_fd_set(reg, client->socket_id, -1);
+    }
+
+    group_unlink(reg, slot);
+    memset(client, 0, sizeof(Client_t));
+    reg->live[slot] = 0;
+    reg->free_list[reg->free_count++] = slot;
+    reg->count--;
+}
+
+/**
+ * @brief Altera o `data` de um sensor, movendo-o para a lista do novo valor.
+ * @param reg O registro.
+ * @param client O sensor.
+ * @param data A nova localização (SL) ou o novo status (SS).
+ */
+void registry_set_data(Registry_t *reg, Client_t *client, int data)
+{
+    uint32_t slot = client - reg->slots;
+    if (client->data == data)
+    {
+        return;
+    }
+
+    group_unlink(reg, slot);
+    client->data = data;
+    group_link(reg, slot);
+}
+
+/**
+ * @brief Retorna o número de sensores registrados.
+ * @param reg O registro.
+ * @return uint32_t O número de sensores.
+ */
+uint32_t registry_count(const Registry_t *reg)
+{
+    return reg->count;
+}
+
+/**
+ * @brief Percorre os sensores registrados.
+ * * Uso: `uint32_t cursor = 0; while ((c = registry_next(reg, &cursor)) != NULL)`.
+ * * @param reg O registro.
+ * @param cursor A posição atual da iteração (começa em 0).
+ * @return Client_t* O próximo sensor, ou NULL ao final.
+ */
+Client_t *registry_next(Registry_t *reg, uint32_t *cursor)
+{
+    while (*cursor < reg->high_water)
+    {
+        uint32_t slot = (*cursor)++;
+        if (reg->live[slot])
+        {
+            return &reg->slots[slot];
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Retorna o primeiro sensor com um dado valor de `data`.
+ * * Uso: `for (c = registry_group_first(reg, d); c != NULL; c = registry_group_next(reg, c))`.
+ * * @param reg O registro.
+ * @param data A localização (SL) ou o status (SS).
+ * @return Client_t* O sensor, ou NULL se não houver nenhum.
+ */
+Client_t *registry_group_first(Registry_t *reg, int data)
+{
+    if (data < 0 || data >= reg->group_cap || reg->group_head[data] == 0)
+    {
+        return NULL;
+    }
+
+    return &reg->slots[reg->group_head[data] - 1];
+}
+
+/**
+ * @brief Retorna o próximo sensor com o mesmo valor de `data`.
+ * @param reg O registro.
+ * @param client O sensor atual.
+ * @return Client_t* O próximo sensor, ou NULL ao final.
+ */
+Client_t *registry_group_next(Registry_t *reg, const Client_t *client)
+{
+    uint32_t next = reg->group_next[client - reg->slots];
+    return next == 0 ? NULL : &reg->slots[next - 1];
+}
+
+/**
+ * @brief Retorna o número de sensores com um dado valor de `data`.
+ * @param reg O registro.
+ * @param data A localização (SL) ou o status (SS).
+ * @return uint32_t O número de sensores.
+ */
+uint32_t registry_group_size(const Registry_t *reg, int data)
+{
+    if (data < 0 || data >= reg->group_cap)
+    {
+        return 0;
+    }
+
+    return reg->group_size[data];
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdint.h>
+#include "common.h"
+
+/**
+ * Registro de sensores conectados.
+ *
+ * Os sensores ficam em um pool de posições estáveis (nunca deslocadas na
+ * remoção), indexado por uma tabela hash de endereçamento aberto pelo ID do
+ * sensor e por uma tabela direta fd -> posição. Inserção, busca e remoção
+ * custam O(1), independentemente do número de sensores.
+ *
+ * Sensores com o mesmo `data` (localização no SL, status no SS) são ainda
+ * encadeados em listas intrusivas, de modo que listar os sensores de uma
+ * localização custa apenas O(sensores nela).
+ */
+typedef struct Registry
+{
+    Client_t *slots;     // Pool de sensores
+    uint8_t *live;       // live[i] != 0 se slots[i] está ocupada
+    uint32_t *free_list; // Pilha de posições livres
+    uint32_t free_count;
+    uint32_t slots_cap;
+    uint32_t high_water; // Posições [0, high_water) já foram usadas alguma vez
+
+    uint32_t *index; // Hash por ID: posição + 1 (0 = vazio)
+    uint32_t index_cap;
+
+    int32_t *by_fd; // fd -> posição (-1 = nenhum sensor)
+    int by_fd_cap;
+
+    uint32_t *group_next; // Próxima posição com o mesmo `data` + 1 (0 = fim)
+    uint32_t *group_prev; // Posição anterior com o mesmo `data` + 1 (0 = início)
+    uint32_t *group_head; // group_head[data]: primeira posição + 1 (0 = vazio)
+    uint32_t *group_tail; // group_tail[data]: última posição + 1 (0 = vazio)
+    uint32_t *group_size; // group_size[data]: número de sensores
+    int group_cap;
+
+    uint32_t count;
+    uint32_t max_clients;
+} Registry_t;
+
+void registry_init(Registry_t *reg, uint32_t max_clients);
+
+void registry_free(Registry_t *reg);
+
+void registry_reserve(Registry_t *reg, uint32_t count);
+
+Client_t *registry_find(Registry_t *reg, int id);
+
+Client_t *registry_find_by_socket(Registry_t *reg, int sock);
+
+Client_t *registry_add(Registry_t *reg, int id, int sock, int data);
+
+void registry_attach(Registry_t *reg, Client_t *client, int sock);
+
+void registry_remove(Registry_t *reg, Client_t *client);
+
+void registry_set_data(Registry_t *reg, Client_t *client, int data);
+
+uint32_t registry_count(const Registry_t *reg);
+
+Client_t *registry_next(Registry_t *reg, uint32_t *cursor);
+
+Client_t *registry_group_first(Registry_t *reg, int data);
+
+Client_t *registry_group_next(Registry_t *reg, const Client_t *client);
+
+uint32_t registry_group_size(const Registry_t *reg, int data);
@@ -1,12 +1,324 @@
+#define _GNU_SOURCE // accept4
+
 #include "common.h"
+#include "registry.h"
+#include "mpsc.h"
+#include "metrics.h"
+#include "log.h"
+#include "store.h"
+#include "timer.h"
+#include "uring.h"
+#include "hashring.h"
+#include "shmring.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/socket.h>
 #include <sys/types.h>
-#include <sys/select.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <time.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <poll.h>
+
+#define MAX_EVENTS 64
+
+typedef enum
+{
+    FD_STDIN,
+    FD_PEER,      // Link com um peer; `data` guarda peer * PEER_LINKS_MAX + link
+    FD_P2P_LISTEN,
+    FD_CLIENTS_LISTEN,
+    FD_UNIX_LISTEN, // Escuta AF_UNIX de clientes locais, compartilhada pelos workers (ver init_unix_socket)
+    FD_SENSOR,
+    FD_HANDSHAKE, // Conexão aceita aguardando o REQ_CONNSEN; `data` guarda a posição em `handshakes`
+    FD_INBOX,
+} FdKind;
+
+/**
+ * Destino de uma resposta a um cliente: a conexão, o worker dono dela e o
+ * ID de correlação da requisição, que é devolvido na resposta para que
+ * clientes com requisições em paralelo as associem.
+ */
+typedef struct ReplyTo
+{
+    int worker;        // Worker dono da conexão do cliente
+    int client_socket;
+    uint32_t gen;      // Geração da conexão do cliente (ver conn_generation)
+    uint32_t seq;      // ID de correlação da requisição do cliente
+} ReplyTo_t;
+
+/**
+ * Resposta parcial de um REQ_SENSSTATUS_BATCH que aguarda as localizações
+ * dos sensores em falha. Pertence ao job que a leva ao worker 0 e, depois,
+ * às consultas pendentes que a referenciam; é liberada com a última delas.
+ */
+typedef struct StatusBatch
+{
+    int count;
+    int ids[BATCH_MAX_IDS];
+    int values[BATCH_MAX_IDS]; // 0 = sem falha, -1 = não encontrado, >0 = localização do alerta
+    int failed[BATCH_MAX_IDS]; // Índices dos sensores em falha
+    int nfailed;
+    int outstanding;           // Consultas ao peer ainda sem resposta
+} StatusBatch_t;
+
+typedef struct PendingAlert
+{
+    uint32_t seq; // 0 = posição livre
+    ReplyTo_t to; // Cliente que aguarda a resposta
+    int sensor_id;
+    uint64_t sent_at; // Instante do envio (metrics_now)
+    StatusBatch_t *batch; // Lote ao qual a consulta pertence (ou NULL)
+    int batch_index;      // Sensor do lote consultado (-1 = todos os em falha que pertencem a `peer`)
+    int peer;             // Peer (SL) ao qual a consulta foi enviada
+    int push;             // Alerta por push: a resposta é entregue como ALERT_MSG
+} PendingAlert_t;
+
+/**
+ * Requisições REQ_CHECKALERT enviadas pelos links de um worker e ainda sem resposta, indexadas
+ * por `seq & (cap - 1)`. Como os seqs são atribuídos em ordem, o anel cobre
+ * sempre o intervalo [oldest, next).
+ */
+typedef struct PendingTable
+{
+    PendingAlert_t *slots;
+    uint32_t cap;
+    uint32_t oldest;
+    uint32_t next;
+} PendingTable_t;
+
+#define PENDING_INITIAL_CAP 64
+
+typedef struct Options
+{
+    size_t out_limit;       // Máximo de bytes pendentes por conexão
+    SlowPolicy slow_policy; // Tratamento de consumidores lentos
+    uint32_t max_sensors;   // Máximo de sensores conectados simultaneamente
+    int workers;            // Número de threads de atendimento a clientes
+    int metrics_port;       // Porta local do endpoint de métricas (0 = desativado)
+    LogLevel log_level;     // Nível inicial de log
+    const char *state_path; // Arquivo de estado persistente (NULL = desativado)
+    int backlog;            // Fila de conexões do socket de escuta e de handshakes por worker
+    int handshake_timeout;  // Tempo máximo para o REQ_CONNSEN chegar, em ms
+    int idle_timeout;       // Inatividade após a qual um sensor é desconectado, em ms (0 = nunca)
+    int reclaim_timeout;    // Prazo para um sensor recuperado do estado se reconectar, em ms (0 = nunca expira)
+    int heartbeat;          // Intervalo dos heartbeats no link com o peer, em ms
+    int io_uring;           // Backend de E/S dos sensores: 0 = epoll, 1 = io_uring
+    const char *cluster;    // (SS) Portas P2P dos demais SLs do cluster, separadas por vírgula (NULL = nenhum)
+    int peer_conns;         // (SS) Conexões com cada SL (link 0 + links do pool)
+    int shm;                // Links com um peer na mesma máquina em memória compartilhada
+    const char *unix_path;  // Caminho base da escuta AF_UNIX de clientes (NULL = desativada)
+} Options_t;
+
+#define HANDSHAKE_TIMEOUT_DEFAULT 5000
+#define HEARTBEAT_DEFAULT 1000
+#define RECLAIM_TIMEOUT_DEFAULT 60000
+#define PEER_LINKS_MAX 16           // Conexões com cada peer (--peer-conns)
+#define HEARTBEAT_MISSES 3          // Intervalos sem nenhum quadro do peer até considerá-lo perdido
+#define TIMER_TICK_NS 10000000ull   // Resolução dos timer wheels (10 ms)
+
+#define URING_ENTRIES 256  // Fila de submissão do io_uring de cada worker
+#define URING_BUFS 512     // Buffers de recepção por worker (potência de 2)
+#define URING_BUF_SIZE 4096
+
+typedef enum
+{
+    TIMER_IDLE,      // Inatividade de um sensor (`data` guarda o socket)
+    TIMER_HEARTBEAT, // Heartbeat do link com o peer (worker 0)
+    TIMER_RECLAIM,   // Prazo dos sensores recuperados do estado persistente (worker 0)
+} TimerKind;
+
+/**
+ * Controle de inatividade de uma conexão de sensor, indexado pelo socket e
+ * usado apenas pelo worker dono da conexão. Cada mensagem recebida só
+ * atualiza `last_active`; o temporizador é rearmado quando expira, de modo que
+ * o tráfego não custa nenhuma operação no wheel.
+ */
+typedef struct IdleTimer
+{
+    Timer_t timer;
+    uint64_t last_active; // Instante (metrics_now) da última mensagem recebida
+} IdleTimer_t;
+#define HANDSHAKE_NONE UINT32_MAX
+
+/**
+ * Operações do backend io_uring. A identificação de cada operação leva o
+ * tipo nos 8 bits superiores, a geração da conexão (24 bits, ver
+ * conn_generation) e o fd ou a posição em `sends` nos 32 bits inferiores; uma
+ * conclusão de uma conexão já fechada (fd reaproveitado) é descartada.
+ */
+typedef enum
+{
+    UR_EPOLL = 1, // Poll multishot da instância epoll (entrada padrão, peer e caixa de entrada)
+    UR_ACCEPT,    // Accept multishot do socket de escuta de clientes
+    UR_RECV,      // Recv multishot de um sensor ou de uma conexão em handshake
+    UR_SEND,      // Envio da fila de saída de um sensor
+} UringOp;
+
+#define URING_GEN_MASK 0xffffffu
+
+/**
+ * Envio io_uring em andamento. Os bytes da fila de saída são copiados para
+ * `buf`, que pertence ao envio até a conclusão: enquanto isso a fila pode
+ * crescer (e mudar de endereço) e a conexão pode até ser fechada.
+ */
+typedef struct UringSend
+{
+    int sock;
+    uint32_t gen;
+    unsigned char *buf;
+    size_t cap;
+} UringSend_t;
+
+/**
+ * Conexão aceita que ainda não enviou o REQ_CONNSEN. As posições ocupadas
+ * formam uma lista em ordem de chegada; como o prazo é o mesmo para todas, a
+ * cabeça da lista é sempre a próxima a expirar.
+ */
+typedef struct Handshake
+{
+    int sock;
+    uint64_t deadline; // Instante (metrics_now) em que a conexão é descartada
+    uint32_t prev;
+    uint32_t next;
+} Handshake_t;
+
+typedef enum
+{
+    JOB_CHECKALERT, // Worker -> dono do link: enviar REQ_CHECKALERT ao peer
+    JOB_CHECKALERT_BATCH, // Worker -> dono do link: consultar os sensores em falha de um lote
+    JOB_ALERT,      // Worker -> dono do link: resolver a localização e enviar um ALERT_MSG
+    JOB_PEER_SEND,  // Worker -> worker 0: enviar uma mensagem ao peer
+    JOB_PEER_LINK,  // Worker 0 -> worker: assumir um link aceito do pool (`msg.payload` = socket, `msg.seq` = índice)
+    JOB_PEER_LOST,  // Worker -> worker 0: um link do pool foi fechado
+    JOB_REPLY,      // Worker 0 -> worker: entregar uma resposta a um cliente
+    JOB_STOP,       // Worker 0 -> worker: encerrar a thread
+} JobKind;
+
+/**
+ * Mensagem trocada entre workers pelas caixas de entrada (filas MPSC).
+ */
+typedef struct Job
+{
+    MpscNode_t node; // Deve ser o primeiro campo
+    JobKind kind;
+    ReplyTo_t to;      // Cliente que aguarda a resposta
+    Msg_t msg;
+    StatusBatch_t *batch; // JOB_CHECKALERT_BATCH
+} Job_t;
+
+/**
+ * Partição do registro de sensores, escolhida pelo ID do sensor. Cada
+ * operação no registro é O(1), então a trava é mantida por muito pouco tempo.
+ */
+typedef struct Shard
+{
+    pthread_mutex_t lock;
+    Registry_t registry;
+    int next_id; // Próximo ID a atribuir; os IDs deste shard avançam de `nshards` em `nshards`
+} Shard_t;
+
+typedef struct Session Session_t;
+
+/**
+ * Thread de atendimento. Cada worker tem sua própria instância epoll e seu
+ * próprio socket de escuta, e é o único que lê e escreve nas conexões que
+ * aceitou. O worker 0 roda na thread principal e é também o dono da entrada
+ * padrão e do link 0 com cada peer; o link k do pool pertence ao worker
+ * k % nworkers, que envia por ele as suas consultas e recebe as respostas.
+ */
+typedef struct Worker
+{
+    int id;
+    int epfd;
+    int clients_socket;
+    Mpsc_t inbox;   // Jobs enviados por outros workers
+    int inbox_fd;   // eventfd sinalizado a cada job
+    pthread_t thread;
+    Session_t *session;
+    Metrics_t *metrics; // Métricas desta thread (NULL = desativadas)
+    Handshake_t *handshakes; // `session->backlog` posições
+    uint32_t *handshake_free; // Pilha de posições livres
+    uint32_t handshake_free_count;
+    uint32_t handshake_head; // Mais antigo (HANDSHAKE_NONE = nenhum)
+    uint32_t handshake_tail;
+    int accept_paused; // A fila de handshakes encheu com conexões ainda por aceitar
+    int unix_paused;   // O mesmo, na escuta AF_UNIX
+    TimerWheel_t wheel; // Temporizadores das conexões deste worker
+    Uring_t *ring;      // Backend io_uring dos sensores (NULL = epoll)
+    int accept_armed;   // (io_uring) O accept multishot está ativo
+    int *parked;        // (io_uring) Aceitas com a fila de handshakes cheia, antes de o accept ser cancelado
+    uint32_t parked_head;
+    uint32_t parked_count;
+    uint32_t parked_cap;
+    UringSend_t *sends; // (io_uring) Envios, indexados pela posição
+    uint32_t *send_free; // Pilha de posições livres em `sends`
+    uint32_t send_cap;
+    uint32_t send_free_count;
+    PendingTable_t pending; // Consultas enviadas pelos links deste worker
+} Worker_t;
+
+/**
+ * Conexão com um peer. O SL tem um único peer (o SS); o SS tem um por SL do
+ * cluster, na ordem dos nós do anel (ver hashring.h). Pertence ao worker 0,
+ * exceto os links do pool, cada um do seu worker.
+ */
+typedef struct Peer
+{
+    int sock;             // Link 0: handshake, controle e consultas do worker 0
+    int links[PEER_LINKS_MAX]; // links[0] = sock; 0 = posição livre
+    int id;               // ID atribuído ao peer no handshake
+    int self_id;          // ID atribuído a este servidor pelo peer
+    int clients_port;     // (SS) Porta de clientes do SL, sua chave no anel
+    uint64_t last_rx;     // Instante do último quadro recebido do peer
+    int beats;            // O peer envia heartbeats (versões antigas não enviam)
+} Peer_t;
+
+/**
+ * Estado compartilhado pelos workers durante uma sessão com o peer.
+ */
+struct Session
+{
+    Server type;
+    Peer_t *peers;          // Pertencem ao worker 0
+    int npeers;
+    int nlinks;             // (SS) Links com cada SL; o worker w consulta pelo link w % nlinks
+    _Atomic(HashRing_t *) cluster; // Anel do cluster de SLs (NULL = o SL ainda não o recebeu)
+    int clients_port;       // Porta de clientes deste servidor
+    int listen_socket;      // Pertence ao worker 0
+    int unix_socket;        // Escuta AF_UNIX de clientes, monitorada por todos os workers (-1 = desativada)
+    int *connected_peer_id;
+    Shard_t *shards;
+    uint32_t nshards;
+    _Atomic uint32_t sensors; // Sensores conectados em todos os shards (os recuperados só contam ao se reconectar)
+    uint32_t max_sensors;
+    Worker_t *workers;
+    int nworkers;
+    Metrics_t *metrics; // Uma entrada por worker; sobrevive às sessões (NULL = desativadas)
+    Store_t *store;     // Estado persistente dos sensores; sobrevive às sessões (NULL = desativado)
+    int backlog;
+    uint64_t handshake_timeout; // Em ns
+    uint64_t idle_timeout;      // Em ns (0 = desativado)
+    IdleTimer_t *idle;          // Indexado pelo socket (NULL = desativado)
+    int idle_cap;
+    uint64_t heartbeat;         // Em ns
+    Timer_t heartbeat_timer;    // Pertence ao worker 0
+    uint64_t reclaim_timeout;   // Em ns (0 = desativado)
+    Timer_t reclaim_timer;      // Pertence ao worker 0
+    int io_uring;               // Os workers usam o backend io_uring
+    uint32_t *fd_handshake;     // (io_uring) Posição de cada socket na fila de handshakes, indexada pelo fd
+    int fd_cap;
+};
 
 /**
  * @brief Exibe a forma correta de usar o programa e o encerra.
@@ -15,11 +327,187 @@
  */
 void usage(int argc, char **argv)
 {
-    printf("usage: %s <server IP> <p2p server port> <clients server port>\n", argv[0]);
+    printf("usage: %s [options] <server IP> <p2p server port> <clients server port>\n", argv[0]);
     printf("example: %s 127.0.0.1 51500 51511\n", argv[0]);
+    printf("options:\n");
+    printf("  --out-limit <bytes>        bytes pendentes por conexão (padrão %d)\n", OUT_LIMIT_DEFAULT);
+    printf("  --slow-policy <close|drop> ação ao exceder o limite (padrão close)\n");
+    printf("  --max-sensors <n>          sensores simultâneos (padrão %d)\n", MAX_CLIENTS);
+    printf("  --workers <n>              threads de atendimento a clientes (padrão 1)\n");
+    printf("  --metrics-port <porta>     endpoint de métricas em 127.0.0.1 (padrão desativado)\n");
+    printf("  --log-level <nível>        error, warn, info ou debug (padrão info)\n");
+    printf("  --state <arquivo>          persiste os sensores em um arquivo (padrão desativado)\n");
+    printf("  --backlog <n>              conexões aguardando accept e handshake (padrão %d)\n", SOMAXCONN);
+    printf("  --handshake-timeout <ms>   prazo para o REQ_CONNSEN (padrão %d)\n", HANDSHAKE_TIMEOUT_DEFAULT);
+    printf("  --idle-timeout <ms>        desconecta sensores inativos (padrão desativado)\n");
+    printf("  --reclaim-timeout <ms>     prazo para os sensores do --state se reconectarem (padrão %d, 0 = nunca)\n", RECLAIM_TIMEOUT_DEFAULT);
+    printf("  --heartbeat <ms>           intervalo dos heartbeats com o peer (padrão %d)\n", HEARTBEAT_DEFAULT);
+    printf("  --io <epoll|uring>         backend de E/S dos sensores (padrão epoll)\n");
+    printf("  --cluster <porta,...>      portas P2P dos demais SLs, para o SS (padrão nenhum)\n");
+    printf("  --peer-conns <n>           conexões do SS com cada SL, até --workers (padrão 1)\n");
+    printf("  --no-shm                   links com um peer local sempre em TCP (padrão memória compartilhada)\n");
+    printf("  --unix <caminho>           também atende clientes em <caminho>.<porta> (padrão desativado)\n");
     exit(EXIT_FAILURE);
 }
 
+/**
+ * @brief Lê as opções de linha de comando do servidor.
+ * * As opções podem aparecer antes ou depois dos argumentos posicionais;
+ * ao final, `optind` aponta para o primeiro argumento posicional.
+ * * @param argc O número de argumentos da linha de comando.
+ * @param argv O array de strings dos argumentos.
+ * @param opts A estrutura a ser preenchida (já com os valores padrão).
+ */
+void parse_options(int argc, char **argv, Options_t *opts)
+{
+    static struct option long_opts[] = {
+        {"out-limit", required_argument, NULL, 'q'},
+        {"slow-policy", required_argument, NULL, 's'},
+        {"max-sensors", required_argument, NULL, 'm'},
+        {"workers", required_argument, NULL, 'w'},
+        {"metrics-port", required_argument, NULL, 'M'},
+        {"log-level", required_argument, NULL, 'l'},
+        {"state", required_argument, NULL, 'S'},
+        {"backlog", required_argument, NULL, 'b'},
+        {"handshake-timeout", required_argument, NULL, 'H'},
+        {"idle-timeout", required_argument, NULL, 'i'},
+        {"reclaim-timeout", required_argument, NULL, 'R'},
+        {"heartbeat", required_argument, NULL, 'h'},
+        {"io", required_argument, NULL, 'I'},
+        {"cluster", required_argument, NULL, 'C'},
+        {"peer-conns", required_argument, NULL, 'P'},
+        {"no-shm", no_argument, NULL, 'N'},
+        {"unix", required_argument, NULL, 'U'},
+        {NULL, 0, NULL, 0},
+    };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "", long_opts, NULL)) != -1)
+    {
+        switch (c)
+        {
+        case 'q':
+            opts->out_limit = strtoul(optarg, NULL, 10);
+            if (opts->out_limit == 0)
+            {
+                usage(argc, argv);
+            }
+            break;
+        case 's':
+            if (strcmp(optarg, "close") == 0)
+            {
+                opts->slow_policy = SLOW_CLOSE;
+            }
+            else if (strcmp(optarg, "drop") == 0)
+            {
+                opts->slow_policy = SLOW_DROP;
+            }
+            else
+            {
+                usage(argc, argv);
+            }
+            break;
+        case 'm':
+            opts->max_sensors = strtoul(optarg, NULL, 10);
+            if (opts->max_sensors == 0)
+            {
+                usage(argc, argv);
+            }
+            break;
+        case 'w':
+            opts->workers = atoi(optarg);
+            if (opts->workers < 1)
+            {
+                usage(argc, argv);
+            }
+            break;
+        case 'M':
+            opts->metrics_port = atoi(optarg);
+            if (opts->metrics_port <= 0 || opts->metrics_port > 65535)
+            {
+                usage(argc, argv);
+            }
+            break;
+        case 'l':
+            if (log_parse_level(optarg, &opts->log_level) != 0)
+            {
+                usage(argc, argv);
+            }
+            break;
+        case 'S':
+            opts->state_path = optarg;
+            break;
+        case 'b':
+            opts->backlog = atoi(optarg);
+            if (opts->backlog < 1)
+            {
+                usage(argc, argv);
+            }
+            break;
+        case 'H':
+            opts->handshake_timeout = atoi(optarg);
+            if (opts->handshake_timeout < 1)
+            {
+                usage(argc, argv);
+            }
+            break;
+        case 'i':
+            opts->idle_timeout = atoi(optarg);
+            if (opts->idle_timeout < 0)
+            {
+                usage(argc, argv);
+            }
+            break;
+        case 'R':
+            opts->reclaim_timeout = atoi(optarg);
+            if (opts->reclaim_timeout < 0)
+            {
+                usage(argc, argv);
+            }
+            break;
+        case 'h':
+            opts->heartbeat = atoi(optarg);
+            if (opts->heartbeat < 1)
+            {
+                usage(argc, argv);
+            }
+            break;
+        case 'I':
+            if (strcmp(optarg, "epoll") == 0)
+            {
+                opts->io_uring = 0;
+            }
+            else if (strcmp(optarg, "uring") == 0)
+            {
+                opts->io_uring = 1;
+            }
+            else
+            {
+                usage(argc, argv);
+            }
+            break;
+        case 'C':
+            opts->cluster = optarg;
+            break;
+        case 'P':
+            opts->peer_conns = atoi(optarg);
+            if (opts->peer_conns < 1 || opts->peer_conns > PEER_LINKS_MAX)
+            {
+                usage(argc, argv);
+            }
+            break;
+        case 'N':
+            opts->shm = 0;
+            break;
+        case 'U':
+            opts->unix_path = optarg;
+            break;
+        default:
+            usage(argc, argv);
+        }
+    }
+}
+
 /**
  * @brief Gera um ID único para um peer.
  * * Esta função utiliza uma variável estática para manter o controle do último ID gerado,
@@ -59,6 +547,183 @@ int get_client_status()
     return random;
 }
 
+/**
+ * @brief Registra um file descriptor na instância epoll do servidor.
+ * * O tipo do descritor é guardado junto ao próprio fd no campo `data` do
+ * evento, permitindo despachar cada evento pronto sem consultar nenhuma
+ * outra estrutura.
+ * * @param epfd A instância epoll.
+ * @param fd O file descriptor a ser monitorado.
+ * @param kind O papel do descritor no servidor.
+ * @param events A máscara de eventos (ex: EPOLLIN | EPOLLET).
+ * @return int 0 em caso de sucesso, -1 em caso de falha.
+ */
+int event_register(int epfd, int fd, FdKind kind, uint32_t events)
+{
+    struct epoll_event ev = {0};
+    ev.events = events;
+    ev.data.u64 = ((uint64_t)kind << 32) | (uint32_t)fd;
+    return epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+/**
+ * @brief Altera o papel e a máscara de eventos de um fd já registrado.
+ * @param epfd A instância epoll.
+ * @param fd O file descriptor monitorado.
+ * @param kind O novo papel do descritor.
+ * @param events A nova máscara de eventos.
+ * @return int 0 em caso de sucesso, -1 em caso de falha.
+ */
+int event_modify(int epfd, int fd, FdKind kind, uint32_t events)
+{
+    struct epoll_event ev = {0};
+    ev.events = events;
+    ev.data.u64 = ((uint64_t)kind << 32) | (uint32_t)fd;
+    return epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev);
+}
+
+/**
+ * @brief Monta a identificação de uma operação io_uring (ver UringOp).
+ * @param op O tipo da operação.
+ * @param gen A geração da conexão (0 se não se aplica).
+ * @param index O fd ou a posição em `sends`.
+ * @return uint64_t A identificação.
+ */
+uint64_t uring_data(UringOp op, uint32_t gen, uint32_t index)
+{
+    return ((uint64_t)op << 56) | ((uint64_t)(gen & URING_GEN_MASK) << 32) | index;
+}
+
+/**
+ * @brief Registra uma consulta REQ_CHECKALERT pendente e retorna seu ID.
+ * * O anel dobra de tamanho quando todas as posições estão ocupadas, de modo
+ * que não há limite fixo de requisições em andamento.
+ * * @param pending A tabela de requisições pendentes.
+ * @param to O cliente que aguarda a resposta.
+ * @param sensor_id O sensor consultado.
+ * @param batch O lote ao qual a consulta pertence (ou NULL).
+ * @param batch_index O índice do sensor no lote (-1 = todos os em falha que pertencem a `peer`).
+ * @param push 1 se a consulta resolve um alerta por push.
+ * @param peer O peer ao qual a consulta é enviada.
+ * @return uint32_t O ID de correlação (nunca 0).
+ */
+uint32_t pending_add(PendingTable_t *pending, const ReplyTo_t *to, int sensor_id, StatusBatch_t *batch,
+                     int batch_index, int push, int peer)
+{
+    if (pending->next == 0)
+    {
+        pending->next = 1;
+    }
+
+    if (pending->next - pending->oldest >= pending->cap)
+    {
+        uint32_t cap = pending->cap ? pending->cap * 2 : PENDING_INITIAL_CAP;
+        PendingAlert_t *slots = calloc(cap, sizeof(PendingAlert_t));
+        if (slots == NULL)
+        {
+            logexit("calloc");
+        }
+
+        for (uint32_t i = 0; i < pending->cap; i++)
+        {
+            if (pending->slots[i].seq != 0)
+            {
+                slots[pending->slots[i].seq & (cap - 1)] = pending->slots[i];
+            }
+        }
+
+        free(pending->slots);
+        pending->slots = slots;
+        pending->cap = cap;
+    }
+
+    uint32_t seq = pending->next++;
+    PendingAlert_t *slot = &pending->slots[seq & (pending->cap - 1)];
+    slot->seq = seq;
+    slot->to = *to;
+    slot->sensor_id = sensor_id;
+    slot->sent_at = metrics_now();
+    slot->batch = batch;
+    slot->batch_index = batch_index;
+    slot->push = push;
+    slot->peer = peer;
+    return seq;
+}
+
+/**
+ * @brief Remove e retorna a consulta pendente correspondente a uma resposta.
+ * * Peers que não usam o formato compacto não devolvem o ID (seq 0); como eles
+ * respondem em ordem, a resposta corresponde à consulta pendente mais antiga.
+ * * @param pending A tabela de requisições pendentes.
+ * @param seq O ID de correlação recebido na resposta.
+ * @param out Destino da consulta encontrada.
+ * @return int 1 se a consulta foi encontrada, 0 caso contrário.
+ */
+int pending_take(PendingTable_t *pending, uint32_t seq, PendingAlert_t *out)
+{
+    if (pending->cap == 0)
+    {
+        return 0;
+    }
+
+    // Avança sobre posições já respondidas (e sobre o seq 0, que nunca é usado)
+    while (pending->oldest != pending->next &&
+           (pending->oldest == 0 || pending->slots[pending->oldest & (pending->cap - 1)].seq != pending->oldest))
+    {
+        pending->oldest++;
+    }
+
+    if (seq == 0)
+    {
+        seq = pending->oldest;
+    }
+
+    PendingAlert_t *slot = &pending->slots[seq & (pending->cap - 1)];
+    if (slot->seq == 0 || slot->seq != seq)
+    {
+        return 0;
+    }
+
+    *out = *slot;
+    slot->seq = 0;
+    return 1;
+}
+
+/**
+ * @brief Libera a tabela de consultas pendentes e os lotes ainda referenciados.
+ * @param pending A tabela de requisições pendentes.
+ */
+void pending_free(PendingTable_t *pending)
+{
+    for (uint32_t i = 0; i < pending->cap; i++)
+    {
+        StatusBatch_t *batch = pending->slots[i].batch;
+        if (pending->slots[i].seq != 0 && batch != NULL && --batch->outstanding == 0)
+        {
+            free(batch);
+        }
+    }
+
+    free(pending->slots);
+    memset(pending, 0, sizeof(PendingTable_t));
+}
+
+/**
+ * @brief Desativa o algoritmo de Nagle na conexão com o peer.
+ * * O peer troca apenas quadros pequenos e sensíveis à latência (consultas,
+ * respostas e SENSLOC_NOTIFY); com Nagle, um quadro enviado logo após outro
+ * aguardaria a confirmação, possivelmente atrasada, do anterior.
+ * * @param sock O socket da conexão com o peer.
+ */
+void peer_set_nodelay(int sock)
+{
+    int enable = 1;
+    if (0 != setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(int)))
+    {
+        logexit("setsockopt");
+    }
+}
+
 /**
  * @brief Configura o socket para atuar como um servidor passivo (de escuta).
  * * Realiza o bind do socket a um endereço e porta específicos e o coloca
@@ -85,12 +750,17 @@ void init_passive_server(int s, struct sockaddr *p2p_addr, struct sockaddr_stora
  * @brief Aceita uma nova conexão de peer e realiza o handshake inicial.
  * * Aguarda e aceita uma conexão em um socket de escuta, troca mensagens
  * com o novo peer para estabelecer os IDs de cada um e retorna o ID do peer conectado.
+ * Se o peer oferecer o formato compacto, ele é aceito na resposta e usado daí em diante.
+ * A resposta leva também a porta de clientes deste servidor, que identifica o
+ * SL no anel quando o SS forma um cluster. Com um peer na mesma máquina, os
+ * quadros passam a trafegar em memória compartilhada (ver shmring.h).
  * * @param s O socket de escuta.
  * @param connected_peer_id Ponteiro para armazenar o ID do peer que se conectou.
  * @param server_sock Ponteiro para armazenar o file descriptor do novo socket de comunicação.
+ * @param clients_port A porta de clientes deste servidor.
  * @return int O ID do peer recém-conectado.
  */
-int handle_peer_accept(int s, int *connected_peer_id, int *server_sock)
+int handle_peer_accept(int s, int *connected_peer_id, int *server_sock, int clients_port)
 {
     int my_peer_id = 0;
 
@@ -102,6 +772,7 @@ int handle_peer_accept(int s, int *connected_peer_id, int *server_sock)
     {
         logexit("accept");
     }
+    peer_set_nodelay(s_sock);
 
     Msg_t msg = {0};
     recv_msg(s_sock, &msg);
@@ -114,7 +785,7 @@ int handle_peer_accept(int s, int *connected_peer_id, int *server_sock)
             err.payload = PEER_LIMIT_ERROR;
             strcpy(err.desc, "Peer limit exceeded");
             send_msg(s_sock, &err);
-            close(s_sock);
+            conn_close(s_sock);
             return 0;
         }
 
@@ -122,15 +793,36 @@ int handle_peer_accept(int s, int *connected_peer_id, int *server_sock)
         Msg_t resp = {0};
         resp.type = RES_CONPEER;
         resp.payload = *connected_peer_id;
+        snprintf(resp.desc, sizeof(resp.desc), "%d", clients_port);
+        int shm_sock = shm_answer(&msg, &resp, s_sock);
+        if (wire_offered(&msg))
+        {
+            wire_offer(&resp);
+        }
         send_msg(s_sock, &resp);
-        printf("Peer %d connected\n", *connected_peer_id);
+
+        // O restante do handshake e da sessão já usa o formato negociado
+        if (wire_offered(&msg))
+        {
+            conn_set_wire(s_sock, WIRE_COMPACT);
+        }
+        log_info("Peer %d connected", *connected_peer_id);
+
+        // O link em memória compartilhada é entregue antes da confirmação, que ainda trafega no TCP
+        ShmLink_t *shm = shm_sock != -1 ? shm_join(shm_sock) : NULL;
 
         Msg_t peer_id_msg = {0};
         recv_msg(s_sock, &peer_id_msg);
         if (peer_id_msg.type == RES_CONPEER)
         {
             my_peer_id = peer_id_msg.payload;
-            printf("New Peer ID: %d\n", my_peer_id);
+            log_info("New Peer ID: %d", my_peer_id);
+        }
+
+        if (shm != NULL)
+        {
+            conn_set_transport(s_sock, &shm_transport, shm);
+            log_debug("Peer %d link 0 in shared memory", *connected_peer_id);
         }
     }
 
@@ -141,629 +833,3334 @@ int handle_peer_accept(int s, int *connected_peer_id, int *server_sock)
 /**
  * @brief Inicia uma conexão ativa com outro peer e realiza o handshake.
  * * Envia uma requisição de conexão para um peer, recebe a resposta e
- * estabelece os IDs de comunicação.
+ * estabelece os IDs de comunicação. O formato compacto é oferecido na
+ * requisição e passa a ser usado se o peer o aceitar na resposta; o mesmo
+ * vale para o link em memória compartilhada, oferecido a um peer local.
  * * @param s O socket para se conectar.
  * @param connected_peer_id Ponteiro para armazenar o ID do peer ao qual se conectou.
+ * @param clients_port Destino da porta de clientes do peer (0 = versão sem cluster, que não a informa).
  * @return int O ID deste servidor, recebido do peer.
  */
-int start_active_socket(int s, int *connected_peer_id)
+int start_active_socket(int s, int *connected_peer_id, int *clients_port)
 {
     int my_peer_id;
+    *clients_port = 0;
+
+    peer_set_nodelay(s);
 
     Msg_t msg = {0};
     msg.type = REQ_CONPEER;
+    int shm_listen = shm_offer(&msg, s);
+    wire_offer(&msg);
     send_msg(s, &msg);
     recv_msg(s, &msg);
 
     if (msg.type == ERROR_MSG)
     {
-        close(s);
+        conn_close(s);
         logexit(msg.desc);
     }
 
+    ShmLink_t *shm = NULL;
     if (msg.type == RES_CONPEER)
     {
-        printf("New Peer ID: %d\n", msg.payload);
+        if (wire_offered(&msg))
+        {
+            conn_set_wire(s, WIRE_COMPACT);
+        }
+
+        log_info("New Peer ID: %d", msg.payload);
         my_peer_id = msg.payload;
+        *clients_port = atoi(msg.desc);
+
+        pid_t sl_pid = shm_accepted(&msg);
+        if (shm_listen != -1 && wire_offered(&msg) && sl_pid != 0)
+        {
+            shm = shm_serve(shm_listen, sl_pid);
+            shm_listen = -1;
+        }
 
         *connected_peer_id = get_peer_id(my_peer_id);
         Msg_t resp = {0};
         resp.type = RES_CONPEER;
         resp.payload = *connected_peer_id;
         send_msg(s, &resp);
-        printf("Peer %d connected\n", *connected_peer_id);
+        log_info("Peer %d connected", *connected_peer_id);
+    }
+
+    if (shm_listen != -1)
+    {
+        close(shm_listen);
+    }
+    if (shm != NULL)
+    {
+        conn_set_transport(s, &shm_transport, shm);
+        log_debug("Peer %d link 0 in shared memory", *connected_peer_id);
     }
 
     return my_peer_id;
 }
 
 /**
- * @brief Inicializa o socket para aceitar conexões de clientes.
- * * Cria um socket, o associa a um endereço/porta e o prepara para
- * escutar conexões de clientes (sensores).
- * * @param clients_storage A estrutura de armazenamento de endereço para clientes.
- * @return int O file descriptor do socket de escuta de clientes.
+ * @brief Conecta o SS aos demais SLs do cluster (opção --cluster).
+ * * Cada SL escuta peers em sua própria porta P2P, no mesmo endereço do
+ * primeiro. O roteamento pelo anel exige que todos informem a porta de
+ * clientes e usem o formato compacto, que devolve o seq das respostas.
+ * * @param ports As portas P2P, separadas por vírgula (NULL = nenhuma).
+ * @param p2p_storage O endereço P2P do primeiro SL.
+ * @param peers Os peers; a posição 0 já está conectada.
+ * @return int O número total de peers.
  */
-int init_clients_socket(struct sockaddr_storage *clients_storage)
+int cluster_connect(const char *ports, const struct sockaddr_storage *p2p_storage, Peer_t *peers)
 {
-    int s = socket(clients_storage->ss_family, SOCK_STREAM, 0);
-    if (s == -1)
-    {
-        logexit("socket");
-    }
+    int npeers = 1;
 
-    int enable = 1;
-    if (0 != setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(int)))
+    while (ports != NULL && *ports != '\0')
     {
-        logexit("setsockopt");
-    }
+        char *end;
+        long port = strtol(ports, &end, 10);
+        if (end == ports || port <= 0 || port > 65535 || npeers == HASHRING_MAX_NODES)
+        {
+            logexit("--cluster");
+        }
+        ports = *end == ',' ? end + 1 : end;
 
-    struct sockaddr *clients_addr = (struct sockaddr *)(clients_storage);
-    socklen_t addrlen = sizeof(struct sockaddr_in);
+        struct sockaddr_storage storage = *p2p_storage;
+        ((struct sockaddr_in *)&storage)->sin_port = htons((uint16_t)port);
+        int s = socket(storage.ss_family, SOCK_STREAM, 0);
+        if (s == -1)
+        {
+            logexit("socket");
+        }
+        if (connect(s, (struct sockaddr *)&storage, sizeof(struct sockaddr_in)) != 0)
+        {
+            logexit("connect");
+        }
 
-    if (0 != bind(s, clients_addr, addrlen))
-    {
-        logexit("bind");
+        Peer_t *peer = &peers[npeers++];
+        peer->sock = s;
+        peer->self_id = start_active_socket(s, &peer->id, &peer->clients_port);
     }
-    if (0 != listen(s, 10))
+
+    for (int i = 0; npeers > 1 && i < npeers; i++)
     {
-        logexit("listen");
+        if (peers[i].clients_port == 0 || conn_get_wire(peers[i].sock) != WIRE_COMPACT)
+        {
+            logexit("SL without cluster support");
+        }
     }
 
-    return s;
+    if (npeers > 1)
+    {
+        log_info("Cluster of %d SLs", npeers);
+    }
+    return npeers;
 }
 
 /**
- * @brief Trata a requisição CHECKALERT de um peer.
- * * Esta função é chamada quando o servidor de localização recebe uma
- * requisição do servidor de status. Ela envia a localização do sensor
- * solicitado de volta para o peer.
- * * @param peer_socket O socket do peer.
- * @param client O cliente (sensor) cuja localização é solicitada.
- * @param next_client_index (Não utilizado aqui)
+ * @brief Abre os links do pool do SS com cada SL (opção --peer-conns).
+ * * Cada link é uma nova conexão com a porta P2P do SL, identificada pelo ID
+ * que o SL atribuiu ao SS no handshake. Como as respostas são associadas às
+ * consultas pelo seq, os links exigem o formato compacto; com um SL legado,
+ * o SS fica só com o link 0.
+ * * @param peers Os peers (SLs), com o link 0 já conectado.
+ * @param npeers O número de peers.
+ * @param nlinks O número de links desejado com cada SL (incluindo o link 0).
+ * @return int O número de links com cada SL.
+ */
+int peer_connect_links(Peer_t *peers, int npeers, int nlinks)
+{
+    for (int i = 0; nlinks > 1 && i < npeers; i++)
+    {
+        if (conn_get_wire(peers[i].sock) != WIRE_COMPACT)
+        {
+            log_warn("Peer %d uses the legacy format, keeping a single link", peers[i].id);
+            return 1;
+        }
+    }
+
+    for (int i = 0; i < npeers; i++)
+    {
+        struct sockaddr_storage storage;
+        socklen_t addrlen = sizeof(storage);
+        if (getpeername(peers[i].sock, (struct sockaddr *)&storage, &addrlen) != 0)
+        {
+            logexit("getpeername");
+        }
+
+        for (int link = 1; link < nlinks; link++)
+        {
+            int s = socket(storage.ss_family, SOCK_STREAM, 0);
+            if (s == -1)
+            {
+                logexit("socket");
+            }
+            if (connect(s, (struct sockaddr *)&storage, addrlen) != 0)
+            {
+                logexit("connect");
+            }
+            peer_set_nodelay(s);
+
+            Msg_t msg = {0};
+            msg.type = REQ_PEERLINK;
+            msg.payload = peers[i].self_id;
+            snprintf(msg.desc, sizeof(msg.desc), "%d", link);
+            int shm_listen = shm_offer(&msg, s);
+            wire_offer(&msg);
+            send_msg(s, &msg);
+
+            memset(&msg, 0, sizeof(msg));
+            if (recv_msg(s, &msg) <= 0 || msg.type != RES_PEERLINK || !wire_offered(&msg))
+            {
+                logexit("peer link");
+            }
+            conn_set_wire(s, WIRE_COMPACT);
+            peers[i].links[link] = s;
+
+            pid_t sl_pid = shm_accepted(&msg);
+            if (shm_listen != -1 && sl_pid != 0)
+            {
+                ShmLink_t *shm = shm_serve(shm_listen, sl_pid);
+                if (shm != NULL)
+                {
+                    conn_set_transport(s, &shm_transport, shm);
+                    log_debug("Peer %d link %d in shared memory", peers[i].id, link);
+                }
+            }
+            else if (shm_listen != -1)
+            {
+                close(shm_listen);
+            }
+        }
+    }
+
+    if (nlinks > 1)
+    {
+        log_info("%d links per peer", nlinks);
+    }
+    return nlinks;
+}
+
+/**
+ * @brief Inicializa o socket para aceitar conexões de clientes.
+ * * Cria um socket não bloqueante, o associa a um endereço/porta e o prepara
+ * para escutar conexões de clientes (sensores). O modo não bloqueante permite
+ * esvaziar a fila de conexões pendentes a cada notificação do epoll.
+ * * @param clients_storage A estrutura de armazenamento de endereço para clientes.
+ * @param reuseport Se diferente de zero, permite que vários sockets (um por
+ * worker) escutem na mesma porta.
+ * @param backlog O tamanho da fila de conexões ainda não aceitas (limitado
+ * pelo kernel a net.core.somaxconn).
+ * @return int O file descriptor do socket de escuta de clientes.
+ */
+int init_clients_socket(struct sockaddr_storage *clients_storage, int reuseport, int backlog)
+{
+    int s = socket(clients_storage->ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (s == -1)
+    {
+        logexit("socket");
+    }
+
+    int enable = 1;
+    if (0 != setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(int)))
+    {
+        logexit("setsockopt");
+    }
+    if (reuseport && 0 != setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(int)))
+    {
+        logexit("setsockopt");
+    }
+
+    struct sockaddr *clients_addr = (struct sockaddr *)(clients_storage);
+    socklen_t addrlen = sizeof(struct sockaddr_in);
+
+    if (0 != bind(s, clients_addr, addrlen))
+    {
+        logexit("bind");
+    }
+    if (0 != listen(s, backlog))
+    {
+        logexit("listen");
+    }
+
+    return s;
+}
+
+/**
+ * @brief Inicializa o socket AF_UNIX para aceitar conexões de clientes locais.
+ * * O socket é SOCK_SEQPACKET, que preserva os limites de cada envio e evita
+ * a pilha TCP para sensores e ferramentas na mesma máquina. Um arquivo de
+ * socket deixado por uma execução anterior é removido antes do bind.
+ * * @param path O caminho base (opção --unix); o socket fica em "<caminho>.<porta>".
+ * @param port A porta de clientes deste servidor.
+ * @param backlog O tamanho da fila de conexões ainda não aceitas.
+ * @return int O file descriptor do socket de escuta, ou -1 se `path` é NULL.
+ */
+int init_unix_socket(const char *path, int port, int backlog)
+{
+    if (path == NULL)
+    {
+        return -1;
+    }
+
+    struct sockaddr_storage storage;
+    if (unix_sockaddr_init(path, port, &storage) != 0)
+    {
+        logexit("--unix");
+    }
+
+    int s = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (s == -1)
+    {
+        logexit("socket");
+    }
+
+    unlink(((struct sockaddr_un *)&storage)->sun_path);
+    if (0 != bind(s, (struct sockaddr *)&storage, sockaddr_len(&storage)))
+    {
+        logexit("bind");
+    }
+    if (0 != listen(s, backlog))
+    {
+        logexit("listen");
+    }
+
+    return s;
+}
+
+/**
+ * @brief Fecha o socket de escuta AF_UNIX e remove o seu arquivo.
+ * @param session A sessão.
+ * @param path O caminho base (opção --unix).
+ */
+void close_unix_socket(Session_t *session, const char *path)
+{
+    if (session->unix_socket == -1)
+    {
+        return;
+    }
+
+    struct sockaddr_storage storage;
+    if (unix_sockaddr_init(path, session->clients_port, &storage) == 0)
+    {
+        unlink(((struct sockaddr_un *)&storage)->sun_path);
+    }
+    close(session->unix_socket);
+    session->unix_socket = -1;
+}
+
+/**
+ * @brief Retorna quantos file descriptors o processo pode abrir.
+ * * Dimensiona as tabelas indexadas pelo fd, como a tabela de conexões (ver conn_get).
+ * * @return int O limite (no mínimo 1024).
+ */
+int fd_limit(void)
+{
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY && rl.rlim_cur > 1024)
+    {
+        return (int)rl.rlim_cur;
+    }
+    return 1024;
+}
+
+/**
+ * @brief Retorna o shard responsável por um ID de sensor.
+ * @param session A sessão.
+ * @param id O ID do sensor.
+ * @return Shard_t* O shard que guarda o sensor.
+ */
+Shard_t *shard_for(Session_t *session, int id)
+{
+    return &session->shards[(uint32_t)id % session->nshards];
+}
+
+/**
+ * @brief Reserva uma vaga no limite global de sensores.
+ * @param session A sessão.
+ * @return int 1 se a vaga foi reservada, 0 se o limite foi atingido.
+ */
+int session_reserve(Session_t *session)
+{
+    if (atomic_fetch_add(&session->sensors, 1) >= session->max_sensors)
+    {
+        atomic_fetch_sub(&session->sensors, 1);
+        return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Busca um sensor em seu shard e copia seus dados.
+ * * A cópia permite liberar a trava do shard antes de tratar a requisição.
+ * * @param session A sessão.
+ * @param id O ID do sensor.
+ * @param out Destino da cópia.
+ * @return int 1 se o sensor foi encontrado, 0 caso contrário.
+ */
+int session_find(Session_t *session, int id, Client_t *out)
+{
+    Shard_t *shard = shard_for(session, id);
+
+    pthread_mutex_lock(&shard->lock);
+    Client_t *client = registry_find(&shard->registry, id);
+    if (client != NULL)
+    {
+        *out = *client;
+    }
+    pthread_mutex_unlock(&shard->lock);
+
+    return client != NULL;
+}
+
+/**
+ * @brief Remove um sensor pelo ID.
+ * @param session A sessão.
+ * @param id O ID do sensor.
+ * @return int 1 se o sensor foi removido, 0 se ele não estava registrado.
+ */
+int session_remove(Session_t *session, int id)
+{
+    Shard_t *shard = shard_for(session, id);
+
+    pthread_mutex_lock(&shard->lock);
+    Client_t *client = registry_find(&shard->registry, id);
+    if (client != NULL)
+    {
+        if (session->store != NULL)
+        {
+            store_remove(session->store, client->record);
+        }
+        if (client->socket_id != -1)
+        {
+            atomic_fetch_sub(&session->sensors, 1);
+        }
+        registry_remove(&shard->registry, client);
+    }
+    pthread_mutex_unlock(&shard->lock);
+
+    return client != NULL;
+}
+
+/**
+ * @brief Remove o sensor associado a um socket, se houver.
+ * * O socket não identifica o shard do sensor, então todos são consultados.
+ * Isso só ocorre em desconexões, de modo que o custo O(shards) não afeta
+ * as requisições.
+ * * @param session A sessão.
+ * @param sock O socket do sensor.
+ * @param id Destino do ID do sensor removido.
+ * @return int 1 se um sensor foi removido, 0 caso contrário.
+ */
+int session_remove_socket(Session_t *session, int sock, int *id)
+{
+    for (uint32_t i = 0; i < session->nshards; i++)
+    {
+        Shard_t *shard = &session->shards[i];
+
+        pthread_mutex_lock(&shard->lock);
+        Client_t *client = registry_find_by_socket(&shard->registry, sock);
+        if (client != NULL)
+        {
+            *id = client->id;
+            if (session->store != NULL)
+            {
+                store_remove(session->store, client->record);
+            }
+            registry_remove(&shard->registry, client);
+            atomic_fetch_sub(&session->sensors, 1);
+        }
+        pthread_mutex_unlock(&shard->lock);
+
+        if (client != NULL)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Registra nos shards os sensores gravados no estado persistente.
+ * * Os sensores recuperados ficam sem conexão até se reconectarem com o mesmo
+ * ID, quando retomam a localização ou o status que já tinham (ver
+ * `handle_client_handshake`), sem que o servidor precise recebê-los de novo.
+ * Eles só ocupam uma vaga de `max_sensors` ao se reconectarem; os que não o
+ * fizerem dentro de `reclaim_timeout` são descartados (ver `session_expire_restored`).
+ * * @param session A sessão (antes de os workers serem iniciados).
+ */
+void session_restore(Session_t *session)
+{
+    StoreRecord_t rec;
+    uint32_t cursor = 0;
+    uint32_t count = 0;
+
+    // Os IDs se distribuem uniformemente entre os shards (ver shard_for)
+    uint32_t expected = store_count(session->store) / session->nshards + 1;
+    for (int i = 0; i < session->nshards; i++)
+    {
+        registry_reserve(&session->shards[i].registry, expected);
+    }
+
+    // O arquivo não contém IDs repetidos: um sensor só é gravado ao ser adicionado ao registro
+    while (store_next(session->store, &cursor, &rec))
+    {
+        Registry_t *reg = &shard_for(session, rec.id)->registry;
+        Client_t *client = registry_add(reg, rec.id, -1, rec.data);
+        client->record = cursor - 1;
+        count++;
+    }
+
+    log_info("Restored %u sensors", count);
+}
+
+/**
+ * @brief Descarta os sensores recuperados que não se reconectaram no prazo.
+ * * São removidos do registro e do estado persistente, como em um REQ_DISCSEN.
+ * * @param session A sessão.
+ */
+void session_expire_restored(Session_t *session)
+{
+    uint32_t expired = 0;
+    for (uint32_t i = 0; i < session->nshards; i++)
+    {
+        Shard_t *shard = &session->shards[i];
+
+        pthread_mutex_lock(&shard->lock);
+        uint32_t cursor = 0;
+        Client_t *client;
+        // A remoção só libera a posição do sensor, então a iteração continua válida
+        while ((client = registry_next(&shard->registry, &cursor)) != NULL)
+        {
+            if (client->socket_id == -1)
+            {
+                store_remove(session->store, client->record);
+                registry_remove(&shard->registry, client);
+                expired++;
+            }
+        }
+        pthread_mutex_unlock(&shard->lock);
+    }
+
+    if (expired > 0)
+    {
+        log_info("Expired %u restored sensors", expired);
+    }
+}
+
+/**
+ * @brief Guarda no SS a localização de um sensor informada pelo SL.
+ * * A localização de um sensor no SL nunca muda enquanto ele está registrado,
+ * então o SS a reaproveita nas próximas consultas de status. Sensores ainda
+ * não registrados no SS são ignorados; a localização deles é obtida na
+ * primeira consulta.
+ * * @param session A sessão.
+ * @param id O ID do sensor.
+ * @param loc A localização (<= 0 invalida a entrada).
+ */
+void session_cache_loc(Session_t *session, int id, int loc)
+{
+    Shard_t *shard = shard_for(session, id);
+
+    pthread_mutex_lock(&shard->lock);
+    Client_t *client = registry_find(&shard->registry, id);
+    if (client != NULL)
+    {
+        client->loc = loc > 0 ? loc : 0;
+    }
+    pthread_mutex_unlock(&shard->lock);
+}
+
+/**
+ * @brief Aloca um job vazio do tipo indicado.
+ * @param kind O tipo do job.
+ * @return Job_t* O job alocado.
+ */
+Job_t *job_new(JobKind kind)
+{
+    Job_t *job = calloc(1, sizeof(Job_t));
+    if (job == NULL)
+    {
+        logexit("calloc");
+    }
+
+    job->kind = kind;
+    return job;
+}
+
+/**
+ * @brief Entrega um job na caixa de entrada de um worker e o acorda.
+ * * Pode ser chamada por qualquer thread. O eventfd é sinalizado somente
+ * após a inserção estar completa, garantindo que o worker encontre o job.
+ * * @param worker O worker de destino.
+ * @param job O job (passa a pertencer ao destino).
+ */
+void worker_post(Worker_t *worker, Job_t *job)
+{
+    mpsc_push(&worker->inbox, &job->node);
+
+    uint64_t one = 1;
+    if (write(worker->inbox_fd, &one, sizeof(one)) == -1 && errno != EAGAIN)
+    {
+        logexit("write");
+    }
+}
+
+/**
+ * @brief Informa ao SS a localização de um sensor registrado ou removido do SL.
+ * * Peers no formato legado não conhecem SENSLOC_NOTIFY e não são avisados;
+ * eles continuam a consultar o SL a cada REQ_CHECKALERT. Pode ser chamada
+ * por qualquer worker: a mensagem é enviada pelo worker 0, dono do peer.
+ * * @param self O worker que alterou o registro.
+ * @param id O ID do sensor.
+ * @param loc A localização (-1 = sensor removido).
+ */
+void worker_notify_loc(Worker_t *self, int id, int loc)
+{
+    Session_t *session = self->session;
+    if (session->type != LOC)
+    {
+        return;
+    }
+
+    Msg_t msg = {0};
+    int pair[2] = {id, loc};
+    msg.type = SENSLOC_NOTIFY;
+    batch_format(&msg, pair, 2);
+
+    if (self->id != 0)
+    {
+        Job_t *job = job_new(JOB_PEER_SEND);
+        job->msg = msg;
+        worker_post(&session->workers[0], job);
+    }
+    else if (conn_get_wire(session->peers[0].sock) == WIRE_COMPACT)
+    {
+        send_msg(session->peers[0].sock, &msg);
+    }
+}
+
+/**
+ * @brief Escolhe o SL dono de um sensor.
+ * * Com um único SL, ele é o dono de todos os sensores; em um cluster, o dono
+ * é dado pelo anel de hashing consistente.
+ * * @param session A sessão.
+ * @param id O ID do sensor.
+ * @return int A posição do SL em `session->peers`.
+ */
+int session_peer_for(Session_t *session, int id)
+{
+    HashRing_t *ring = atomic_load_explicit(&session->cluster, memory_order_acquire);
+    return session->npeers > 1 && ring != NULL ? hashring_owner(ring, id) : 0;
+}
+
+/**
+ * @brief Verifica se este SL pode atribuir um ID a um sensor.
+ * * Em um cluster, cada SL só atribui IDs que o anel lhe designa, de modo que
+ * os IDs atribuídos por SLs diferentes nunca colidem e o sensor já fica
+ * registrado no seu dono.
+ * * @param session A sessão.
+ * @param id O ID candidato.
+ * @return int 1 se o ID pertence a este servidor (ou não há cluster), 0 caso contrário.
+ */
+int session_owns(Session_t *session, int id)
+{
+    HashRing_t *ring = atomic_load_explicit(&session->cluster, memory_order_acquire);
+    if (session->type != LOC || ring == NULL || ring->nodes < 2)
+    {
+        return 1;
+    }
+    return ring->keys[hashring_owner(ring, id)] == session->clients_port;
+}
+
+/**
+ * @brief Escolhe o worker que envia ao SL as consultas de um worker.
+ * * O worker w consulta pelo link w % nlinks, que pertence ao worker de mesmo
+ * índice (ver main); um worker sem link próprio entrega as consultas ao dono.
+ * * @param self O worker que originou a consulta.
+ * @return Worker_t* O dono do link.
+ */
+Worker_t *worker_link_owner(Worker_t *self)
+{
+    Session_t *session = self->session;
+    return &session->workers[self->id % session->nlinks];
+}
+
+/**
+ * @brief Retorna o socket do link de um worker com um peer.
+ * @param self O worker dono do link.
+ * @param peer A posição do peer em `session->peers`.
+ * @return int O socket.
+ */
+int worker_link(Worker_t *self, int peer)
+{
+    Session_t *session = self->session;
+    return session->peers[peer].links[self->id % session->nlinks];
+}
+
+/**
+ * @brief Envia uma consulta REQ_CHECKALERT ao SL dono do sensor em nome de um cliente.
+ * * Só pode ser chamada pelo dono de um link (ver `worker_link_owner`): a
+ * resposta chega pelo mesmo link e é associada à consulta pela tabela de
+ * consultas pendentes do worker.
+ * * @param self O worker dono do link.
+ * @param to O cliente que aguarda a resposta.
+ * @param sensor_id O sensor consultado.
+ * @param push 1 para entregar a resposta como um ALERT_MSG não solicitado.
+ */
+void worker_send_checkalert(Worker_t *self, const ReplyTo_t *to, int sensor_id, int push)
+{
+    Session_t *session = self->session;
+    int peer = session_peer_for(session, sensor_id);
+    log_info("Sending REQ_CHECKALERT %d to SL %d", sensor_id, session->peers[peer].id);
+
+    Msg_t msg = {0};
+    msg.type = REQ_CHECKALERT;
+    msg.payload = sensor_id;
+    msg.seq = pending_add(&self->pending, to, sensor_id, NULL, 0, push, peer);
+    send_msg(worker_link(self, peer), &msg);
+}
+
+/**
+ * @brief Consulta aos SLs a localização de todos os sensores em falha de um lote.
+ * * Os sensores são agrupados em um REQ_CHECKALERT_BATCH por SL dono (um só,
+ * sem cluster). Peers no formato legado não conhecem as mensagens em lote e
+ * recebem um REQ_CHECKALERT por sensor; o lote é respondido quando todas as
+ * consultas retornam. Só pode ser chamada pelo dono de um link.
+ * * @param self O worker dono do link.
+ * @param to O cliente que aguarda a resposta.
+ * @param batch O lote (passa a pertencer às consultas pendentes do worker).
+ */
+void worker_send_checkalert_batch(Worker_t *self, const ReplyTo_t *to, StatusBatch_t *batch)
+{
+    Session_t *session = self->session;
+
+    // Um cluster exige o formato compacto (ver main), então só o SL único pode ser legado
+    if (conn_get_wire(session->peers[0].sock) != WIRE_COMPACT)
+    {
+        batch->outstanding = batch->nfailed;
+        for (int i = 0; i < batch->nfailed; i++)
+        {
+            int index = batch->failed[i];
+            Msg_t msg = {0};
+            msg.type = REQ_CHECKALERT;
+            msg.payload = batch->ids[index];
+            msg.seq = pending_add(&self->pending, to, batch->ids[index], batch, index, 0, 0);
+            send_msg(worker_link(self, 0), &msg);
+        }
+        return;
+    }
+
+    int owner[BATCH_MAX_IDS];
+    for (int i = 0; i < batch->nfailed; i++)
+    {
+        owner[i] = session_peer_for(session, batch->ids[batch->failed[i]]);
+    }
+
+    batch->outstanding = 0;
+    for (int peer = 0; peer < session->npeers; peer++)
+    {
+        int ids[BATCH_MAX_IDS];
+        int count = 0;
+        for (int i = 0; i < batch->nfailed; i++)
+        {
+            if (owner[i] == peer)
+            {
+                ids[count++] = batch->ids[batch->failed[i]];
+            }
+        }
+        if (count == 0)
+        {
+            continue;
+        }
+
+        log_info("Sending REQ_CHECKALERT_BATCH %d to SL %d", count, session->peers[peer].id);
+        Msg_t msg = {0};
+        msg.type = REQ_CHECKALERT_BATCH;
+        batch_format(&msg, ids, count);
+        batch->outstanding++;
+        msg.seq = pending_add(&self->pending, to, -1, batch, -1, 0, peer);
+        send_msg(worker_link(self, peer), &msg);
+    }
+}
+
+/**
+ * @brief Entrega uma resposta a um cliente de qualquer worker.
+ * * Clientes de outros workers recebem a resposta pela caixa de entrada do
+ * seu worker, pois só o dono de uma conexão pode escrever nela. Se o cliente
+ * já se desconectou (a geração do fd mudou), a resposta é descartada.
+ * * @param self O worker que produziu a resposta.
+ * @param to O cliente de destino.
+ * @param resp A resposta (recebe o ID de correlação da requisição).
+ */
+void worker_reply(Worker_t *self, const ReplyTo_t *to, Msg_t *resp)
+{
+    resp->seq = to->seq;
+
+    if (to->worker != self->id)
+    {
+        Job_t *job = job_new(JOB_REPLY);
+        job->to = *to;
+        job->msg = *resp;
+        worker_post(&self->session->workers[to->worker], job);
+    }
+    else if (conn_generation(to->client_socket) == to->gen)
+    {
+        send_msg(to->client_socket, resp);
+    }
+}
+
+/**
+ * @brief Trata a requisição CHECKALERT de um peer.
+ * * Esta função é chamada quando o servidor de localização recebe uma
+ * requisição do servidor de status. Ela envia a localização do sensor
+ * solicitado de volta para o peer, com o mesmo ID de correlação da requisição.
+ * * @param peer_socket O socket do peer.
+ * @param client O cliente (sensor) cuja localização é solicitada.
+ * @param seq O ID de correlação da requisição.
  * @param type O tipo de servidor (LOC).
  * @return ServerCommand O estado de continuação do servidor.
  */
-ServerCommand handle_server_checkalert(int peer_socket, Client_t client,
-                                       int *next_client_index, Server type)
+ServerCommand handle_server_checkalert(int peer_socket, Client_t client,
+                                       uint32_t seq, Server type)
+{
+    log_info("Found location of sensor %d: location %d", client.id, client.data);
+    log_info("Sending RES_CHECKALERT %d to SS", client.data);
+
+    Msg_t msg = {0};
+    msg.type = RES_CHECKALERT;
+    msg.payload = client.data;
+    msg.seq = seq;
+    send_msg(peer_socket, &msg);
+    return CONTINUE_RUNNING;
+}
+
+/**
+ * @brief Trata a requisição REQ_CHECKALERT_BATCH de um peer.
+ * * Responde com a localização de cada sensor do lote, na mesma ordem
+ * (-1 para sensores não encontrados), em um único RES_CHECKALERT_BATCH,
+ * pelo mesmo link da requisição.
+ * * @param peer_socket O link pelo qual a requisição chegou.
+ * @param disc A requisição.
+ * @param session A sessão.
+ * @return ServerCommand O estado de continuação do servidor.
+ */
+ServerCommand handle_server_checkalert_batch(int peer_socket, Msg_t *disc, Session_t *session)
+{
+    int ids[BATCH_MAX_IDS];
+    int count = batch_parse(disc, ids, BATCH_MAX_IDS);
+    log_info("REQ_CHECKALERT_BATCH %d", count);
+
+    for (int i = 0; i < count; i++)
+    {
+        Client_t client;
+        int id = ids[i];
+        ids[i] = session_find(session, id, &client) ? client.data : -1;
+        log_debug("Found location of sensor %d: location %d", id, ids[i]);
+    }
+
+    Msg_t msg = {0};
+    msg.type = RES_CHECKALERT_BATCH;
+    msg.seq = disc->seq;
+    batch_format(&msg, ids, count);
+    log_info("Sending RES_CHECKALERT_BATCH %d to SS", count);
+    send_msg(peer_socket, &msg);
+    return CONTINUE_RUNNING;
+}
+
+/**
+ * @brief Preenche um lote com a resposta do peer e o responde quando completo.
+ * @param alert A consulta pendente (referencia o lote).
+ * @param msg A resposta recebida do peer.
+ * @param self O worker dono do link que recebeu a resposta.
+ */
+void status_batch_complete(PendingAlert_t *alert, Msg_t *msg, Worker_t *self)
+{
+    Session_t *session = self->session;
+    StatusBatch_t *batch = alert->batch;
+
+    if (alert->batch_index >= 0)
+    {
+        batch->values[alert->batch_index] = msg->type == RES_CHECKALERT ? msg->payload : -1;
+        session_cache_loc(session, alert->sensor_id, batch->values[alert->batch_index]);
+    }
+    else
+    {
+        // A consulta cobriu, em ordem, os sensores em falha que pertencem ao SL que a respondeu
+        int locs[BATCH_MAX_IDS];
+        int count = msg->type == RES_CHECKALERT_BATCH ? batch_parse(msg, locs, BATCH_MAX_IDS) : 0;
+        int next = 0;
+        for (int i = 0; i < batch->nfailed; i++)
+        {
+            int index = batch->failed[i];
+            if (session_peer_for(session, batch->ids[index]) != alert->peer)
+            {
+                continue;
+            }
+            batch->values[index] = next < count ? locs[next] : -1;
+            next++;
+            if (msg->type == RES_CHECKALERT_BATCH)
+            {
+                session_cache_loc(session, batch->ids[index], batch->values[index]);
+            }
+        }
+    }
+
+    if (--batch->outstanding > 0)
+    {
+        return;
+    }
+
+    Msg_t resp = {0};
+    resp.type = RES_SENSSTATUS_BATCH;
+    batch_format(&resp, batch->values, batch->count);
+    log_info("Sending RES_SENSSTATUS_BATCH %d to CLIENT", batch->count);
+    worker_reply(self, &alert->to, &resp);
+    free(batch);
+}
+
+/**
+ * @brief Trata a resposta do peer a uma consulta REQ_CHECKALERT.
+ * * Localiza a consulta pendente pelo ID de correlação e responde ao cliente
+ * que a originou (ver `worker_reply`). Respostas a consultas de um lote
+ * são acumuladas até que o lote esteja completo.
+ * * @param msg A resposta (`RES_CHECKALERT`, `RES_CHECKALERT_BATCH` ou `ERROR_MSG`) recebida do peer.
+ * @param self O worker dono do link pelo qual a resposta chegou.
+ * @return ServerCommand O estado de continuação do servidor.
+ */
+ServerCommand handle_res_checkalert(Msg_t *msg, Worker_t *self)
+{
+    Session_t *session = self->session;
+    PendingAlert_t alert;
+    if (!pending_take(&self->pending, msg->seq, &alert))
+    {
+        return CONTINUE_RUNNING;
+    }
+
+    metrics_peer_rtt(self->metrics, metrics_now() - alert.sent_at);
+
+    if (alert.batch != NULL)
+    {
+        status_batch_complete(&alert, msg, self);
+        return CONTINUE_RUNNING;
+    }
+
+    session_cache_loc(session, alert.sensor_id, msg->type == RES_CHECKALERT ? msg->payload : 0);
+
+    Msg_t resp = {0};
+
+    if (alert.push)
+    {
+        // O sensor não está registrado no SL: não há área a informar
+        if (msg->type != RES_CHECKALERT)
+        {
+            log_info("ERROR(%d) received from SL, alert for sensor %d dropped", msg->payload, alert.sensor_id);
+            return CONTINUE_RUNNING;
+        }
+
+        log_info("Sending ALERT %d to CLIENT %d", msg->payload, alert.sensor_id);
+        resp.type = ALERT_MSG;
+        resp.payload = msg->payload;
+        worker_reply(self, &alert.to, &resp);
+        return CONTINUE_RUNNING;
+    }
+
+    if (msg->type == ERROR_MSG)
+    {
+        log_info("ERROR(%d) received from SL", msg->payload);
+        log_info("Sending ERROR(%d) to CLIENT", msg->payload);
+        resp.type = ERROR_MSG;
+        resp.payload = 10;
+        strcpy(resp.desc, DESC_ERROR_10);
+    }
+
+    if (msg->type == RES_CHECKALERT)
+    {
+        log_info("RES_CHECKALERT %d", msg->payload);
+        log_info("Sending RES_SENSSTATUS %d to CLIENT", msg->payload);
+
+        resp.type = RES_SENSSTATUS;
+        resp.payload = msg->payload;
+    }
+
+    worker_reply(self, &alert.to, &resp);
+    return CONTINUE_RUNNING;
+}
+
+/**
+ * @brief Altera o status de um sensor no SS e avisa o sensor, se inscrito.
+ * * Quando o status passa a 1 e o sensor está inscrito (REQ_SUBSCRIBE), a
+ * localização é consultada ao SL e entregue ao sensor como um ALERT_MSG
+ * (ver `handle_res_checkalert`). Só pode ser chamada pelo worker 0.
+ * * @param session A sessão.
+ * @param id O ID do sensor.
+ * @param status O novo status (0 ou 1).
+ * @return int 1 se o sensor foi encontrado, 0 caso contrário.
+ */
+int session_set_status(Session_t *session, int id, int status)
+{
+    Shard_t *shard = shard_for(session, id);
+
+    pthread_mutex_lock(&shard->lock);
+    Client_t *client = registry_find(&shard->registry, id);
+    if (client == NULL)
+    {
+        pthread_mutex_unlock(&shard->lock);
+        return 0;
+    }
+
+    int notify = client->subscribed && client->data != 1 && status == 1;
+    int loc = client->loc;
+    ReplyTo_t to = {client->worker, client->socket_id, client->gen, 0};
+    registry_set_data(&shard->registry, client, status);
+    if (session->store != NULL)
+    {
+        store_set(session->store, client->record, status);
+    }
+    pthread_mutex_unlock(&shard->lock);
+
+    log_info("Sensor %d status = %d", id, status);
+    if (notify && loc > 0)
+    {
+        Msg_t alert = {0};
+        alert.type = ALERT_MSG;
+        alert.payload = loc;
+        log_info("Sending ALERT %d to CLIENT %d", loc, id);
+        worker_reply(&session->workers[0], &to, &alert);
+    }
+    else if (notify)
+    {
+        // O worker 0 é o dono do link 0
+        worker_send_checkalert(&session->workers[0], &to, id, 1);
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Passa a monitorar um link com um peer na instância epoll do seu dono.
+ * @param worker O dono do link.
+ * @param peer A posição do peer em `session->peers`.
+ * @param link O índice do link.
+ */
+void worker_watch_link(Worker_t *worker, int peer, int link)
+{
+    int sock = worker->session->peers[peer].links[link];
+    conn_set_nonblocking(sock);
+
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.u64 = ((uint64_t)FD_PEER << 32) | (uint32_t)(peer * PEER_LINKS_MAX + link);
+    if (epoll_ctl(worker->epfd, EPOLL_CTL_ADD, sock, &ev) != 0)
+    {
+        logexit("epoll_ctl");
+    }
+
+    // Em memória compartilhada, dados e espaço livre chegam pela campainha; o socket só indica o fim
+    int bell = conn_transport_fd(sock);
+    if (bell != -1)
+    {
+        ev.events = EPOLLIN | EPOLLET;
+        if (epoll_ctl(worker->epfd, EPOLL_CTL_ADD, bell, &ev) != 0)
+        {
+            logexit("epoll_ctl");
+        }
+    }
+}
+
+/**
+ * @brief Assume no SL um link do pool aceito pelo worker 0.
+ * @param self O dono do link.
+ * @param sock O socket do link.
+ * @param link O índice do link.
+ */
+void worker_add_link(Worker_t *self, int sock, int link)
+{
+    Peer_t *peer = &self->session->peers[0];
+    if (peer->links[link] != 0)
+    {
+        log_warn("Duplicate peer link %d", link);
+        conn_close(sock);
+        return;
+    }
+
+    peer->links[link] = sock;
+    worker_watch_link(self, 0, link);
+    log_debug("Peer link %d on worker %d", link, self->id);
+}
+
+/**
+ * @brief Processa os jobs recebidos na caixa de entrada de um worker.
+ * * @param self O worker.
+ * @return ServerCommand TERMINATE_P2P_CONNECTION se o worker deve encerrar,
+ * CONTINUE_RUNNING caso contrário.
+ */
+ServerCommand handle_inbox(Worker_t *self)
+{
+    uint64_t count;
+    if (read(self->inbox_fd, &count, sizeof(count)) == -1 && errno != EAGAIN)
+    {
+        logexit("read");
+    }
+
+    ServerCommand status = CONTINUE_RUNNING;
+    MpscNode_t *node;
+    while ((node = mpsc_pop(&self->inbox)) != NULL)
+    {
+        Job_t *job = (Job_t *)node;
+        switch (job->kind)
+        {
+        case JOB_CHECKALERT:
+            worker_send_checkalert(self, &job->to, job->msg.payload, 0);
+            break;
+        case JOB_ALERT:
+            worker_send_checkalert(self, &job->to, job->msg.payload, 1);
+            break;
+        case JOB_PEER_SEND:
+            if (conn_get_wire(self->session->peers[0].sock) == WIRE_COMPACT)
+            {
+                send_msg(self->session->peers[0].sock, &job->msg);
+            }
+            break;
+        case JOB_CHECKALERT_BATCH:
+            worker_send_checkalert_batch(self, &job->to, job->batch);
+            job->batch = NULL;
+            break;
+        case JOB_PEER_LINK:
+            worker_add_link(self, job->msg.payload, (int)job->msg.seq);
+            break;
+        case JOB_PEER_LOST:
+            log_info("Peer link lost");
+            *self->session->connected_peer_id = -1;
+            status = TERMINATE_P2P_CONNECTION;
+            break;
+        case JOB_REPLY:
+            if (conn_generation(job->to.client_socket) == job->to.gen)
+            {
+                send_msg(job->to.client_socket, &job->msg);
+            }
+            break;
+        case JOB_STOP:
+            status = TERMINATE_P2P_CONNECTION;
+            break;
+        }
+        free(job);
+    }
+
+    return status;
+}
+
+/**
+ * @brief Processa a entrada do usuário via terminal (stdin).
+ * * Detecta o comando "kill" para iniciar o processo de desconexão
+ * do peer e encerrar o servidor de forma limpa, e o comando
+ * "log <nível>" para alterar o nível de log em execução. No SS, o comando
+ * "status <sensor> <0|1>" altera o status de um sensor.
+ * * @param buf Buffer para ler a entrada.
+ * @param session A sessão (a entrada padrão pertence ao worker 0).
+ * @return ServerCommand Retorna SERVER_SHUTDOWN para encerrar ou CONTINUE_RUNNING.
+ */
+ServerCommand handle_stdin_input(char *buf, Session_t *session)
+{
+    memset(buf, 0, BUFSZ);
+    if (fgets(buf, BUFSZ, stdin) != NULL)
+    {
+        if (strncmp(buf, "kill", 4) == 0)
+        {
+            // No SS de um cluster, todos os SLs são desconectados
+            for (int i = 0; i < session->npeers; i++)
+            {
+                int server_socket = session->peers[i].sock;
+                Msg_t disc = {0};
+                disc.type = REQ_DISCPEER;
+                disc.payload = session->peers[i].self_id;
+
+                send_msg(server_socket, &disc);
+
+                // Quadros assíncronos do peer (heartbeats, notificações, rotas e respostas a
+                // consultas ainda em andamento, inclusive o ERROR 10 de um REQ_CHECKALERT)
+                // podem chegar antes da resposta e são descartados
+                int received;
+                do
+                {
+                    memset(&disc, 0, sizeof(disc));
+                    received = recv_msg(server_socket, &disc) > 0;
+                } while (received && disc.type != OK_MSG &&
+                         (disc.type != ERROR_MSG || disc.payload == 10));
+
+                if (!received)
+                {
+                    continue;
+                }
+
+                if (disc.type == OK_MSG)
+                {
+                    log_info("%s", disc.desc);
+                    log_info("Peer %d disconnected", disc.payload);
+                }
+                else
+                {
+                    logexit(disc.desc);
+                }
+            }
+
+            return SERVER_SHUTDOWN;
+        }
+
+        if (strncmp(buf, "log ", 4) == 0)
+        {
+            LogLevel level;
+            buf[strcspn(buf, "\r\n")] = '\0';
+            if (log_parse_level(buf + 4, &level) == 0)
+            {
+                log_set_level(level);
+            }
+            else
+            {
+                log_warn("Invalid log level: %s", buf + 4);
+            }
+        }
+
+        if (strncmp(buf, "status ", 7) == 0)
+        {
+            int id, value;
+            if (session->type != STATUS || sscanf(buf + 7, "%d %d", &id, &value) != 2 || (value != 0 && value != 1))
+            {
+                log_warn("Usage: status <sensor> <0|1> (SS only)");
+            }
+            else if (!session_set_status(session, id, value))
+            {
+                log_warn("Sensor %d not found", id);
+            }
+        }
+    }
+    return CONTINUE_RUNNING;
+}
+
+
+/**
+ * @brief Guarda no SL o anel do cluster enviado pelo SS (`RES_ROUTES`).
+ * * O anel é publicado uma única vez por sessão e lido sem trava pelos
+ * workers ao atribuir IDs (ver `session_owns`).
+ * * @param disc A mensagem com as portas de clientes dos SLs.
+ * @param session A sessão.
+ */
+void session_set_cluster(Msg_t *disc, Session_t *session)
+{
+    int keys[HASHRING_MAX_NODES];
+    int count = batch_parse(disc, keys, HASHRING_MAX_NODES);
+    HashRing_t *ring = malloc(sizeof(HashRing_t));
+    if (ring == NULL)
+    {
+        logexit("malloc");
+    }
+
+    HashRing_t *expected = NULL;
+    if (hashring_init(ring, keys, count) != 0 ||
+        !atomic_compare_exchange_strong_explicit(&session->cluster, &expected, ring, memory_order_release,
+                                                 memory_order_relaxed))
+    {
+        free(ring);
+        return;
+    }
+    log_info("Joined cluster of %d SLs", count);
+}
+
+/**
+ * @brief Trata uma única mensagem recebida de um peer.
+ * * Processa diferentes tipos de mensagens do peer, como desconexão (`REQ_DISCPEER`),
+ * verificação de alerta (`REQ_CHECKALERT`) e as respostas a essas verificações.
+ * Consultas e respostas podem chegar por qualquer link do pool; as mensagens
+ * de controle só trafegam pelo link 0, do worker 0.
+ * * @param disc A mensagem recebida.
+ * @param self O worker dono do link.
+ * @param peer O peer que enviou a mensagem.
+ * @param server_socket O link pelo qual a mensagem chegou.
+ * @return ServerCommand O estado de continuação do servidor.
+ */
+ServerCommand handle_peer_msg(Msg_t *disc, Worker_t *self, Peer_t *peer, int server_socket)
+{
+    Session_t *session = self->session;
+
+    if (disc->type == REQ_DISCPEER)
+    {
+        if (disc->payload != peer->id)
+        {
+            Msg_t err = {0};
+            err.type = ERROR_MSG;
+            err.payload = 2;
+            strcpy(err.desc, DESC_ERROR_02);
+            send_msg(server_socket, &err);
+            return CONTINUE_RUNNING;
+        }
+
+        Msg_t ok = {0};
+        ok.type = OK_MSG;
+        ok.payload = peer->id;
+        strcpy(ok.desc, DESC_OK_01);
+        send_msg(server_socket, &ok);
+        log_info("Peer %d disconnected", peer->id);
+
+        *session->connected_peer_id = -1;
+        return TERMINATE_P2P_CONNECTION;
+    }
+
+    if (disc->type == REQ_CHECKALERT)
+    {
+        log_info("REQ_CHECKALERT %d", disc->payload);
+        Client_t client;
+        if (session_find(session, disc->payload, &client))
+        {
+            return handle_server_checkalert(server_socket, client, disc->seq, LOC);
+        }
+
+        Msg_t err = {0};
+        err.type = ERROR_MSG;
+        err.payload = 10;
+        err.seq = disc->seq;
+        strcpy(err.desc, DESC_ERROR_10);
+        log_info("ERROR(10) - Sensor not found");
+        send_msg(server_socket, &err);
+
+        return CONTINUE_RUNNING;
+    }
+
+    if (disc->type == REQ_CHECKALERT_BATCH)
+    {
+        return handle_server_checkalert_batch(server_socket, disc, session);
+    }
+
+    if (disc->type == HEARTBEAT)
+    {
+        peer->beats = 1;
+        return CONTINUE_RUNNING;
+    }
+
+    if (disc->type == RES_ROUTES)
+    {
+        session_set_cluster(disc, session);
+        return CONTINUE_RUNNING;
+    }
+
+    if (disc->type == SENSLOC_NOTIFY)
+    {
+        int pair[2];
+        if (batch_parse(disc, pair, 2) == 2)
+        {
+            log_debug("SENSLOC_NOTIFY %d %d", pair[0], pair[1]);
+            session_cache_loc(session, pair[0], pair[1]);
+        }
+        return CONTINUE_RUNNING;
+    }
+
+    if (disc->type == RES_CHECKALERT || disc->type == RES_CHECKALERT_BATCH || disc->type == ERROR_MSG)
+    {
+        return handle_res_checkalert(disc, self);
+    }
+
+    return CONTINUE_RUNNING;
+}
+
+/**
+ * @brief Gerencia a comunicação e as mensagens recebidas de um peer.
+ * * Como o socket do peer é monitorado em modo edge-triggered, ele é lido até
+ * se esvaziar e todas as mensagens completas remontadas no buffer da conexão
+ * são tratadas antes de retornar ao loop de eventos. A perda de qualquer SL
+ * do cluster, ou de qualquer link do pool, encerra a sessão; um worker
+ * secundário a comunica ao worker 0, que é quem a encerra.
+ * * @param self O worker dono do link.
+ * @param peer O peer com atividade.
+ * @param link O índice do link com atividade.
+ * @return ServerCommand O estado de continuação do servidor.
+ */
+ServerCommand handle_peer_activity(Worker_t *self, Peer_t *peer, int link)
+{
+    Session_t *session = self->session;
+    int server_socket = peer->links[link];
+    ConnFill fill;
+    do
+    {
+        fill = conn_fill(server_socket);
+
+        Msg_t disc;
+        int len;
+        while ((len = conn_next_msg(server_socket, &disc)) > 0)
+        {
+            int type = disc.type;
+            uint64_t start = metrics_now();
+            if (link == 0)
+            {
+                // Os heartbeats trafegam no link 0 (ver handle_heartbeat)
+                peer->last_rx = start;
+            }
+            ServerCommand status = handle_peer_msg(&disc, self, peer, server_socket);
+            metrics_count(self->metrics, METRIC_PEER, type, metrics_now() - start);
+            if (status != CONTINUE_RUNNING)
+            {
+                return status;
+            }
+        }
+
+        if ((len < 0 || fill == CONN_CLOSED) && self->id != 0)
+        {
+            log_debug("Peer %d link %d closed", peer->id, link);
+            epoll_ctl(self->epfd, EPOLL_CTL_DEL, server_socket, NULL);
+            if (conn_transport_fd(server_socket) != -1)
+            {
+                epoll_ctl(self->epfd, EPOLL_CTL_DEL, conn_transport_fd(server_socket), NULL);
+            }
+            worker_post(&session->workers[0], job_new(JOB_PEER_LOST));
+            return CONTINUE_RUNNING;
+        }
+
+        if (len < 0 || fill == CONN_CLOSED)
+        {
+            log_info("Peer %d disconnected", peer->id);
+            *session->connected_peer_id = -1;
+            return TERMINATE_P2P_CONNECTION;
+        }
+    } while (fill == CONN_FULL);
+
+    return CONTINUE_RUNNING;
+}
+
+/**
+ * @brief Aceita uma conexão na porta P2P durante uma sessão.
+ * * Um link do pool do SS (REQ_PEERLINK com o ID que este SL lhe atribuiu)
+ * é entregue ao worker que o atende; qualquer outra conexão é recusada, pois
+ * o SL atende um único SS por vez. O handshake é bloqueante, como o do link 0.
+ * * @param self O worker 0.
+ */
+void session_accept_link(Worker_t *self)
+{
+    Session_t *session = self->session;
+    int sock = accept(session->listen_socket, NULL, NULL);
+    if (sock == -1)
+    {
+        log_warn("accept: %s", strerror(errno));
+        return;
+    }
+    peer_set_nodelay(sock);
+
+    Msg_t msg = {0};
+    int link = 0;
+    if (recv_msg(sock, &msg) > 0 && msg.type == REQ_PEERLINK && wire_offered(&msg) &&
+        msg.payload == *session->connected_peer_id)
+    {
+        link = atoi(msg.desc);
+    }
+
+    if (session->type != LOC || link < 1 || link >= PEER_LINKS_MAX)
+    {
+        Msg_t err = {0};
+        err.type = ERROR_MSG;
+        err.payload = PEER_LIMIT_ERROR;
+        strcpy(err.desc, "Peer limit exceeded");
+        send_msg(sock, &err);
+        conn_close(sock);
+        return;
+    }
+
+    Msg_t resp = {0};
+    resp.type = RES_PEERLINK;
+    resp.payload = link;
+    int shm_sock = shm_answer(&msg, &resp, sock);
+    wire_offer(&resp);
+    send_msg(sock, &resp);
+    conn_set_wire(sock, WIRE_COMPACT);
+
+    ShmLink_t *shm = shm_sock != -1 ? shm_join(shm_sock) : NULL;
+    if (shm != NULL)
+    {
+        conn_set_transport(sock, &shm_transport, shm);
+        log_debug("Peer link %d in shared memory", link);
+    }
+
+    Worker_t *owner = &session->workers[link % session->nworkers];
+    if (owner == self)
+    {
+        worker_add_link(self, sock, link);
+        return;
+    }
+
+    Job_t *job = job_new(JOB_PEER_LINK);
+    job->msg.payload = sock;
+    job->msg.seq = (uint32_t)link;
+    worker_post(owner, job);
+}
+
+/**
+ * @brief Registra no shard do seu ID o sensor de um REQ_CONNSEN.
+ * * Com ID_ASSIGN, atribui um ID novo, devolvido em `msg->payload`. Um ID
+ * recuperado do estado persistente (ainda sem conexão) é retomado com o dado
+ * que já tinha; um ID em uso por uma conexão ativa é recusado, para que um
+ * cliente não tome o sensor de outro.
+ * * @param self O worker que aceitou a conexão.
+ * @param csock O socket do cliente.
+ * @param msg A requisição (recebe o ID atribuído).
+ * @param client_data Destino do dado (localização ou status) do sensor.
+ * @param reconnected Recebe 1 se o ID foi retomado do estado persistente.
+ * @return int 0 se o sensor foi admitido, ou o código do ERROR_MSG da recusa
+ * (CLIENT_LIMIT_ERROR ou SENSOR_IN_USE_ERROR).
+ */
+int session_admit(Worker_t *self, int csock, Msg_t *msg, int *client_data, int *reconnected)
+{
+    Session_t *session = self->session;
+    int assign = msg->payload == ID_ASSIGN;
+    // Cada worker atribui IDs do seu próprio shard, sem disputar a trava dos outros
+    Shard_t *shard = assign ? &session->shards[self->id % session->nshards] : shard_for(session, msg->payload);
+    int error = 0;
+
+    pthread_mutex_lock(&shard->lock);
+    if (assign)
+    {
+        // Pula IDs já usados por sensores que escolheram o próprio ID ou que foram
+        // recuperados e, em um cluster, os que pertencem a outros SLs
+        do
+        {
+            msg->payload = shard->next_id;
+            shard->next_id += session->nshards;
+        } while (registry_find(&shard->registry, msg->payload) != NULL || !session_owns(session, msg->payload));
+    }
+
+    Client_t *existing = assign ? NULL : registry_find(&shard->registry, msg->payload);
+    if (existing != NULL && existing->socket_id != -1)
+    {
+        // A conexão que registrou o ID continua com ele até se desconectar
+        error = SENSOR_IN_USE_ERROR;
+    }
+    else if (existing != NULL && !session_reserve(session))
+    {
+        // Um sensor recuperado só ocupa uma vaga ao se reconectar
+        error = CLIENT_LIMIT_ERROR;
+    }
+    else if (existing != NULL)
+    {
+        // Sensor recuperado do estado persistente: mantém o dado e recebe o socket
+        *client_data = existing->data;
+        existing->subscribed = 0;
+        registry_attach(&shard->registry, existing, csock);
+        *reconnected = 1;
+    }
+    else if (session_reserve(session))
+    {
+        *client_data = session->type == LOC ? get_client_loc() : get_client_status();
+        Client_t *client = registry_add(&shard->registry, msg->payload, csock, *client_data);
+        if (session->store != NULL)
+        {
+            client->record = store_add(session->store, msg->payload, *client_data);
+        }
+    }
+    else
+    {
+        error = CLIENT_LIMIT_ERROR;
+    }
+    pthread_mutex_unlock(&shard->lock);
+
+    return error;
+}
+
+/**
+ * @brief Realiza o handshake de um cliente (sensor) recém-aceito.
+ * * Adiciona o novo cliente ao shard do seu ID, atribui a ele um dado
+ * (localização ou status) dependendo do tipo de servidor e passa a tratar
+ * seu socket como o de um sensor na instância epoll do worker que o aceitou,
+ * que é o dono da conexão. Clientes que oferecem o formato compacto passam a
+ * usá-lo após a resposta RES_CONNSEN. Uma conexão só de consulta (ID_QUERY)
+ * é atendida como a de um sensor, mas não registra nenhum.
+ * * @param csock O socket do cliente recém-aceito.
+ * @param self O worker que aceitou a conexão.
+ * @param req A primeira mensagem recebida do cliente.
+ */
+void handle_client_handshake(int csock, Worker_t *self, const Msg_t *req)
+{
+    Session_t *session = self->session;
+    Msg_t msg = *req;
+
+    if (msg.type != REQ_CONNSEN)
+    {
+        conn_close(csock);
+        return;
+    }
+
+    uint64_t start = metrics_now();
+    // Conexões só de consulta (ID_QUERY) não registram um sensor
+    int query = msg.payload == ID_QUERY;
+    int reconnected = 0;
+    int client_data = 0;
+    int error = query ? 0 : session_admit(self, csock, &msg, &client_data, &reconnected);
+
+    if (error != 0)
+    {
+        Msg_t err = {0};
+        err.type = ERROR_MSG;
+        err.payload = error;
+        strcpy(err.desc, error == SENSOR_IN_USE_ERROR ? DESC_ERROR_12 : DESC_ERROR_09);
+        send_msg(csock, &err);
+        conn_close(csock);
+        metrics_count(self->metrics, METRIC_CLIENT, REQ_CONNSEN, metrics_now() - start);
+        return;
+    }
+
+    if (!query)
+    {
+        worker_notify_loc(self, msg.payload, client_data);
+    }
+
+    Msg_t resp = {0};
+    memcpy(resp.desc, session->type == LOC ? "SL" : "SS", 2);
+    if (query)
+    {
+        log_info("Query connection on socket %d", csock);
+    }
+    else if (reconnected)
+    {
+        log_info("Client %d reconnected", msg.payload);
+    }
+    else if (session->type == LOC)
+    {
+        log_info("Client %d added (Loc %d)", msg.payload, client_data);
+    }
+    else
+    {
+        log_info("Client %d added (%d)", msg.payload, client_data);
+    }
+
+    // No backend io_uring, o recv multishot armado no handshake continua valendo
+    if (self->ring == NULL && event_modify(self->epfd, csock, FD_SENSOR, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET) != 0)
+    {
+        logexit("epoll_ctl");
+    }
+
+    if (session->idle != NULL && csock < session->idle_cap)
+    {
+        IdleTimer_t *idle = &session->idle[csock];
+        idle->last_active = start;
+        timer_init(&idle->timer, ((uint64_t)TIMER_IDLE << 32) | (uint32_t)csock);
+        timer_arm(&self->wheel, &idle->timer, start + session->idle_timeout);
+    }
+
+    resp.type = RES_CONNSEN;
+    resp.payload = msg.payload;
+    if (wire_offered(&msg))
+    {
+        wire_offer(&resp);
+    }
+    send_msg(csock, &resp);
+
+    if (wire_offered(&msg))
+    {
+        conn_set_wire(csock, WIRE_COMPACT);
+    }
+
+    metrics_count(self->metrics, METRIC_CLIENT, REQ_CONNSEN, metrics_now() - start);
+}
+
+/**
+ * @brief Coloca uma conexão recém-aceita na fila de handshakes do worker.
+ * * O socket é registrado no epoll com a posição na fila (ou recebe um recv
+ * multishot, no backend io_uring), e o REQ_CONNSEN é lido quando chegar, sem
+ * bloquear o worker.
+ * * @param self O worker.
+ * @param csock O socket aceito.
+ */
+void handshake_begin(Worker_t *self, int csock)
+{
+    uint32_t slot = self->handshake_free[--self->handshake_free_count];
+    Handshake_t *hs = &self->handshakes[slot];
+    hs->sock = csock;
+    hs->deadline = metrics_now() + self->session->handshake_timeout;
+    hs->prev = self->handshake_tail;
+    hs->next = HANDSHAKE_NONE;
+
+    if (self->handshake_tail != HANDSHAKE_NONE)
+    {
+        self->handshakes[self->handshake_tail].next = slot;
+    }
+    else
+    {
+        self->handshake_head = slot;
+    }
+    self->handshake_tail = slot;
+
+    if (self->ring != NULL)
+    {
+        // O recv multishot continua armado depois do handshake, quando a conexão vira um sensor
+        self->session->fd_handshake[csock] = slot;
+        uring_recv_multishot(self->ring, csock, uring_data(UR_RECV, conn_generation(csock), csock));
+        return;
+    }
+
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+    ev.data.u64 = ((uint64_t)FD_HANDSHAKE << 32) | slot;
+    if (epoll_ctl(self->epfd, EPOLL_CTL_ADD, csock, &ev) != 0)
+    {
+        logexit("epoll_ctl");
+    }
+}
+
+/**
+ * @brief Retira uma conexão da fila de handshakes (sem fechá-la).
+ * @param self O worker.
+ * @param slot A posição da conexão na fila.
+ */
+void handshake_end(Worker_t *self, uint32_t slot)
+{
+    Handshake_t *hs = &self->handshakes[slot];
+    if (self->session->fd_handshake != NULL)
+    {
+        self->session->fd_handshake[hs->sock] = HANDSHAKE_NONE;
+    }
+
+    if (hs->prev != HANDSHAKE_NONE)
+    {
+        self->handshakes[hs->prev].next = hs->next;
+    }
+    else
+    {
+        self->handshake_head = hs->next;
+    }
+    if (hs->next != HANDSHAKE_NONE)
+    {
+        self->handshakes[hs->next].prev = hs->prev;
+    }
+    else
+    {
+        self->handshake_tail = hs->prev;
+    }
+
+    self->handshake_free[self->handshake_free_count++] = slot;
+}
+
+/**
+ * @brief Fecha as conexões cujo REQ_CONNSEN não chegou no prazo.
+ * @param self O worker.
+ */
+void handshake_expire(Worker_t *self)
+{
+    uint64_t now = metrics_now();
+    while (self->handshake_head != HANDSHAKE_NONE && self->handshakes[self->handshake_head].deadline <= now)
+    {
+        int sock = self->handshakes[self->handshake_head].sock;
+        handshake_end(self, self->handshake_head);
+        conn_close(sock);
+        log_debug("Handshake timed out");
+    }
+}
+
+/**
+ * @brief Calcula quanto o worker pode esperar no epoll até o próximo prazo de handshake.
+ * @param self O worker.
+ * @return int O tempo em ms (arredondado para cima), ou -1 se não há handshakes pendentes.
+ */
+int handshake_wait_ms(Worker_t *self)
+{
+    if (self->handshake_head == HANDSHAKE_NONE)
+    {
+        return -1;
+    }
+
+    uint64_t deadline = self->handshakes[self->handshake_head].deadline;
+    uint64_t now = metrics_now();
+    return deadline > now ? (int)((deadline - now + 999999) / 1000000) : 0;
+}
+
+/**
+ * @brief Conclui ou descarta o handshake de uma conexão com os bytes já recebidos.
+ * * Quando o REQ_CONNSEN está completo, a conexão sai da fila e o handshake é
+ * realizado; se ela fecha antes disso, é descartada.
+ * * @param self O worker.
+ * @param slot A posição da conexão na fila.
+ * @param fill O resultado da leitura que trouxe os bytes.
+ */
+void handshake_receive(Worker_t *self, uint32_t slot, ConnFill fill)
+{
+    int csock = self->handshakes[slot].sock;
+
+    Msg_t msg;
+    int len = conn_next_msg(csock, &msg);
+    if (len > 0)
+    {
+        handshake_end(self, slot);
+        handle_client_handshake(csock, self, &msg);
+    }
+    else if (len < 0 || fill == CONN_CLOSED)
+    {
+        handshake_end(self, slot);
+        conn_close(csock);
+    }
+}
+
+/**
+ * @brief Lê o REQ_CONNSEN de uma conexão na fila de handshakes.
+ * @param self O worker.
+ * @param slot A posição da conexão na fila.
+ */
+void handle_handshake_activity(Worker_t *self, uint32_t slot)
+{
+    handshake_receive(self, slot, conn_fill(self->handshakes[slot].sock));
+}
+
+/**
+ * @brief Aceita em laço as conexões pendentes em um socket de escuta não bloqueante.
+ * * As conexões de um socket AF_UNIX são marcadas como SOCK_SEQPACKET (ver
+ * conn_set_packet). No backend io_uring, elas são lidas e escritas pelo
+ * io_uring, como as aceitas pelo accept multishot.
+ * * @param self O worker.
+ * @param listen_socket O socket de escuta.
+ * @param paused Recebe 1 se restaram conexões por aceitar (fila de handshakes cheia ou sem descritores).
+ */
+void accept_clients(Worker_t *self, int listen_socket, int *paused)
+{
+    *paused = 0;
+
+    for (;;)
+    {
+        if (self->handshake_free_count == 0)
+        {
+            *paused = 1;
+            break;
+        }
+
+        // No io_uring o socket fica bloqueante para o kernel (ver conn_set_async)
+        int csock = accept4(listen_socket, NULL, NULL, (self->ring != NULL ? 0 : SOCK_NONBLOCK) | SOCK_CLOEXEC);
+        if (csock == -1)
+        {
+            if (errno == ECONNABORTED || errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                break;
+            }
+            if (errno == EMFILE || errno == ENFILE)
+            {
+                // Sem descritores livres: tenta de novo quando um handshake terminar
+                log_warn("accept: %s", strerror(errno));
+                *paused = 1;
+                break;
+            }
+            logexit("accept client");
+        }
+
+        if (self->ring != NULL)
+        {
+            conn_set_async(csock);
+        }
+        else
+        {
+            conn_set_nonblocking(csock);
+        }
+        if (listen_socket == self->session->unix_socket)
+        {
+            conn_set_packet(csock);
+        }
+        handshake_begin(self, csock);
+    }
+}
+
+/**
+ * @brief Aceita todas as conexões de clientes (sensores) pendentes.
+ * * O socket de escuta é não bloqueante e monitorado em modo edge-triggered,
+ * então as conexões são aceitas em laço até que a fila do kernel se esvazie
+ * ou até que a fila de handshakes do worker encha; nesse caso, as conexões
+ * restantes esperam no kernel até que alguma posição seja liberada. No
+ * backend io_uring, passa para a fila as conexões estacionadas e (re)arma o
+ * accept multishot.
+ * * @param self O worker dono do socket de escuta.
+ * @return ServerCommand O estado de continuação do servidor.
+ */
+ServerCommand handle_client_connection(Worker_t *self)
+{
+    if (self->ring != NULL)
+    {
+        while (self->parked_head < self->parked_count && self->handshake_free_count > 0)
+        {
+            handshake_begin(self, self->parked[self->parked_head++]);
+        }
+        if (self->parked_head == self->parked_count)
+        {
+            self->parked_head = self->parked_count = 0;
+        }
+
+        // Um accept multishot ainda sendo cancelado é rearmado quando terminar
+        if (self->parked_count == 0 && self->handshake_free_count > 0 && !self->accept_armed)
+        {
+            uring_accept_multishot(self->ring, self->clients_socket, uring_data(UR_ACCEPT, 0, 0));
+            self->accept_armed = 1;
+            self->accept_paused = 0;
+        }
+        return CONTINUE_RUNNING;
+    }
+
+    accept_clients(self, self->clients_socket, &self->accept_paused);
+    return CONTINUE_RUNNING;
+}
+
+/**
+ * @brief Aceita todas as conexões de clientes locais (AF_UNIX) pendentes.
+ * * O socket de escuta é monitorado por todos os workers com EPOLLEXCLUSIVE,
+ * de modo que cada nova conexão acorda um deles, que a atende daí em diante,
+ * nos dois backends; como na escuta TCP, um worker com a fila de handshakes
+ * cheia deixa as conexões esperando no kernel.
+ * * @param self O worker acordado.
+ * @return ServerCommand O estado de continuação do servidor.
+ */
+ServerCommand handle_unix_connection(Worker_t *self)
+{
+    accept_clients(self, self->session->unix_socket, &self->unix_paused);
+    return CONTINUE_RUNNING;
+}
+
+
+/**
+ * @brief Processa a solicitação de desconexão (`REQ_DISCSEN`) de um cliente.
+ * * Remove o cliente do registro de sensores ativos.
+ * * @param current_socket O socket do cliente que pediu para desconectar.
+ * @param self O worker dono da conexão do cliente.
+ * @param id O ID do cliente a ser removido.
+ * @param seq O ID de correlação da requisição, devolvido na resposta.
+ * @return ServerCommand O estado de continuação do servidor.
+ */
+ServerCommand handle_req_discsen(int current_socket, Worker_t *self, int id, uint32_t seq)
+{
+    Session_t *session = self->session;
+    if (session_remove(session, id))
+    {
+        worker_notify_loc(self, id, -1);
+    }
+
+    Msg_t ok = {0};
+    ok.type = OK_MSG;
+    ok.payload = 1;
+    ok.seq = seq;
+    sprintf(ok.desc, "%s Successful disconnect", session->type == LOC ? "SL" : "SS");
+    send_msg(current_socket, &ok);
+    log_info("Client %d removed", id);
+
+    return CONTINUE_RUNNING;
+}
+
+/**
+ * @brief Processa uma solicitação de status (`REQ_SENSSTATUS`) de um cliente.
+ * * Se o status do sensor indicar uma falha (status 1), o servidor consulta o
+ * peer (servidor de localização) para obter a localização do sensor. A
+ * consulta é registrada com um ID de correlação e o cliente fica aguardando
+ * sem bloquear o servidor; a resposta é enviada por `handle_res_checkalert`.
+ * Workers que não são donos do peer repassam a consulta ao worker 0. Se a
+ * localização já é conhecida (ver `session_cache_loc`), responde sem consultar
+ * o peer. Caso contrário, envia uma mensagem de OK.
+ * * @param current_socket O socket do cliente solicitante.
+ * @param self O worker dono da conexão do cliente.
+ * @param client O cliente (sensor) que fez a solicitação.
+ * @param seq O ID de correlação da requisição, devolvido na resposta.
+ * @return ServerCommand O estado de continuação do servidor.
+ */
+ServerCommand handle_req_sensstatus(int current_socket, Worker_t *self, Client_t client, uint32_t seq)
+{
+    Msg_t msg = {0};
+    msg.seq = seq;
+
+    if (client.data != 1)
+    {
+        msg.type = OK_MSG;
+        msg.payload = 2;
+        strcpy(msg.desc, DESC_OK_03);
+        send_msg(current_socket, &msg);
+        return CONTINUE_RUNNING;
+    }
+
+    log_info("Sensor %d status = 1 (failure detected)", client.id);
+
+    if (client.loc > 0)
+    {
+        log_info("Sending RES_SENSSTATUS %d to CLIENT (cached location)", client.loc);
+        msg.type = RES_SENSSTATUS;
+        msg.payload = client.loc;
+        send_msg(current_socket, &msg);
+        return CONTINUE_RUNNING;
+    }
+
+    ReplyTo_t to = {self->id, current_socket, conn_generation(current_socket), seq};
+    Worker_t *owner = worker_link_owner(self);
+    if (owner == self)
+    {
+        worker_send_checkalert(self, &to, client.id, 0);
+        return CONTINUE_RUNNING;
+    }
+
+    Job_t *job = job_new(JOB_CHECKALERT);
+    job->to = to;
+    job->msg.payload = client.id;
+    worker_post(owner, job);
+
+    return CONTINUE_RUNNING;
+}
+
+/**
+ * @brief Processa uma inscrição em alertas por push (`REQ_SUBSCRIBE`) de um sensor.
+ * * A inscrição vale para a conexão do próprio sensor e é desfeita com a sua
+ * remoção ou reconexão. A resposta leva o status atual; se o sensor já está
+ * em falha, o alerta é enviado em seguida, como em uma mudança de status
+ * (ver `session_set_status`).
+ * * @param current_socket O socket do cliente solicitante.
+ * @param self O worker dono da conexão do cliente.
+ * @param id O ID do sensor.
+ * @param seq O ID de correlação da requisição, devolvido na resposta.
+ * @return ServerCommand O estado de continuação do servidor.
+ */
+ServerCommand handle_req_subscribe(int current_socket, Worker_t *self, int id, uint32_t seq)
+{
+    Shard_t *shard = shard_for(self->session, id);
+    ReplyTo_t to = {self->id, current_socket, conn_generation(current_socket), 0};
+    int status = -1;
+    int loc = 0;
+
+    pthread_mutex_lock(&shard->lock);
+    Client_t *client = registry_find(&shard->registry, id);
+    if (client != NULL && client->socket_id == current_socket)
+    {
+        client->subscribed = 1;
+        client->worker = to.worker;
+        client->gen = to.gen;
+        status = client->data;
+        loc = client->loc;
+    }
+    pthread_mutex_unlock(&shard->lock);
+
+    Msg_t msg = {0};
+    msg.seq = seq;
+    if (status < 0)
+    {
+        msg.type = ERROR_MSG;
+        msg.payload = 10;
+        strcpy(msg.desc, DESC_ERROR_10);
+        send_msg(current_socket, &msg);
+        return CONTINUE_RUNNING;
+    }
+
+    msg.type = RES_SUBSCRIBE;
+    msg.payload = status;
+    send_msg(current_socket, &msg);
+
+    if (status != 1)
+    {
+        return CONTINUE_RUNNING;
+    }
+
+    if (loc > 0)
+    {
+        Msg_t alert = {0};
+        alert.type = ALERT_MSG;
+        alert.payload = loc;
+        log_info("Sending ALERT %d to CLIENT %d", loc, id);
+        send_msg(current_socket, &alert);
+        return CONTINUE_RUNNING;
+    }
+
+    Worker_t *owner = worker_link_owner(self);
+    if (owner == self)
+    {
+        worker_send_checkalert(self, &to, id, 1);
+        return CONTINUE_RUNNING;
+    }
+
+    Job_t *job = job_new(JOB_ALERT);
+    job->to = to;
+    job->msg.payload = id;
+    worker_post(owner, job);
+
+    return CONTINUE_RUNNING;
+}
+
+/**
+ * @brief Processa uma solicitação de localização (`REQ_SENSLOC`) de um cliente.
+ * * Envia a localização armazenada do sensor de volta para o cliente.
+ * * @param current_socket O socket do cliente solicitante.
+ * @param client O cliente (sensor) que fez a solicitação.
+ * @param seq O ID de correlação da requisição, devolvido na resposta.
+ * @return ServerCommand O estado de continuação do servidor.
+ */
+ServerCommand handle_req_sensloc(int current_socket, Client_t client, uint32_t seq)
+{
+    Msg_t msg = {0};
+    msg.seq = seq;
+
+    if (client.data < 1)
+    {
+        msg.type = ERROR_MSG;
+        msg.payload = 10;
+        strcpy(msg.desc, DESC_ERROR_10);
+        send_msg(current_socket, &msg);
+        return CONTINUE_RUNNING;
+    }
+
+    msg.type = RES_SENSLOC;
+    msg.payload = client.data;
+    send_msg(current_socket, &msg);
+    return CONTINUE_RUNNING;
+}
+
+/**
+ * @brief Processa uma solicitação de localização em lote (`REQ_SENSLOC_BATCH`).
+ * * Responde com a localização de cada sensor, na ordem da requisição
+ * (-1 para sensores não encontrados), em um único RES_SENSLOC_BATCH.
+ * * @param current_socket O socket do cliente solicitante.
+ * @param disc A requisição.
+ * @param session A sessão.
+ * @return ServerCommand O estado de continuação do servidor.
+ */
+ServerCommand handle_req_sensloc_batch(int current_socket, Msg_t *disc, Session_t *session)
+{
+    int values[BATCH_MAX_IDS];
+    int count = batch_parse(disc, values, BATCH_MAX_IDS);
+    log_info("REQ_SENSLOC_BATCH %d", count);
+
+    for (int i = 0; i < count; i++)
+    {
+        Client_t client;
+        values[i] = session_find(session, values[i], &client) && client.data >= 1 ? client.data : -1;
+    }
+
+    Msg_t msg = {0};
+    msg.type = RES_SENSLOC_BATCH;
+    msg.seq = disc->seq;
+    batch_format(&msg, values, count);
+    send_msg(current_socket, &msg);
+    return CONTINUE_RUNNING;
+}
+
+/**
+ * @brief Processa uma solicitação de status em lote (`REQ_SENSSTATUS_BATCH`).
+ * * Sensores sem falha são respondidos com 0 e sensores não encontrados com
+ * -1. A localização de todos os sensores em falha é consultada ao peer em
+ * uma única requisição (ver `worker_send_checkalert_batch`); a resposta ao
+ * cliente é enviada quando ela retorna. Sem falhas, a resposta é imediata.
+ * * @param current_socket O socket do cliente solicitante.
+ * @param disc A requisição.
+ * @param self O worker dono da conexão do cliente.
+ * @return ServerCommand O estado de continuação do servidor.
+ */
+ServerCommand handle_req_sensstatus_batch(int current_socket, Msg_t *disc, Worker_t *self)
+{
+    StatusBatch_t *batch = calloc(1, sizeof(StatusBatch_t));
+    if (batch == NULL)
+    {
+        logexit("calloc");
+    }
+
+    batch->count = batch_parse(disc, batch->ids, BATCH_MAX_IDS);
+    log_info("REQ_SENSSTATUS_BATCH %d", batch->count);
+
+    for (int i = 0; i < batch->count; i++)
+    {
+        Client_t client;
+        if (!session_find(self->session, batch->ids[i], &client))
+        {
+            batch->values[i] = -1;
+        }
+        else if (client.data == 1 && client.loc > 0)
+        {
+            batch->values[i] = client.loc;
+        }
+        else if (client.data == 1)
+        {
+            log_debug("Sensor %d status = 1 (failure detected)", client.id);
+            batch->failed[batch->nfailed++] = i;
+        }
+    }
+
+    if (batch->nfailed == 0)
+    {
+        Msg_t msg = {0};
+        msg.type = RES_SENSSTATUS_BATCH;
+        msg.seq = disc->seq;
+        batch_format(&msg, batch->values, batch->count);
+        send_msg(current_socket, &msg);
+        free(batch);
+        return CONTINUE_RUNNING;
+    }
+
+    ReplyTo_t to = {self->id, current_socket, conn_generation(current_socket), disc->seq};
+    Worker_t *owner = worker_link_owner(self);
+    if (owner == self)
+    {
+        worker_send_checkalert_batch(self, &to, batch);
+        return CONTINUE_RUNNING;
+    }
+
+    Job_t *job = job_new(JOB_CHECKALERT_BATCH);
+    job->to = to;
+    job->batch = batch;
+    worker_post(owner, job);
+
+    return CONTINUE_RUNNING;
+}
+
+/**
+ * @brief Processa uma solicitação de lista de sensores por localização (`REQ_LOCLIST`).
+ * * Percorre apenas a lista de sensores da localização especificada em cada
+ * shard e envia seus IDs ao cliente. Se a lista não couber em uma única
+ * mensagem, ela é dividida em páginas (RES_LOCLIST com `more` = 1, exceto a
+ * última); clientes no formato legado, que não conhecem a paginação, recebem
+ * apenas a primeira.
+ * * @param current_socket O socket do cliente solicitante.
+ * @param loc_id O ID da localização a ser buscada.
+ * @param session A sessão.
+ * @param seq O ID de correlação da requisição, devolvido na resposta.
+ * @return ServerCommand O estado de continuação do servidor.
+ */
+ServerCommand handle_req_loclist(int current_socket, int loc_id, Session_t *session, uint32_t seq)
+{
+    int paged = conn_get_wire(current_socket) == WIRE_COMPACT;
+    Msg_t msg = {0};
+    msg.type = RES_LOCLIST;
+    msg.payload = loc_id;
+    msg.seq = seq;
+    size_t len = 0;
+    int found = 0;
+    int full = 0;
+
+    for (uint32_t s = 0; loc_id >= 1 && loc_id <= 10 && s < session->nshards && !full; s++)
+    {
+        Shard_t *shard = &session->shards[s];
+
+        pthread_mutex_lock(&shard->lock);
+        for (Client_t *c = registry_group_first(&shard->registry, loc_id); c != NULL;
+             c = registry_group_next(&shard->registry, c))
+        {
+            char client_id[16];
+            int id_len = sprintf(client_id, "%s%d", len > 0 ? ", " : "", c->id);
+
+            if (len + id_len > BUFSZ - 1)
+            {
+                if (!paged)
+                {
+                    full = 1;
+                    break;
+                }
+
+                log_info("Sending RES_LOCLIST %s", msg.desc);
+                msg.more = 1;
+                send_msg(current_socket, &msg);
+                len = 0;
+                id_len = sprintf(client_id, "%d", c->id);
+            }
+
+            if (found++ == 0)
+            {
+                log_info("Found sensors at location %d", loc_id);
+            }
+            memcpy(msg.desc + len, client_id, id_len + 1);
+            len += id_len;
+        }
+        pthread_mutex_unlock(&shard->lock);
+    }
+
+    if (found == 0)
+    {
+        Msg_t err = {0};
+        err.type = ERROR_MSG;
+        err.payload = 11;
+        err.seq = seq;
+        log_info("Location %d not found", loc_id);
+        log_info("Sending ERROR(11) to CLIENT");
+        strcpy(err.desc, DESC_ERROR_11);
+        send_msg(current_socket, &err);
+        return CONTINUE_RUNNING;
+    }
+
+    log_info("Sending RES_LOCLIST %s", msg.desc);
+    msg.more = 0;
+    send_msg(current_socket, &msg);
+
+    return CONTINUE_RUNNING;
+}
+
+/**
+ * @brief Envia ao cliente a tabela de roteamento do cluster de SLs (`REQ_ROUTES`).
+ * * A tabela lista as portas de clientes dos SLs, na ordem dos nós do anel;
+ * o cliente constrói o mesmo anel e envia cada consulta ao SL dono do sensor.
+ * Um SL que não faz parte de um cluster informa apenas a própria porta.
+ * * @param current_socket O socket do cliente solicitante.
+ * @param session A sessão.
+ * @param seq O ID de correlação da requisição, devolvido na resposta.
+ * @return ServerCommand O estado de continuação do servidor.
+ */
+ServerCommand handle_req_routes(int current_socket, Session_t *session, uint32_t seq)
+{
+    HashRing_t *ring = atomic_load_explicit(&session->cluster, memory_order_acquire);
+
+    Msg_t msg = {0};
+    msg.type = RES_ROUTES;
+    msg.seq = seq;
+    if (ring != NULL)
+    {
+        batch_format(&msg, ring->keys, ring->nodes);
+    }
+    else
+    {
+        batch_format(&msg, &session->clients_port, 1);
+    }
+    log_debug("Sending RES_ROUTES %s", msg.desc);
+    send_msg(current_socket, &msg);
+    return CONTINUE_RUNNING;
+}
+
+/**
+ * @brief Remove um cliente desconectado e fecha seu socket.
+ * * Sockets que já enviaram REQ_DISCSEN não estão mais no registro e são
+ * apenas fechados.
+ * * @param current_socket O socket do cliente.
+ * @param self O worker dono da conexão do cliente.
+ */
+void handle_client_disconnect(int current_socket, Worker_t *self)
+{
+    Session_t *session = self->session;
+    if (session->idle != NULL && current_socket < session->idle_cap)
+    {
+        timer_cancel(&self->wheel, &session->idle[current_socket].timer);
+    }
+
+    int id;
+    if (session_remove_socket(self->session, current_socket, &id))
+    {
+        log_info("Client %d removed", id);
+        worker_notify_loc(self, id, -1);
+    }
+
+    conn_close(current_socket);
+}
+
+/**
+ * @brief Trata uma única mensagem recebida de um cliente.
+ * * Direciona a mensagem para a função de tratamento apropriada
+ * (desconexão, status, localização, etc.).
+ * * @param disc A mensagem recebida.
+ * @param current_socket O socket do cliente que enviou a mensagem.
+ * @param self O worker dono da conexão do cliente.
+ * @return ServerCommand O estado de continuação do servidor.
+ */
+ServerCommand handle_client_msg(Msg_t *disc, int current_socket, Worker_t *self)
+{
+    if (disc->type == HEARTBEAT)
+    {
+        // A atividade já foi registrada por handle_client_activity
+        return CONTINUE_RUNNING;
+    }
+
+    if (disc->type == REQ_LOCLIST)
+    {
+        log_info("REQ_LOCLIST %d", disc->payload);
+        return handle_req_loclist(current_socket, disc->payload, self->session, disc->seq);
+    }
+
+    if (disc->type == REQ_SENSLOC_BATCH)
+    {
+        return handle_req_sensloc_batch(current_socket, disc, self->session);
+    }
+
+    if (disc->type == REQ_ROUTES)
+    {
+        return handle_req_routes(current_socket, self->session, disc->seq);
+    }
+
+    if (disc->type == REQ_SENSSTATUS_BATCH)
+    {
+        return handle_req_sensstatus_batch(current_socket, disc, self);
+    }
+
+    Client_t client;
+    if (session_find(self->session, disc->payload, &client))
+    {
+        if (disc->type == REQ_DISCSEN)
+        {
+            return handle_req_discsen(current_socket, self, client.id, disc->seq);
+        }
+
+        if (disc->type == REQ_SENSSTATUS)
+        {
+            log_info("REQ_SENSSTATUS %d", client.id);
+            return handle_req_sensstatus(current_socket, self, client, disc->seq);
+        }
+
+        if (disc->type == REQ_SENSLOC)
+        {
+            log_info("REQ_SENSLOC %d", client.id);
+            return handle_req_sensloc(current_socket, client, disc->seq);
+        }
+
+        if (disc->type == REQ_SUBSCRIBE && self->session->type == STATUS)
+        {
+            log_info("REQ_SUBSCRIBE %d", client.id);
+            return handle_req_subscribe(current_socket, self, client.id, disc->seq);
+        }
+    }
+
+    Msg_t err = {0};
+    err.type = ERROR_MSG;
+    err.payload = 10;
+    err.seq = disc->seq;
+    strcpy(err.desc, DESC_ERROR_10);
+    send_msg(current_socket, &err);
+
+    return CONTINUE_RUNNING;
+}
+
+/**
+ * @brief Trata todas as mensagens completas já recebidas de um cliente.
+ * * Inclusive as que chegaram agrupadas em um mesmo segmento.
+ * * @param current_socket O socket do cliente.
+ * @param self O worker dono da conexão do cliente.
+ * @param malformed Recebe 1 se um quadro malformado foi encontrado (a conexão deve ser fechada).
+ * @return ServerCommand O estado de continuação do servidor.
+ */
+ServerCommand handle_client_frames(int current_socket, Worker_t *self, int *malformed)
 {
-    printf("Found location of sensor %d: location %d\n", client.id, client.data);
-    printf("Sending RES_CHECKALERT %d to SS\n", client.data);
+    Msg_t disc;
+    int len;
+    while ((len = conn_next_msg(current_socket, &disc)) > 0)
+    {
+        int type = disc.type;
+        uint64_t start = metrics_now();
+        if (self->session->idle != NULL && current_socket < self->session->idle_cap)
+        {
+            self->session->idle[current_socket].last_active = start;
+        }
+        ServerCommand status = handle_client_msg(&disc, current_socket, self);
+        metrics_count(self->metrics, METRIC_CLIENT, type, metrics_now() - start);
+        if (status != CONTINUE_RUNNING)
+        {
+            return status;
+        }
+    }
 
-    Msg_t msg = {0};
-    msg.type = RES_CHECKALERT;
-    msg.payload = client.data;
-    send_msg(peer_socket, &msg);
+    *malformed = len < 0;
     return CONTINUE_RUNNING;
 }
 
 /**
- * @brief Processa a entrada do usuário via terminal (stdin).
- * * Detecta o comando "kill" para iniciar o processo de desconexão
- * do peer e encerrar o servidor de forma limpa.
- * * @param buf Buffer para ler a entrada.
- * @param server_socket O socket de comunicação com o peer.
- * @param my_peer_id O ID deste servidor.
- * @return ServerCommand Retorna SERVER_SHUTDOWN para encerrar ou CONTINUE_RUNNING.
+ * @brief Gerencia a comunicação e as mensagens recebidas de um cliente.
+ * * O socket é lido até se esvaziar (modo edge-triggered) e todas as mensagens
+ * completas remontadas no buffer da conexão são tratadas. Quando o cliente
+ * encerra a conexão, o socket é fechado (o que também o remove da instância
+ * epoll).
+ * * @param current_socket O socket do cliente que apresentou atividade.
+ * @param self O worker dono da conexão do cliente.
+ * @return ServerCommand O estado de continuação do servidor.
  */
-ServerCommand handle_stdin_input(char *buf, int server_socket, int my_peer_id)
+ServerCommand handle_client_activity(int current_socket, Worker_t *self)
 {
-    memset(buf, 0, BUFSZ);
-    if (fgets(buf, BUFSZ, stdin) != NULL)
+    ConnFill fill;
+    do
     {
-        if (strncmp(buf, "kill", 4) == 0)
+        fill = conn_fill(current_socket);
+
+        int malformed;
+        ServerCommand status = handle_client_frames(current_socket, self, &malformed);
+        if (status != CONTINUE_RUNNING)
+        {
+            return status;
+        }
+
+        if (malformed || fill == CONN_CLOSED)
+        {
+            handle_client_disconnect(current_socket, self);
+            return CONTINUE_RUNNING;
+        }
+    } while (fill == CONN_FULL);
+
+    return CONTINUE_RUNNING;
+}
+
+/**
+ * @brief Envia um heartbeat a cada peer ou encerra a sessão se algum parou de responder.
+ * * Qualquer quadro recebido do peer conta como sinal de vida, então um link
+ * com tráfego não depende dos heartbeats. Detecta conexões semiabertas, em
+ * que o peer desapareceu sem que o TCP sinalizasse o fechamento. Um peer que
+ * nunca enviou heartbeats (versão anterior) não é verificado nem os recebe.
+ * * @param self O worker 0.
+ * @param now O instante atual (metrics_now).
+ * @return ServerCommand TERMINATE_P2P_CONNECTION se o peer foi perdido, CONTINUE_RUNNING caso contrário.
+ */
+ServerCommand handle_heartbeat(Worker_t *self, uint64_t now)
+{
+    Session_t *session = self->session;
+    for (int i = 0; i < session->npeers; i++)
+    {
+        Peer_t *peer = &session->peers[i];
+        if (peer->beats && now - peer->last_rx >= HEARTBEAT_MISSES * session->heartbeat)
+        {
+            log_warn("Peer %d timed out", peer->id);
+            *session->connected_peer_id = -1;
+            return TERMINATE_P2P_CONNECTION;
+        }
+    }
+
+    Msg_t beat = {0};
+    beat.type = HEARTBEAT;
+    for (int i = 0; i < session->npeers; i++)
+    {
+        if (conn_get_wire(session->peers[i].sock) == WIRE_COMPACT)
+        {
+            send_msg(session->peers[i].sock, &beat);
+        }
+    }
+
+    timer_arm(&self->wheel, &session->heartbeat_timer, now + session->heartbeat);
+    return CONTINUE_RUNNING;
+}
+
+/**
+ * @brief Trata os temporizadores vencidos do worker.
+ * * Um sensor cujo temporizador de inatividade vence só é desconectado se não
+ * enviou nada desde que ele foi armado; caso contrário, o temporizador é
+ * rearmado a partir da última mensagem recebida.
+ * * @param self O worker.
+ * @return ServerCommand O comando resultante (ex: perda do peer).
+ */
+ServerCommand handle_timers(Worker_t *self)
+{
+    Session_t *session = self->session;
+    uint64_t now = metrics_now();
+    ServerCommand status = CONTINUE_RUNNING;
+
+    Timer_t expired;
+    timer_advance(&self->wheel, now, &expired);
+
+    Timer_t *t;
+    while ((t = timer_pop(&self->wheel, &expired)) != NULL)
+    {
+        TimerKind kind = (TimerKind)(t->data >> 32);
+        int sock = (int)(uint32_t)t->data;
+
+        if (kind == TIMER_HEARTBEAT && status == CONTINUE_RUNNING)
+        {
+            status = handle_heartbeat(self, now);
+        }
+        else if (kind == TIMER_RECLAIM)
+        {
+            session_expire_restored(session);
+        }
+        else if (kind == TIMER_IDLE)
         {
-            Msg_t disc = {0};
-            disc.type = REQ_DISCPEER;
-            disc.payload = my_peer_id;
+            IdleTimer_t *idle = &session->idle[sock];
+            if (now - idle->last_active >= session->idle_timeout)
+            {
+                log_info("Idle timeout on socket %d", sock);
+                handle_client_disconnect(sock, self);
+            }
+            else
+            {
+                timer_arm(&self->wheel, t, idle->last_active + session->idle_timeout);
+            }
+        }
+    }
+
+    return status;
+}
 
-            send_msg(server_socket, &disc);
+/**
+ * @brief Trata os eventos coletados da instância epoll de um worker.
+ * * Sockets que voltam a aceitar escrita (EPOLLOUT) têm sua fila de saída
+ * esvaziada. Apenas o worker 0 monitora a entrada padrão e o link 0 com
+ * cada peer; os links do pool são monitorados pelos seus donos.
+ * * @param self O worker.
+ * @param events Os eventos prontos.
+ * @param ready O número de eventos.
+ * @return ServerCommand O comando resultante da atividade.
+ */
+ServerCommand handle_events(Worker_t *self, struct epoll_event *events, int ready)
+{
+    Session_t *session = self->session;
+    char buf[BUFSZ];
+    ServerCommand status = CONTINUE_RUNNING;
 
-            memset(&disc, 0, sizeof(disc));
-            recv_msg(server_socket, &disc);
+    for (int i = 0; i < ready && status == CONTINUE_RUNNING; i++)
+    {
+        FdKind kind = (FdKind)(events[i].data.u64 >> 32);
+        int fd = (int)(uint32_t)events[i].data.u64;
 
-            if (disc.type == OK_MSG)
+        switch (kind)
+        {
+        case FD_STDIN:
+            status = handle_stdin_input(buf, session);
+            if (feof(stdin))
+            {
+                // Sem mais entrada: evita que o fd continue sempre pronto
+                epoll_ctl(self->epfd, EPOLL_CTL_DEL, STDIN_FILENO, NULL);
+            }
+            break;
+        case FD_PEER:
+        {
+            Peer_t *peer = &session->peers[fd / PEER_LINKS_MAX];
+            if (events[i].events & EPOLLOUT)
+            {
+                conn_flush(peer->links[fd % PEER_LINKS_MAX]);
+            }
+            if (events[i].events & ~EPOLLOUT)
+            {
+                status = handle_peer_activity(self, peer, fd % PEER_LINKS_MAX);
+            }
+            break;
+        }
+        case FD_P2P_LISTEN:
+            session_accept_link(self);
+            break;
+        case FD_CLIENTS_LISTEN:
+            status = handle_client_connection(self);
+            break;
+        case FD_UNIX_LISTEN:
+            status = handle_unix_connection(self);
+            break;
+        case FD_SENSOR:
+            if (events[i].events & EPOLLOUT)
             {
-                printf("%s\n", disc.desc);
-                printf("Peer %d disconnected\n", disc.payload);
+                conn_flush(fd);
             }
-            else if (disc.type == ERROR_MSG)
+            if (events[i].events & ~EPOLLOUT)
             {
-                logexit(disc.desc);
+                status = handle_client_activity(fd, self);
             }
+            break;
+        case FD_HANDSHAKE:
+            handle_handshake_activity(self, (uint32_t)fd);
+            break;
+        case FD_INBOX:
+            status = handle_inbox(self);
+            break;
+        }
+    }
 
-            return SERVER_SHUTDOWN;
+    return status;
+}
+
+/**
+ * @brief Trata os prazos do worker depois dos eventos de um ciclo.
+ * * Temporizadores vencidos, handshakes expirados e a retomada dos accepts
+ * suspensos quando a fila de handshakes encheu.
+ * * @param self O worker.
+ * @return ServerCommand O comando resultante (ex: perda do peer).
+ */
+ServerCommand handle_deadlines(Worker_t *self)
+{
+    ServerCommand status = handle_timers(self);
+
+    if (status == CONTINUE_RUNNING)
+    {
+        handshake_expire(self);
+        if (self->accept_paused && self->handshake_free_count > 0)
+        {
+            handle_client_connection(self);
+        }
+        if (self->unix_paused && self->handshake_free_count > 0)
+        {
+            handle_unix_connection(self);
+        }
+    }
+
+    return status;
+}
+
+/**
+ * @brief Copia a fila de saída de um sensor para um envio io_uring.
+ * * Não faz nada se a fila estiver vazia ou se já houver um envio da conexão
+ * em andamento; nesse caso, o restante é enviado quando ele terminar.
+ * * @param self O worker dono da conexão.
+ * @param sock O socket do sensor.
+ */
+void uring_send_output(Worker_t *self, int sock)
+{
+    struct iovec iov[2];
+    size_t len = conn_output_begin(sock, iov);
+    if (len == 0)
+    {
+        return;
+    }
+
+    if (self->send_free_count == 0)
+    {
+        uint32_t cap = self->send_cap ? self->send_cap * 2 : 64;
+        UringSend_t *sends = realloc(self->sends, cap * sizeof(UringSend_t));
+        uint32_t *free_slots = realloc(self->send_free, cap * sizeof(uint32_t));
+        if (sends == NULL || free_slots == NULL)
+        {
+            logexit("realloc");
+        }
+        memset(sends + self->send_cap, 0, (cap - self->send_cap) * sizeof(UringSend_t));
+        for (uint32_t i = cap; i > self->send_cap; i--)
+        {
+            free_slots[self->send_free_count++] = i - 1;
+        }
+        self->sends = sends;
+        self->send_free = free_slots;
+        self->send_cap = cap;
+    }
+
+    uint32_t slot = self->send_free[--self->send_free_count];
+    UringSend_t *send = &self->sends[slot];
+    if (send->cap < len)
+    {
+        unsigned char *buf = realloc(send->buf, len);
+        if (buf == NULL)
+        {
+            logexit("realloc");
+        }
+        send->buf = buf;
+        send->cap = len;
+    }
+
+    memcpy(send->buf, iov[0].iov_base, iov[0].iov_len);
+    memcpy(send->buf + iov[0].iov_len, iov[1].iov_base, iov[1].iov_len);
+    send->sock = sock;
+    send->gen = conn_generation(sock);
+    uring_send(self->ring, sock, send->buf, len, uring_data(UR_SEND, 0, slot));
+}
+
+/**
+ * @brief Envia a fila de saída de uma conexão ao final de um ciclo io_uring.
+ * * Os sensores são escritos por envios submetidos junto com a próxima
+ * espera; os links com o peer continuam sendo escritos diretamente.
+ * * @param sock O socket.
+ * @param arg O worker (Worker_t *).
+ */
+void uring_flush(int sock, void *arg)
+{
+    Worker_t *self = arg;
+    Session_t *session = self->session;
+    for (int i = 0; i < session->npeers; i++)
+    {
+        // Só os links deste worker (ver worker_watch_link)
+        for (int link = self->id; link < PEER_LINKS_MAX; link += session->nworkers)
+        {
+            if (sock == session->peers[i].links[link])
+            {
+                conn_flush(sock);
+                return;
+            }
+        }
+    }
+    uring_send_output(self, sock);
+}
+
+/**
+ * @brief Trata a conclusão de um envio io_uring e continua a fila, se preciso.
+ * @param self O worker.
+ * @param cqe A conclusão.
+ */
+void handle_uring_send(Worker_t *self, const struct io_uring_cqe *cqe)
+{
+    uint32_t slot = (uint32_t)cqe->user_data;
+    int sock = self->sends[slot].sock;
+    uint32_t gen = self->sends[slot].gen;
+    self->send_free[self->send_free_count++] = slot;
+
+    // Um erro marca a conexão para fechar; o recv multishot então recebe o EOF
+    if (conn_generation(sock) == gen && conn_output_done(sock, cqe->res) > 0)
+    {
+        uring_send_output(self, sock);
+    }
+}
+
+/**
+ * @brief Trata uma conexão aceita pelo accept multishot.
+ * * Se a fila de handshakes encher, o accept é cancelado e as conexões
+ * seguintes esperam no kernel, como no backend epoll. As que o kernel já
+ * aceitou antes de o cancelamento ter efeito ficam estacionadas até que
+ * alguma posição seja liberada.
+ * * @param self O worker.
+ * @param cqe A conclusão.
+ */
+void handle_uring_accept(Worker_t *self, const struct io_uring_cqe *cqe)
+{
+    if (!(cqe->flags & IORING_CQE_F_MORE))
+    {
+        // Cancelado ou falhou (ex: EMFILE): rearmado quando houver posição livre
+        self->accept_armed = 0;
+        self->accept_paused = 1;
+        if (cqe->res < 0 && cqe->res != -ECANCELED)
+        {
+            log_warn("accept: %s", strerror(-cqe->res));
+        }
+    }
+
+    if (cqe->res < 0)
+    {
+        return;
+    }
+
+    int csock = cqe->res;
+    conn_set_async(csock);
+
+    if (self->handshake_free_count > 0)
+    {
+        handshake_begin(self, csock);
+    }
+    else
+    {
+        if (self->parked_count == self->parked_cap)
+        {
+            uint32_t cap = self->parked_cap ? self->parked_cap * 2 : 64;
+            int *parked = realloc(self->parked, cap * sizeof(int));
+            if (parked == NULL)
+            {
+                logexit("realloc");
+            }
+            self->parked = parked;
+            self->parked_cap = cap;
+        }
+        self->parked[self->parked_count++] = csock;
+    }
+
+    if (self->handshake_free_count == 0 && self->accept_armed && !self->accept_paused)
+    {
+        uring_cancel(self->ring, uring_data(UR_ACCEPT, 0, 0));
+        self->accept_paused = 1;
+    }
+}
+
+/**
+ * @brief Trata bytes recebidos por um recv multishot.
+ * * Os bytes são passados ao buffer da conexão em partes, se preciso, e cada
+ * parte é tratada como em `handle_handshake_activity` ou
+ * `handle_client_activity`, conforme a conexão ainda esteja ou não na fila
+ * de handshakes.
+ * * @param sock O socket.
+ * @param self O worker dono da conexão.
+ * @param data Os bytes recebidos.
+ * @param len A quantidade de bytes.
+ * @return ServerCommand O estado de continuação do servidor.
+ */
+ServerCommand handle_client_data(int sock, Worker_t *self, const unsigned char *data, size_t len)
+{
+    Session_t *session = self->session;
+    uint32_t gen = conn_generation(sock);
+
+    while (len > 0 && conn_generation(sock) == gen)
+    {
+        size_t fed = conn_feed(sock, data, len);
+        if (fed == 0)
+        {
+            // Conexão marcada para fechar: o EOF virá do shutdown
+            break;
+        }
+        data += fed;
+        len -= fed;
+
+        uint32_t slot = session->fd_handshake[sock];
+        if (slot != HANDSHAKE_NONE)
+        {
+            handshake_receive(self, slot, CONN_DRAINED);
+            continue;
+        }
+
+        int malformed;
+        ServerCommand status = handle_client_frames(sock, self, &malformed);
+        if (status != CONTINUE_RUNNING)
+        {
+            return status;
+        }
+        if (malformed)
+        {
+            handle_client_disconnect(sock, self);
+        }
+    }
+
+    return CONTINUE_RUNNING;
+}
+
+/**
+ * @brief Trata uma conclusão do recv multishot de um sensor ou handshake.
+ * * O buffer fornecido volta ao kernel logo após o tratamento. Se o recv
+ * terminou sem EOF (ex: faltaram buffers), ele é rearmado; no EOF ou em caso
+ * de erro, a conexão é fechada.
+ * * @param self O worker.
+ * @param cqe A conclusão.
+ * @return ServerCommand O estado de continuação do servidor.
+ */
+ServerCommand handle_uring_recv(Worker_t *self, const struct io_uring_cqe *cqe)
+{
+    int sock = (int)(uint32_t)cqe->user_data;
+    uint32_t gen = (uint32_t)(cqe->user_data >> 32) & URING_GEN_MASK;
+    ServerCommand status = CONTINUE_RUNNING;
+
+    if (cqe->flags & IORING_CQE_F_BUFFER)
+    {
+        unsigned bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        if (cqe->res > 0 && (conn_generation(sock) & URING_GEN_MASK) == gen)
+        {
+            status = handle_client_data(sock, self, uring_buf(self->ring, bid), cqe->res);
+        }
+        uring_buf_recycle(self->ring, bid);
+    }
+
+    if ((cqe->flags & IORING_CQE_F_MORE) || (conn_generation(sock) & URING_GEN_MASK) != gen)
+    {
+        return status;
+    }
+
+    if (cqe->res > 0 || cqe->res == -ENOBUFS)
+    {
+        uring_recv_multishot(self->ring, sock, cqe->user_data);
+    }
+    else if (self->session->fd_handshake[sock] != HANDSHAKE_NONE)
+    {
+        handshake_end(self, self->session->fd_handshake[sock]);
+        conn_close(sock);
+    }
+    else
+    {
+        handle_client_disconnect(sock, self);
+    }
+
+    return status;
+}
+
+/**
+ * @brief Aguarda por atividade em um worker com o backend io_uring.
+ * * Os envios preparados no ciclo anterior são submetidos na mesma chamada
+ * que espera pelas conclusões. Os descritores que não são de sensores
+ * continuam na instância epoll, que é monitorada por um poll multishot.
+ * * @param self O worker.
+ * @param timeout O prazo da espera em ms (-1 = sem prazo).
+ * @return ServerCommand O comando resultante da atividade.
+ */
+ServerCommand uring_wait_for_activity(Worker_t *self, int timeout)
+{
+    if (uring_wait(self->ring, timeout) != 0)
+    {
+        logexit("io_uring_enter");
+    }
+
+    conn_cork();
+    ServerCommand status = CONTINUE_RUNNING;
+
+    struct io_uring_cqe *next;
+    while (status == CONTINUE_RUNNING && (next = uring_peek(self->ring)) != NULL)
+    {
+        struct io_uring_cqe cqe = *next;
+        uring_seen(self->ring);
+
+        switch ((UringOp)(cqe.user_data >> 56))
+        {
+        case UR_EPOLL:
+        {
+            struct epoll_event events[MAX_EVENTS];
+            int ready = epoll_wait(self->epfd, events, MAX_EVENTS, 0);
+            if (ready > 0)
+            {
+                status = handle_events(self, events, ready);
+            }
+            if (!(cqe.flags & IORING_CQE_F_MORE))
+            {
+                uring_poll_multishot(self->ring, self->epfd, POLLIN, cqe.user_data);
+            }
+            break;
+        }
+        case UR_ACCEPT:
+            handle_uring_accept(self, &cqe);
+            break;
+        case UR_RECV:
+            status = handle_uring_recv(self, &cqe);
+            break;
+        case UR_SEND:
+            handle_uring_send(self, &cqe);
+            break;
         }
     }
-    return CONTINUE_RUNNING;
+
+    if (status == CONTINUE_RUNNING)
+    {
+        status = handle_deadlines(self);
+    }
+
+    conn_uncork_with(uring_flush, self);
+    return status;
 }
 
 /**
- * @brief Gerencia a comunicação e as mensagens recebidas do peer conectado.
- * * Processa diferentes tipos de mensagens do peer, como desconexão (`REQ_DISCPEER`)
- * e verificação de alerta (`REQ_CHECKALERT`).
- * * @param server_socket O socket de comunicação com o peer.
- * @param connected_peer_id Ponteiro para o ID do peer conectado.
- * @param clients Array de clientes (sensores) para consulta.
- * @return ServerCommand O estado de continuação do servidor.
+ * @brief Aguarda por atividade nos descritores de um worker usando `epoll`.
+ * * Os descritores (entrada padrão, peer, sockets de escuta, clientes e a
+ * caixa de entrada do worker) são registrados uma única vez; cada chamada
+ * apenas coleta os eventos prontos e trata todos eles, de modo que o custo é
+ * proporcional ao número de descritores prontos, e não ao número de clientes
+ * conectados. A espera termina no prazo do handshake pendente mais antigo ou
+ * no próximo temporizador, para que conexões silenciosas sejam descartadas
+ * mesmo sem outra atividade.
+ * * @param self O worker.
+ * @return ServerCommand O comando resultante da atividade.
  */
-ServerCommand handle_peer_activity(int server_socket, int *connected_peer_id, Client_t *clients)
+ServerCommand wait_for_activity(Worker_t *self)
 {
-    Msg_t disc = {0};
-    size_t count = recv_msg(server_socket, &disc);
-    if (count == 0)
+    struct epoll_event events[MAX_EVENTS];
+
+    int timeout = handshake_wait_ms(self);
+    int timer_timeout = timer_wait_ms(&self->wheel, metrics_now());
+    if (timeout < 0 || (timer_timeout >= 0 && timer_timeout < timeout))
     {
-        printf("Peer %d disconnected\n", *connected_peer_id);
-        *connected_peer_id = -1;
-        return TERMINATE_P2P_CONNECTION;
+        timeout = timer_timeout;
     }
 
-    if (disc.type == REQ_DISCPEER)
+    if (self->ring != NULL)
     {
-        if (disc.payload != *connected_peer_id)
-        {
-            Msg_t err = {0};
-            err.type = ERROR_MSG;
-            err.payload = 2;
-            strcpy(err.desc, DESC_ERROR_02);
-            send_msg(server_socket, &err);
-            return CONTINUE_RUNNING;
-        }
-
-        Msg_t ok = {0};
-        ok.type = OK_MSG;
-        ok.payload = *connected_peer_id;
-        strcpy(ok.desc, DESC_OK_01);
-        send_msg(server_socket, &ok);
-        printf("Peer %d disconnected\n", *connected_peer_id);
-
-        *connected_peer_id = -1;
-        return TERMINATE_P2P_CONNECTION;
+        return uring_wait_for_activity(self, timeout);
     }
 
-    if (disc.type == REQ_CHECKALERT)
+    int ready = epoll_wait(self->epfd, events, MAX_EVENTS, timeout);
+    if (ready == -1)
     {
-        printf("REQ_CHECKALERT %d\n", disc.payload);
-        Client_t client = {0};
-        for (int i = 0; i < MAX_CLIENTS; i++)
+        if (errno == EINTR)
         {
-            if (disc.payload == clients[i].id)
-            {
-                client = clients[i];
-                return handle_server_checkalert(server_socket, client, NULL, LOC);
-            }
+            return CONTINUE_RUNNING;
         }
+        logexit("epoll_wait");
+    }
 
-        Msg_t err = {0};
-        err.type = ERROR_MSG;
-        err.payload = 10;
-        strcpy(err.desc, DESC_ERROR_10);
-        printf("ERROR(10) - Sensor not found\n");
-        send_msg(server_socket, &err);
+    // As respostas geradas no ciclo são enviadas juntas, uma chamada por conexão
+    conn_cork();
+    ServerCommand status = handle_events(self, events, ready);
 
-        return CONTINUE_RUNNING;
+    if (status == CONTINUE_RUNNING)
+    {
+        status = handle_deadlines(self);
     }
 
-    return CONTINUE_RUNNING;
+    conn_uncork();
+    return status;
 }
 
 /**
- * @brief Aceita e gerencia uma nova conexão de cliente (sensor).
- * * Adiciona o novo cliente à lista de clientes conectados e atribui a ele
- * um dado (localização ou status) dependendo do tipo de servidor.
- * * @param clients_socket O socket de escuta para clientes.
- * @param clients Array de clientes conectados.
- * @param next_client_index Ponteiro para o índice do próximo slot livre no array de clientes.
- * @param read_fds (Não utilizado diretamente aqui)
- * @param type O tipo do servidor (LOC ou STATUS).
- * @return ServerCommand O estado de continuação do servidor.
+ * @brief Prepara um worker: instância epoll, caixa de entrada e socket de escuta.
+ * * Com mais de um worker, cada um abre seu próprio socket de escuta com
+ * SO_REUSEPORT e o kernel distribui as novas conexões entre eles. No backend
+ * io_uring, o worker também cria sua instância io_uring, que recebe o socket
+ * de escuta e os sensores; a instância epoll fica com os demais descritores.
+ * * @param worker O worker a ser inicializado.
+ * @param id O índice do worker (0 = thread principal).
+ * @param session A sessão à qual o worker pertence.
+ * @param clients_storage O endereço de escuta de clientes.
  */
-ServerCommand handle_client_connection(int clients_socket, Client_t *clients,
-                                       int *next_client_index, fd_set *read_fds, Server type)
+void worker_init(Worker_t *worker, int id, Session_t *session, struct sockaddr_storage *clients_storage)
 {
-    struct sockaddr_in c_in;
-    socklen_t caddrlen = sizeof(c_in);
-    Msg_t msg = {0};
+    worker->id = id;
+    worker->session = session;
+    worker->metrics = session->metrics != NULL ? &session->metrics[id] : NULL;
+    mpsc_init(&worker->inbox);
+
+    worker->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (worker->epfd == -1)
+    {
+        logexit("epoll_create1");
+    }
 
-    int csock = accept(clients_socket, (struct sockaddr *)(&c_in), &caddrlen);
-    if (csock == -1)
+    worker->inbox_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (worker->inbox_fd == -1)
     {
-        logexit("accept client");
+        logexit("eventfd");
     }
 
-    recv_msg(csock, &msg);
+    worker->clients_socket = init_clients_socket(clients_storage, session->nworkers > 1, session->backlog);
 
-    if (msg.type == REQ_CONNSEN)
+    worker->handshakes = calloc(session->backlog, sizeof(Handshake_t));
+    worker->handshake_free = calloc(session->backlog, sizeof(uint32_t));
+    if (worker->handshakes == NULL || worker->handshake_free == NULL)
     {
-        if (*next_client_index > MAX_CLIENTS - 1)
-        {
-            Msg_t err = {0};
-            err.type = ERROR_MSG;
-            err.payload = CLIENT_LIMIT_ERROR;
-            strcpy(err.desc, DESC_ERROR_09);
-            send_msg(csock, &err);
-            close(csock);
-            return CONTINUE_RUNNING;
-        }
+        logexit("calloc");
+    }
+    for (int i = 0; i < session->backlog; i++)
+    {
+        worker->handshake_free[i] = session->backlog - 1 - i;
+    }
+    worker->handshake_free_count = session->backlog;
+    worker->handshake_head = worker->handshake_tail = HANDSHAKE_NONE;
+    timer_wheel_init(&worker->wheel, TIMER_TICK_NS, metrics_now());
 
-        Msg_t resp = {0};
-        int client_data;
-        if (type == LOC)
+    if (event_register(worker->epfd, worker->inbox_fd, FD_INBOX, EPOLLIN) != 0)
+    {
+        logexit("epoll_ctl");
+    }
+
+    if (session->io_uring)
+    {
+        worker->ring = malloc(sizeof(Uring_t));
+        if (worker->ring == NULL)
         {
-            client_data = get_client_loc();
-            memcpy(resp.desc, "SL", 2);
-            printf("Client %d added (Loc %d)\n", msg.payload, client_data);
+            logexit("malloc");
         }
-        else
+        if (uring_init(worker->ring, URING_ENTRIES, URING_BUFS, URING_BUF_SIZE) != 0)
         {
-            client_data = get_client_status();
-            memcpy(resp.desc, "SS", 2);
-            printf("Client %d added (%d)\n", msg.payload, client_data);
+            logexit("io_uring");
         }
 
-        clients[*next_client_index].id = msg.payload;
-        clients[*next_client_index].socket_id = csock;
-        clients[*next_client_index].data = client_data;
-        (*next_client_index)++;
-
-        resp.type = RES_CONNSEN;
-        resp.payload = msg.payload;
-        send_msg(csock, &resp);
+        uring_poll_multishot(worker->ring, worker->epfd, POLLIN, uring_data(UR_EPOLL, 0, 0));
+        handle_client_connection(worker);
     }
-
-    return CONTINUE_RUNNING;
-}
-
-/**
- * @brief Processa a solicitação de desconexão (`REQ_DISCSEN`) de um cliente.
- * * Remove o cliente da lista de clientes ativos e reorganiza a lista.
- * * @param current_socket O socket do cliente que pediu para desconectar.
- * @param clients O array de clientes.
- * @param next_client_index Ponteiro para o número de clientes.
- * @param client_index O índice do cliente a ser removido.
- * @param type O tipo do servidor.
- * @return ServerCommand O estado de continuação do servidor.
- */
-ServerCommand handle_req_discsen(int current_socket, Client_t *clients,
-                                 int *next_client_index, int client_index, Server type)
-{
-
-    clients[client_index].socket_id = 0;
-    clients[client_index].id = 0;
-    clients[client_index].data = 0;
-
-    for (int k = client_index; k < *next_client_index - 1; k++)
+    else if (event_register(worker->epfd, worker->clients_socket, FD_CLIENTS_LISTEN, EPOLLIN | EPOLLET) != 0)
     {
-        clients[k] = clients[k + 1];
+        logexit("epoll_ctl");
     }
-    (*next_client_index)--;
-
-    Msg_t ok = {0};
-    ok.type = OK_MSG;
-    ok.payload = 1;
-    sprintf(ok.desc, "%s Successful disconnect", type == LOC ? "SL" : "SS");
-    send_msg(current_socket, &ok);
-    printf("Client %d removed\n", clients[client_index].id);
 
-    return CONTINUE_RUNNING;
+    // Cada conexão local acorda um só worker, como o SO_REUSEPORT faz na escuta TCP
+    if (session->unix_socket != -1 &&
+        event_register(worker->epfd, session->unix_socket, FD_UNIX_LISTEN, EPOLLIN | EPOLLET | EPOLLEXCLUSIVE) != 0)
+    {
+        logexit("epoll_ctl");
+    }
 }
 
 /**
- * @brief Processa uma solicitação de status (`REQ_SENSSTATUS`) de um cliente.
- * * Se o status do sensor indicar uma falha (status 1), o servidor consulta o
- * peer (servidor de localização) para obter a localização do sensor e a envia
- * ao cliente. Caso contrário, envia uma mensagem de OK.
- * * @param current_socket O socket do cliente solicitante.
- * @param peer_socket O socket do peer (servidor de localização).
- * @param client O cliente (sensor) que fez a solicitação.
- * @return ServerCommand O estado de continuação do servidor.
+ * @brief Fecha os descritores de um worker e descarta os jobs não processados.
+ * @param worker O worker.
  */
-ServerCommand handle_req_sensstatus(int current_socket, int peer_socket, Client_t client)
+void worker_close(Worker_t *worker)
 {
-    Msg_t msg = {0};
-
-    if (client.data != 1)
+    MpscNode_t *node;
+    while ((node = mpsc_pop(&worker->inbox)) != NULL)
     {
-        msg.type = OK_MSG;
-        msg.payload = 2;
-        strcpy(msg.desc, DESC_OK_03);
-        send_msg(current_socket, &msg);
-        return CONTINUE_RUNNING;
+        free(((Job_t *)node)->batch);
+        free(node);
     }
 
-    printf("Sensor %d status = 1 (failure detected)\n", client.id);
-    printf("Sending REQ_CHECKALERT %d to SL\n", client.id);
-
-    msg.type = REQ_CHECKALERT;
-    msg.payload = client.id;
-    send_msg(peer_socket, &msg);
-
-    memset(&msg, 0, sizeof(msg));
-
-    recv_msg(peer_socket, &msg);
-
-    Msg_t resp = {0};
-
-    if (msg.type == ERROR_MSG)
+    while (worker->handshake_head != HANDSHAKE_NONE)
     {
-        printf("ERROR(%d) received from SL\n", msg.payload);
-        printf("Sending ERROR(%d) to CLIENT\n", msg.payload);
-        resp.type = ERROR_MSG;
-        resp.payload = 10;
-        strcpy(resp.desc, DESC_ERROR_10);
+        int sock = worker->handshakes[worker->handshake_head].sock;
+        handshake_end(worker, worker->handshake_head);
+        conn_close(sock);
     }
+    free(worker->handshakes);
+    free(worker->handshake_free);
 
-    if (msg.type == RES_CHECKALERT)
+    if (worker->ring != NULL)
     {
-        printf("RES_CHECKALERT %d\n", msg.payload);
-        printf("Sending RES_SENSSTATUS %d to CLIENT\n", msg.payload);
-
-        resp.type = RES_SENSSTATUS;
-        resp.payload = msg.payload;
+        // Fechar o anel cancela as operações pendentes
+        uring_close(worker->ring);
+        free(worker->ring);
+        for (uint32_t i = 0; i < worker->send_cap; i++)
+        {
+            free(worker->sends[i].buf);
+        }
+        free(worker->sends);
+        free(worker->send_free);
+        for (uint32_t i = worker->parked_head; i < worker->parked_count; i++)
+        {
+            conn_close(worker->parked[i]);
+        }
+        free(worker->parked);
     }
 
-    send_msg(current_socket, &resp);
-    return CONTINUE_RUNNING;
+    pending_free(&worker->pending);
+    close(worker->clients_socket);
+    close(worker->inbox_fd);
+    close(worker->epfd);
 }
 
 /**
- * @brief Processa uma solicitação de localização (`REQ_SENSLOC`) de um cliente.
- * * Envia a localização armazenada do sensor de volta para o cliente.
- * * @param current_socket O socket do cliente solicitante.
- * @param client O cliente (sensor) que fez a solicitação.
- * @return ServerCommand O estado de continuação do servidor.
+ * @brief Loop de um worker secundário, executado em sua própria thread.
+ * @param arg O worker (Worker_t *).
+ * @return void* Sempre NULL.
  */
-ServerCommand handle_req_sensloc(int current_socket, Client_t client)
+void *worker_main(void *arg)
 {
-    Msg_t msg = {0};
-
-    if (client.data < 1)
+    Worker_t *self = arg;
+    while (wait_for_activity(self) == CONTINUE_RUNNING)
     {
-        msg.type = ERROR_MSG;
-        msg.payload = 10;
-        strcpy(msg.desc, DESC_ERROR_10);
-        send_msg(current_socket, &msg);
-        return CONTINUE_RUNNING;
     }
 
-    msg.type = RES_SENSLOC;
-    msg.payload = client.data;
-    send_msg(current_socket, &msg);
-    return CONTINUE_RUNNING;
+    log_thread_exit();
+    return NULL;
 }
 
 /**
- * @brief Processa uma solicitação de lista de sensores por localização (`REQ_LOCLIST`).
- * * Busca todos os sensores na localização especificada e retorna uma lista
- * com seus IDs para o cliente.
- * * @param current_socket O socket do cliente solicitante.
- * @param loc_id O ID da localização a ser buscada.
- * @param clients O array de clientes para buscar.
- * @return ServerCommand O estado de continuação do servidor.
+ * @brief Abre o estado persistente para o papel atual do servidor.
+ * @param store Onde guardar o estado.
+ * @param path O caminho do arquivo (NULL = persistência desativada).
+ * @param type O papel do servidor (LOC ou STATUS).
+ * @return Store_t* O estado aberto, ou NULL se a persistência está desativada.
  */
-ServerCommand handle_req_loclist(int current_socket, int loc_id, Client_t *clients)
+Store_t *state_open(Store_t *store, const char *path, Server type)
 {
-    char loc_clients[BUFSZ];
-    int count = 0;
-    for (int i = 0; i < MAX_CLIENTS; i++)
+    if (path == NULL)
     {
-        if (clients[i].data == loc_id)
-        {
-            count++;
-            char client_id[10];
-            if (count > 1)
-            {
-                sprintf(client_id, ", %d", clients[i].id);
-            }
-            else
-            {
-                memset(loc_clients, 0, BUFSZ);
-                sprintf(loc_clients, "%d", clients[i].id);
-            }
-            strcat(loc_clients, client_id);
-        }
+        return NULL;
     }
 
-    if (loc_id < 1 || loc_id > 10 || count == 0)
+    if (store_open(store, path, type) != 0)
     {
-        Msg_t err = {0};
-        err.type = ERROR_MSG;
-        err.payload = 11;
-        printf("Location %d not found\n", loc_id);
-        printf("Sending ERROR(11) to CLIENT\n");
-        strcpy(err.desc, DESC_ERROR_11);
-        send_msg(current_socket, &err);
-        return CONTINUE_RUNNING;
+        logexit(path);
     }
 
-    printf("Found sensors at location %d\n", loc_id);
-    printf("Sending RES_LOCLIST %s\n", loc_clients);
-
-    Msg_t msg = {0};
-    msg.type = RES_LOCLIST;
-    msg.payload = loc_id;
-    strcpy(msg.desc, loc_clients);
-    send_msg(current_socket, &msg);
-
-    return CONTINUE_RUNNING;
+    return store;
 }
 
 /**
- * @brief Gerencia a comunicação e as mensagens recebidas dos clientes.
- * * Verifica qual cliente enviou dados e direciona a mensagem para a
- * função de tratamento apropriada (desconexão, status, localização, etc.).
- * * @param clients O array de clientes conectados.
- * @param peer_socket O socket do peer (necessário para `handle_req_sensstatus`).
- * @param next_client_index Ponteiro para o número de clientes.
- * @param read_fds O conjunto de file descriptors prontos para leitura.
- * @param type O tipo do servidor.
- * @return ServerCommand O estado de continuação do servidor.
+ * @brief Loop principal que gerencia a conexão com o peer e com os clientes.
+ * * Cria os shards do registro e os workers, inicia uma thread para cada
+ * worker secundário e executa o worker 0 na thread atual, chamando
+ * `wait_for_activity` repetidamente para processar todos os eventos de rede
+ * e do usuário, até que a conexão com o peer seja encerrada ou o servidor
+ * seja desligado. O SS monta o anel com os SLs conectados e, se forem vários,
+ * o envia a cada um deles. O link k com cada peer é monitorado pelo worker
+ * k % nworkers; no SL, os links do pool chegam já durante a sessão.
+ * * @param peers As conexões com os peers (um SL por posição do anel, no SS).
+ * @param npeers O número de peers (1 no SL).
+ * @param nlinks O número de links com cada peer (1 no SL, ver session_accept_link).
+ * @param listen_socket O socket de escuta de peers.
+ * @param connected_peer_id Ponteiro para o ID do peer conectado.
+ * @param my_type O tipo deste servidor.
+ * @param clients_storage O endereço de escuta de clientes.
+ * @param opts As opções de linha de comando.
+ * @param metrics As métricas de cada worker (NULL se desativadas).
+ * @param store O estado persistente dos sensores (NULL se desativado).
  */
-ServerCommand handle_client_activity(Client_t *clients, int peer_socket, int *next_client_index,
-                                     fd_set *read_fds, Server type)
+void manage_peer_connection(Peer_t *peers, int npeers, int nlinks, int listen_socket, int *connected_peer_id,
+                            Server my_type, struct sockaddr_storage *clients_storage, const Options_t *opts,
+                            Metrics_t *metrics, Store_t *store)
 {
-    for (int i = 0; i < *next_client_index; i++)
-    {
-        int current_socket = clients[i].socket_id;
+    ServerCommand status = CONTINUE_RUNNING;
+    Session_t session = {0};
 
-        if (FD_ISSET(current_socket, read_fds))
+    session.type = my_type;
+    session.peers = peers;
+    session.npeers = npeers;
+    session.nlinks = nlinks;
+    session.clients_port = ntohs(((struct sockaddr_in *)clients_storage)->sin_port);
+    session.listen_socket = listen_socket;
+    session.unix_socket = init_unix_socket(opts->unix_path, session.clients_port, opts->backlog);
+    session.connected_peer_id = connected_peer_id;
+    session.max_sensors = opts->max_sensors;
+    session.nshards = opts->workers;
+    session.nworkers = opts->workers;
+    session.metrics = metrics;
+    session.store = store;
+    session.backlog = opts->backlog;
+    session.handshake_timeout = (uint64_t)opts->handshake_timeout * 1000000;
+    session.idle_timeout = (uint64_t)opts->idle_timeout * 1000000;
+    session.heartbeat = (uint64_t)opts->heartbeat * 1000000;
+    timer_init(&session.heartbeat_timer, (uint64_t)TIMER_HEARTBEAT << 32);
+    session.reclaim_timeout = (uint64_t)opts->reclaim_timeout * 1000000;
+    timer_init(&session.reclaim_timer, (uint64_t)TIMER_RECLAIM << 32);
+    if (session.idle_timeout > 0)
+    {
+        session.idle_cap = fd_limit();
+        session.idle = calloc(session.idle_cap, sizeof(IdleTimer_t));
+        if (session.idle == NULL)
         {
-            Msg_t disc = {0};
-            size_t count = recv_msg(current_socket, &disc);
-
-            if (count == 0)
-            {
-                printf("Client %d removed\n", clients[i].id);
-                clients[i].socket_id = 0;
-                clients[i].id = 0;
-                clients[i].data = 0;
-
-                for (int j = i; j < *next_client_index - 1; j++)
-                {
-                    clients[j] = clients[j + 1];
-                }
-                (*next_client_index)--;
-
-                return CONTINUE_RUNNING;
-            }
-
-            if (disc.type == REQ_LOCLIST)
-            {
-                printf("REQ_LOCLIST %d\n", disc.payload);
-                return handle_req_loclist(current_socket, disc.payload, clients);
-            }
-
-            for (int j = 0; j < *next_client_index; j++)
-            {
-                if (disc.payload == clients[j].id)
-                {
-                    if (disc.type == REQ_DISCSEN)
-                    {
-                        return handle_req_discsen(current_socket, clients, next_client_index, j, type);
-                    }
-
-                    if (disc.type == REQ_SENSSTATUS)
-                    {
-                        printf("REQ_SENSSTATUS %d\n", clients[j].id);
-                        return handle_req_sensstatus(current_socket, peer_socket, clients[j]);
-                    }
-
-                    if (disc.type == REQ_SENSLOC)
-                    {
-                        printf("REQ_SENSLOC %d\n", clients[j].id);
-                        return handle_req_sensloc(current_socket, clients[j]);
-                    }
-                }
-            }
+            logexit("calloc");
+        }
+    }
+    session.io_uring = opts->io_uring;
+    if (session.io_uring)
+    {
+        session.fd_cap = fd_limit();
+        session.fd_handshake = malloc(session.fd_cap * sizeof(uint32_t));
+        if (session.fd_handshake == NULL)
+        {
+            logexit("malloc");
+        }
+        memset(session.fd_handshake, 0xff, session.fd_cap * sizeof(uint32_t)); // HANDSHAKE_NONE
+    }
+    atomic_init(&session.sensors, 0);
+    atomic_init(&session.cluster, NULL);
+    if (my_type == STATUS)
+    {
+        // O SL de um cluster só o conhece quando o SS envia o anel (ver session_set_cluster)
+        int keys[HASHRING_MAX_NODES];
+        for (int i = 0; i < npeers; i++)
+        {
+            keys[i] = peers[i].clients_port;
+        }
+        HashRing_t *ring = malloc(sizeof(HashRing_t));
+        if (ring == NULL || hashring_init(ring, keys, npeers) != 0)
+        {
+            logexit("hashring_init");
+        }
+        atomic_store(&session.cluster, ring);
+    }
 
-            Msg_t err = {0};
-            err.type = ERROR_MSG;
-            err.payload = 10;
-            strcpy(err.desc, DESC_ERROR_10);
-            send_msg(current_socket, &err);
+    session.shards = calloc(session.nshards, sizeof(Shard_t));
+    session.workers = calloc(session.nworkers, sizeof(Worker_t));
+    if (session.shards == NULL || session.workers == NULL)
+    {
+        logexit("calloc");
+    }
 
-            return CONTINUE_RUNNING;
-        }
+    for (uint32_t i = 0; i < session.nshards; i++)
+    {
+        pthread_mutex_init(&session.shards[i].lock, NULL);
+        // O limite de sensores é global e controlado por `session.sensors`
+        registry_init(&session.shards[i].registry, UINT32_MAX);
+        // Primeiro ID da faixa do papel que cai neste shard (ver shard_for)
+        uint32_t base = my_type == LOC ? ID_BASE_LOC : ID_BASE_STATUS;
+        session.shards[i].next_id = base + (i + session.nshards - base % session.nshards) % session.nshards;
     }
 
-    return CONTINUE_RUNNING;
-}
+    if (store != NULL)
+    {
+        session_restore(&session);
+    }
 
-/**
- * @brief Aguarda por atividade em múltiplos sockets usando `select`.
- * * Monitora a entrada padrão, o socket do peer, o socket de escuta de clientes
- * e todos os sockets de clientes conectados. Quando uma atividade é detectada,
- * chama a função de tratamento correspondente.
- * * @param read_fds O conjunto de file descriptors a ser monitorado.
- * @param server_socket O socket de comunicação com o peer.
- * @param clients_socket O socket de escuta para clientes.
- * @param listen_socket O socket de escuta para peers.
- * @param my_peer_id O ID deste servidor.
- * @param connected_peer_id Ponteiro para o ID do peer conectado.
- * @param clients Array de clientes.
- * @param next_client_index Ponteiro para o número de clientes.
- * @param type O tipo do servidor.
- * @return ServerCommand O comando resultante da atividade.
- */
-ServerCommand wait_for_activity(fd_set *read_fds, int server_socket, int clients_socket, int listen_socket,
-                                int my_peer_id, int *connected_peer_id, Client_t *clients,
-                                int *next_client_index, Server type)
-{
-    char buf[BUFSZ];
+    for (int i = 0; i < session.nworkers; i++)
+    {
+        worker_init(&session.workers[i], i, &session, clients_storage);
+    }
 
-    FD_ZERO(read_fds);
-    FD_SET(server_socket, read_fds);
-    FD_SET(clients_socket, read_fds);
-    FD_SET(listen_socket, read_fds);
-    FD_SET(STDIN_FILENO, read_fds);
+    Worker_t *self = &session.workers[0];
 
-    int current_max_fd = ((clients_socket > server_socket) ? clients_socket : server_socket);
-    current_max_fd = ((current_max_fd > STDIN_FILENO) ? current_max_fd : STDIN_FILENO) + 1;
+    // A entrada padrão pode não ser monitorável (ex: redirecionada de um arquivo)
+    event_register(self->epfd, STDIN_FILENO, FD_STDIN, EPOLLIN);
 
-    for (int i = 0; i < *next_client_index; i++)
+    HashRing_t *ring = atomic_load(&session.cluster);
+    for (int i = 0; i < npeers; i++)
     {
-        if (clients[i].socket_id > 0)
+        peers[i].last_rx = metrics_now();
+        peers[i].beats = 0;
+        peers[i].links[0] = peers[i].sock;
+        for (int link = 0; link < nlinks; link++)
         {
-            FD_SET(clients[i].socket_id, read_fds);
-            if (clients[i].socket_id >= current_max_fd)
-            {
-                current_max_fd = clients[i].socket_id + 1;
-            }
+            worker_watch_link(&session.workers[link % session.nworkers], i, link);
         }
-    }
 
-    int rv = select(current_max_fd, read_fds, NULL, NULL, NULL);
-    if (rv == -1)
-    {
-        logexit("select");
+        if (npeers > 1)
+        {
+            Msg_t routes = {0};
+            routes.type = RES_ROUTES;
+            batch_format(&routes, ring->keys, ring->nodes);
+            send_msg(peers[i].sock, &routes);
+        }
     }
 
-    if (FD_ISSET(STDIN_FILENO, read_fds))
+    // Os heartbeats só trafegam no formato compacto; um peer antigo não os envia
+    if (conn_get_wire(peers[0].sock) == WIRE_COMPACT)
     {
-        return handle_stdin_input(buf, server_socket, my_peer_id);
+        timer_arm(&self->wheel, &session.heartbeat_timer, metrics_now() + session.heartbeat);
     }
 
-    if (FD_ISSET(server_socket, read_fds))
+    if (store != NULL && session.reclaim_timeout > 0 && store_count(store) > 0)
     {
-        return handle_peer_activity(server_socket, connected_peer_id, clients);
+        timer_arm(&self->wheel, &session.reclaim_timer, metrics_now() + session.reclaim_timeout);
     }
 
-    if (FD_ISSET(listen_socket, read_fds))
+    // O socket de escuta P2P é bloqueante, então é monitorado em modo level-triggered
+    if (listen_socket > 0 && event_register(self->epfd, listen_socket, FD_P2P_LISTEN, EPOLLIN) != 0)
     {
-        handle_peer_accept(listen_socket, connected_peer_id, &server_socket);
+        logexit("epoll_ctl");
     }
 
-    if (FD_ISSET(clients_socket, read_fds))
+    for (int i = 1; i < session.nworkers; i++)
     {
-        return handle_client_connection(clients_socket, clients, next_client_index,
-                                        read_fds, type);
+        if (pthread_create(&session.workers[i].thread, NULL, worker_main, &session.workers[i]) != 0)
+        {
+            logexit("pthread_create");
+        }
     }
 
-    return handle_client_activity(clients, server_socket, next_client_index, read_fds, type);
-}
-
-/**
- * @brief Loop principal que gerencia a conexão com o peer e com os clientes.
- * * Chama `wait_for_activity` repetidamente para processar todos os eventos
- * de rede e do usuário, mantendo o servidor em execução até que a conexão
- * com o peer seja encerrada ou o servidor seja desligado.
- * * @param peer_socket O socket de comunicação com o peer.
- * @param clients_socket O socket de escuta de clientes.
- * @param listen_socket O socket de escuta de peers.
- * @param my_peer_id O ID deste servidor.
- * @param connected_peer_id Ponteiro para o ID do peer conectado.
- * @param my_type O tipo deste servidor.
- */
-void manage_peer_connection(int peer_socket, int clients_socket, int listen_socket, int my_peer_id, int *connected_peer_id, Server my_type)
-{
-    fd_set read_fds;
-    ServerCommand status = CONTINUE_RUNNING;
-    Client_t clients[MAX_CLIENTS] = {0};
-    int next_client_index = 0;
-
     while (status)
     {
-        status = wait_for_activity(&read_fds, peer_socket, clients_socket, listen_socket, my_peer_id, connected_peer_id, clients, &next_client_index, my_type);
+        status = wait_for_activity(self);
 
         if (status == SERVER_SHUTDOWN)
         {
@@ -771,16 +4168,55 @@ void manage_peer_connection(int peer_socket, int clients_socket, int listen_sock
             {
                 close(listen_socket);
             }
-            close(peer_socket);
-            close(clients_socket);
+            for (int i = 0; i < npeers; i++)
+            {
+                conn_close(peers[i].sock);
+            }
+            close(self->clients_socket);
+            close_unix_socket(&session, opts->unix_path);
+            close(self->epfd);
+            if (store != NULL)
+            {
+                store_close(store);
+            }
             sleep(1);
             exit(EXIT_SUCCESS);
         }
 
         if (status == TERMINATE_P2P_CONNECTION)
         {
-            close(peer_socket);
-            close(clients_socket);
+            for (int i = 1; i < session.nworkers; i++)
+            {
+                worker_post(&session.workers[i], job_new(JOB_STOP));
+                pthread_join(session.workers[i].thread, NULL);
+            }
+            for (int i = 0; i < session.nworkers; i++)
+            {
+                worker_close(&session.workers[i]);
+            }
+            close_unix_socket(&session, opts->unix_path);
+            for (uint32_t i = 0; i < session.nshards; i++)
+            {
+                registry_free(&session.shards[i].registry);
+                pthread_mutex_destroy(&session.shards[i].lock);
+            }
+
+            for (int i = 0; i < npeers; i++)
+            {
+                for (int link = 0; link < PEER_LINKS_MAX; link++)
+                {
+                    if (peers[i].links[link] != 0)
+                    {
+                        conn_close(peers[i].links[link]);
+                        peers[i].links[link] = 0;
+                    }
+                }
+            }
+            free(atomic_load(&session.cluster));
+            free(session.idle);
+            free(session.fd_handshake);
+            free(session.shards);
+            free(session.workers);
             sleep(1);
             break;
         }
@@ -799,24 +4235,54 @@ void manage_peer_connection(int peer_socket, int clients_socket, int listen_sock
  */
 int main(int argc, char **argv)
 {
+    // Campos omitidos começam zerados (NULL = desativado)
+    Options_t opts = {
+        .out_limit = OUT_LIMIT_DEFAULT,
+        .slow_policy = SLOW_CLOSE,
+        .max_sensors = MAX_CLIENTS,
+        .workers = 1,
+        .log_level = LOG_INFO,
+        .backlog = SOMAXCONN,
+        .handshake_timeout = HANDSHAKE_TIMEOUT_DEFAULT,
+        .heartbeat = HEARTBEAT_DEFAULT,
+        .reclaim_timeout = RECLAIM_TIMEOUT_DEFAULT,
+        .peer_conns = 1,
+        .shm = 1,
+    };
+    parse_options(argc, argv, &opts);
+    log_init(opts.log_level);
+    conn_set_out_policy(opts.out_limit, opts.slow_policy);
+    shm_set_enabled(opts.shm);
+
     // Verifica se os argumentos da linha de comando estão corretos
-    if (argc < 4)
+    if (argc - optind < 3)
     {
         usage(argc, argv);
     }
+    char **args = argv + optind - 1;
 
     // Inicializa o gerador de números aleatórios
     srand(time(NULL));
 
+    // As métricas acumulam durante toda a vida do processo, entre sessões com o peer
+    Metrics_t *metrics = NULL;
+    if (opts.metrics_port != 0)
+    {
+        metrics = metrics_create(opts.workers);
+        metrics_serve(metrics, opts.workers, opts.metrics_port);
+    }
+
     // Estruturas para armazenar endereços de sockets
     struct sockaddr_storage clients_storage;
     struct sockaddr_storage p2p_storage;
     Server my_type;
-    int connected_peer_id = -1, my_peer_id = -1;
-    int csock = -1; // Socket para clientes
+    int connected_peer_id = -1;
+    Peer_t peers[HASHRING_MAX_NODES] = {0};
+    Store_t store;
+    Store_t *state = NULL;
 
     // Inicializa as estruturas de endereço a partir dos argumentos
-    if (0 != server_sockaddr_init(argv[1], argv[2], argv[3], &p2p_storage, &clients_storage))
+    if (0 != server_sockaddr_init(args[1], args[2], args[3], &p2p_storage, &clients_storage))
     {
         usage(argc, argv);
     }
@@ -844,11 +4310,23 @@ int main(int argc, char **argv)
     {
         // Conexão bem-sucedida, assume o papel de Servidor de Status (SS)
         my_type = STATUS;
-        my_peer_id = start_active_socket(s, &connected_peer_id);
-        csock = init_clients_socket(&clients_storage);
+        peers[0].sock = s;
+        peers[0].self_id = start_active_socket(s, &peers[0].id, &peers[0].clients_port);
+        connected_peer_id = peers[0].id;
+        int npeers = cluster_connect(opts.cluster, &p2p_storage, peers);
+        // Cada worker consulta por um único link; links além do número de workers ficariam ociosos
+        int nlinks = peer_connect_links(peers, npeers, opts.peer_conns < opts.workers ? opts.peer_conns : opts.workers);
+        state = state_open(&store, opts.state_path, my_type);
 
         // Entra no loop principal para gerenciar a conexão
-        manage_peer_connection(s, csock, -1, my_peer_id, &connected_peer_id, my_type);
+        manage_peer_connection(peers, npeers, nlinks, -1, &connected_peer_id, my_type, &clients_storage, &opts,
+                               metrics, state);
+
+        // O estado de um SS guarda status, não localizações: o arquivo é recomeçado
+        if (state != NULL)
+        {
+            store_close(state);
+        }
     }
     else
     {
@@ -860,6 +4338,7 @@ int main(int argc, char **argv)
     // Se o código chegou aqui, a tentativa de conexão ativa falhou.
     // O servidor agora se tornará passivo (Servidor de Localização - SL) e aguardará uma conexão.
     my_type = LOC;
+    state = state_open(&store, opts.state_path, my_type);
 
     // Cria um novo socket para escutar por conexões de peers
     int listen_s = socket(p2p_storage.ss_family, SOCK_STREAM, 0);
@@ -876,20 +4355,21 @@ int main(int argc, char **argv)
     // Configura o socket de escuta
     init_passive_server(listen_s, p2p_addr, p2p_storage);
 
-    int server_socket = -1;
+    int clients_port = ntohs(((struct sockaddr_in *)&clients_storage)->sin_port);
 
     // Loop infinito para sempre voltar a escutar após uma desconexão de peer
     while (1)
     {
-        printf("No peer found, starting to listen...\n");
+        log_info("No peer found, starting to listen...");
         // Aguarda e aceita uma conexão de um novo peer
-        my_peer_id = handle_peer_accept(listen_s, &connected_peer_id, &server_socket);
-
-        // Inicializa o socket para escutar conexões de clientes
-        csock = init_clients_socket(&clients_storage);
+        memset(&peers[0], 0, sizeof(Peer_t));
+        peers[0].self_id = handle_peer_accept(listen_s, &connected_peer_id, &peers[0].sock, clients_port);
+        peers[0].id = connected_peer_id;
 
         // Entra no loop para gerenciar a conexão com o peer e os clientes
-        manage_peer_connection(server_socket, csock, listen_s, my_peer_id, &connected_peer_id, my_type);
+        // (os sockets de escuta de clientes são criados por cada worker)
+        manage_peer_connection(peers, 1, 1, listen_s, &connected_peer_id, my_type, &clients_storage, &opts,
+                               metrics, state);
     }
 
     return 0;
@@ -0,0 +1,485 @@
+#define _GNU_SOURCE // memfd_create
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "shmring.h"
+
+#define SHM_MASK (SHM_RING_SZ - 1)
+#define SHM_FDS 3 // memfd e as duas campainhas
+
+static int enabled = 1;
+
+/**
+ * @brief Habilita ou desabilita a negociação do link em memória compartilhada.
+ * @param on 0 para usar sempre TCP (opção --no-shm).
+ */
+void shm_set_enabled(int on)
+{
+    enabled = on;
+}
+
+/**
+ * @brief Toca uma campainha.
+ * @param bell O eventfd.
+ */
+static void bell_ring(int bell)
+{
+    uint64_t one = 1;
+    if (write(bell, &one, sizeof(one)) == -1 && errno != EAGAIN)
+    {
+        logexit("write");
+    }
+}
+
+/**
+ * @brief Escreve no anel de envio o máximo possível dos trechos dados.
+ * * Tem a mesma semântica de `sendmsg` com MSG_DONTWAIT: a escrita pode ser
+ * parcial, e -1 com EAGAIN indica o anel cheio.
+ * * @param ctx O link (ShmLink_t *).
+ * @param iov Os trechos.
+ * @param iovcnt O número de trechos.
+ * @return ssize_t Os bytes escritos, ou -1 com errno EAGAIN.
+ */
+static ssize_t shm_send(void *ctx, const struct iovec *iov, int iovcnt)
+{
+    ShmLink_t *link = ctx;
+    ShmRing_t *r = link->tx;
+    uint32_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    uint32_t room = SHM_RING_SZ - (tail - atomic_load_explicit(&r->head, memory_order_acquire));
+
+    if (room == 0)
+    {
+        // O consumidor vê a marca ao liberar espaço, ou esta releitura vê o espaço liberado
+        atomic_store(&r->blocked, 1);
+        room = SHM_RING_SZ - (tail - atomic_load(&r->head));
+        if (room == 0)
+        {
+            errno = EAGAIN;
+            return -1;
+        }
+    }
+
+    size_t written = 0;
+    for (int i = 0; i < iovcnt && written < room; i++)
+    {
+        size_t len = iov[i].iov_len < room - written ? iov[i].iov_len : room - written;
+        uint32_t start = (tail + written) & SHM_MASK;
+        size_t first = SHM_RING_SZ - start < len ? SHM_RING_SZ - start : len;
+        memcpy(r->data + start, iov[i].iov_base, first);
+        memcpy(r->data, (const unsigned char *)iov[i].iov_base + first, len - first);
+        written += len;
+    }
+
+    atomic_store_explicit(&r->tail, tail + written, memory_order_release);
+
+    // Se o consumidor já tinha lido tudo, ele pode ter dormido antes de ver a publicação
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&r->head, memory_order_relaxed) == tail)
+    {
+        bell_ring(link->tx_bell);
+    }
+    return written;
+}
+
+/**
+ * @brief Lê do anel de recepção, como `recv` com MSG_DONTWAIT.
+ * * Com o anel vazio, a campainha é esvaziada antes de uma nova verificação,
+ * de modo que um toque posterior à última leitura nunca se perde.
+ * * @param ctx O link (ShmLink_t *).
+ * @param buf O destino.
+ * @param len O tamanho do destino.
+ * @return ssize_t Os bytes lidos, ou -1 com errno EAGAIN se não há nenhum.
+ */
+static ssize_t shm_recv(void *ctx, void *buf, size_t len)
+{
+    ShmLink_t *link = ctx;
+    ShmRing_t *r = link->rx;
+    uint32_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+
+    if (tail == head)
+    {
+        uint64_t count;
+        if (read(link->rx_bell, &count, sizeof(count)) == -1 && errno != EAGAIN)
+        {
+            logexit("read");
+        }
+        tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+        if (tail == head)
+        {
+            errno = EAGAIN;
+            return -1;
+        }
+    }
+
+    size_t n = tail - head < len ? tail - head : len;
+    uint32_t start = head & SHM_MASK;
+    size_t first = SHM_RING_SZ - start < n ? SHM_RING_SZ - start : n;
+    memcpy(buf, r->data + start, first);
+    memcpy((unsigned char *)buf + first, r->data, n - first);
+
+    atomic_store_explicit(&r->head, head + n, memory_order_release);
+
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&r->blocked, memory_order_relaxed))
+    {
+        atomic_store_explicit(&r->blocked, 0, memory_order_relaxed);
+        bell_ring(link->tx_bell);
+    }
+    return n;
+}
+
+/**
+ * @brief Retorna o descritor que sinaliza bytes a receber (a campainha).
+ * @param ctx O link (ShmLink_t *).
+ * @return int O eventfd.
+ */
+static int shm_fd(void *ctx)
+{
+    ShmLink_t *link = ctx;
+    return link->rx_bell;
+}
+
+/**
+ * @brief Desfaz o mapeamento e fecha as campainhas de um link.
+ * @param ctx O link (ShmLink_t *), liberado.
+ */
+static void shm_close(void *ctx)
+{
+    ShmLink_t *link = ctx;
+    munmap(link->base, 2 * sizeof(ShmRing_t));
+    close(link->tx_bell);
+    close(link->rx_bell);
+    free(link);
+}
+
+const ConnTransport_t shm_transport = {shm_recv, shm_send, shm_fd, shm_close};
+
+/**
+ * @brief Verifica se o peer de uma conexão TCP está na mesma máquina.
+ * @param sock O socket.
+ * @return int 1 se o endereço do peer é o local ou de loopback, 0 caso contrário.
+ */
+static int peer_local(int sock)
+{
+    struct sockaddr_in local, peer;
+    socklen_t local_len = sizeof(local), peer_len = sizeof(peer);
+    if (getsockname(sock, (struct sockaddr *)&local, &local_len) != 0 ||
+        getpeername(sock, (struct sockaddr *)&peer, &peer_len) != 0 || peer.sin_family != AF_INET)
+    {
+        return 0;
+    }
+
+    return peer.sin_addr.s_addr == local.sin_addr.s_addr || (ntohl(peer.sin_addr.s_addr) >> 24) == 127;
+}
+
+/**
+ * @brief Monta o endereço de um socket AF_UNIX no espaço de nomes abstrato.
+ * @param addr O endereço.
+ * @param name O nome (sem o '\0' inicial).
+ * @return socklen_t O tamanho do endereço.
+ */
+static socklen_t unix_addr(struct sockaddr_un *addr, const char *name)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    size_t len = strnlen(name, sizeof(addr->sun_path) - 1);
+    memcpy(addr->sun_path + 1, name, len);
+    return offsetof(struct sockaddr_un, sun_path) + 1 + len;
+}
+
+/**
+ * @brief Verifica se a outra ponta de um socket AF_UNIX é o processo esperado.
+ * * O nome do socket não é segredo para quem lista os sockets abstratos, então
+ * o processo que se conecta (ou escuta) é conferido pelas credenciais do kernel.
+ * * @param s O socket AF_UNIX conectado.
+ * @param pid O PID esperado (anunciado pelo peer na conexão TCP).
+ * @return int 1 se a outra ponta é `pid`, do mesmo usuário, 0 caso contrário.
+ */
+static int unix_peer_is(int s, pid_t pid)
+{
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    if (getsockopt(s, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0)
+    {
+        return 0;
+    }
+    return cred.pid == pid && cred.uid == getuid();
+}
+
+/**
+ * @brief Procura um item separado por espaços em `desc`.
+ * @param desc A descrição de uma mensagem de handshake.
+ * @param prefix O início do item.
+ * @return const char* O item encontrado, ou NULL.
+ */
+static const char *desc_item(const char *desc, const char *prefix)
+{
+    size_t len = strlen(prefix);
+    for (const char *p = desc; *p != '\0'; p++)
+    {
+        if ((p == desc || p[-1] == ' ') && strncmp(p, prefix, len) == 0)
+        {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief (SS) Oferece o link em memória compartilhada em um REQ_CONPEER ou REQ_PEERLINK.
+ * * Só oferece se o SL estiver na mesma máquina. O item "shm:<nome>" é
+ * acrescentado a `desc` e nomeia um socket AF_UNIX abstrato pelo qual os
+ * descritores do link são entregues; deve ser chamada antes de `wire_offer`.
+ * O nome leva o PID do SS, conferido pelo SL, e uma parte aleatória, para
+ * que outro processo não o ocupe antes.
+ * * @param msg A requisição.
+ * @param sock A conexão TCP com o SL.
+ * @return int O socket de escuta AF_UNIX, ou -1 se o link não é oferecido.
+ */
+int shm_offer(Msg_t *msg, int sock)
+{
+    uint64_t nonce[2];
+    if (!enabled || !peer_local(sock) || getrandom(nonce, sizeof(nonce), 0) != sizeof(nonce))
+    {
+        return -1;
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "tp-shm-%d-%016llx%016llx", (int)getpid(), (unsigned long long)nonce[0],
+             (unsigned long long)nonce[1]);
+
+    struct sockaddr_un addr;
+    socklen_t addrlen = unix_addr(&addr, name);
+    // Não bloqueante: `shm_serve` só aceita as conexões que já estão na fila
+    int s = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (s == -1 || bind(s, (struct sockaddr *)&addr, addrlen) != 0 || listen(s, 1) != 0)
+    {
+        if (s != -1)
+        {
+            close(s);
+        }
+        return -1;
+    }
+
+    size_t len = strnlen(msg->desc, BUFSZ);
+    snprintf(msg->desc + len, BUFSZ - len, "%sshm:%s", len > 0 ? " " : "", name);
+    return s;
+}
+
+/**
+ * @brief (SL) Aceita a oferta de link em memória compartilhada, se houver.
+ * * Conecta-se ao socket AF_UNIX nomeado na oferta, o que também confirma que
+ * os dois processos estão na mesma máquina, e acrescenta o item "shm:<PID>"
+ * à resposta; deve ser chamada antes de `wire_offer`. O socket só é usado se
+ * quem o escuta for o SS que fez a oferta. Os descritores são recebidos
+ * depois, com `shm_join`.
+ * * @param req A requisição recebida.
+ * @param resp A resposta a ser enviada.
+ * @param sock A conexão TCP com o SS.
+ * @return int O socket AF_UNIX conectado, ou -1 se o link fica em TCP.
+ */
+int shm_answer(const Msg_t *req, Msg_t *resp, int sock)
+{
+    const char *offer = desc_item(req->desc, "shm:");
+    if (!enabled || offer == NULL || !wire_offered(req) || !peer_local(sock))
+    {
+        return -1;
+    }
+
+    char name[64];
+    int ss_pid;
+    if (sscanf(offer + 4, "%63s", name) != 1 || sscanf(name, "tp-shm-%d-", &ss_pid) != 1)
+    {
+        return -1;
+    }
+
+    struct sockaddr_un addr;
+    socklen_t addrlen = unix_addr(&addr, name);
+    int s = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (s == -1 || connect(s, (struct sockaddr *)&addr, addrlen) != 0 || !unix_peer_is(s, ss_pid))
+    {
+        if (s != -1)
+        {
+            close(s);
+        }
+        return -1;
+    }
+
+    size_t len = strnlen(resp->desc, BUFSZ);
+    snprintf(resp->desc + len, BUFSZ - len, "%sshm:%d", len > 0 ? " " : "", (int)getpid());
+    return s;
+}
+
+/**
+ * @brief (SS) Verifica se o SL aceitou o link em memória compartilhada.
+ * @param resp O RES_CONPEER ou RES_PEERLINK recebido.
+ * @return pid_t O PID do SL, que deve ser quem se conectou ao socket da
+ * oferta, ou 0 se ele não aceitou.
+ */
+pid_t shm_accepted(const Msg_t *resp)
+{
+    const char *item = desc_item(resp->desc, "shm:");
+    int pid;
+    if (item == NULL || sscanf(item + 4, "%d", &pid) != 1 || pid <= 0)
+    {
+        return 0;
+    }
+    return pid;
+}
+
+/**
+ * @brief Mapeia o memfd de um link e escolhe os sentidos de cada processo.
+ * @param memfd O memfd com os dois anéis.
+ * @param bells As campainhas (a primeira acorda quem recebeu os descritores).
+ * @param creator 1 no processo que criou o link.
+ * @return ShmLink_t* O link, ou NULL se o mapeamento falhou.
+ */
+static ShmLink_t *link_map(int memfd, const int bells[2], int creator)
+{
+    ShmLink_t *link = calloc(1, sizeof(ShmLink_t));
+    if (link == NULL)
+    {
+        logexit("calloc");
+    }
+
+    link->base = mmap(NULL, 2 * sizeof(ShmRing_t), PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (link->base == MAP_FAILED)
+    {
+        free(link);
+        return NULL;
+    }
+
+    ShmRing_t *rings = link->base;
+    link->tx = &rings[creator ? 0 : 1];
+    link->rx = &rings[creator ? 1 : 0];
+    link->tx_bell = bells[creator ? 0 : 1];
+    link->rx_bell = bells[creator ? 1 : 0];
+    return link;
+}
+
+/**
+ * @brief (SS) Cria o link e entrega seus descritores ao SL que aceitou a oferta.
+ * * O SL se conecta antes de responder, então sua conexão já está na fila.
+ * Conexões de qualquer outro processo são descartadas sem receber nada.
+ * * @param listen_fd O socket de escuta retornado por `shm_offer` (fechado aqui).
+ * @param sl_pid O PID do SL, retornado por `shm_accepted`.
+ * @return ShmLink_t* O link, ou NULL se os descritores não foram entregues (o link fica em TCP).
+ */
+ShmLink_t *shm_serve(int listen_fd, pid_t sl_pid)
+{
+    int s;
+    while ((s = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC)) != -1 && !unix_peer_is(s, sl_pid))
+    {
+        close(s);
+    }
+    close(listen_fd);
+    if (s == -1)
+    {
+        return NULL;
+    }
+
+    int fds[SHM_FDS];
+    fds[0] = memfd_create("tp-shm", MFD_CLOEXEC);
+    fds[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    fds[2] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fds[0] == -1 || fds[1] == -1 || fds[2] == -1 || ftruncate(fds[0], 2 * sizeof(ShmRing_t)) != 0)
+    {
+        logexit("shm");
+    }
+
+    // O link só é usado se os descritores forem entregues: a partir daí, o SL também o usa
+    ShmLink_t *link = link_map(fds[0], fds + 1, 1);
+    if (link == NULL)
+    {
+        logexit("mmap");
+    }
+
+    // Um byte de dados acompanha os descritores (SCM_RIGHTS)
+    char byte = 0;
+    struct iovec iov = {&byte, 1};
+    union
+    {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(fds))];
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct msghdr mh = {0};
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = control.buf;
+    mh.msg_controllen = sizeof(control.buf);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&mh);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    int sent = sendmsg(s, &mh, MSG_NOSIGNAL) == 1;
+    close(s);
+    close(fds[0]);
+    if (!sent)
+    {
+        shm_close(link);
+        return NULL;
+    }
+    return link;
+}
+
+/**
+ * @brief (SL) Recebe os descritores do link criado pelo SS e o mapeia.
+ * @param unix_fd O socket retornado por `shm_answer` (fechado aqui).
+ * @return ShmLink_t* O link, ou NULL se o SS não o criou (o link fica em TCP).
+ */
+ShmLink_t *shm_join(int unix_fd)
+{
+    int fds[SHM_FDS];
+    char byte;
+    struct iovec iov = {&byte, 1};
+    union
+    {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(fds))];
+    } control;
+    struct msghdr mh = {0};
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = control.buf;
+    mh.msg_controllen = sizeof(control.buf);
+
+    ssize_t count = recvmsg(unix_fd, &mh, MSG_CMSG_CLOEXEC);
+    close(unix_fd);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&mh);
+    if (count != 1 || cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(fds)))
+    {
+        return NULL;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+    // O SS já passou a usar o link ao entregar os descritores: não há volta ao TCP
+    struct stat st;
+    if (fstat(fds[0], &st) != 0 || st.st_size != (off_t)(2 * sizeof(ShmRing_t)))
+    {
+        logexit("shm");
+    }
+    ShmLink_t *link = link_map(fds[0], fds + 1, 0);
+    if (link == NULL)
+    {
+        logexit("mmap");
+    }
+
+    close(fds[0]);
+    return link;
+}
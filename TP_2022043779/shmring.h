@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+
+#include "common.h"
+
+#define SHM_RING_SZ (256 * 1024) // Bytes de cada sentido (potência de 2)
+
+/**
+ * Anel de bytes de um sentido do link em memória compartilhada, com um único
+ * produtor e um único consumidor (o worker dono do link em cada processo).
+ * Os contadores são livres: o índice real é (contador & (SHM_RING_SZ - 1)).
+ *
+ * O produtor só toca a campainha (um eventfd) quando o consumidor já tinha
+ * lido tudo antes da publicação, ou seja, quando ele pode estar dormindo; sob
+ * carga, os quadros passam sem nenhuma chamada de sistema do lado de quem
+ * envia. Com o anel cheio, o produtor marca `blocked` e o consumidor o acorda
+ * pela campainha do outro sentido ao liberar espaço.
+ */
+typedef struct ShmRing
+{
+    _Alignas(64) _Atomic uint32_t head; // Escrito pelo consumidor
+    _Alignas(64) _Atomic uint32_t tail; // Escrito pelo produtor
+    _Atomic uint32_t blocked;           // O produtor aguarda espaço
+    _Alignas(64) unsigned char data[SHM_RING_SZ];
+} ShmRing_t;
+
+/**
+ * Visão de um processo sobre o par de anéis de um link: o memfd com os dois
+ * sentidos e as duas campainhas. Criado pelo SS (`shm_serve`) e recebido pelo
+ * SL (`shm_join`) por um socket AF_UNIX, com SCM_RIGHTS.
+ */
+typedef struct ShmLink
+{
+    ShmRing_t *tx;
+    ShmRing_t *rx;
+    int tx_bell; // Acorda o peer: dados no anel dele ou espaço no anel em que ele escreve
+    int rx_bell; // Tocada pelo peer
+    void *base;
+} ShmLink_t;
+
+// Transporte da camada de conexão (ver conn_set_transport) sobre um ShmLink_t
+extern const ConnTransport_t shm_transport;
+
+void shm_set_enabled(int enabled);
+
+int shm_offer(Msg_t *msg, int sock);
+
+int shm_answer(const Msg_t *req, Msg_t *resp, int sock);
+
+pid_t shm_accepted(const Msg_t *resp);
+
+ShmLink_t *shm_serve(int listen_fd, pid_t sl_pid);
+
+ShmLink_t *shm_join(int unix_fd);
@@ -0,0 +1,420 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "store.h"
+
+#define STORE_MAGIC "SENSREG"
+#define STORE_VERSION 1
+#define STORE_HEADER_SZ 64 // Os registros começam alinhados após o cabeçalho
+#define STORE_INITIAL_CAP 1024
+
+// Operações no journal entre duas sincronizações do mapeamento
+#define STORE_CHECKPOINT_OPS (1 << 16)
+
+#define JOURNAL_PUT 0x5455504a // "JPUT"
+#define JOURNAL_DEL 0x4c45444a // "JDEL"
+
+/**
+ * Entrada do journal. Cada entrada é gravada com um único `write` em um
+ * arquivo aberto com O_APPEND, então nunca fica intercalada com outra.
+ */
+typedef struct JournalEntry
+{
+    uint32_t op; // JOURNAL_PUT ou JOURNAL_DEL
+    uint32_t record;
+    int32_t id;
+    int32_t data;
+} JournalEntry_t;
+
+/**
+ * @brief Mapeia o arquivo com capacidade para `cap` registros, aumentando-o se preciso.
+ * * O mapeamento anterior (se houver) é desfeito, então ponteiros para
+ * registros não podem ser mantidos entre chamadas que possam aumentar o arquivo.
+ * * @param st O estado persistente.
+ * @param cap A capacidade desejada, em registros.
+ */
+static void store_map(Store_t *st, uint32_t cap)
+{
+    size_t size = STORE_HEADER_SZ + (size_t)cap * sizeof(StoreRecord_t);
+
+    struct stat sb;
+    if (fstat(st->fd, &sb) != 0)
+    {
+        logexit("fstat");
+    }
+    if ((size_t)sb.st_size < size && ftruncate(st->fd, size) != 0)
+    {
+        logexit("ftruncate");
+    }
+
+    if (st->header != NULL)
+    {
+        munmap(st->header, st->map_size);
+    }
+
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, st->fd, 0);
+    if (map == MAP_FAILED)
+    {
+        logexit("mmap");
+    }
+
+    uint32_t *free_list = realloc(st->free_list, cap * sizeof(uint32_t));
+    if (free_list == NULL)
+    {
+        logexit("realloc");
+    }
+
+    st->header = map;
+    st->records = (StoreRecord_t *)((char *)map + STORE_HEADER_SZ);
+    st->map_size = size;
+    st->free_list = free_list;
+    st->header->cap = cap;
+}
+
+/**
+ * @brief Garante espaço para o registro `record`, dobrando o arquivo se preciso.
+ * @param st O estado persistente.
+ * @param record A posição que deve existir.
+ */
+static void store_reserve(Store_t *st, uint32_t record)
+{
+    uint32_t cap = st->header->cap;
+    if (record < cap)
+    {
+        return;
+    }
+
+    while (cap <= record)
+    {
+        cap *= 2;
+    }
+    store_map(st, cap);
+}
+
+/**
+ * @brief Anexa uma operação ao journal, antes de aplicá-la ao mapeamento.
+ * @param st O estado persistente.
+ * @param op JOURNAL_PUT ou JOURNAL_DEL.
+ * @param record A posição do registro.
+ * @param id O ID do sensor.
+ * @param data O dado do sensor.
+ */
+static void journal_append(Store_t *st, uint32_t op, uint32_t record, int id, int data)
+{
+    JournalEntry_t entry = {op, record, id, data};
+    if (write(st->journal_fd, &entry, sizeof(entry)) != sizeof(entry))
+    {
+        logexit("write");
+    }
+    st->journal_ops++;
+}
+
+/**
+ * @brief Aplica uma entrada do journal ao mapeamento.
+ * * Aplicar a mesma entrada mais de uma vez não altera o resultado, então o
+ * journal pode ser reaplicado sobre um mapeamento que já contém parte dele.
+ * * @param st O estado persistente.
+ * @param entry A entrada.
+ * @return int 0 em caso de sucesso, -1 se a entrada é inválida.
+ */
+static int journal_apply(Store_t *st, const JournalEntry_t *entry)
+{
+    if (entry->op == JOURNAL_PUT)
+    {
+        store_reserve(st, entry->record);
+        StoreRecord_t *rec = &st->records[entry->record];
+        rec->id = entry->id;
+        rec->data = entry->data;
+        rec->live = 1;
+        if (entry->record >= st->header->high_water)
+        {
+            st->header->high_water = entry->record + 1;
+        }
+        return 0;
+    }
+
+    if (entry->op == JOURNAL_DEL)
+    {
+        if (entry->record < st->header->high_water)
+        {
+            st->records[entry->record].live = 0;
+        }
+        return 0;
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Reaplica o journal sobre o mapeamento.
+ * * Uma entrada incompleta no final (término durante a escrita) é ignorada.
+ * * @param st O estado persistente.
+ */
+static void journal_replay(Store_t *st)
+{
+    JournalEntry_t entries[256];
+    ssize_t count;
+
+    lseek(st->journal_fd, 0, SEEK_SET);
+    while ((count = read(st->journal_fd, entries, sizeof(entries))) >= (ssize_t)sizeof(JournalEntry_t))
+    {
+        for (size_t i = 0; i < count / sizeof(JournalEntry_t); i++)
+        {
+            if (journal_apply(st, &entries[i]) != 0)
+            {
+                return;
+            }
+        }
+
+        if (count % sizeof(JournalEntry_t) != 0)
+        {
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Sincroniza o mapeamento com o disco e descarta o journal.
+ * * Deve ser chamada com a trava do estado obtida (ou antes de ele ser compartilhado).
+ * * @param st O estado persistente.
+ */
+static void store_checkpoint_locked(Store_t *st)
+{
+    if (msync(st->header, st->map_size, MS_SYNC) != 0)
+    {
+        logexit("msync");
+    }
+    if (ftruncate(st->journal_fd, 0) != 0)
+    {
+        logexit("ftruncate");
+    }
+    st->journal_ops = 0;
+}
+
+/**
+ * @brief Abre (ou cria) o arquivo de estado e recupera os sensores gravados.
+ * * Um arquivo gravado pelo outro papel (um SS que passou a atuar como SL,
+ * por exemplo) guarda dados de outro tipo e é descartado.
+ * * @param st O estado persistente.
+ * @param path O caminho do arquivo; o journal fica em `<path>.journal`.
+ * @param type O papel deste servidor (LOC ou STATUS).
+ * @return int 0 em caso de sucesso, -1 se o arquivo não pôde ser aberto ou é inválido.
+ */
+int store_open(Store_t *st, const char *path, Server type)
+{
+    memset(st, 0, sizeof(Store_t));
+
+    char journal_path[PATH_MAX];
+    snprintf(journal_path, sizeof(journal_path), "%s.journal", path);
+
+    st->fd = open(path, O_RDWR | O_CREAT, 0644);
+    st->journal_fd = open(journal_path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (st->fd == -1 || st->journal_fd == -1)
+    {
+        return -1;
+    }
+
+    struct stat sb;
+    if (fstat(st->fd, &sb) != 0)
+    {
+        return -1;
+    }
+
+    int fresh = 1;
+    if ((size_t)sb.st_size >= STORE_HEADER_SZ)
+    {
+        StoreHeader_t header;
+        if (pread(st->fd, &header, sizeof(header), 0) != sizeof(header) ||
+            memcmp(header.magic, STORE_MAGIC, sizeof(STORE_MAGIC)) != 0 || header.version != STORE_VERSION ||
+            header.cap == 0 || header.high_water > header.cap ||
+            (size_t)sb.st_size < STORE_HEADER_SZ + (size_t)header.cap * sizeof(StoreRecord_t))
+        {
+            return -1;
+        }
+
+        fresh = header.type != (int32_t)type;
+        if (!fresh)
+        {
+            store_map(st, header.cap);
+        }
+    }
+
+    if (fresh)
+    {
+        if (ftruncate(st->fd, 0) != 0 || ftruncate(st->journal_fd, 0) != 0)
+        {
+            return -1;
+        }
+
+        store_map(st, STORE_INITIAL_CAP);
+        memcpy(st->header->magic, STORE_MAGIC, sizeof(STORE_MAGIC));
+        st->header->version = STORE_VERSION;
+        st->header->type = type;
+        st->header->high_water = 0;
+    }
+
+    journal_replay(st);
+
+    for (uint32_t i = st->header->high_water; i-- > 0;)
+    {
+        if (!st->records[i].live)
+        {
+            st->free_list[st->free_count++] = i;
+        }
+    }
+
+    store_checkpoint_locked(st);
+    pthread_mutex_init(&st->lock, NULL);
+    return 0;
+}
+
+/**
+ * @brief Sincroniza o estado com o disco e o fecha.
+ * @param st O estado persistente.
+ */
+void store_close(Store_t *st)
+{
+    store_checkpoint_locked(st);
+    munmap(st->header, st->map_size);
+    close(st->fd);
+    close(st->journal_fd);
+    free(st->free_list);
+    pthread_mutex_destroy(&st->lock);
+    memset(st, 0, sizeof(Store_t));
+}
+
+/**
+ * @brief Grava um novo sensor.
+ * @param st O estado persistente.
+ * @param id O ID do sensor.
+ * @param data A localização (SL) ou o status (SS).
+ * @return uint32_t A posição do registro, a ser guardada em `Client_t.record`.
+ */
+uint32_t store_add(Store_t *st, int id, int data)
+{
+    pthread_mutex_lock(&st->lock);
+
+    uint32_t record;
+    if (st->free_count > 0)
+    {
+        record = st->free_list[--st->free_count];
+    }
+    else
+    {
+        record = st->header->high_water;
+    }
+
+    journal_append(st, JOURNAL_PUT, record, id, data);
+    journal_apply(st, &(JournalEntry_t){JOURNAL_PUT, record, id, data});
+
+    if (st->journal_ops >= STORE_CHECKPOINT_OPS)
+    {
+        store_checkpoint_locked(st);
+    }
+
+    pthread_mutex_unlock(&st->lock);
+    return record;
+}
+
+/**
+ * @brief Altera o dado gravado de um sensor.
+ * @param st O estado persistente.
+ * @param record A posição do registro (ver `store_add`).
+ * @param data O novo dado.
+ */
+void store_set(Store_t *st, uint32_t record, int data)
+{
+    pthread_mutex_lock(&st->lock);
+
+    int id = st->records[record].id;
+    journal_append(st, JOURNAL_PUT, record, id, data);
+    journal_apply(st, &(JournalEntry_t){JOURNAL_PUT, record, id, data});
+
+    if (st->journal_ops >= STORE_CHECKPOINT_OPS)
+    {
+        store_checkpoint_locked(st);
+    }
+
+    pthread_mutex_unlock(&st->lock);
+}
+
+/**
+ * @brief Apaga um sensor do estado.
+ * @param st O estado persistente.
+ * @param record A posição do registro (ver `store_add`).
+ */
+void store_remove(Store_t *st, uint32_t record)
+{
+    pthread_mutex_lock(&st->lock);
+
+    journal_append(st, JOURNAL_DEL, record, 0, 0);
+    journal_apply(st, &(JournalEntry_t){JOURNAL_DEL, record, 0, 0});
+    st->free_list[st->free_count++] = record;
+
+    if (st->journal_ops >= STORE_CHECKPOINT_OPS)
+    {
+        store_checkpoint_locked(st);
+    }
+
+    pthread_mutex_unlock(&st->lock);
+}
+
+/**
+ * @brief Percorre os sensores gravados.
+ * * Uso: `uint32_t cursor = 0; while (store_next(st, &cursor, &rec))`; a
+ * posição do registro retornado é `cursor - 1`.
+ * * @param st O estado persistente.
+ * @param cursor A posição atual da iteração (começa em 0).
+ * @param out Destino de uma cópia do registro.
+ * @return int 1 se um registro foi retornado, 0 ao final.
+ */
+int store_next(Store_t *st, uint32_t *cursor, StoreRecord_t *out)
+{
+    int found = 0;
+
+    pthread_mutex_lock(&st->lock);
+    while (*cursor < st->header->high_water)
+    {
+        uint32_t record = (*cursor)++;
+        if (st->records[record].live)
+        {
+            *out = st->records[record];
+            found = 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&st->lock);
+
+    return found;
+}
+
+/**
+ * @brief Sincroniza o mapeamento com o disco e descarta o journal.
+ * @param st O estado persistente.
+ */
+void store_checkpoint(Store_t *st)
+{
+    pthread_mutex_lock(&st->lock);
+    store_checkpoint_locked(st);
+    pthread_mutex_unlock(&st->lock);
+}
+
+/**
+ * @brief Conta os sensores gravados.
+ * @param st O estado persistente.
+ * @return uint32_t O número de registros ocupados.
+ */
+uint32_t store_count(Store_t *st)
+{
+    pthread_mutex_lock(&st->lock);
+    uint32_t count = st->header->high_water - st->free_count;
+    pthread_mutex_unlock(&st->lock);
+
+    return count;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include "common.h"
+
+/**
+ * Estado persistente dos sensores (`--state <arquivo>`).
+ *
+ * O arquivo é mapeado em memória (mmap) e tem um cabeçalho seguido de
+ * registros de tamanho fixo, um por sensor, endereçados pela posição
+ * (`Client_t.record`). Cada alteração é antes anexada a um journal
+ * (`<arquivo>.journal`) e só então aplicada ao mapeamento; na abertura, o
+ * journal é reaplicado sobre o arquivo, o que recupera o estado mesmo que o
+ * processo termine no meio de uma escrita. Periodicamente (e no encerramento)
+ * o mapeamento é sincronizado com o disco e o journal é truncado.
+ *
+ * A recuperação custa uma varredura sequencial dos registros, sem nenhuma
+ * troca de mensagens com os sensores. Não há fsync por operação: o estado
+ * sobrevive ao término do processo, mas não necessariamente a uma queda do
+ * sistema operacional.
+ */
+typedef struct StoreHeader
+{
+    char magic[8];       // STORE_MAGIC
+    uint32_t version;
+    int32_t type;        // LOC ou STATUS: papel do servidor que gravou o arquivo
+    uint32_t cap;        // Registros alocados no arquivo
+    uint32_t high_water; // Registros [0, high_water) já foram usados alguma vez
+} StoreHeader_t;
+
+typedef struct StoreRecord
+{
+    int32_t id;
+    int32_t data;  // Localização (SL) ou status (SS)
+    uint32_t live; // 0 = posição livre
+} StoreRecord_t;
+
+typedef struct Store
+{
+    pthread_mutex_t lock; // Protege o mapeamento (que pode mudar de endereço), a lista de livres e o journal
+    int fd;
+    int journal_fd;
+    StoreHeader_t *header; // Início do mapeamento
+    StoreRecord_t *records;
+    size_t map_size;
+    uint32_t *free_list; // Pilha de posições livres
+    uint32_t free_count;
+    uint32_t journal_ops; // Operações no journal desde a última sincronização
+} Store_t;
+
+int store_open(Store_t *st, const char *path, Server type);
+
+void store_close(Store_t *st);
+
+uint32_t store_add(Store_t *st, int id, int data);
+
+void store_set(Store_t *st, uint32_t record, int data);
+
+void store_remove(Store_t *st, uint32_t record);
+
+int store_next(Store_t *st, uint32_t *cursor, StoreRecord_t *out);
+
+void store_checkpoint(Store_t *st);
+
+uint32_t store_count(Store_t *st);
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// Encerra o teste na primeira verificação que falhar, indicando o arquivo e a linha
+#define CHECK(cond)                                                              \
+    do                                                                           \
+    {                                                                            \
+        if (!(cond))                                                             \
+        {                                                                        \
+            fprintf(stderr, "%s:%d: falhou: %s\n", __FILE__, __LINE__, #cond);   \
+            exit(EXIT_FAILURE);                                                  \
+        }                                                                        \
+    } while (0)
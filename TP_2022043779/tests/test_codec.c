@@ -0,0 +1,194 @@
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "../common.h"
+#include "check.h"
+
+/**
+ * @brief Envia uma mensagem por um par de sockets e a recebe do outro lado.
+ * @param wire O formato de fio das duas pontas.
+ * @param in A mensagem enviada.
+ * @param out Destino da mensagem recebida.
+ */
+static void round_trip(WireFormat wire, Msg_t *in, Msg_t *out)
+{
+    int sv[2];
+    CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    conn_set_wire(sv[0], wire);
+    conn_set_wire(sv[1], wire);
+
+    CHECK(send_msg(sv[0], in) > 0);
+    memset(out, 0, sizeof(Msg_t));
+    CHECK(recv_msg(sv[1], out) > 0);
+
+    conn_close(sv[0]);
+    conn_close(sv[1]);
+}
+
+/**
+ * @brief Abre uma conexão cujos bytes são entregues diretamente com `conn_feed`.
+ * @param wire O formato de fio.
+ * @param peer Destino da outra ponta, que deve ser fechada pelo chamador.
+ * @return int O socket que recebe os bytes.
+ */
+static int feed_socket(WireFormat wire, int *peer)
+{
+    int sv[2];
+    CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    conn_set_wire(sv[0], wire);
+    *peer = sv[1];
+    return sv[0];
+}
+
+/**
+ * @brief Campos do formato compacto: valores negativos, seq, `more` e a maior descrição.
+ */
+static void test_compact_round_trip(void)
+{
+    Msg_t in = {0}, out;
+    in.type = RES_LOCLIST;
+    in.payload = -123456;
+    in.seq = 0x7fffffff;
+    in.more = 1;
+    memset(in.desc, 'x', BUFSZ - 1);
+
+    round_trip(WIRE_COMPACT, &in, &out);
+    CHECK(out.type == in.type);
+    CHECK(out.payload == in.payload);
+    CHECK(out.seq == in.seq);
+    CHECK(out.more == 1);
+    CHECK(strlen(out.desc) == BUFSZ - 1);
+    CHECK(memcmp(out.desc, in.desc, BUFSZ) == 0);
+
+    // Sem descrição nem seq, o quadro não carrega esses campos
+    Msg_t small = {0};
+    small.type = OK_MSG;
+    small.payload = 1;
+    round_trip(WIRE_COMPACT, &small, &out);
+    CHECK(out.type == OK_MSG && out.payload == 1 && out.seq == 0 && out.desc[0] == '\0');
+}
+
+/**
+ * @brief O formato original transporta a Msg_t inteira, sem seq.
+ */
+static void test_legacy_round_trip(void)
+{
+    Msg_t in = {0}, out;
+    in.type = REQ_SENSLOC;
+    in.payload = 42;
+    strcpy(in.desc, "abc");
+
+    round_trip(WIRE_LEGACY, &in, &out);
+    CHECK(out.type == REQ_SENSLOC && out.payload == 42);
+    CHECK(strcmp(out.desc, "abc") == 0);
+}
+
+/**
+ * @brief Um quadro compacto só é entregue quando chega inteiro.
+ */
+static void test_compact_partial(void)
+{
+    int peer;
+    int sock = feed_socket(WIRE_COMPACT, &peer);
+
+    // Tamanho 5: tipo 38, flags com descrição, payload 7 (zigzag 14), 1 byte de descrição
+    const unsigned char frame[] = {0x00, 0x05, REQ_SENSLOC, FRAME_DESC, 14, 2, 'z'};
+    Msg_t msg;
+    for (size_t i = 0; i < sizeof(frame) - 1; i++)
+    {
+        CHECK(conn_feed(sock, frame + i, 1) == 1);
+        CHECK(conn_next_msg(sock, &msg) == 0);
+    }
+    CHECK(conn_feed(sock, frame + sizeof(frame) - 1, 1) == 1);
+    CHECK(conn_next_msg(sock, &msg) == (int)sizeof(frame));
+    CHECK(msg.type == REQ_SENSLOC && msg.payload == 7 && strcmp(msg.desc, "z") == 0);
+    CHECK(conn_next_msg(sock, &msg) == 0);
+
+    conn_close(sock);
+    close(peer);
+}
+
+/**
+ * @brief Quadros compactos malformados são recusados.
+ */
+static void test_compact_malformed(void)
+{
+    Msg_t msg;
+    int peer;
+
+    // desc_len == BUFSZ (zigzag 1002 = 0xea 0x07) não deixaria lugar para o '\0'
+    unsigned char frame[FRAME_HDR_SZ + 6 + BUFSZ];
+    size_t body = 6 + BUFSZ;
+    frame[0] = (unsigned char)(body >> 8);
+    frame[1] = (unsigned char)body;
+    frame[2] = RES_LOCLIST;
+    frame[3] = FRAME_DESC;
+    frame[4] = 0;
+    frame[5] = 0xea;
+    frame[6] = 0x07;
+    memset(frame + 7, 'y', sizeof(frame) - 7);
+    int sock = feed_socket(WIRE_COMPACT, &peer);
+    CHECK(conn_feed(sock, frame, sizeof(frame)) == sizeof(frame));
+    CHECK(conn_next_msg(sock, &msg) == -1);
+    conn_close(sock);
+    close(peer);
+
+    // Descrição maior que o corpo do quadro
+    const unsigned char overrun[] = {0x00, 0x05, REQ_SENSLOC, FRAME_DESC, 0, 20, 'a'};
+    sock = feed_socket(WIRE_COMPACT, &peer);
+    conn_feed(sock, overrun, sizeof(overrun));
+    CHECK(conn_next_msg(sock, &msg) == -1);
+    conn_close(sock);
+    close(peer);
+
+    // Varint sem fim
+    const unsigned char varint[] = {0x00, 0x04, REQ_SENSLOC, 0, 0x80, 0x80};
+    sock = feed_socket(WIRE_COMPACT, &peer);
+    conn_feed(sock, varint, sizeof(varint));
+    CHECK(conn_next_msg(sock, &msg) == -1);
+    conn_close(sock);
+    close(peer);
+
+    // Corpo maior que qualquer quadro válido
+    const unsigned char huge[] = {0xff, 0xff};
+    sock = feed_socket(WIRE_COMPACT, &peer);
+    conn_feed(sock, huge, sizeof(huge));
+    CHECK(conn_next_msg(sock, &msg) == -1);
+    conn_close(sock);
+    close(peer);
+}
+
+/**
+ * @brief Uma descrição sem terminador no formato original é truncada.
+ */
+static void test_legacy_unterminated(void)
+{
+    int peer;
+    int sock = feed_socket(WIRE_LEGACY, &peer);
+
+    unsigned char frame[2 * sizeof(int) + BUFSZ + 3];
+    memset(frame, 'w', sizeof(frame));
+    int header[2] = {REQ_LOCLIST, 3};
+    memcpy(frame, header, sizeof(header));
+    CHECK(conn_feed(sock, frame, sizeof(frame)) == sizeof(frame));
+
+    Msg_t msg;
+    CHECK(conn_next_msg(sock, &msg) == (int)sizeof(frame));
+    CHECK(msg.type == REQ_LOCLIST && msg.payload == 3);
+    CHECK(strlen(msg.desc) == BUFSZ - 1);
+
+    conn_close(sock);
+    close(peer);
+}
+
+int main(void)
+{
+    test_compact_round_trip();
+    test_legacy_round_trip();
+    test_compact_partial();
+    test_compact_malformed();
+    test_legacy_unterminated();
+    printf("test_codec: ok\n");
+    return 0;
+}
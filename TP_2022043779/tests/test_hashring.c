@@ -0,0 +1,68 @@
+#include "../hashring.h"
+#include "check.h"
+
+#define IDS 20000
+
+/**
+ * @brief Todos os nós recebem sensores e a ordem das chaves não muda o dono.
+ */
+static void test_owner(void)
+{
+    const int keys[] = {51511, 51521, 51531};
+    const int reversed[] = {51531, 51521, 51511};
+    HashRing_t ring, other;
+    CHECK(hashring_init(&ring, keys, 3) == 0);
+    CHECK(hashring_init(&other, reversed, 3) == 0);
+
+    int per_node[3] = {0};
+    for (int id = 0; id < IDS; id++)
+    {
+        int node = hashring_owner(&ring, id);
+        CHECK(node >= 0 && node < 3);
+        per_node[node]++;
+        CHECK(other.keys[hashring_owner(&other, id)] == keys[node]);
+    }
+
+    // Com 64 pontos por nó, nenhum fica com menos da metade da sua parte
+    for (int i = 0; i < 3; i++)
+    {
+        CHECK(per_node[i] > IDS / 6);
+    }
+
+    CHECK(hashring_find(&ring, 51521) == 1);
+    CHECK(hashring_find(&ring, 1) == -1);
+    CHECK(hashring_init(&ring, keys, 0) == -1);
+    CHECK(hashring_init(&ring, keys, HASHRING_MAX_NODES + 1) == -1);
+}
+
+/**
+ * @brief Um nó novo só recebe sensores; os demais não trocam de dono entre si.
+ */
+static void test_add_node(void)
+{
+    const int keys[] = {51511, 51521, 51531, 51541};
+    HashRing_t before, after;
+    CHECK(hashring_init(&before, keys, 3) == 0);
+    CHECK(hashring_init(&after, keys, 4) == 0);
+
+    int moved = 0;
+    for (int id = 0; id < IDS; id++)
+    {
+        int old_key = before.keys[hashring_owner(&before, id)];
+        int new_key = after.keys[hashring_owner(&after, id)];
+        if (old_key != new_key)
+        {
+            CHECK(new_key == 51541);
+            moved++;
+        }
+    }
+    CHECK(moved > 0 && moved < IDS / 2);
+}
+
+int main(void)
+{
+    test_owner();
+    test_add_node();
+    printf("test_hashring: ok\n");
+    return 0;
+}
@@ -0,0 +1,129 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "../registry.h"
+#include "check.h"
+
+#define N 4000
+
+/**
+ * @brief Confere que exatamente os IDs marcados em `present` estão registrados.
+ * @param reg O registro.
+ * @param present present[i] != 0 se o sensor de índice i deve estar registrado.
+ */
+static void check_index(Registry_t *reg, const uint8_t *present)
+{
+    uint32_t count = 0;
+    for (int i = 0; i < N; i++)
+    {
+        // IDs espalhados e múltiplos da capacidade formam sequências longas de colisão
+        int id = i % 2 ? i * 7919 : i * 4096;
+        Client_t *c = registry_find(reg, id);
+        CHECK((c != NULL) == (present[i] != 0));
+        if (c != NULL)
+        {
+            CHECK(c->id == id && c->socket_id == i + 10);
+            count++;
+        }
+    }
+    CHECK(registry_count(reg) == count);
+}
+
+/**
+ * @brief Remoções no meio de sequências de sondagem não escondem os demais IDs.
+ * * A tabela hash usa sondagem linear com remoção por deslocamento para trás;
+ * um deslocamento errado tornaria inalcançável um ID que continua registrado.
+ */
+static void test_index(void)
+{
+    Registry_t reg;
+    registry_init(&reg, UINT32_MAX);
+    static uint8_t present[N];
+    memset(present, 0, sizeof(present));
+
+    for (int i = 0; i < N; i++)
+    {
+        int id = i % 2 ? i * 7919 : i * 4096;
+        CHECK(registry_add(&reg, id, i + 10, i % 7) != NULL);
+        present[i] = 1;
+    }
+    check_index(&reg, present);
+
+    for (int i = 0; i < N; i += 3)
+    {
+        int id = i % 2 ? i * 7919 : i * 4096;
+        registry_remove(&reg, registry_find(&reg, id));
+        present[i] = 0;
+        if (i % 300 == 0)
+        {
+            check_index(&reg, present);
+        }
+    }
+    check_index(&reg, present);
+
+    // As posições liberadas são reaproveitadas
+    for (int i = 0; i < N; i += 3)
+    {
+        int id = i % 2 ? i * 7919 : i * 4096;
+        CHECK(registry_add(&reg, id, i + 10, i % 7) != NULL);
+        present[i] = 1;
+    }
+    check_index(&reg, present);
+
+    registry_free(&reg);
+}
+
+/**
+ * @brief O socket e as listas por `data` acompanham reconexões e mudanças.
+ */
+static void test_socket_and_groups(void)
+{
+    Registry_t reg;
+    registry_init(&reg, 3);
+
+    Client_t *a = registry_add(&reg, 100, 5, 1);
+    registry_add(&reg, 200, 6, 1);
+    registry_add(&reg, 300, 7, 2);
+    CHECK(registry_add(&reg, 400, 8, 2) == NULL); // Limite atingido
+    CHECK(registry_group_size(&reg, 1) == 2);
+    CHECK(registry_group_size(&reg, 2) == 1);
+
+    a = registry_find(&reg, 100);
+    registry_attach(&reg, a, 9);
+    CHECK(registry_find_by_socket(&reg, 5) == NULL);
+    CHECK(registry_find_by_socket(&reg, 9)->id == 100);
+
+    registry_set_data(&reg, registry_find(&reg, 200), 2);
+    CHECK(registry_group_size(&reg, 1) == 1);
+    CHECK(registry_group_size(&reg, 2) == 2);
+
+    int seen = 0;
+    for (Client_t *c = registry_group_first(&reg, 2); c != NULL; c = registry_group_next(&reg, c))
+    {
+        CHECK(c->data == 2);
+        seen++;
+    }
+    CHECK(seen == 2);
+
+    registry_remove(&reg, registry_find(&reg, 300));
+    CHECK(registry_find_by_socket(&reg, 7) == NULL);
+    CHECK(registry_group_size(&reg, 2) == 1);
+
+    uint32_t cursor = 0;
+    seen = 0;
+    while (registry_next(&reg, &cursor) != NULL)
+    {
+        seen++;
+    }
+    CHECK(seen == 2);
+
+    registry_free(&reg);
+}
+
+int main(void)
+{
+    test_index();
+    test_socket_and_groups();
+    printf("test_registry: ok\n");
+    return 0;
+}
@@ -0,0 +1,161 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "../store.h"
+#include "check.h"
+
+static char path[64];
+static char journal_path[80];
+
+/**
+ * @brief Lê os registros vivos do arquivo, indexados pelo ID.
+ * @param st O estado persistente.
+ * @param data data[id] recebe o dado do sensor, ou -1 se ele não está gravado.
+ * @param max O maior ID considerado.
+ * @return uint32_t O número de registros vivos.
+ */
+static uint32_t load(Store_t *st, int *data, int max)
+{
+    for (int i = 0; i <= max; i++)
+    {
+        data[i] = -1;
+    }
+
+    StoreRecord_t rec;
+    uint32_t cursor = 0;
+    uint32_t count = 0;
+    while (store_next(st, &cursor, &rec))
+    {
+        CHECK(rec.id >= 0 && rec.id <= max);
+        CHECK(data[rec.id] == -1); // Sem IDs repetidos
+        data[rec.id] = rec.data;
+        count++;
+    }
+    CHECK(store_count(st) == count);
+    return count;
+}
+
+/**
+ * @brief Registros sobrevivem ao fechamento, inclusive após o arquivo crescer.
+ */
+static void test_reopen(void)
+{
+    Store_t st;
+    CHECK(store_open(&st, path, LOC) == 0);
+    static uint32_t records[3000];
+    for (int id = 0; id < 3000; id++)
+    {
+        records[id] = store_add(&st, id, id % 10 + 1);
+    }
+    for (int id = 0; id < 3000; id += 2)
+    {
+        store_remove(&st, records[id]);
+    }
+    store_set(&st, records[1], 99);
+    store_close(&st);
+
+    static int data[3000];
+    CHECK(store_open(&st, path, LOC) == 0);
+    CHECK(load(&st, data, 2999) == 1500);
+    CHECK(data[0] == -1 && data[1] == 99 && data[3] == 4);
+
+    // Posições liberadas são reaproveitadas
+    uint32_t reused = store_add(&st, 0, 5);
+    CHECK(reused < 3000);
+    store_close(&st);
+
+    // Um servidor do outro papel descarta o arquivo
+    CHECK(store_open(&st, path, STATUS) == 0);
+    CHECK(store_count(&st) == 0);
+    store_close(&st);
+}
+
+/**
+ * @brief Lê todo o conteúdo de um arquivo para um buffer alocado.
+ * @param p O caminho do arquivo.
+ * @param size Destino do tamanho.
+ * @return char* O conteúdo (deve ser liberado pelo chamador).
+ */
+static char *snapshot(const char *p, size_t *size)
+{
+    int fd = open(p, O_RDONLY);
+    CHECK(fd != -1);
+    struct stat sb;
+    CHECK(fstat(fd, &sb) == 0);
+    char *buf = malloc(sb.st_size);
+    CHECK(buf != NULL && pread(fd, buf, sb.st_size, 0) == sb.st_size);
+    close(fd);
+    *size = sb.st_size;
+    return buf;
+}
+
+/**
+ * @brief O journal recupera as operações que não chegaram ao arquivo.
+ * * Um processo filho grava e termina sem sincronizar; o arquivo volta à
+ * versão da última sincronização e a última entrada do journal é cortada ao
+ * meio, como em um término durante a escrita.
+ */
+static void test_journal_replay(void)
+{
+    Store_t st;
+    CHECK(store_open(&st, path, STATUS) == 0);
+    uint32_t a = store_add(&st, 1, 10);
+    store_add(&st, 2, 20);
+    store_close(&st);
+
+    size_t size;
+    char *before = snapshot(path, &size);
+
+    pid_t pid = fork();
+    CHECK(pid != -1);
+    if (pid == 0)
+    {
+        CHECK(store_open(&st, path, STATUS) == 0);
+        store_set(&st, a, 11);
+        store_add(&st, 3, 30);
+        store_remove(&st, a + 1);
+        store_add(&st, 4, 40); // Será cortada
+        _exit(EXIT_SUCCESS);
+    }
+    int status;
+    CHECK(waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    int fd = open(path, O_WRONLY);
+    CHECK(fd != -1 && pwrite(fd, before, size, 0) == (ssize_t)size);
+    close(fd);
+    free(before);
+
+    struct stat sb;
+    CHECK(stat(journal_path, &sb) == 0 && sb.st_size > 0);
+    CHECK(truncate(journal_path, sb.st_size - 5) == 0);
+
+    int data[5];
+    CHECK(store_open(&st, path, STATUS) == 0);
+    CHECK(load(&st, data, 4) == 2);
+    CHECK(data[1] == 11);
+    CHECK(data[2] == -1);
+    CHECK(data[3] == 30);
+    CHECK(data[4] == -1);
+    store_close(&st);
+}
+
+int main(void)
+{
+    snprintf(path, sizeof(path), "/tmp/tp-test-store-%d", (int)getpid());
+    snprintf(journal_path, sizeof(journal_path), "%s.journal", path);
+
+    test_reopen();
+    unlink(path);
+    unlink(journal_path);
+    test_journal_replay();
+    unlink(path);
+    unlink(journal_path);
+
+    printf("test_store: ok\n");
+    return 0;
+}
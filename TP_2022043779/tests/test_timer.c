@@ -0,0 +1,116 @@
+#include <stdint.h>
+
+#include "../timer.h"
+#include "check.h"
+
+/**
+ * @brief Avança o wheel um tick e retira os temporizadores vencidos.
+ * @param w O wheel (tick de 1 ns).
+ * @param tick O novo instante.
+ * @param fired fired[t->data] recebe o tick em que o temporizador venceu.
+ * @return int O número de temporizadores vencidos.
+ */
+static int step(TimerWheel_t *w, uint64_t tick, uint64_t *fired)
+{
+    Timer_t expired;
+    timer_advance(w, tick, &expired);
+
+    int count = 0;
+    Timer_t *t;
+    while ((t = timer_pop(w, &expired)) != NULL)
+    {
+        CHECK(!timer_armed(t));
+        fired[t->data] = tick;
+        count++;
+    }
+    return count;
+}
+
+/**
+ * @brief Temporizadores de todos os níveis vencem exatamente no seu tick.
+ * * Os dos níveis superiores só chegam ao nível 0 pela redistribuição, então
+ * um erro nela os adiantaria, atrasaria ou perderia.
+ */
+static void test_cascade(void)
+{
+    static const uint64_t deadlines[] = {1, 5, 63, 64, 65, 127, 4095, 4096, 4097, 4096 + 64 * 3 + 7, 262143, 262144,
+                                         300001};
+    enum
+    {
+        COUNT = sizeof(deadlines) / sizeof(deadlines[0])
+    };
+    TimerWheel_t w;
+    timer_wheel_init(&w, 1, 0);
+
+    Timer_t timers[COUNT];
+    uint64_t fired[COUNT] = {0};
+    for (int i = 0; i < COUNT; i++)
+    {
+        timer_init(&timers[i], i);
+        timer_arm(&w, &timers[i], deadlines[i]);
+    }
+
+    int total = 0;
+    for (uint64_t tick = 1; tick <= deadlines[COUNT - 1]; tick++)
+    {
+        total += step(&w, tick, fired);
+    }
+
+    CHECK(total == COUNT);
+    for (int i = 0; i < COUNT; i++)
+    {
+        CHECK(fired[i] == deadlines[i]);
+    }
+    CHECK(timer_wait_ms(&w, deadlines[COUNT - 1]) == -1);
+}
+
+/**
+ * @brief Cancelar um temporizador já retirado, ou vencido e ainda não retirado, é seguro.
+ */
+static void test_cancel(void)
+{
+    TimerWheel_t w;
+    timer_wheel_init(&w, 1, 0);
+
+    Timer_t a, b, c;
+    timer_init(&a, 0);
+    timer_init(&b, 1);
+    timer_init(&c, 2);
+    timer_arm(&w, &a, 10);
+    timer_arm(&w, &b, 10);
+    timer_arm(&w, &c, 20);
+    CHECK(w.armed == 3);
+
+    Timer_t expired;
+    timer_advance(&w, 10, &expired);
+    Timer_t *first = timer_pop(&w, &expired);
+    CHECK(first == &a);
+
+    // Já retirado: não está em nenhuma lista
+    timer_cancel(&w, first);
+    CHECK(w.armed == 2);
+
+    // Vencido, ainda na lista de expirados: sai dela
+    timer_cancel(&w, &b);
+    CHECK(!timer_armed(&b));
+    CHECK(timer_pop(&w, &expired) == NULL);
+    CHECK(w.armed == 1);
+
+    // Rearmar antes de vencer adia a expiração
+    timer_arm(&w, &c, 40);
+    uint64_t fired[3] = {0};
+    for (uint64_t tick = 11; tick <= 40; tick++)
+    {
+        step(&w, tick, fired);
+    }
+    CHECK(fired[2] == 40);
+    CHECK(w.armed == 0);
+}
+
+int main(void)
+{
+    test_cascade();
+    test_cancel();
+    printf("test_timer: ok\n");
+    return 0;
+}
@@ -0,0 +1,250 @@
+#include <stddef.h>
+
+#include "timer.h"
+
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+#define WHEEL_SPAN (1ull << (WHEEL_BITS * WHEEL_LEVELS)) // Ticks cobertos por todos os níveis
+
+/**
+ * @brief Esvazia uma lista circular.
+ * @param head A sentinela da lista.
+ */
+static void list_init(Timer_t *head)
+{
+    head->prev = head->next = head;
+}
+
+/**
+ * @brief Insere um temporizador no final de uma lista.
+ * @param head A sentinela da lista.
+ * @param t O temporizador (fora de qualquer lista).
+ */
+static void list_append(Timer_t *head, Timer_t *t)
+{
+    t->prev = head->prev;
+    t->next = head;
+    head->prev->next = t;
+    head->prev = t;
+}
+
+/**
+ * @brief Retira um temporizador da lista em que ele está.
+ * @param t O temporizador.
+ */
+static void list_unlink(Timer_t *t)
+{
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+    t->prev = t->next = NULL;
+}
+
+/**
+ * @brief Coloca um temporizador na posição do wheel correspondente ao seu tick.
+ * * O nível é escolhido pela distância até a expiração, de modo que um
+ * temporizador do nível L é redistribuído exatamente quando o relógio entra
+ * no intervalo de 64^L ticks que o contém.
+ * * @param w O wheel.
+ * @param t O temporizador (fora de qualquer lista).
+ */
+static void wheel_place(TimerWheel_t *w, Timer_t *t)
+{
+    if (t->expires <= w->now)
+    {
+        // A posição do tick atual já foi processada
+        t->expires = w->now + 1;
+    }
+    if (t->expires - w->now >= WHEEL_SPAN)
+    {
+        t->expires = w->now + WHEEL_SPAN - 1;
+    }
+
+    uint64_t delta = t->expires - w->now;
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >= (1ull << (WHEEL_BITS * (level + 1))))
+    {
+        level++;
+    }
+
+    list_append(&w->slots[level][(t->expires >> (WHEEL_BITS * level)) & WHEEL_MASK], t);
+}
+
+/**
+ * @brief Redistribui uma posição de um nível superior, agora alcançada pelo relógio.
+ * @param w O wheel.
+ * @param level O nível (>= 1).
+ * @param slot A posição no nível.
+ * @param expired Lista que recebe os temporizadores vencidos no tick atual.
+ */
+static void wheel_cascade(TimerWheel_t *w, int level, uint32_t slot, Timer_t *expired)
+{
+    Timer_t *head = &w->slots[level][slot];
+    while (head->next != head)
+    {
+        Timer_t *t = head->next;
+        list_unlink(t);
+        if (t->expires <= w->now)
+        {
+            list_append(expired, t);
+        }
+        else
+        {
+            wheel_place(w, t);
+        }
+    }
+}
+
+/**
+ * @brief Inicializa um wheel vazio.
+ * @param w O wheel.
+ * @param tick_ns A resolução, em ns.
+ * @param now_ns O instante atual (metrics_now).
+ */
+void timer_wheel_init(TimerWheel_t *w, uint64_t tick_ns, uint64_t now_ns)
+{
+    w->tick_ns = tick_ns;
+    w->now = now_ns / tick_ns;
+    w->armed = 0;
+
+    for (int level = 0; level < WHEEL_LEVELS; level++)
+    {
+        for (int slot = 0; slot < WHEEL_SLOTS; slot++)
+        {
+            list_init(&w->slots[level][slot]);
+        }
+    }
+}
+
+/**
+ * @brief Inicializa um temporizador desarmado.
+ * @param t O temporizador.
+ * @param data Identificação devolvida junto com o temporizador quando ele expira.
+ */
+void timer_init(Timer_t *t, uint64_t data)
+{
+    t->prev = t->next = NULL;
+    t->expires = 0;
+    t->data = data;
+}
+
+/**
+ * @brief Verifica se um temporizador está armado (ou expirado e ainda não retirado).
+ * @param t O temporizador.
+ * @return int 1 se armado, 0 caso contrário.
+ */
+int timer_armed(const Timer_t *t)
+{
+    return t->next != NULL;
+}
+
+/**
+ * @brief Arma (ou rearma) um temporizador.
+ * * O temporizador nunca expira antes do instante pedido; pode expirar até um
+ * tick depois.
+ * * @param w O wheel.
+ * @param t O temporizador.
+ * @param expires_ns O instante de expiração (metrics_now).
+ */
+void timer_arm(TimerWheel_t *w, Timer_t *t, uint64_t expires_ns)
+{
+    timer_cancel(w, t);
+
+    t->expires = (expires_ns + w->tick_ns - 1) / w->tick_ns;
+    wheel_place(w, t);
+    w->armed++;
+}
+
+/**
+ * @brief Desarma um temporizador. Não faz nada se ele não estiver armado.
+ * @param w O wheel.
+ * @param t O temporizador.
+ */
+void timer_cancel(TimerWheel_t *w, Timer_t *t)
+{
+    if (t->next != NULL)
+    {
+        list_unlink(t);
+        w->armed--;
+    }
+}
+
+/**
+ * @brief Avança o relógio do wheel até o instante atual.
+ * * Os temporizadores vencidos são movidos para `expired` e devem ser
+ * retirados com `timer_pop`; podem ser rearmados ou cancelados durante o
+ * tratamento, inclusive os ainda não retirados.
+ * * @param w O wheel.
+ * @param now_ns O instante atual (metrics_now).
+ * @param expired Sentinela da lista de vencidos (inicializada pela função).
+ */
+void timer_advance(TimerWheel_t *w, uint64_t now_ns, Timer_t *expired)
+{
+    list_init(expired);
+
+    uint64_t target = now_ns / w->tick_ns;
+    while (w->now < target)
+    {
+        uint64_t now = ++w->now;
+
+        for (int level = 1; level < WHEEL_LEVELS && (now & ((1ull << (WHEEL_BITS * level)) - 1)) == 0; level++)
+        {
+            wheel_cascade(w, level, (now >> (WHEEL_BITS * level)) & WHEEL_MASK, expired);
+        }
+
+        Timer_t *head = &w->slots[0][now & WHEEL_MASK];
+        while (head->next != head)
+        {
+            Timer_t *t = head->next;
+            list_unlink(t);
+            list_append(expired, t);
+        }
+    }
+}
+
+/**
+ * @brief Retira o próximo temporizador vencido, que fica desarmado.
+ * @param w O wheel.
+ * @param expired A lista preenchida por `timer_advance`.
+ * @return Timer_t* O temporizador, ou NULL se não houver mais nenhum.
+ */
+Timer_t *timer_pop(TimerWheel_t *w, Timer_t *expired)
+{
+    if (expired->next == expired)
+    {
+        return NULL;
+    }
+
+    Timer_t *t = expired->next;
+    list_unlink(t);
+    w->armed--;
+    return t;
+}
+
+/**
+ * @brief Calcula quanto o loop de eventos pode esperar até o próximo tick relevante.
+ * * Procura o próximo tick com temporizadores no nível 0, limitado à próxima
+ * redistribuição dos níveis superiores; o custo é de no máximo 64 posições.
+ * * @param w O wheel.
+ * @param now_ns O instante atual (metrics_now).
+ * @return int O tempo em ms (arredondado para cima), ou -1 se não há temporizadores armados.
+ */
+int timer_wait_ms(const TimerWheel_t *w, uint64_t now_ns)
+{
+    if (w->armed == 0)
+    {
+        return -1;
+    }
+
+    uint64_t target = (w->now | WHEEL_MASK) + 1;
+    for (uint64_t tick = w->now + 1; tick < target; tick++)
+    {
+        const Timer_t *head = &w->slots[0][tick & WHEEL_MASK];
+        if (head->next != head)
+        {
+            target = tick;
+            break;
+        }
+    }
+
+    uint64_t deadline = target * w->tick_ns;
+    return deadline > now_ns ? (int)((deadline - now_ns + 999999) / 1000000) : 0;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 4 // Alcance de 64^4 ticks (~46 h com ticks de 10 ms)
+
+/**
+ * Temporizador intrusivo, embutido na estrutura que ele controla. Um
+ * temporizador armado está em exatamente uma lista do wheel; armar, cancelar
+ * e rearmar são O(1).
+ */
+typedef struct Timer
+{
+    struct Timer *prev;
+    struct Timer *next;
+    uint64_t expires; // Tick de expiração
+    uint64_t data;    // Identificação definida por quem arma o temporizador
+} Timer_t;
+
+/**
+ * Timer wheel hierárquico (Varghese & Lauck). O nível 0 tem uma posição por
+ * tick; cada nível seguinte cobre 64 vezes o intervalo do anterior e é
+ * redistribuído para os níveis de baixo quando o tempo o alcança. O custo de
+ * avançar o relógio não depende do número de temporizadores armados.
+ * Pertence a uma única thread.
+ */
+typedef struct TimerWheel
+{
+    uint64_t tick_ns;
+    uint64_t now; // Último tick processado
+    uint32_t armed; // Temporizadores no wheel ou na lista de expirados ainda não retirados
+    Timer_t slots[WHEEL_LEVELS][WHEEL_SLOTS]; // Sentinelas das listas circulares
+} TimerWheel_t;
+
+void timer_wheel_init(TimerWheel_t *w, uint64_t tick_ns, uint64_t now_ns);
+
+void timer_init(Timer_t *t, uint64_t data);
+
+int timer_armed(const Timer_t *t);
+
+void timer_arm(TimerWheel_t *w, Timer_t *t, uint64_t expires_ns);
+
+void timer_cancel(TimerWheel_t *w, Timer_t *t);
+
+void timer_advance(TimerWheel_t *w, uint64_t now_ns, Timer_t *expired);
+
+Timer_t *timer_pop(TimerWheel_t *w, Timer_t *expired);
+
+int timer_wait_ms(const TimerWheel_t *w, uint64_t now_ns);
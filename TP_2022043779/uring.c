@@ -0,0 +1,427 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+#include "common.h"
+#include "uring.h"
+
+/**
+ * @brief Envia ao kernel as submissões preparadas e, opcionalmente, espera por conclusões.
+ * @param r O anel.
+ * @param min_complete Quantas conclusões aguardar (0 = apenas submeter).
+ * @param timeout_ms O prazo da espera (-1 = sem prazo).
+ * @return int 0 em caso de sucesso (inclusive prazo esgotado ou sinal), -1 em caso de erro.
+ */
+static int uring_enter(Uring_t *r, unsigned min_complete, int timeout_ms)
+{
+    // O kernel só enxerga as submissões após a publicação da cauda
+    __atomic_store_n(r->sq_tail, *r->sq_tail + r->sq_pending, __ATOMIC_RELEASE);
+    r->sq_pending = 0;
+
+    unsigned to_submit = *r->sq_tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    if (to_submit == 0 && min_complete == 0)
+    {
+        return 0;
+    }
+
+    unsigned flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg = {0};
+    void *argp = NULL;
+    size_t argsz = 0;
+    if (min_complete > 0 && timeout_ms >= 0)
+    {
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+        arg.ts = (uint64_t)(uintptr_t)&ts;
+        flags |= IORING_ENTER_EXT_ARG;
+        argp = &arg;
+        argsz = sizeof(arg);
+    }
+
+    if (syscall(__NR_io_uring_enter, r->fd, to_submit, min_complete, flags, argp, argsz) < 0 && errno != ETIME &&
+        errno != EINTR)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Obtém uma entrada livre na fila de submissão, já zerada.
+ * * Se a fila estiver cheia, as submissões preparadas são enviadas antes. Se o
+ * kernel não consumir nenhuma (ex: EBUSY com conclusões acumuladas, ou a
+ * instância ainda desativada), não há entrada a entregar sem sobrescrever
+ * uma submissão pendente, e o processo é encerrado.
+ * * @param r O anel.
+ * @param op A operação.
+ * @param fd O descritor alvo.
+ * @param data Identificação devolvida nas conclusões.
+ * @return struct io_uring_sqe* A entrada.
+ */
+static struct io_uring_sqe *uring_sqe(Uring_t *r, int op, int fd, uint64_t data)
+{
+    unsigned tail = *r->sq_tail + r->sq_pending;
+    if (tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) >= r->sq_entries)
+    {
+        if (r->disabled)
+        {
+            // Só a thread dona pode ativar a instância (ver uring_wait)
+            errno = EBADFD;
+            logexit("io_uring submission queue full");
+        }
+        if (uring_enter(r, 0, -1) != 0)
+        {
+            logexit("io_uring_enter");
+        }
+        tail = *r->sq_tail;
+        if (tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) >= r->sq_entries)
+        {
+            errno = EBUSY;
+            logexit("io_uring submission queue full");
+        }
+    }
+
+    struct io_uring_sqe *sqe = &r->sqes[tail & r->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = op;
+    sqe->fd = fd;
+    sqe->user_data = data;
+    r->sq_pending++;
+    return sqe;
+}
+
+/**
+ * @brief Devolve um buffer ao anel de buffers fornecidos, sem publicá-lo.
+ * @param r O anel.
+ * @param bid O índice do buffer.
+ */
+static void uring_buf_add(Uring_t *r, unsigned bid)
+{
+    struct io_uring_buf *buf = &r->bufring->bufs[r->buf_tail & (r->nbufs - 1)];
+    buf->addr = (uint64_t)(uintptr_t)(r->bufs + (size_t)bid * r->buf_size);
+    buf->len = r->buf_size;
+    buf->bid = bid;
+    r->buf_tail++;
+}
+
+/**
+ * @brief Cria uma instância io_uring e registra seu anel de buffers fornecidos.
+ * @param r O anel a ser inicializado.
+ * @param entries O tamanho da fila de submissão (a de conclusão tem 4 vezes mais).
+ * @param nbufs O número de buffers de recepção (potência de 2).
+ * @param buf_size O tamanho de cada buffer.
+ * @return int 0 em caso de sucesso, -1 (com errno) se o kernel não oferece o necessário.
+ */
+int uring_init(Uring_t *r, unsigned entries, unsigned nbufs, unsigned buf_size)
+{
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+
+    struct io_uring_params p;
+    // Os `recv` multishot geram várias conclusões por submissão. Com
+    // DEFER_TASKRUN, o kernel só processa as conclusões dentro da espera, sem
+    // interromper a thread; a instância é criada desativada porque a thread
+    // que a usará (SINGLE_ISSUER) ainda não existe (ver uring_wait).
+    static const unsigned setups[] = {
+        IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN | IORING_SETUP_R_DISABLED,
+        IORING_SETUP_COOP_TASKRUN,
+        0,
+    };
+    for (size_t i = 0; i < sizeof(setups) / sizeof(setups[0]) && r->fd < 0; i++)
+    {
+        memset(&p, 0, sizeof(p));
+        p.flags = IORING_SETUP_CQSIZE | setups[i];
+        p.cq_entries = entries * 4;
+        r->fd = syscall(__NR_io_uring_setup, entries, &p);
+        if (r->fd < 0 && errno != EINVAL)
+        {
+            return -1;
+        }
+    }
+    if (r->fd < 0)
+    {
+        return -1;
+    }
+    r->disabled = (p.flags & IORING_SETUP_R_DISABLED) != 0;
+
+    if (!(p.features & IORING_FEAT_EXT_ARG))
+    {
+        // Necessário para esperar com prazo (temporizadores e handshakes)
+        uring_close(r);
+        errno = ENOSYS;
+        return -1;
+    }
+
+    r->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (r->cq_ring_size > r->sq_ring_size)
+        {
+            r->sq_ring_size = r->cq_ring_size;
+        }
+        r->cq_ring_size = 0;
+    }
+
+    r->sq_ring = mmap(NULL, r->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd,
+                      IORING_OFF_SQ_RING);
+    if (r->sq_ring == MAP_FAILED)
+    {
+        r->sq_ring = NULL;
+        uring_close(r);
+        return -1;
+    }
+    r->cq_ring = r->sq_ring;
+    if (r->cq_ring_size > 0)
+    {
+        r->cq_ring = mmap(NULL, r->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd,
+                          IORING_OFF_CQ_RING);
+        if (r->cq_ring == MAP_FAILED)
+        {
+            r->cq_ring = NULL;
+            uring_close(r);
+            return -1;
+        }
+    }
+
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED)
+    {
+        r->sqes = NULL;
+        uring_close(r);
+        return -1;
+    }
+
+    unsigned char *sq = r->sq_ring;
+    unsigned char *cq = r->cq_ring;
+    r->sq_head = (unsigned *)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = *(unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_entries = p.sq_entries;
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = *(unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    // Cada posição da fila de submissão aponta sempre para a entrada de mesmo índice
+    for (unsigned i = 0; i < p.sq_entries; i++)
+    {
+        r->sq_array[i] = i;
+    }
+
+    r->nbufs = nbufs;
+    r->buf_size = buf_size;
+    r->bufring_size = nbufs * sizeof(struct io_uring_buf);
+    r->bufring = mmap(NULL, r->bufring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    r->bufs = malloc((size_t)nbufs * buf_size);
+    if (r->bufring == MAP_FAILED || r->bufs == NULL)
+    {
+        if (r->bufring == MAP_FAILED)
+        {
+            r->bufring = NULL;
+        }
+        uring_close(r);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)r->bufring;
+    reg.ring_entries = nbufs;
+    reg.bgid = URING_BGID;
+    if (syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0)
+    {
+        uring_close(r);
+        return -1;
+    }
+
+    for (unsigned i = 0; i < nbufs; i++)
+    {
+        uring_buf_add(r, i);
+    }
+    __atomic_store_n(&r->bufring->tail, r->buf_tail, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+/**
+ * @brief Libera a instância io_uring. As operações pendentes são canceladas pelo kernel.
+ * @param r O anel.
+ */
+void uring_close(Uring_t *r)
+{
+    if (r->fd >= 0)
+    {
+        close(r->fd);
+    }
+    if (r->sqes != NULL)
+    {
+        munmap(r->sqes, r->sqes_size);
+    }
+    if (r->cq_ring != NULL && r->cq_ring != r->sq_ring)
+    {
+        munmap(r->cq_ring, r->cq_ring_size);
+    }
+    if (r->sq_ring != NULL)
+    {
+        munmap(r->sq_ring, r->sq_ring_size);
+    }
+    if (r->bufring != NULL)
+    {
+        munmap(r->bufring, r->bufring_size);
+    }
+    free(r->bufs);
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+}
+
+/**
+ * @brief Prepara um accept multishot: uma conclusão por conexão aceita.
+ * * Os sockets aceitos são bloqueantes, para que os recv e send submetidos
+ * ao anel aguardem no kernel em vez de falharem com EAGAIN.
+ * @param r O anel.
+ * @param fd O socket de escuta.
+ * @param data Identificação devolvida nas conclusões.
+ */
+void uring_accept_multishot(Uring_t *r, int fd, uint64_t data)
+{
+    struct io_uring_sqe *sqe = uring_sqe(r, IORING_OP_ACCEPT, fd, data);
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+}
+
+/**
+ * @brief Prepara um recv multishot com buffers fornecidos.
+ * * Cada conclusão traz o índice do buffer com os dados recebidos (ou 0 no
+ * EOF). Sem IORING_CQE_F_MORE, a operação terminou e precisa ser rearmada
+ * (ex: -ENOBUFS quando todos os buffers estavam em uso).
+ * * @param r O anel.
+ * @param fd O socket.
+ * @param data Identificação devolvida nas conclusões.
+ */
+void uring_recv_multishot(Uring_t *r, int fd, uint64_t data)
+{
+    struct io_uring_sqe *sqe = uring_sqe(r, IORING_OP_RECV, fd, data);
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BGID;
+}
+
+/**
+ * @brief Prepara um poll multishot: uma conclusão a cada vez que o descritor fica pronto.
+ * @param r O anel.
+ * @param fd O descritor.
+ * @param events A máscara de eventos (ex: POLLIN).
+ * @param data Identificação devolvida nas conclusões.
+ */
+void uring_poll_multishot(Uring_t *r, int fd, unsigned events, uint64_t data)
+{
+    struct io_uring_sqe *sqe = uring_sqe(r, IORING_OP_POLL_ADD, fd, data);
+    sqe->poll32_events = events;
+    sqe->len = IORING_POLL_ADD_MULTI;
+}
+
+/**
+ * @brief Prepara um envio. O buffer deve permanecer válido até a conclusão.
+ * @param r O anel.
+ * @param fd O socket.
+ * @param buf Os dados.
+ * @param len A quantidade de bytes.
+ * @param data Identificação devolvida na conclusão.
+ */
+void uring_send(Uring_t *r, int fd, const void *buf, size_t len, uint64_t data)
+{
+    struct io_uring_sqe *sqe = uring_sqe(r, IORING_OP_SEND, fd, data);
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = len;
+    sqe->msg_flags = MSG_NOSIGNAL;
+}
+
+/**
+ * @brief Prepara o cancelamento das operações com a identificação dada.
+ * @param r O anel.
+ * @param data A identificação das operações a cancelar.
+ */
+void uring_cancel(Uring_t *r, uint64_t data)
+{
+    struct io_uring_sqe *sqe = uring_sqe(r, IORING_OP_ASYNC_CANCEL, -1, 0);
+    sqe->addr = data;
+}
+
+/**
+ * @brief Envia as submissões preparadas e espera por ao menos uma conclusão.
+ * * Não espera se já houver conclusões a tratar. Na primeira chamada, ativa a
+ * instância, que a partir daí só pode receber submissões desta thread.
+ * * @param r O anel.
+ * @param timeout_ms O prazo da espera (-1 = sem prazo).
+ * @return int 0 em caso de sucesso (inclusive prazo esgotado), -1 em caso de erro.
+ */
+int uring_wait(Uring_t *r, int timeout_ms)
+{
+    if (r->disabled)
+    {
+        if (syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_ENABLE_RINGS, NULL, 0) != 0)
+        {
+            return -1;
+        }
+        r->disabled = 0;
+    }
+
+    return uring_enter(r, uring_peek(r) != NULL ? 0 : 1, timeout_ms);
+}
+
+/**
+ * @brief Retorna a próxima conclusão, sem consumi-la.
+ * @param r O anel.
+ * @return struct io_uring_cqe* A conclusão, ou NULL se não houver nenhuma.
+ */
+struct io_uring_cqe *uring_peek(Uring_t *r)
+{
+    unsigned head = *r->cq_head;
+    if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+    {
+        return NULL;
+    }
+
+    return &r->cqes[head & r->cq_mask];
+}
+
+/**
+ * @brief Consome a conclusão retornada por `uring_peek`.
+ * @param r O anel.
+ */
+void uring_seen(Uring_t *r)
+{
+    __atomic_store_n(r->cq_head, *r->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Retorna o endereço de um buffer fornecido.
+ * @param r O anel.
+ * @param bid O índice do buffer (de `cqe->flags >> IORING_CQE_BUFFER_SHIFT`).
+ * @return unsigned char* O buffer.
+ */
+unsigned char *uring_buf(Uring_t *r, unsigned bid)
+{
+    return r->bufs + (size_t)bid * r->buf_size;
+}
+
+/**
+ * @brief Devolve um buffer ao kernel depois que seus dados foram consumidos.
+ * @param r O anel.
+ * @param bid O índice do buffer.
+ */
+void uring_buf_recycle(Uring_t *r, unsigned bid)
+{
+    uring_buf_add(r, bid);
+    __atomic_store_n(&r->bufring->tail, r->buf_tail, __ATOMIC_RELEASE);
+}
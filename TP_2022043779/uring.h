@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+/**
+ * Instância io_uring acessada diretamente pelas chamadas de sistema, sem
+ * liburing. As submissões são apenas preparadas na fila do anel e enviadas ao
+ * kernel junto com a espera por conclusões, em uma única chamada por ciclo.
+ *
+ * Os dados recebidos pelos `recv` multishot vão para um anel de buffers
+ * fornecidos (provided buffers): o kernel escolhe um buffer livre a cada
+ * recepção, e o buffer volta ao anel com `uring_buf_recycle`. Pertence a uma
+ * única thread: a que chama `uring_wait` pela primeira vez.
+ */
+typedef struct Uring
+{
+    int fd;
+    int disabled; // Criada com IORING_SETUP_R_DISABLED e ainda não ativada
+    // Fila de submissão
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned sq_pending; // Preparadas e ainda não enviadas ao kernel
+    // Fila de conclusão
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+    // Mapeamentos
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring; // Igual a sq_ring com IORING_FEAT_SINGLE_MMAP
+    size_t cq_ring_size;
+    size_t sqes_size;
+    // Buffers fornecidos (grupo URING_BGID)
+    struct io_uring_buf_ring *bufring;
+    size_t bufring_size;
+    unsigned char *bufs;
+    unsigned nbufs; // Potência de 2
+    unsigned buf_size;
+    uint16_t buf_tail;
+} Uring_t;
+
+#define URING_BGID 0
+
+int uring_init(Uring_t *r, unsigned entries, unsigned nbufs, unsigned buf_size);
+
+void uring_close(Uring_t *r);
+
+void uring_accept_multishot(Uring_t *r, int fd, uint64_t data);
+
+void uring_recv_multishot(Uring_t *r, int fd, uint64_t data);
+
+void uring_poll_multishot(Uring_t *r, int fd, unsigned events, uint64_t data);
+
+void uring_send(Uring_t *r, int fd, const void *buf, size_t len, uint64_t data);
+
+void uring_cancel(Uring_t *r, uint64_t data);
+
+int uring_wait(Uring_t *r, int timeout_ms);
+
+struct io_uring_cqe *uring_peek(Uring_t *r);
+
+void uring_seen(Uring_t *r);
+
+unsigned char *uring_buf(Uring_t *r, unsigned bid);
+
+void uring_buf_recycle(Uring_t *r, unsigned bid);